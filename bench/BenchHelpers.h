@@ -0,0 +1,106 @@
+#ifndef AGAR_BENCHHELPERS_H
+#define AGAR_BENCHHELPERS_H
+
+#include "General.h"
+#include "Config.h"
+#include "Network.h"
+#include "NetworkWorker.h"
+#include "Session.h"
+#include "Player.h"
+#include "Room.h"
+
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Benchmarks run gameplay in-process, without server around it; every client is replaced by local socket pair,
+ * the session writes to one end as usual, and the benchmark drains the other one */
+
+/* Player connected through local socket pair */
+struct BenchClient
+{
+    /* player with session bound to one end of pair */
+    Player* player;
+    /* the other end of pair, playing the client */
+    int peer;
+};
+
+/* Prepares config for running gameplay without server; nothing is logged to file */
+inline void BenchInitConfig()
+{
+    sConfig->SetStringValue(CONF_LOG_FILE, "");
+    sConfig->SetIntValue(CONF_DEBUG_LOG, 0);
+}
+
+/* Creates player with session bound to supplied worker; the worker is not running, the benchmark flushes
+ * sessions on its own */
+inline BenchClient BenchCreateClient(NetworkWorker* worker, uint32_t id, uint32_t clientFlags)
+{
+    BenchClient client;
+    int fds[2];
+    sockaddr_in addr;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    memset(&addr, 0, sizeof(addr));
+
+    client.player = new Player();
+    client.player->SetId(id);
+    client.player->SetName(("bench" + std::to_string(id)).c_str());
+
+    Session* sess = client.player->GetSession();
+    sess->SetConnectionInfo(fds[0], addr, (char*)"bench");
+    sess->SetWorker(worker);
+    sess->SetClientFlags(clientFlags);
+    sess->SetConnectionState(CONNECTION_STATE_LOBBY);
+
+    client.peer = fds[1];
+
+    return client;
+}
+
+/* Asks room to take the player in and to place it on map, the same way as join and world request handlers do */
+inline void BenchJoinRoom(Room* room, BenchClient& client)
+{
+    Player* plr = client.player;
+
+    plr->SetRoomId(room->GetId());
+    plr->GetSession()->SetConnectionState(CONNECTION_STATE_GAME);
+
+    room->QueueMembershipCommand(new RoomCommand(ROOM_COMMAND_PLAYER_JOIN, plr));
+    room->QueueCommand(new RoomCommand(ROOM_COMMAND_WORLD_REQUEST, plr->GetId()));
+}
+
+/* Writes everything queued for client and throws it away on the client side; returns count of bytes received */
+inline size_t BenchDrainClient(BenchClient& client)
+{
+    static char sink[65536];
+    size_t total = 0;
+    ssize_t got;
+    int written;
+
+    do
+    {
+        written = client.player->GetSession()->FlushSendQueue();
+
+        while ((got = read(client.peer, sink, sizeof(sink))) > 0)
+            total += (size_t)got;
+    } while (written > 0);
+
+    return total;
+}
+
+/* Returns monotonic time in microseconds */
+inline uint64_t BenchNowUs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
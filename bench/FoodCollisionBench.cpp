@@ -0,0 +1,225 @@
+#include "General.h"
+#include "FoodStore.h"
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+/* Food collision search benchmark - at first checks, that every kernel (scalar, SSE2, AVX2) finds the same food as plain
+ * reference search over randomized food and player paths, including food exactly at reach, standing players, eaten
+ * food and ranges not aligned to vector or bitmask words; then measures time of one search over ranges of typical
+ * sizes (one cell, and one grid column of collision check) with every kernel.
+ * Returns nonzero, if any kernel disagrees with reference.
+ *
+ * Usage: FoodCollisionBench [equivalence cases = 20000] [search calls = 2000000] */
+
+static const char* kernelNames[] = { "scalar", "SSE2", "AVX2" };
+
+/* Reference search - distance of every food from the segment is computed one by one, in plain code */
+static void referenceFindColliding(FoodStore const& store, uint32_t begin, uint32_t end, Position const& from, Position const& to, float reach,
+                                   std::vector<uint32_t> &found)
+{
+    float dx = to.x - from.x, dy = to.y - from.y;
+    float lenSq = dx*dx + dy*dy;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (!store.IsAlive(i))
+            continue;
+
+        float t = 0.0f;
+        if (lenSq > 0.0f)
+            t = std::min(std::max(((store.GetX(i) - from.x)*dx + (store.GetY(i) - from.y)*dy) / lenSq, 0.0f), 1.0f);
+
+        float ex = store.GetX(i) - (from.x + t*dx);
+        float ey = store.GetY(i) - (from.y + t*dy);
+
+        if (std::sqrt(ex*ex + ey*ey) < reach)
+            found.push_back(i);
+    }
+}
+
+/* Fills store with food; coarse coordinates make food exactly at reach common */
+static void generateFood(FoodStore &store, std::mt19937 &rng, uint32_t count, bool coarse, uint32_t eatenPercent)
+{
+    std::uniform_real_distribution<float> fine(0.0f, 500.0f);
+    std::uniform_int_distribution<int> grid(0, 20);
+    std::uniform_int_distribution<uint32_t> percent(0, 99);
+
+    store.Clear();
+    store.Reserve(count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (coarse)
+            store.Add((float)grid(rng), (float)grid(rng), OBJECT_TYPE_IDLEFOOD);
+        else
+            store.Add(fine(rng), fine(rng), OBJECT_TYPE_IDLEFOOD);
+
+        if (percent(rng) < eatenPercent)
+            store.SetAlive(i, false);
+    }
+}
+
+/* Compares every kernel with reference over random stores, ranges and paths; returns count of mismatches */
+static uint32_t checkEquivalence(uint32_t cases, FoodSearchKernel bestKernel)
+{
+    std::mt19937 rng(12345);
+    std::uniform_int_distribution<uint32_t> sizeDist(0, 300);
+    std::uniform_int_distribution<uint32_t> eatenDist(0, 100);
+    std::uniform_int_distribution<int> coarseQuery(0, 20);
+    std::uniform_real_distribution<float> fineQuery(-10.0f, 510.0f);
+    std::uniform_real_distribution<float> stepDist(-15.0f, 15.0f);
+    std::uniform_int_distribution<int> coarseReach(1, 6);
+    std::uniform_real_distribution<float> fineReach(0.5f, 60.0f);
+    uint32_t mismatches = 0, found = 0, standing = 0;
+    std::vector<uint32_t> refFound, kernelFound;
+    FoodStore store;
+
+    for (uint32_t c = 0; c < cases; c++)
+    {
+        uint32_t count = sizeDist(rng);
+        bool coarse = (c % 2) == 0;
+
+        // every tenth store is almost all eaten, every twentieth completely eaten
+        generateFood(store, rng, count, coarse, (c % 10 == 0) ? ((c % 20 == 0) ? 100 : 95) : eatenDist(rng) / 2);
+
+        uint32_t begin = count ? rng() % (count + 1) : 0;
+        uint32_t end = begin + (count - begin ? rng() % (count - begin + 1) : 0);
+
+        // coarse paths are axis aligned and go through integer points, so food lies exactly at reach quite often
+        Position from, to;
+        float reach;
+
+        if (coarse)
+        {
+            from = Position((float)coarseQuery(rng), (float)coarseQuery(rng));
+            to = (c % 4 == 0) ? Position(from.x + (float)coarseQuery(rng), from.y) : Position(from.x, from.y + (float)coarseQuery(rng));
+            reach = (float)coarseReach(rng);
+        }
+        else
+        {
+            from = Position(fineQuery(rng), fineQuery(rng));
+            to = Position(from.x + stepDist(rng), from.y + stepDist(rng));
+            reach = fineReach(rng);
+        }
+
+        // every eighth player is standing
+        if (c % 8 == 0)
+        {
+            to = from;
+            standing++;
+        }
+
+        refFound.clear();
+        referenceFindColliding(store, begin, end, from, to, reach, refFound);
+
+        if (!refFound.empty())
+            found++;
+
+        for (int k = FOOD_SEARCH_SCALAR; k <= bestKernel; k++)
+        {
+            FoodStore::SetSearchKernel((FoodSearchKernel)k);
+
+            kernelFound.clear();
+            store.FindColliding(begin, end, from, to, reach, kernelFound);
+
+            if (kernelFound != refFound)
+            {
+                if (mismatches < 10)
+                {
+                    printf("MISMATCH %s: case %u, range %u-%u, path %.3f %.3f - %.3f %.3f, reach %.3f: %u food found, reference %u\n",
+                        kernelNames[k], c, begin, end, from.x, from.y, to.x, to.y, reach, (uint32_t)kernelFound.size(), (uint32_t)refFound.size());
+                }
+                mismatches++;
+            }
+        }
+    }
+
+    FoodStore::SetSearchKernel(bestKernel);
+
+    printf("equivalence: %u cases, %u with food found, %u standing players, kernels up to %s, %u mismatches\n",
+        cases, found, standing, kernelNames[bestKernel], mismatches);
+
+    return mismatches;
+}
+
+/* Measures search over ranges of given size; returns nanoseconds per search */
+static double measureSearch(FoodStore const& store, uint32_t rangeSize, uint32_t calls)
+{
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coord(0.0f, 500.0f);
+    std::uniform_real_distribution<float> step(-5.0f, 5.0f);
+    uint32_t ranges = store.GetCount() / rangeSize;
+    std::vector<uint32_t> found;
+    uint64_t sink = 0;
+
+    // paths are prepared in advance, so the random generator is not measured
+    std::vector<Position> froms(1024), tos(1024);
+    std::vector<uint32_t> begins(1024);
+    for (uint32_t i = 0; i < 1024; i++)
+    {
+        froms[i] = Position(coord(rng), coord(rng));
+        tos[i] = Position(froms[i].x + step(rng), froms[i].y + step(rng));
+        begins[i] = (rng() % ranges) * rangeSize;
+    }
+
+    found.reserve(rangeSize);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (uint32_t i = 0; i < calls; i++)
+    {
+        uint32_t q = i & 1023;
+
+        found.clear();
+        store.FindColliding(begins[q], begins[q] + rangeSize, froms[q], tos[q], 20.0f, found);
+        sink += found.size();
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // keep the result alive
+    if (sink == 42)
+        printf(" ");
+
+    return elapsed / calls;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t cases, calls;
+    FoodStore store;
+
+    cases = (argc > 1) ? (uint32_t)atoi(argv[1]) : 20000;
+    calls = (argc > 2) ? (uint32_t)atoi(argv[2]) : 2000000;
+
+    FoodSearchKernel bestKernel = FoodStore::SetSearchKernel(FOOD_SEARCH_AVX2);
+
+    uint32_t mismatches = checkEquivalence(cases, bestKernel);
+
+    // one cell, and one column of 3 cells, as searched by collision check of usual player; a tenth of food is eaten
+    std::mt19937 rng(99);
+    generateFood(store, rng, 100000, false, 10);
+
+    const uint32_t rangeSizes[] = { FOOD_PER_CELL, 3 * FOOD_PER_CELL };
+
+    for (uint32_t r = 0; r < sizeof(rangeSizes) / sizeof(rangeSizes[0]); r++)
+    {
+        printf("range of %3u food:", rangeSizes[r]);
+
+        for (int k = FOOD_SEARCH_SCALAR; k <= bestKernel; k++)
+        {
+            FoodStore::SetSearchKernel((FoodSearchKernel)k);
+            printf("  %s %.1f ns", kernelNames[k], measureSearch(store, rangeSizes[r], calls));
+        }
+
+        printf("\n");
+    }
+
+    FoodStore::SetSearchKernel(bestKernel);
+
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+#include "General.h"
+#include "Gameplay.h"
+#include "Room.h"
+#include "Player.h"
+#include "GridSearchers.h"
+
+#include <chrono>
+
+/* Grid scan benchmark - walks 5x5 neighbourhood of every cell of generated room using NearVisibilityGridSearcher,
+ * with visitor reading position of every object, food and player found, as visibility checks do; reports average
+ * time of one neighbourhood scan. Uses nothing but room and searchers, so it could be built against older grid
+ * layouts; food is read from room food store, when there's one, and from cell object lists otherwise.
+ *
+ * Usage: GridScanBench [map size = 500] [rounds = 200] */
+
+/* Sums positions of everything in visited cells */
+class PositionSumCellVisitor : public BaseCellVisitor
+{
+    public:
+        PositionSumCellVisitor(Room* room) : m_room(room), m_sum(0.0), m_count(0) { };
+
+        void Visit(Cell* cell) override
+        {
+            // range loops do not care about cell container type
+            for (auto obj : cell->objectList)
+            {
+                m_sum += obj->GetPosition().x;
+                m_count++;
+            }
+#ifdef FOOD_INDEX_NONE
+            // food store is read the same way as visibility checks do; eaten food is skipped there too
+            FoodStore& food = m_room->GetFoodStore();
+            for (uint32_t i = cell->foodBegin; i < cell->foodEnd; i++)
+            {
+                if (!food.IsAlive(i))
+                    continue;
+
+                m_sum += food.GetX(i);
+                m_count++;
+            }
+#endif
+            for (auto plr : cell->playerList)
+            {
+                m_sum += plr->GetPosition().x;
+                m_count++;
+            }
+        };
+
+        Room* m_room;
+        /* sum of positions, so the scan could not be optimized out */
+        double m_sum;
+        /* count of objects visited */
+        uint64_t m_count;
+};
+
+int main(int argc, char** argv)
+{
+    uint32_t mapSize, rounds, x, y, r;
+    uint64_t scans;
+
+    mapSize = (argc > 1) ? (uint32_t)atoi(argv[1]) : 500;
+    rounds = (argc > 2) ? (uint32_t)atoi(argv[2]) : 200;
+
+    Room* room = new Room(1, GAME_TYPE_FREEFORALL, 10, "Benchmark room", mapSize);
+
+    PositionSumCellVisitor visitor(room);
+
+    // one round to warm caches up
+    for (x = 0; x < room->GetGridSizeX(); x++)
+    {
+        for (y = 0; y < room->GetGridSizeY(); y++)
+        {
+            NearVisibilityGridSearcher gs(room, &visitor, x, y);
+            gs.Execute();
+        }
+    }
+
+    visitor.m_count = 0;
+    scans = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (r = 0; r < rounds; r++)
+    {
+        for (x = 0; x < room->GetGridSizeX(); x++)
+        {
+            for (y = 0; y < room->GetGridSizeY(); y++)
+            {
+                NearVisibilityGridSearcher gs(room, &visitor, x, y);
+                gs.Execute();
+                scans++;
+            }
+        }
+    }
+
+    double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("grid %ux%u, %llu scans, %.1f objects per scan, %.1f ns per scan, %.2f ns per object (checksum %.0f)\n",
+        (uint32_t)room->GetGridSizeX(), (uint32_t)room->GetGridSizeY(), (unsigned long long)scans,
+        (double)visitor.m_count / scans, elapsed / scans, visitor.m_count ? elapsed / visitor.m_count : 0.0, visitor.m_sum);
+
+    fflush(stdout);
+
+    // room is left to the process exit
+    _exit(0);
+}
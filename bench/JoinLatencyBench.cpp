@@ -0,0 +1,94 @@
+#include "BenchHelpers.h"
+#include "Gameplay.h"
+
+#include <vector>
+#include <algorithm>
+
+/* Join latency benchmark - players join one room one by one; every join is measured from the room update processing
+ * join and world request, until the client end of socket received the whole world. The room is updated directly by
+ * this thread, so waiting for the room tick is not included. Reports latency percentiles, and count of bytes and
+ * packets received per join (world is streamed in chunks, see WorldUpdateBuilder).
+ *
+ * Usage: JoinLatencyBench [joins = 200] [client flags = 0] [map size = 500] */
+
+/* Reads everything the client received; returns count of bytes, and adds count of packets */
+static size_t drainPackets(BenchClient& client, std::vector<uint8_t>& stream, uint32_t& packets)
+{
+    static uint8_t chunk[65536];
+    size_t pos = 0;
+    ssize_t got;
+    int written;
+    uint16_t size;
+
+    stream.clear();
+
+    do
+    {
+        written = client.player->GetSession()->FlushSendQueue();
+
+        while ((got = read(client.peer, chunk, sizeof(chunk))) > 0)
+            stream.insert(stream.end(), chunk, chunk + got);
+    } while (written > 0);
+
+    // walk packet headers; snapshot counts as one packet
+    while (pos + GAMEPACKET_HEADER_SIZE <= stream.size())
+    {
+        memcpy(&size, &stream[pos + 2], 2);
+        pos += GAMEPACKET_HEADER_SIZE + ntohs(size);
+        packets++;
+    }
+
+    return stream.size();
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t joins, clientFlags, mapSize, packets;
+    uint64_t start, bytes;
+    std::vector<uint64_t> latencies;
+    std::vector<uint8_t> stream;
+
+    joins = (argc > 1) ? (uint32_t)atoi(argv[1]) : 200;
+    clientFlags = (argc > 2) ? (uint32_t)atoi(argv[2]) : 0;
+    mapSize = (argc > 3) ? (uint32_t)atoi(argv[3]) : 500;
+
+    BenchInitConfig();
+
+    RoomPtr room = sGameplay->CreateRoom(GAME_TYPE_FREEFORALL, joins, "Benchmark room", mapSize);
+
+    // sessions are flushed by this thread, the worker just collects them
+    NetworkWorker worker(0);
+    std::vector<BenchClient> clients;
+
+    bytes = 0;
+    packets = 0;
+
+    for (uint32_t i = 0; i < joins; i++)
+    {
+        clients.push_back(BenchCreateClient(&worker, i + 1, clientFlags));
+        BenchJoinRoom(room.get(), clients.back());
+
+        start = BenchNowUs();
+
+        room->Update(0);
+        bytes += drainPackets(clients.back(), stream, packets);
+
+        latencies.push_back(BenchNowUs() - start);
+
+        // others got the new player, throw it away outside of measured time
+        for (uint32_t j = 0; j + 1 < clients.size(); j++)
+            BenchDrainClient(clients[j]);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("%u joins, map %u, client flags %u: join p50 %llu us, p99 %llu us, max %llu us; %.0f B and %.1f packets per join\n",
+        joins, mapSize, clientFlags, (unsigned long long)latencies[latencies.size() / 2],
+        (unsigned long long)latencies[(latencies.size() * 99) / 100], (unsigned long long)latencies.back(),
+        (double)bytes / joins, (double)packets / joins);
+
+    fflush(stdout);
+
+    // players and sessions are left to the process exit, room may still refer to them
+    _exit(0);
+}
@@ -0,0 +1,173 @@
+#include "BenchHelpers.h"
+#include "Storage.h"
+#include "sqlite3_wrapper.h"
+
+#include <vector>
+#include <algorithm>
+
+/* Login query benchmark - looks up users by name in two ways over the same database: through sqlite3_exec, with the
+ * name formatted into SQL text and every cell copied to result set (as GetUserByUsername did before prepared
+ * statements), and through Storage::GetUserByUsername itself, that binds the name to statement compiled once by
+ * SQLiteDB::Prepare. User directory is disabled, so every lookup goes to SQLite. 9 of 10 lookups are logins of
+ * existing users, the rest are names, that do not exist. Database is created in new temporary directory, so no
+ * existing main.db is touched. Returns nonzero, if both ways do not find the same users.
+ *
+ * Usage: LoginQueryBench [users = 1000] [lookups = 20000] */
+
+/* password hash stored for every user; lookups do not check it */
+#define BENCH_PASSWORD_HASH "0123456789abcdef0123456789abcdef01234567"
+/* every n-th lookup is name, that does not exist */
+#define BENCH_UNKNOWN_USER_RATIO 10
+
+/* Fills database with users, in one transaction */
+static void createUsers(SQLiteDB* db, uint32_t users)
+{
+    char name[32];
+
+    db->Execute("BEGIN");
+
+    for (uint32_t i = 0; i < users; i++)
+    {
+        snprintf(name, sizeof(name), "user%u", i);
+
+        SQLiteCursor cursor(db->Prepare("INSERT INTO users (username, password) VALUES (?, ?)"));
+        cursor.BindString(1, name);
+        cursor.BindString(2, BENCH_PASSWORD_HASH);
+        cursor.Execute();
+    }
+
+    db->Execute("COMMIT");
+}
+
+/* Looks up user the way GetUserByUsername did before prepared statements - the query is formatted, then parsed,
+ * planned and run by sqlite3_exec, and the row is copied to result set */
+static StorageResult::UserRecord* execGetUserByUsername(SQLiteDB* db, const char* username)
+{
+    SQLiteQueryResult* res = db->Query("SELECT id, username, password FROM users WHERE username = '%s'", username);
+    StorageResult::UserRecord* user = nullptr;
+    SQLiteResultRow* rrow;
+
+    if (!res)
+        return nullptr;
+
+    if ((rrow = res->Fetch()) != nullptr)
+    {
+        user = new StorageResult::UserRecord;
+        user->id = rrow->GetInt(0);
+        user->username = rrow->GetString(1);
+        user->passwordHash = rrow->GetString(2);
+    }
+
+    res->Finalize()->Destroy();
+
+    return user;
+}
+
+/* Builds name of i-th lookup */
+static void lookupName(char* name, size_t size, uint32_t users, uint32_t i)
+{
+    if (i % BENCH_UNKNOWN_USER_RATIO == BENCH_UNKNOWN_USER_RATIO - 1)
+        snprintf(name, size, "newuser%u", i);
+    else
+        snprintf(name, size, "user%u", (uint32_t)(((uint64_t)i * 7919) % users));
+}
+
+/* Runs the lookups through sqlite3_exec, or through storage; returns sum of found user IDs plus count of found
+ * users, so both ways could be compared, and stores time of every lookup */
+static uint64_t runLookups(SQLiteDB* execDB, uint32_t users, uint32_t lookups, std::vector<uint64_t>& latencies)
+{
+    StorageResult::UserRecord* user;
+    uint64_t checksum = 0, start;
+    char name[32];
+
+    latencies.clear();
+
+    for (uint32_t i = 0; i < lookups; i++)
+    {
+        lookupName(name, sizeof(name), users, i);
+
+        start = BenchNowUs();
+        user = execDB ? execGetUserByUsername(execDB, name) : sStorage->GetUserByUsername(name);
+        latencies.push_back(BenchNowUs() - start);
+
+        if (user)
+        {
+            checksum += (uint64_t)user->id + 1;
+            delete user;
+        }
+    }
+
+    return checksum;
+}
+
+static void printResult(const char* mode, std::vector<uint64_t>& latencies)
+{
+    uint64_t total = 0;
+
+    for (uint64_t lat : latencies)
+        total += lat;
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("%-9s %u lookups: %.2f us per lookup, p50 %llu us, p99 %llu us, max %llu us\n", mode,
+        (uint32_t)latencies.size(), (double)total / latencies.size(),
+        (unsigned long long)latencies[latencies.size() / 2],
+        (unsigned long long)latencies[(latencies.size() * 99) / 100], (unsigned long long)latencies.back());
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t users, lookups;
+    uint64_t execChecksum, preparedChecksum;
+    std::vector<uint64_t> latencies;
+    char dir[] = "/tmp/loginquery.XXXXXX";
+    SQLiteDB* execDB;
+
+    users = (argc > 1) ? (uint32_t)atoi(argv[1]) : 1000;
+    lookups = (argc > 2) ? (uint32_t)atoi(argv[2]) : 20000;
+
+    if (users == 0 || lookups == 0)
+    {
+        fprintf(stderr, "Users and lookups must not be zero\n");
+        return 1;
+    }
+
+    if (!mkdtemp(dir) || chdir(dir) != 0)
+    {
+        perror("temporary directory");
+        return 1;
+    }
+
+    BenchInitConfig();
+
+    // storage thread is idle, the lookups are done by this thread, as if it was the storage thread
+    sConfig->SetIntValue(CONF_USER_DIRECTORY_SIZE, 0);
+    sStorage->Init();
+
+    // sqlite3_exec lookups use their own connection, as the storage one is hidden
+    execDB = SQLiteDB::OpenDB("main.db");
+    createUsers(execDB, users);
+
+    // one untimed pass of each way, so both connections have the table cached
+    runLookups(execDB, users, lookups, latencies);
+    runLookups(nullptr, users, lookups, latencies);
+
+    execChecksum = runLookups(execDB, users, lookups, latencies);
+    printResult("exec", latencies);
+
+    preparedChecksum = runLookups(nullptr, users, lookups, latencies);
+    printResult("prepared", latencies);
+
+    printf("%u users, checksum %llu / %llu\n", users, (unsigned long long)execChecksum, (unsigned long long)preparedChecksum);
+
+    delete execDB;
+    sStorage->Shutdown();
+
+    fflush(stdout);
+
+    unlink("main.db");
+    if (chdir("/") == 0)
+        rmdir(dir);
+
+    _exit(execChecksum == preparedChecksum ? 0 : 1);
+}
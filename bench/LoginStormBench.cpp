@@ -0,0 +1,143 @@
+#include "BenchHelpers.h"
+#include "Storage.h"
+#include "sqlite3_wrapper.h"
+
+#include <vector>
+#include <algorithm>
+
+/* Login storm benchmark - looks up users by name the same way as login and registration requests do on storage
+ * thread; 9 of 10 lookups are logins of existing users, the rest are name checks of new registrations, that do not
+ * exist yet. The same lookups run twice over the same database: once with user directory disabled, so every lookup
+ * goes to SQLite, and once with user directory of configured size. Database is created in new temporary directory,
+ * so no existing main.db is touched. Returns nonzero, if both runs do not find the same users.
+ *
+ * Usage: LoginStormBench [users = 10000] [lookups = 20000] [directory size = 100000] */
+
+/* password hash stored for every user; lookups do not check it */
+#define BENCH_PASSWORD_HASH "0123456789abcdef0123456789abcdef01234567"
+/* every n-th lookup is name check of new registration */
+#define BENCH_NEW_USER_RATIO 10
+
+/* Fills database with users, in one transaction, through its own connection */
+static void createUsers(uint32_t users)
+{
+    SQLiteDB* db = SQLiteDB::OpenDB("main.db");
+    char name[32];
+
+    db->Execute("BEGIN");
+
+    for (uint32_t i = 0; i < users; i++)
+    {
+        snprintf(name, sizeof(name), "user%u", i);
+
+        SQLiteCursor cursor(db->Prepare("INSERT INTO users (username, password) VALUES (?, ?)"));
+        cursor.BindString(1, name);
+        cursor.BindString(2, BENCH_PASSWORD_HASH);
+        cursor.Execute();
+    }
+
+    db->Execute("COMMIT");
+
+    delete db;
+}
+
+/* Runs the lookups; returns count of users found, and stores time of every lookup */
+static uint32_t runLookups(uint32_t users, uint32_t lookups, std::vector<uint64_t>& latencies)
+{
+    StorageResult::UserRecord* user;
+    uint32_t found = 0;
+    uint64_t start;
+    char name[32];
+
+    latencies.clear();
+
+    for (uint32_t i = 0; i < lookups; i++)
+    {
+        if (i % BENCH_NEW_USER_RATIO == BENCH_NEW_USER_RATIO - 1)
+            snprintf(name, sizeof(name), "newuser%u", i);
+        else
+            snprintf(name, sizeof(name), "user%u", (uint32_t)(((uint64_t)i * 7919) % users));
+
+        start = BenchNowUs();
+        user = sStorage->GetUserByUsername(name);
+        latencies.push_back(BenchNowUs() - start);
+
+        if (user)
+        {
+            found++;
+            delete user;
+        }
+    }
+
+    return found;
+}
+
+static void printResult(const char* mode, uint32_t found, std::vector<uint64_t>& latencies)
+{
+    uint64_t total = 0;
+
+    for (uint64_t lat : latencies)
+        total += lat;
+
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("%-10s %u lookups, %u found: %.2f us per lookup, p50 %llu us, p99 %llu us, max %llu us\n", mode,
+        (uint32_t)latencies.size(), found, (double)total / latencies.size(),
+        (unsigned long long)latencies[latencies.size() / 2],
+        (unsigned long long)latencies[(latencies.size() * 99) / 100], (unsigned long long)latencies.back());
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t users, lookups, directorySize, sqliteFound, directoryFound;
+    std::vector<uint64_t> latencies;
+    char dir[] = "/tmp/loginstorm.XXXXXX";
+
+    users = (argc > 1) ? (uint32_t)atoi(argv[1]) : 10000;
+    lookups = (argc > 2) ? (uint32_t)atoi(argv[2]) : 20000;
+    directorySize = (argc > 3) ? (uint32_t)atoi(argv[3]) : 100000;
+
+    if (users == 0 || lookups == 0)
+    {
+        fprintf(stderr, "Users and lookups must not be zero\n");
+        return 1;
+    }
+
+    if (!mkdtemp(dir) || chdir(dir) != 0)
+    {
+        perror("temporary directory");
+        return 1;
+    }
+
+    BenchInitConfig();
+
+    // storage thread is idle, the lookups are done by this thread, as if it was the storage thread
+    sConfig->SetIntValue(CONF_USER_DIRECTORY_SIZE, 0);
+    sStorage->Init();
+
+    createUsers(users);
+
+    sqliteFound = runLookups(users, lookups, latencies);
+    printResult("sqlite", sqliteFound, latencies);
+
+    sStorage->Shutdown();
+
+    // initialize again, so the directory is warmed up from the very same database
+    sConfig->SetIntValue(CONF_USER_DIRECTORY_SIZE, (int)directorySize);
+    sStorage->Init();
+
+    directoryFound = runLookups(users, lookups, latencies);
+    printResult("directory", directoryFound, latencies);
+
+    sStorage->Shutdown();
+
+    printf("%u users, directory size %u\n", users, directorySize);
+
+    fflush(stdout);
+
+    unlink("main.db");
+    if (chdir("/") == 0)
+        rmdir(dir);
+
+    _exit(sqliteFound == directoryFound ? 0 : 1);
+}
@@ -0,0 +1,199 @@
+#include "BenchHelpers.h"
+#include "Gameplay.h"
+#include "PacketSchemas.h"
+#include "PacketBufferPool.h"
+
+#include <vector>
+#include <atomic>
+#include <new>
+#include <cmath>
+#include <cstdlib>
+
+/* Movement allocation benchmark - players of one room keep moving in circles; every tick each of them sends direction
+ * change, which goes through the same path as packet read from socket (decoding, handler, room command), then the room
+ * is updated and the worker flushes sessions. After warm-up, every heap allocation is counted using replaced global
+ * operator new, which is used by containers and packet pool as well. Returns nonzero, if steady state movement
+ * allocates anything.
+ *
+ * Usage: MoveAllocBench [players = 20] [warm-up ticks = 500] [measured ticks = 1000] [client flags = 3] */
+
+/* tick length passed to room update, in milliseconds */
+#define BENCH_TICK_DIFF 20
+/* how much does every player turn each tick, in radians */
+#define BENCH_TURN_ANGLE 0.02f
+
+static std::atomic<bool> s_counting(false);
+static std::atomic<uint64_t> s_allocations(0);
+
+/* Every replaced operator new allocates by malloc, and every replaced operator delete releases by free, so
+ * the pairs match no matter which form of new and delete the code uses. Neither is inlined - once inlined into
+ * the code using new and delete, the compiler would see free of memory from operator new, and warn about it */
+__attribute__((noinline)) static void* countedAlloc(size_t size)
+{
+    if (s_counting.load(std::memory_order_relaxed))
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    return std::malloc(size ? size : 1);
+}
+
+__attribute__((noinline)) static void countedFree(void* ptr)
+{
+    std::free(ptr);
+}
+
+void* operator new(size_t size)
+{
+    void* ptr = countedAlloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    void* ptr = countedAlloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept
+{
+    return countedAlloc(size);
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept
+{
+    return countedAlloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    countedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    countedFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    countedFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    countedFree(ptr);
+}
+
+void operator delete(void* ptr, std::nothrow_t const&) noexcept
+{
+    countedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::nothrow_t const&) noexcept
+{
+    countedFree(ptr);
+}
+
+/* Passes encoded packet to session, the same way as network worker does with packet read from socket */
+static void receivePacket(Session* sess, GamePacket& pkt, GamePacket& request)
+{
+    pkt.Reset(request.GetOpcode(), request.GetWritePos());
+    memcpy(pkt.GetData(), request.GetData(), request.GetWritePos());
+
+    sess->HandlePacket(pkt);
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t players, warmupTicks, measuredTicks, clientFlags, tick, moves;
+    uint64_t heapBefore = 0;
+
+    players = (argc > 1) ? (uint32_t)atoi(argv[1]) : 20;
+    warmupTicks = (argc > 2) ? (uint32_t)atoi(argv[2]) : 500;
+    measuredTicks = (argc > 3) ? (uint32_t)atoi(argv[3]) : 1000;
+    clientFlags = (argc > 4) ? (uint32_t)atoi(argv[4]) : (CLIENT_FLAG_WORLD_SNAPSHOT | CLIENT_FLAG_COMPACT_ENCODING);
+
+    BenchInitConfig();
+    sPacketPool->Init();
+
+    RoomPtr room = sGameplay->CreateRoom(GAME_TYPE_FREEFORALL, players, "Benchmark room", 500);
+
+    // the worker is not running, its sessions are flushed by this thread
+    NetworkWorker worker(0);
+    std::vector<BenchClient> clients;
+    std::vector<float> angles;
+
+    for (uint32_t i = 0; i < players; i++)
+    {
+        clients.push_back(BenchCreateClient(&worker, i + 1, clientFlags));
+        BenchJoinRoom(room.get(), clients.back());
+        angles.push_back((float)i);
+    }
+
+    room->Update(0);
+
+    // start moving from where the room placed the players
+    for (uint32_t i = 0; i < players; i++)
+    {
+        Player* plr = clients[i].player;
+
+        MoveStartRequestPacket start;
+        start.posX = plr->GetPosition().x;
+        start.posY = plr->GetPosition().y;
+        start.angle = angles[i];
+
+        GamePacket request(MoveStartRequestPacket::opcode), pkt;
+        start.Encode(request);
+        receivePacket(plr->GetSession(), pkt, request);
+    }
+
+    GamePacket request, pkt;
+    moves = 0;
+
+    for (tick = 0; tick < warmupTicks + measuredTicks; tick++)
+    {
+        if (tick == warmupTicks)
+        {
+            heapBefore = sPacketPool->GetHeapAllocationCount();
+            moves = 0;
+            s_counting = true;
+        }
+
+        for (uint32_t i = 0; i < players; i++)
+        {
+            angles[i] = fmodf(angles[i] + BENCH_TURN_ANGLE, 2.0f * (float)M_PI);
+
+            MoveDirectionRequestPacket direction;
+            direction.angle = angles[i];
+
+            request.Reset(MoveDirectionRequestPacket::opcode);
+            direction.Encode(request);
+            receivePacket(clients[i].player->GetSession(), pkt, request);
+            moves++;
+        }
+
+        room->Update(BENCH_TICK_DIFF);
+        worker.FlushPendingSessions();
+
+        for (uint32_t i = 0; i < players; i++)
+            BenchDrainClient(clients[i]);
+    }
+
+    s_counting = false;
+
+    uint64_t allocations = s_allocations;
+
+    printf("%u players, client flags %u, %u ticks, %u moves: %llu allocations (%.3f per move), %llu packet buffers from heap\n",
+        players, clientFlags, measuredTicks, moves, (unsigned long long)allocations, moves ? (double)allocations / moves : 0.0,
+        (unsigned long long)(sPacketPool->GetHeapAllocationCount() - heapBefore));
+
+    fflush(stdout);
+
+    // players and sessions are left to the process exit, room may still refer to them
+    _exit(allocations ? 1 : 0);
+}
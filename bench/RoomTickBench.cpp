@@ -0,0 +1,207 @@
+#include "BenchHelpers.h"
+#include "Gameplay.h"
+#include "RoomScheduler.h"
+#include "RoomProfiler.h"
+#include "Opcodes.h"
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+/* Room tick benchmark - one crowded room is ticked by room scheduler as usual, while its players keep moving around
+ * and changing direction; phase durations of last ticks are then taken from room profiler. Compares serial update
+ * with striped parallel update, when run with different helper counts. Players are steered like real clients - only
+ * by what they received (own world and own death), nothing touched by room thread is read here.
+ *
+ * Usage: RoomTickBench [parallel helpers = 0] [players = 50] [map size = 500] [seconds = 30] */
+
+/* how often are players steered, in milliseconds */
+#define BENCH_STEER_INTERVAL 500
+/* how often are sessions flushed, in milliseconds */
+#define BENCH_FLUSH_INTERVAL 10
+
+/* What the client knows about its own player */
+struct BenchClientState
+{
+    BenchClientState() : placed(false), moving(false), dead(false), posX(0.0f), posY(0.0f) { };
+
+    /* the player was placed on map (new world received), and did not start moving yet */
+    bool placed;
+    /* movement was started */
+    bool moving;
+    /* the player was eaten, and did not ask for new world yet */
+    bool dead;
+    /* position from new world */
+    float posX, posY;
+    /* received data, that does not form whole packet yet */
+    std::vector<uint8_t> pending;
+};
+
+/* Writes everything queued for client and reads it on the client side; packets about the player itself update
+ * its state. Returns count of bytes received */
+static size_t receivePackets(BenchClient& client, BenchClientState& state)
+{
+    static uint8_t chunk[65536];
+    size_t total = 0, pos = 0;
+    ssize_t got;
+    int written;
+    uint16_t opcode, size;
+    uint32_t id;
+
+    do
+    {
+        written = client.player->GetSession()->FlushSendQueue();
+
+        while ((got = read(client.peer, chunk, sizeof(chunk))) > 0)
+        {
+            state.pending.insert(state.pending.end(), chunk, chunk + got);
+            total += (size_t)got;
+        }
+    } while (written > 0);
+
+    while (pos + GAMEPACKET_HEADER_SIZE <= state.pending.size())
+    {
+        memcpy(&opcode, &state.pending[pos], 2);
+        memcpy(&size, &state.pending[pos + 2], 2);
+        opcode = ntohs(opcode);
+        size = ntohs(size);
+        if (pos + GAMEPACKET_HEADER_SIZE + size > state.pending.size())
+            break;
+
+        GamePacket pkt(opcode, size);
+        pkt.SetData(state.pending.data() + pos + GAMEPACKET_HEADER_SIZE, size);
+
+        // new world starts with map size, followed by the player itself (ID, name, size, position)
+        if (opcode == SP_NEW_WORLD)
+        {
+            pkt.ReadFloat();
+            pkt.ReadFloat();
+            pkt.ReadUInt32();
+            pkt.ReadString();
+            pkt.ReadUInt32();
+            state.posX = pkt.ReadFloat();
+            state.posY = pkt.ReadFloat();
+            state.placed = true;
+            state.moving = false;
+            state.dead = false;
+        }
+        else if (opcode == SP_PLAYER_EATEN)
+        {
+            id = pkt.ReadUInt32();
+            if (id == client.player->GetId())
+                state.dead = true;
+        }
+
+        pos += GAMEPACKET_HEADER_SIZE + size;
+    }
+
+    state.pending.erase(state.pending.begin(), state.pending.begin() + pos);
+
+    return total;
+}
+
+int main(int argc, char** argv)
+{
+    RoomPhaseSummary summary[ROOM_PHASE_MAX];
+    uint32_t helpers, players, mapSize, seconds, ticks;
+    uint64_t start, lastSteer, received;
+
+    helpers = (argc > 1) ? (uint32_t)atoi(argv[1]) : 0;
+    players = (argc > 2) ? (uint32_t)atoi(argv[2]) : 50;
+    mapSize = (argc > 3) ? (uint32_t)atoi(argv[3]) : 500;
+    seconds = (argc > 4) ? (uint32_t)atoi(argv[4]) : 30;
+
+    BenchInitConfig();
+    sConfig->SetIntValue(CONF_ROOM_THREADS, 1);
+    sConfig->SetIntValue(CONF_ROOM_TICK_RATE, ROOM_DEFAULT_TICK_RATE);
+    sConfig->SetIntValue(CONF_ROOM_PARALLEL_THREADS, (int)helpers);
+    sConfig->SetIntValue(CONF_ROOM_PARALLEL_MIN_PLAYERS, 1);
+
+    sRoomScheduler->Startup();
+
+    RoomPtr room = sGameplay->CreateRoom(GAME_TYPE_FREEFORALL, players, "Benchmark room", mapSize);
+    room->SetAsDefault(true);
+
+    // sessions are flushed by this thread, the worker just collects them
+    NetworkWorker worker(0);
+    std::vector<BenchClient> clients;
+    std::vector<BenchClientState> states(players);
+
+    for (uint32_t i = 0; i < players; i++)
+    {
+        clients.push_back(BenchCreateClient(&worker, i + 1, 0));
+        BenchJoinRoom(room.get(), clients.back());
+    }
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> angleDist(0.0f, 2.0f * (float)M_PI);
+
+    start = BenchNowUs();
+    lastSteer = 0;
+    received = 0;
+
+    while (BenchNowUs() - start < (uint64_t)seconds * 1000000)
+    {
+        // steer players; dead ones are placed on map again, the standing ones start moving
+        if (BenchNowUs() - lastSteer >= BENCH_STEER_INTERVAL * 1000)
+        {
+            lastSteer = BenchNowUs();
+
+            for (uint32_t i = 0; i < players; i++)
+            {
+                uint32_t id = clients[i].player->GetId();
+                BenchClientState& state = states[i];
+                RoomCommand* cmd;
+
+                if (state.dead)
+                {
+                    cmd = new RoomCommand(ROOM_COMMAND_WORLD_REQUEST, id);
+                    state.dead = false;
+                    state.placed = false;
+                }
+                else if (state.placed && !state.moving)
+                {
+                    // start from where the new world placed the player
+                    cmd = new RoomCommand(ROOM_COMMAND_MOVE_START, id);
+                    cmd->posX = state.posX;
+                    cmd->posY = state.posY;
+                    cmd->angle = angleDist(rng);
+                    state.moving = true;
+                }
+                else if (state.moving && rng() % 4 == 0)
+                {
+                    cmd = new RoomCommand(ROOM_COMMAND_MOVE_DIRECTION, id);
+                    cmd->angle = angleDist(rng);
+                }
+                else
+                    continue;
+
+                room->QueueCommand(cmd);
+            }
+        }
+
+        for (uint32_t i = 0; i < players; i++)
+            received += receivePackets(clients[i], states[i]);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(BENCH_FLUSH_INTERVAL));
+    }
+
+    ticks = room->GetProfiler().GetSummary(summary);
+
+    printf("%u players, map %u, %u parallel helper(s), last %u ticks, %.1f kB/s received per client\n", players, mapSize,
+        helpers, ticks, (double)received / 1024.0 / seconds / players);
+    printf("phase         p50 us     p99 us     max us\n");
+
+    for (uint32_t i = 0; i < ROOM_PHASE_MAX; i++)
+    {
+        printf("%-10s %9u  %9u  %9u\n", RoomProfiler::GetPhaseName((RoomTickPhase)i),
+            summary[i].p50, summary[i].p99, summary[i].max);
+    }
+
+    fflush(stdout);
+
+    sRoomScheduler->Shutdown();
+
+    // players and sessions are left to the process exit, room may still refer to them
+    _exit(0);
+}
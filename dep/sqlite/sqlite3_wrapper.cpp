@@ -90,6 +90,9 @@ SQLiteDB::SQLiteDB()
 
 SQLiteDB::~SQLiteDB()
 {
+    for (std::unordered_map<std::string, SQLiteStatement*>::iterator itr = m_statements.begin(); itr != m_statements.end(); ++itr)
+        delete itr->second;
+
     if (m_DB)
         sqlite3_close(m_DB);
 }
@@ -161,3 +164,173 @@ bool SQLiteDB::Execute(const char* qr, ...)
 
     return (result == SQLITE_OK);
 }
+
+SQLiteStatement* SQLiteDB::Prepare(const char* sql)
+{
+    sqlite3_stmt* stmt;
+
+    std::unordered_map<std::string, SQLiteStatement*>::iterator itr = m_statements.find(sql);
+    if (itr != m_statements.end())
+        return itr->second;
+
+    if (sqlite3_prepare_v2(m_DB, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        return nullptr;
+
+    SQLiteStatement* res = new SQLiteStatement(stmt);
+    m_statements[sql] = res;
+
+    return res;
+}
+
+int64_t SQLiteDB::GetLastInsertRowId()
+{
+    return (int64_t)sqlite3_last_insert_rowid(m_DB);
+}
+
+sqlite3* SQLiteDB::GetHandle()
+{
+    return m_DB;
+}
+
+SQLiteStatement::SQLiteStatement(sqlite3_stmt* stmt) : m_stmt(stmt)
+{
+    //
+}
+
+SQLiteStatement::~SQLiteStatement()
+{
+    sqlite3_finalize(m_stmt);
+}
+
+bool SQLiteStatement::BindInt(int index, int value)
+{
+    return sqlite3_bind_int(m_stmt, index, value) == SQLITE_OK;
+}
+
+bool SQLiteStatement::BindString(int index, const char* value)
+{
+    return sqlite3_bind_text(m_stmt, index, value, -1, SQLITE_TRANSIENT) == SQLITE_OK;
+}
+
+bool SQLiteStatement::Step()
+{
+    return sqlite3_step(m_stmt) == SQLITE_ROW;
+}
+
+bool SQLiteStatement::Execute()
+{
+    int result = sqlite3_step(m_stmt);
+
+    return (result == SQLITE_DONE || result == SQLITE_ROW);
+}
+
+void SQLiteStatement::Reset()
+{
+    sqlite3_reset(m_stmt);
+    sqlite3_clear_bindings(m_stmt);
+}
+
+int SQLiteStatement::GetColumnCount()
+{
+    return sqlite3_column_count(m_stmt);
+}
+
+const char* SQLiteStatement::GetString(int column)
+{
+    const unsigned char* val = sqlite3_column_text(m_stmt, column);
+
+    return val ? (const char*)val : "";
+}
+
+SQLiteColumnView SQLiteStatement::GetView(int column)
+{
+    SQLiteColumnView view;
+
+    // the text has to be retrieved before its length, so the length matches the UTF-8 form
+    view.data = (const char*)sqlite3_column_text(m_stmt, column);
+    view.length = (size_t)sqlite3_column_bytes(m_stmt, column);
+
+    if (!view.data)
+        view.data = "";
+
+    return view;
+}
+
+int SQLiteStatement::GetInt(int column)
+{
+    return sqlite3_column_int(m_stmt, column);
+}
+
+float SQLiteStatement::GetFloat(int column)
+{
+    return (float)sqlite3_column_double(m_stmt, column);
+}
+
+SQLiteCursor::SQLiteCursor(SQLiteStatement* stmt) : m_stmt(stmt), m_owned(false)
+{
+    //
+}
+
+SQLiteCursor::SQLiteCursor(SQLiteDB* db, const char* sql) : m_stmt(nullptr), m_owned(true)
+{
+    sqlite3_stmt* stmt;
+
+    if (sqlite3_prepare_v2(db->GetHandle(), sql, -1, &stmt, nullptr) == SQLITE_OK)
+        m_stmt = new SQLiteStatement(stmt);
+}
+
+SQLiteCursor::~SQLiteCursor()
+{
+    if (!m_stmt)
+        return;
+
+    if (m_owned)
+        delete m_stmt;
+    else
+        m_stmt->Reset();
+}
+
+bool SQLiteCursor::IsValid()
+{
+    return m_stmt != nullptr;
+}
+
+bool SQLiteCursor::BindInt(int index, int value)
+{
+    return m_stmt->BindInt(index, value);
+}
+
+bool SQLiteCursor::BindString(int index, const char* value)
+{
+    return m_stmt->BindString(index, value);
+}
+
+bool SQLiteCursor::Next()
+{
+    return m_stmt->Step();
+}
+
+bool SQLiteCursor::Execute()
+{
+    return m_stmt->Execute();
+}
+
+SQLiteColumnView SQLiteCursor::GetView(int column)
+{
+    return m_stmt->GetView(column);
+}
+
+const char* SQLiteCursor::GetString(int column)
+{
+    return m_stmt->GetString(column);
+}
+
+int SQLiteCursor::GetInt(int column)
+{
+    return m_stmt->GetInt(column);
+}
+
+float SQLiteCursor::GetFloat(int column)
+{
+    return m_stmt->GetFloat(column);
+}
@@ -9,6 +9,8 @@
 
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <cstdint>
 
 /* class wrapping result row */
 class SQLiteResultRow : public std::vector<std::string>
@@ -19,7 +21,7 @@ class SQLiteResultRow : public std::vector<std::string>
         float GetFloat(int column);
 };
 
-/* class wrapping query result */
+/* class wrapping query result; the whole result is copied to memory at once, SQLiteCursor streams rows instead */
 class SQLiteQueryResult
 {
     public:
@@ -55,6 +57,100 @@ class SQLiteQueryResult
         size_t m_cursor;
 };
 
+/* view of column value owned by SQLite, nothing is copied; valid only until the statement moves to next row */
+struct SQLiteColumnView
+{
+    /* value in UTF-8, zero terminated */
+    const char* data;
+    /* length of value in bytes, excluding zero termination */
+    size_t length;
+};
+
+/* class wrapping prepared statement - the SQL is compiled just once, then it's bound and stepped repeatedly */
+class SQLiteStatement
+{
+    friend class SQLiteDB;
+    friend class SQLiteCursor;
+    public:
+        /* Binds integer to parameter (parameters are indexed from 1) */
+        bool BindInt(int index, int value);
+        /* Binds string to parameter; the string is copied, so it does not need to outlive the statement execution */
+        bool BindString(int index, const char* value);
+
+        /* Moves to next result row; returns false when there's no row left (or on error) */
+        bool Step();
+        /* Executes statement, that does not return rows */
+        bool Execute();
+        /* Resets statement and clears its bindings, so it could be executed again */
+        void Reset();
+
+        /* Retrieves count of columns of result */
+        int GetColumnCount();
+        /* Retrieves string value of column in current row; valid until the next step or reset */
+        const char* GetString(int column);
+        /* Retrieves view of column value in current row; valid until the next step or reset */
+        SQLiteColumnView GetView(int column);
+        /* Retrieves integer value of column in current row */
+        int GetInt(int column);
+        /* Retrieves float value of column in current row */
+        float GetFloat(int column);
+
+    private:
+        /* Hidden constructor, statements are created by database */
+        SQLiteStatement(sqlite3_stmt* stmt);
+        ~SQLiteStatement();
+
+        /* compiled statement */
+        sqlite3_stmt* m_stmt;
+};
+
+class SQLiteDB;
+
+/* Cursor streaming rows of statement one by one, so queries of any size run in constant memory. The statement
+ * is reset (or finalized, if it was compiled just for this cursor) when the cursor goes out of scope */
+class SQLiteCursor
+{
+    public:
+        /* Creates cursor over statement cached by database */
+        SQLiteCursor(SQLiteStatement* stmt);
+        /* Creates cursor over SQL, that is compiled just for this cursor (i.e. it cannot be parametrized) */
+        SQLiteCursor(SQLiteDB* db, const char* sql);
+        ~SQLiteCursor();
+
+        /* Was the statement compiled successfully? */
+        bool IsValid();
+
+        /* Binds integer to parameter (parameters are indexed from 1) */
+        bool BindInt(int index, int value);
+        /* Binds string to parameter */
+        bool BindString(int index, const char* value);
+
+        /* Moves to next row; returns false when there's no row left (or on error) */
+        bool Next();
+        /* Executes statement, that does not return rows */
+        bool Execute();
+
+        /* Retrieves view of column value in current row */
+        SQLiteColumnView GetView(int column);
+        /* Retrieves string value of column in current row */
+        const char* GetString(int column);
+        /* Retrieves integer value of column in current row */
+        int GetInt(int column);
+        /* Retrieves float value of column in current row */
+        float GetFloat(int column);
+
+    private:
+        /* disable copying */
+        SQLiteCursor(SQLiteCursor const&);
+        /* disable assignment */
+        SQLiteCursor& operator = (SQLiteCursor const&);
+
+        /* statement being stepped */
+        SQLiteStatement* m_stmt;
+        /* is the statement owned by cursor (not cached by database)? */
+        bool m_owned;
+};
+
 /* Wrapper class for SQLite database connection */
 class SQLiteDB
 {
@@ -69,12 +165,22 @@ class SQLiteDB
         /* Executes command on opened database - does not expect result */
         bool Execute(const char* qr, ...);
 
+        /* Retrieves prepared statement for given SQL; statements are compiled once and cached by SQL text, so
+         * the caller must not destroy it, and must reset it after use */
+        SQLiteStatement* Prepare(const char* sql);
+        /* Retrieves row ID of last inserted row */
+        int64_t GetLastInsertRowId();
+        /* Retrieves connection handle */
+        sqlite3* GetHandle();
+
     private:
         /* Hidden constructor, use factory method for creating instances */
         SQLiteDB();
 
         /* Stored connection instance */
         sqlite3* m_DB;
+        /* prepared statements cached by SQL text */
+        std::unordered_map<std::string, SQLiteStatement*> m_statements;
 };
 
 #endif
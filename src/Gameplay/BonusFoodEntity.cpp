@@ -1,13 +0,0 @@
-#include "General.h"
-#include "Entities.h"
-#include "WorldObject.h"
-
-BonusFoodEntity::BonusFoodEntity()
-{
-    SetTypeId(OBJECT_TYPE_BONUSFOOD);
-}
-
-BonusFoodEntity::~BonusFoodEntity()
-{
-    //
-}
@@ -0,0 +1,300 @@
+#include "General.h"
+#include "FoodStore.h"
+#include "GamePacket.h"
+#include "Room.h"
+
+#include <cmath>
+#include <algorithm>
+
+/* SSE2 is always present on x86-64, AVX2 is detected in runtime (GCC and Clang only) */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+ #define FOOD_KERNEL_SSE2
+ #include <emmintrin.h>
+#endif
+#if defined(FOOD_KERNEL_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+ #define FOOD_KERNEL_AVX2
+ #include <immintrin.h>
+#endif
+
+bool FoodRespawnComparator::operator()(FoodRespawn const& a, FoodRespawn const& b)
+{
+    return a.when > b.when;
+}
+
+FoodStore::FoodStore() : m_firstId(0)
+{
+    //
+}
+
+void FoodStore::Clear()
+{
+    m_x.clear();
+    m_y.clear();
+    m_type.clear();
+    m_alive.clear();
+}
+
+void FoodStore::Reserve(size_t count)
+{
+    m_x.reserve(count);
+    m_y.reserve(count);
+    m_type.reserve(count);
+    m_alive.reserve((count + 63) / 64);
+}
+
+void FoodStore::SetFirstId(uint32_t id)
+{
+    m_firstId = id;
+}
+
+uint32_t FoodStore::Add(float x, float y, ObjectTypeId type)
+{
+    uint32_t index = GetCount();
+
+    m_x.push_back(x);
+    m_y.push_back(y);
+    m_type.push_back((uint8_t)type);
+
+    if ((index & 63) == 0)
+        m_alive.push_back(0);
+
+    SetAlive(index, true);
+
+    return index;
+}
+
+bool FoodStore::FindIndex(uint32_t id, uint32_t &index)
+{
+    if (id < m_firstId || id - m_firstId >= GetCount())
+        return false;
+
+    index = id - m_firstId;
+    return true;
+}
+
+void FoodStore::BuildCreatePacketBlock(uint32_t index, GamePacket& gp)
+{
+    gp.WriteUInt32(GetId(index));
+    gp.WriteFloat(m_x[index]);
+    gp.WriteFloat(m_y[index]);
+    gp.WriteUInt8(m_type[index]);
+
+    gp.WriteUInt32(0); // TODO: specific parameter for each type
+}
+
+void FoodStore::BuildCompactCreatePacketBlock(uint32_t index, GamePacket& gp)
+{
+    gp.WriteVarUInt(GetId(index));
+    Cell::WriteCompactPosition(gp, m_x[index], m_y[index]);
+    gp.WriteUInt8(m_type[index]);
+
+    gp.WriteVarUInt(0); // TODO: specific parameter for each type
+}
+
+/* Segment swept by moving player, prepared for collision search */
+struct SweepSegment
+{
+    /* start of segment */
+    float ax, ay;
+    /* segment vector */
+    float dx, dy;
+    /* squared length of segment */
+    float lenSq;
+    /* food closer to segment than this collides */
+    float reach;
+};
+
+/* Retrieves "alive" bits of count (at most 32) food starting at index, lowest bit belongs to first food */
+static inline uint32_t getAliveBits(const uint64_t* alive, uint32_t index, uint32_t count)
+{
+    uint32_t shift = index & 63;
+    uint64_t bits = alive[index >> 6] >> shift;
+
+    // range crosses the word boundary
+    if (shift + count > 64)
+        bits |= alive[(index >> 6) + 1] << (64 - shift);
+
+    return (uint32_t)(bits & ((((uint64_t)1) << count) - 1));
+}
+
+/* Appends indexes of food marked by bits (lowest bit belongs to food at index) */
+static inline void appendHits(std::vector<uint32_t> &found, uint32_t index, uint32_t hits)
+{
+    for (; hits != 0; hits >>= 1, index++)
+    {
+        if (hits & 1)
+            found.push_back(index);
+    }
+}
+
+/* Scalar part of search; every operation is done in the same order as by vector kernels, so the results are the same */
+static void findCollidingScalar(const float* xs, const float* ys, const uint64_t* alive, uint32_t begin, uint32_t end, SweepSegment const& seg,
+                                std::vector<uint32_t> &found)
+{
+    float t, ex, ey;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        if (((alive[i >> 6] >> (i & 63)) & 1) == 0)
+            continue;
+
+        // project the food to segment, and clamp the projection to its ends
+        t = 0.0f;
+        if (seg.lenSq > 0.0f)
+            t = std::min(std::max(((xs[i] - seg.ax)*seg.dx + (ys[i] - seg.ay)*seg.dy) / seg.lenSq, 0.0f), 1.0f);
+
+        ex = xs[i] - (seg.ax + t*seg.dx);
+        ey = ys[i] - (seg.ay + t*seg.dy);
+
+        if (std::sqrt(ex*ex + ey*ey) < seg.reach)
+            found.push_back(i);
+    }
+}
+
+#ifdef FOOD_KERNEL_SSE2
+/* Searches 4 food at once; returns index of first food not searched */
+static uint32_t findCollidingSSE2(const float* xs, const float* ys, const uint64_t* alive, uint32_t begin, uint32_t end, SweepSegment const& seg,
+                                  std::vector<uint32_t> &found)
+{
+    uint32_t i = begin;
+    uint32_t hits;
+
+    const __m128 ax = _mm_set1_ps(seg.ax);
+    const __m128 ay = _mm_set1_ps(seg.ay);
+    const __m128 dx = _mm_set1_ps(seg.dx);
+    const __m128 dy = _mm_set1_ps(seg.dy);
+    const __m128 lenSq = _mm_set1_ps(seg.lenSq);
+    const __m128 reach = _mm_set1_ps(seg.reach);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const bool project = seg.lenSq > 0.0f;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 px = _mm_loadu_ps(xs + i);
+        __m128 py = _mm_loadu_ps(ys + i);
+        __m128 t = zero;
+
+        // operand order of min and max matches std::min(std::max(v, 0), 1) of scalar code
+        if (project)
+        {
+            t = _mm_div_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(px, ax), dx), _mm_mul_ps(_mm_sub_ps(py, ay), dy)), lenSq);
+            t = _mm_min_ps(one, _mm_max_ps(zero, t));
+        }
+
+        __m128 ex = _mm_sub_ps(px, _mm_add_ps(ax, _mm_mul_ps(t, dx)));
+        __m128 ey = _mm_sub_ps(py, _mm_add_ps(ay, _mm_mul_ps(t, dy)));
+        __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)));
+
+        hits = (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(dist, reach)) & getAliveBits(alive, i, 4);
+        if (hits)
+            appendHits(found, i, hits);
+    }
+
+    return i;
+}
+#endif
+
+#ifdef FOOD_KERNEL_AVX2
+/* Searches 8 food at once; returns index of first food not searched */
+__attribute__((target("avx2")))
+static uint32_t findCollidingAVX2(const float* xs, const float* ys, const uint64_t* alive, uint32_t begin, uint32_t end, SweepSegment const& seg,
+                                  std::vector<uint32_t> &found)
+{
+    uint32_t i = begin;
+    uint32_t hits;
+
+    const __m256 ax = _mm256_set1_ps(seg.ax);
+    const __m256 ay = _mm256_set1_ps(seg.ay);
+    const __m256 dx = _mm256_set1_ps(seg.dx);
+    const __m256 dy = _mm256_set1_ps(seg.dy);
+    const __m256 lenSq = _mm256_set1_ps(seg.lenSq);
+    const __m256 reach = _mm256_set1_ps(seg.reach);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const bool project = seg.lenSq > 0.0f;
+
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 px = _mm256_loadu_ps(xs + i);
+        __m256 py = _mm256_loadu_ps(ys + i);
+        __m256 t = zero;
+
+        // operand order of min and max matches std::min(std::max(v, 0), 1) of scalar code
+        if (project)
+        {
+            t = _mm256_div_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(px, ax), dx), _mm256_mul_ps(_mm256_sub_ps(py, ay), dy)), lenSq);
+            t = _mm256_min_ps(one, _mm256_max_ps(zero, t));
+        }
+
+        __m256 ex = _mm256_sub_ps(px, _mm256_add_ps(ax, _mm256_mul_ps(t, dx)));
+        __m256 ey = _mm256_sub_ps(py, _mm256_add_ps(ay, _mm256_mul_ps(t, dy)));
+        __m256 dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)));
+
+        hits = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(dist, reach, _CMP_LT_OQ)) & getAliveBits(alive, i, 8);
+        if (hits)
+            appendHits(found, i, hits);
+    }
+
+    return i;
+}
+
+/* Detects AVX2 support of CPU */
+static bool detectAVX2()
+{
+    // static initialization order is not guaranteed, so the CPU detection has to be initialized explicitly
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+}
+
+/* is AVX2 supported by CPU? */
+static const bool s_hasAVX2 = detectAVX2();
+#endif
+
+/* the best kernel used by search; initialized after CPU detection, which precedes it in this file */
+static FoodSearchKernel s_searchKernel = FoodStore::SetSearchKernel(FOOD_SEARCH_AVX2);
+
+FoodSearchKernel FoodStore::SetSearchKernel(FoodSearchKernel kernel)
+{
+#ifndef FOOD_KERNEL_AVX2
+    if (kernel == FOOD_SEARCH_AVX2)
+        kernel = FOOD_SEARCH_SSE2;
+#else
+    if (kernel == FOOD_SEARCH_AVX2 && !s_hasAVX2)
+        kernel = FOOD_SEARCH_SSE2;
+#endif
+#ifndef FOOD_KERNEL_SSE2
+    if (kernel == FOOD_SEARCH_SSE2)
+        kernel = FOOD_SEARCH_SCALAR;
+#endif
+
+    s_searchKernel = kernel;
+    return kernel;
+}
+
+void FoodStore::FindColliding(uint32_t begin, uint32_t end, Position const& from, Position const& to, float reach, std::vector<uint32_t> &found) const
+{
+    SweepSegment seg;
+    uint32_t i = begin;
+
+    if (begin >= end)
+        return;
+
+    seg.ax = from.x;
+    seg.ay = from.y;
+    seg.dx = to.x - from.x;
+    seg.dy = to.y - from.y;
+    seg.lenSq = seg.dx*seg.dx + seg.dy*seg.dy;
+    seg.reach = reach;
+
+    // vectorized part at first; the rest, which does not fill the whole vector, is searched one by one
+#ifdef FOOD_KERNEL_AVX2
+    if (s_searchKernel >= FOOD_SEARCH_AVX2)
+        i = findCollidingAVX2(m_x.data(), m_y.data(), m_alive.data(), i, end, seg, found);
+#endif
+#ifdef FOOD_KERNEL_SSE2
+    if (s_searchKernel >= FOOD_SEARCH_SSE2)
+        i = findCollidingSSE2(m_x.data(), m_y.data(), m_alive.data(), i, end, seg, found);
+#endif
+    findCollidingScalar(m_x.data(), m_y.data(), m_alive.data(), i, end, seg, found);
+}
@@ -0,0 +1,121 @@
+#ifndef AGAR_FOODSTORE_H
+#define AGAR_FOODSTORE_H
+
+#include "WorldObject.h"
+
+#include <vector>
+#include <ctime>
+
+/* count of idle food generated in every cell */
+#define FOOD_IDLE_PER_CELL 20
+/* count of bonus food generated in every cell */
+#define FOOD_BONUS_PER_CELL 1
+/* count of traps generated in every cell */
+#define FOOD_TRAP_PER_CELL 1
+/* count of all food generated in every cell */
+#define FOOD_PER_CELL (FOOD_IDLE_PER_CELL + FOOD_BONUS_PER_CELL + FOOD_TRAP_PER_CELL)
+
+/* size of food, when testing its collision with player */
+#define FOOD_COLLISION_SIZE 2
+
+/* value of food index meaning "no food" */
+#define FOOD_INDEX_NONE 0xFFFFFFFF
+
+class GamePacket;
+
+/* Kernels of food collision search, from the simplest one */
+enum FoodSearchKernel
+{
+    FOOD_SEARCH_SCALAR = 0,
+    FOOD_SEARCH_SSE2 = 1,
+    FOOD_SEARCH_AVX2 = 2
+};
+
+/* Food waiting for respawn */
+struct FoodRespawn
+{
+    FoodRespawn(time_t respawnTime, uint32_t foodIndex) : when(respawnTime), index(foodIndex) { };
+
+    /* time of respawn */
+    time_t when;
+    /* index of food in store */
+    uint32_t index;
+};
+
+struct FoodRespawnComparator
+{
+    bool operator()(FoodRespawn const& a, FoodRespawn const& b);
+};
+
+/* Static food (and traps) of one room, stored as structure of arrays instead of separate objects. Food is generated
+ * cell by cell, so food of one cell occupies continuous range of indexes; IDs are assigned in the same order, so
+ * the ID of food is just the ID of first food plus its index. Food never moves, it is just hidden when eaten */
+class FoodStore
+{
+    public:
+        FoodStore();
+
+        /* Removes all food */
+        void Clear();
+        /* Preallocates storage for given count of food */
+        void Reserve(size_t count);
+        /* Sets ID of first food; must be called before any food is added */
+        void SetFirstId(uint32_t id);
+        /* Appends living food; returns its index */
+        uint32_t Add(float x, float y, ObjectTypeId type);
+
+        /* Finds food index by its ID; returns false, if the ID does not belong to food */
+        bool FindIndex(uint32_t id, uint32_t &index);
+
+        /* Builds create packet contents, the same way WorldObject does */
+        void BuildCreatePacketBlock(uint32_t index, GamePacket& gp);
+        /* Builds create packet contents in compact encoding, the same way WorldObject does */
+        void BuildCompactCreatePacketBlock(uint32_t index, GamePacket& gp);
+
+        /* Finds living food within index range, that is closer than reach to the segment from-to (i.e. touched by
+         * player moving along it), and appends its indexes to found in ascending order. Every kernel computes
+         * the distance the same way, so they all find the same food */
+        void FindColliding(uint32_t begin, uint32_t end, Position const& from, Position const& to, float reach, std::vector<uint32_t> &found) const;
+
+        /* Limits food collision search to given kernel and the simpler ones, i.e. to compare them; kernels not supported
+         * by build or CPU are left out. Returns the best kernel really used. By default, the best supported is used */
+        static FoodSearchKernel SetSearchKernel(FoodSearchKernel kernel);
+
+        /* Accessors are used in tight loops over cells, so they are defined here to allow inlining */
+
+        /* Retrieves count of all food (living or not) */
+        uint32_t GetCount() const { return (uint32_t)m_type.size(); };
+        /* Retrieves food ID */
+        uint32_t GetId(uint32_t index) const { return m_firstId + index; };
+        /* Retrieves food X coordinate */
+        float GetX(uint32_t index) const { return m_x[index]; };
+        /* Retrieves food Y coordinate */
+        float GetY(uint32_t index) const { return m_y[index]; };
+        /* Retrieves food type */
+        ObjectTypeId GetType(uint32_t index) const { return (ObjectTypeId)m_type[index]; };
+        /* Is the food present in world (not eaten)? */
+        bool IsAlive(uint32_t index) const { return ((m_alive[index >> 6] >> (index & 63)) & 1) != 0; };
+        /* Sets presence of food in world */
+        void SetAlive(uint32_t index, bool state)
+        {
+            if (state)
+                m_alive[index >> 6] |= ((uint64_t)1) << (index & 63);
+            else
+                m_alive[index >> 6] &= ~(((uint64_t)1) << (index & 63));
+        };
+
+    private:
+        /* ID of food at index 0 */
+        uint32_t m_firstId;
+
+        /* X coordinates */
+        std::vector<float> m_x;
+        /* Y coordinates */
+        std::vector<float> m_y;
+        /* object types (ObjectTypeId) */
+        std::vector<uint8_t> m_type;
+        /* bitmask of living food, 64 per item */
+        std::vector<uint64_t> m_alive;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "General.h"
 #include "Gameplay.h"
 #include "Room.h"
+#include "RoomScheduler.h"
 #include "Log.h"
 
 Gameplay::Gameplay() : m_lastRoomId(0)
@@ -18,7 +19,7 @@ void Gameplay::Init()
     // Create default room
     sLog->Info("Creating default room...");
 
-    Room* rm = CreateRoom(GAME_TYPE_FREEFORALL, 30, "Default room", (uint32_t)MAP_DEFAULT_SIZE);
+    RoomPtr rm = CreateRoom(GAME_TYPE_FREEFORALL, 30, "Default room", (uint32_t)MAP_DEFAULT_SIZE);
     if (rm)
     {
         // this will guarantee preserving even if the room is empty
@@ -30,13 +31,13 @@ void Gameplay::Shutdown()
 {
     sLog->Info("Shutting down gameplay, destroying rooms...");
 
+    // stop ticking at first, so no room is being updated when destroying it
+    sRoomScheduler->Shutdown();
+
     std::unique_lock<std::recursive_mutex> lck(roomlist_mtx);
 
-    for (std::map<uint32_t, Room*>::iterator itr = m_rooms.begin(); itr != m_rooms.end(); ++itr)
-    {
-        itr->second->SetRunning(false);
-        itr->second->WaitForShutdown();
-    }
+    // rooms still looked up by someone else are freed by the last of them
+    m_rooms.clear();
 }
 
 uint32_t Gameplay::GenerateRoomId()
@@ -45,15 +46,16 @@ uint32_t Gameplay::GenerateRoomId()
     return ++m_lastRoomId;
 }
 
-Room* Gameplay::GetRoom(uint32_t id)
+RoomPtr Gameplay::GetRoom(uint32_t id)
 {
     std::unique_lock<std::recursive_mutex> lck(roomlist_mtx);
 
     // if it's not in rooms map, it does not exist
-    if (m_rooms.find(id) == m_rooms.end())
+    std::map<uint32_t, RoomPtr>::iterator itr = m_rooms.find(id);
+    if (itr == m_rooms.end())
         return nullptr;
 
-    return m_rooms[id];
+    return itr->second;
 }
 
 void Gameplay::DestroyRoom(uint32_t id)
@@ -63,25 +65,28 @@ void Gameplay::DestroyRoom(uint32_t id)
     m_rooms.erase(id);
 }
 
-Room* Gameplay::CreateRoom(uint32_t gameType, uint32_t capacity, const char* name, uint32_t size)
+RoomPtr Gameplay::CreateRoom(uint32_t gameType, uint32_t capacity, const char* name, uint32_t size)
 {
     std::unique_lock<std::recursive_mutex> lck(roomlist_mtx);
 
     // create room record and put it into map
-    Room* nroom = new Room(GenerateRoomId(), gameType, capacity, name, size);
+    RoomPtr nroom = std::make_shared<Room>(GenerateRoomId(), gameType, capacity, name, size);
     m_rooms[nroom->GetId()] = nroom;
 
+    // room is updated by scheduler workers from now on
+    sRoomScheduler->ScheduleRoom(nroom);
+
     return nroom;
 }
 
-void Gameplay::GetRoomList(std::list<Room*> &target, int32_t gameType)
+void Gameplay::GetRoomList(std::list<RoomPtr> &target, int32_t gameType)
 {
     std::unique_lock<std::recursive_mutex> lck(roomlist_mtx);
 
     // at first, clear target list to be filled
     target.clear();
 
-    for (std::map<uint32_t, Room*>::iterator itr = m_rooms.begin(); itr != m_rooms.end(); ++itr)
+    for (std::map<uint32_t, RoomPtr>::iterator itr = m_rooms.begin(); itr != m_rooms.end(); ++itr)
     {
         // retrieve all rooms of specified type / any type if not specified
         if (gameType == GAME_TYPE_ANY || itr->second->GetGameType() == gameType)
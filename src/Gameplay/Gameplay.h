@@ -5,6 +5,7 @@
 
 #include <map>
 #include <list>
+#include <memory>
 
 /* enumerator of known game types */
 enum GameTypes
@@ -16,6 +17,10 @@ enum GameTypes
 
 class Room;
 
+/* Rooms are shared by gameplay, scheduler and anyone who looked them up; the room is freed, when the last
+ * of them lets it go, so nobody has to care about room destruction while using it */
+typedef std::shared_ptr<Room> RoomPtr;
+
 /* Gameplay class - contains all info needed for game - rooms management, etc. */
 class Gameplay
 {
@@ -32,16 +37,16 @@ class Gameplay
         /* Returns first free room ID */
         uint32_t GenerateRoomId();
         /* Retrieves room by its ID */
-        Room* GetRoom(uint32_t id);
+        RoomPtr GetRoom(uint32_t id);
 
         /* Deletes room from update array */
         void DestroyRoom(uint32_t id);
 
         /* Creates room using specified parameters */
-        Room* CreateRoom(uint32_t gameType, uint32_t capacity, const char* name, uint32_t size);
+        RoomPtr CreateRoom(uint32_t gameType, uint32_t capacity, const char* name, uint32_t size);
 
         /* Fills supplied list with existing rooms of specified type */
-        void GetRoomList(std::list<Room*> &target, int32_t gameType = GAME_TYPE_ANY);
+        void GetRoomList(std::list<RoomPtr> &target, int32_t gameType = GAME_TYPE_ANY);
 
     protected:
         /* Hidden singleton constructor */
@@ -51,7 +56,7 @@ class Gameplay
         /* Last assigned room ID */
         uint32_t m_lastRoomId;
         /* Room map */
-        std::map<uint32_t, Room*> m_rooms;
+        std::map<uint32_t, RoomPtr> m_rooms;
 
         /* room list mutex */
         std::recursive_mutex roomlist_mtx;
@@ -4,71 +4,57 @@
 #include "GridSearchers.h"
 #include "Player.h"
 #include "Network.h"
+#include "Opcodes.h"
 #include "Log.h"
 
+#include <algorithm>
+
 void BaseCellVisitor::SetParameter(int32_t param)
 {
     m_parameter = param;
 }
 
-void NearVisibilityGridSearcher::Execute()
+void BaseGridSearcher::VisitNearCells(uint32_t cellX, uint32_t cellY)
 {
-    std::unique_lock<std::recursive_mutex> lock(m_room->cellMapLock);
-
     int32_t i, j;
-    int32_t tmpX, tmpY;
+    int32_t x1, x2, y1, y2;
+    Cell* column;
+
+    // clamp the neighborhood to grid borders at first, so the cells could be visited without any checks
+    x1 = std::max((int32_t)cellX - CELL_VISIBILITY_OFFSET, 0);
+    x2 = std::min((int32_t)cellX + CELL_VISIBILITY_OFFSET, (int32_t)m_room->GetGridSizeX() - 1);
+    y1 = std::max((int32_t)cellY - CELL_VISIBILITY_OFFSET, 0);
+    y2 = std::min((int32_t)cellY + CELL_VISIBILITY_OFFSET, (int32_t)m_room->GetGridSizeY() - 1);
 
-    // iterate one left, center, one right
-    for (i = -CELL_VISIBILITY_OFFSET; i <= CELL_VISIBILITY_OFFSET; i++)
+    // iterate columns from left to right
+    for (i = x1; i <= x2; i++)
     {
-        tmpX = (int32_t)m_cellX + i;
-        // if we are out of grid range, continue to next
-        if (tmpX < 0 || tmpX >= (int32_t)m_room->GetGridSizeX())
-            continue;
+        // cells of one column are stored next to each other, so just walk through them from top to bottom
+        column = m_room->GetCell(i, y1);
+        for (j = 0; j <= y2 - y1; j++)
+            m_cellVisitor->Visit(&column[j]);
+    }
+}
 
-        // iterate one up, center, one down
-        for (j = -CELL_VISIBILITY_OFFSET; j <= CELL_VISIBILITY_OFFSET; j++)
-        {
-            tmpY = (int32_t)m_cellY + j;
-            // out of grid range
-            if (tmpY < 0 || tmpY >= (int32_t)m_room->GetGridSizeY())
-                continue;
+void NearVisibilityGridSearcher::Execute()
+{
+    std::unique_lock<std::recursive_mutex> lock(m_room->cellMapLock);
 
-            m_cellVisitor->Visit(m_room->GetCell(tmpX, tmpY));
-        }
-    }
+    VisitNearCells(m_cellX, m_cellY);
 }
 
 void NearObjectVisibilityGridSearcher::Execute()
 {
-    int32_t i, j;
     uint32_t cellX, cellY;
-    int32_t tmpX, tmpY;
     Position const& pos = m_subject->GetPosition();
 
-    std::lock_guard<std::recursive_mutex> lock(m_room->cellMapLock);
+    std::unique_lock<std::recursive_mutex> lock(m_room->cellMapLock, std::defer_lock);
+    if (m_lockGrid)
+        lock.lock();
 
     Cell::GetCoordPairFor(pos.x, pos.y, cellX, cellY);
 
-    // iterate one left, center, one right
-    for (i = -CELL_VISIBILITY_OFFSET; i <= CELL_VISIBILITY_OFFSET; i++)
-    {
-        tmpX = (int32_t)cellX + i;
-        // if we are out of grid range, continue to next
-        if (tmpX < 0 || tmpX >= (int32_t)m_room->GetGridSizeX())
-            continue;
-
-        // iterate one up, center, one down
-        for (j = -CELL_VISIBILITY_OFFSET; j <= CELL_VISIBILITY_OFFSET; j++)
-        {
-            tmpY = (int32_t)cellY + j;
-            // out of grid range
-            if (tmpY < 0 || tmpY >= (int32_t)m_room->GetGridSizeY())
-                continue;
-
-            m_cellVisitor->Visit(m_room->GetCell(tmpX, tmpY));
-        }
-    }
+    VisitNearCells(cellX, cellY);
 }
 
 void VisibilityChangeGridSearcher::Execute()
@@ -179,13 +165,93 @@ void CellDiscoveryGridSearcher::Execute()
     }
 }
 
+bool AllObjectCreateCellVisitor::IsFoodWanted(uint32_t index)
+{
+    // the client still has this food from earlier, do not send it again
+    return m_food.IsAlive(index) && (!m_knownFood || !m_knownFood->IsKnown(index));
+}
+
 void AllObjectCreateCellVisitor::Visit(Cell* cell)
 {
-    for (std::list<WorldObject*>::iterator itr = cell->objectList.begin(); itr != cell->objectList.end(); ++itr)
+    if (m_compact)
+    {
+        VisitCompact(cell);
+        return;
+    }
+
+    for (uint32_t i = cell->foodBegin; i < cell->foodEnd; i++)
+    {
+        if (!IsFoodWanted(i))
+            continue;
+
+        if (m_knownFood)
+            m_knownFood->SetKnown(i);
+
+        m_food.BuildCreatePacketBlock(i, m_targetPacket);
+        m_counter++;
+        m_builder.AddObjectBlock();
+    }
+
+    for (std::vector<WorldObject*>::iterator itr = cell->objectList.begin(); itr != cell->objectList.end(); ++itr)
     {
         (*itr)->BuildCreatePacketBlock(m_targetPacket);
         m_counter++;
+        m_builder.AddObjectBlock();
+    }
+}
+
+void AllObjectCreateCellVisitor::VisitCompact(Cell* cell)
+{
+    uint32_t i, count;
+    uint32_t lastId = 0;
+    Position pos;
+
+    // count has to be known before the group starts
+    count = (uint32_t)cell->objectList.size();
+    for (i = cell->foodBegin; i < cell->foodEnd; i++)
+    {
+        if (IsFoodWanted(i))
+            count++;
+    }
+
+    if (count == 0)
+        return;
+
+    m_targetPacket.WriteVarUInt(cell->coordX);
+    m_targetPacket.WriteVarUInt(cell->coordY);
+    m_targetPacket.WriteVarUInt(count);
+
+    // food IDs of one cell are consecutive, so the deltas are mostly just 1
+    for (i = cell->foodBegin; i < cell->foodEnd; i++)
+    {
+        if (!IsFoodWanted(i))
+            continue;
+
+        if (m_knownFood)
+            m_knownFood->SetKnown(i);
+
+        m_targetPacket.WriteVarInt((int32_t)(m_food.GetId(i) - lastId));
+        Cell::WriteCompactOffset(m_targetPacket, m_food.GetX(i), m_food.GetY(i), cell->coordX, cell->coordY);
+        m_targetPacket.WriteUInt8((uint8_t)m_food.GetType(i));
+        m_targetPacket.WriteVarUInt(0); // TODO: specific parameter for each type
+
+        lastId = m_food.GetId(i);
     }
+
+    for (std::vector<WorldObject*>::iterator itr = cell->objectList.begin(); itr != cell->objectList.end(); ++itr)
+    {
+        pos = (*itr)->GetPosition();
+
+        m_targetPacket.WriteVarInt((int32_t)((*itr)->GetId() - lastId));
+        Cell::WriteCompactOffset(m_targetPacket, pos.x, pos.y, cell->coordX, cell->coordY);
+        m_targetPacket.WriteUInt8((uint8_t)(*itr)->GetTypeId());
+        m_targetPacket.WriteVarUInt(0); // TODO: specific parameter for each type
+
+        lastId = (*itr)->GetId();
+    }
+
+    m_counter++;
+    m_builder.AddObjectBlock();
 }
 
 uint32_t AllObjectCreateCellVisitor::GetCounter()
@@ -195,10 +261,14 @@ uint32_t AllObjectCreateCellVisitor::GetCounter()
 
 void AllPlayerCreateCellVisitor::Visit(Cell* cell)
 {
-    for (std::list<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
+    for (std::vector<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
     {
-        (*itr)->BuildCreatePacketBlock(m_targetPacket);
+        if (m_compact)
+            (*itr)->BuildCompactCreatePacketBlock(m_targetPacket);
+        else
+            (*itr)->BuildCreatePacketBlock(m_targetPacket);
         m_counter++;
+        m_builder.AddPlayerBlock();
     }
 }
 
@@ -209,81 +279,81 @@ uint32_t AllPlayerCreateCellVisitor::GetCounter()
 
 void BroadcastPacketCellVisitor::Visit(Cell* cell)
 {
-    for (std::list<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
-        sNetwork->SendPacket((*itr)->GetSession(), m_targetPacket);
+    for (std::vector<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
+        sNetwork->SendFrame((*itr)->GetSession(), m_targetFrame, m_compactFrame);
 }
 
-void ObjectFinderCellVisitor::Visit(Cell* cell)
+void FoodCreateCellVisitor::Visit(Cell* cell)
 {
-    // already found, nothing to do
-    if (m_object)
-        return;
-
-    if (m_isPlayer)
-    {
-        for (std::list<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
-        {
-            if ((*itr)->GetId() == m_objectId)
-            {
-                m_object = (*itr);
-                return;
-            }
-        }
-    }
-    else
+    for (std::vector<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
     {
-        for (std::list<WorldObject*>::iterator itr = cell->objectList.begin(); itr != cell->objectList.end(); ++itr)
-        {
-            if ((*itr)->GetId() == m_objectId)
-            {
-                m_object = (*itr);
-                return;
-            }
-        }
+        if ((*itr)->GetKnownFood().IsKnown(m_foodIndex))
+            continue;
+
+        (*itr)->GetKnownFood().SetKnown(m_foodIndex);
+        sNetwork->SendFrame((*itr)->GetSession(), m_targetFrame, m_compactFrame);
     }
 }
 
-void MultiplexBroadcastPacketCellVisitor::Visit(Cell* cell)
+void KnownFoodDestroyCellVisitor::Visit(Cell* cell)
 {
-    GamePacket &tosend = (m_parameter == 0) ? m_srcPacket1 : m_srcPacket2;
-
-    for (std::list<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
-        sNetwork->SendPacket((*itr)->GetSession(), tosend);
-}
+    // newly discovered cells are left to discovery searcher
+    if (m_parameter == 0)
+        return;
 
-void ManhattanClosestCellVisitor::Visit(Cell* cell)
-{
-    float dist;
+    InterestSet& known = m_player->GetKnownFood();
 
-    for (std::list<WorldObject*>::iterator itr = cell->objectList.begin(); itr != cell->objectList.end(); ++itr)
+    for (uint32_t i = cell->foodBegin; i < cell->foodEnd; i++)
     {
-        if (*itr == m_exception)
+        if (!known.IsKnown(i))
             continue;
 
-        dist = (*itr)->GetPosition().DistanceManhattan(m_sourcePos);
-        if (dist < m_closestDistance)
-        {
-            m_closestDistance = dist;
-            m_closest = *itr;
-        }
-    }
+        known.SetUnknown(i);
 
-    for (std::list<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
-    {
-        if (*itr == m_exception)
-            continue;
+        // food of one cell has consecutive IDs most of the time, so the differences fit one byte
+        m_ids.WriteVarInt((int32_t)(m_food.GetId(i) - m_lastId));
+        m_lastId = m_food.GetId(i);
+        m_idCount++;
+        m_counter++;
 
-        // for players, calculate exact distance, since there would be very small amount of players within one cell
-        dist = (*itr)->GetPosition().DistanceExact(m_sourcePos);
-        if (dist - PLAYER_SIZE_CALC_COEF*((*itr)->GetSize() + m_sourceSize) < m_closestDistance)
-        {
-            m_closestDistance = dist;
-            m_closest = *itr;
-        }
+        if (m_ids.GetWritePos() >= WORLD_UPDATE_CHUNK_SIZE)
+            Send();
     }
 }
 
-WorldObject* ManhattanClosestCellVisitor::GetFoundObject()
+void KnownFoodDestroyCellVisitor::Finish()
 {
-    return m_closest;
+    if (m_idCount != 0)
+        Send();
+}
+
+void KnownFoodDestroyCellVisitor::Send()
+{
+    GamePacket pkt(SP_DESTROY_OBJECTS);
+    pkt.WriteUInt8(PACKET_OBJECT_TYPE_WORLDOBJECT);
+    pkt.WriteUInt8(0); // "reason" - we don't use this at the moment, maybe in future
+    pkt.WriteVarUInt(m_idCount);
+    pkt.WriteData(m_ids.GetData(), m_ids.GetWritePos());
+
+    sNetwork->SendPacket(m_player, pkt);
+
+    // every packet starts the differences from zero, so the client can read it on its own
+    m_ids.Reset(0);
+    m_idCount = 0;
+    m_lastId = 0;
+}
+
+uint32_t KnownFoodDestroyCellVisitor::GetCounter()
+{
+    return m_counter;
+}
+
+void MultiplexBroadcastPacketCellVisitor::Visit(Cell* cell)
+{
+    WireFramePtr &tosend = (m_parameter == 0) ? m_srcFrame1 : m_srcFrame2;
+    // destroy packet is the same in both encodings
+    WireFramePtr &compact = (m_parameter == 0) ? m_compactFrame1 : m_srcFrame2;
+
+    for (std::vector<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
+        sNetwork->SendFrame((*itr)->GetSession(), tosend, compact);
 }
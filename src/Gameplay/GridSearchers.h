@@ -3,8 +3,9 @@
 
 #include "WorldObject.h"
 #include "Room.h"
-
-class GamePacket;
+#include "GamePacket.h"
+#include "InterestSet.h"
+#include "WorldUpdateBuilder.h"
 
 /*********************
  * Base class section
@@ -36,6 +37,9 @@ class BaseGridSearcher
         virtual void Execute() = 0;
 
     protected:
+        /* Visits all cells visible from given cell */
+        void VisitNearCells(uint32_t cellX, uint32_t cellY);
+
         Room* m_room;
         BaseCellVisitor* m_cellVisitor;
 };
@@ -44,16 +48,18 @@ class BaseGridSearcher
  * Derived grid searchers section
  *********************************/
 
-/* Checks near cells, which are still visible by WorldObject */
+/* Checks near cells, which are still visible by WorldObject; the grid lock may be omitted only when the caller
+ * guarantees, that the grid does not change meanwhile (i.e. in parallel phase of room update) */
 class NearObjectVisibilityGridSearcher : public BaseGridSearcher
 {
     public:
-        NearObjectVisibilityGridSearcher(Room* room, BaseCellVisitor *visitor, WorldObject* subject) : BaseGridSearcher(room, visitor), m_subject(subject) { };
+        NearObjectVisibilityGridSearcher(Room* room, BaseCellVisitor *visitor, WorldObject* subject, bool lockGrid = true) : BaseGridSearcher(room, visitor), m_subject(subject), m_lockGrid(lockGrid) { };
 
         void Execute() override;
 
     private:
         WorldObject* m_subject;
+        bool m_lockGrid;
 };
 
 /* Checks near cells, which are still visible by WorldObject */
@@ -98,19 +104,31 @@ class CellDiscoveryGridSearcher : public BaseGridSearcher
  * Derived cell visitors section
  *********************************/
 
-/* Visits cell and builds create block of every object in it */
+/* Visits cell and builds create block of every object in it; when the set of food known by recipient is supplied,
+ * the known food is skipped, and the rest is marked as known. In compact encoding, objects are grouped by cells -
+ * every nonempty cell writes its coordinates and object count, then objects with ID delta and offset within cell */
 class AllObjectCreateCellVisitor : public BaseCellVisitor
 {
     public:
-        AllObjectCreateCellVisitor(GamePacket &gp) : m_targetPacket(gp), m_counter(0) { };
+        AllObjectCreateCellVisitor(WorldUpdateBuilder &builder, FoodStore &food, InterestSet* knownFood = nullptr) : m_builder(builder),
+            m_targetPacket(builder.GetObjectBlocks()), m_food(food), m_knownFood(knownFood), m_compact(builder.IsCompact()), m_counter(0) { };
 
         void Visit(Cell* cell) override;
 
-        /* Retrieves count of objects visited */
+        /* Retrieves count of objects visited (count of cell groups in compact encoding) */
         uint32_t GetCounter();
 
     private:
+        /* Builds cell group in compact encoding */
+        void VisitCompact(Cell* cell);
+        /* Is the food supposed to be sent? */
+        bool IsFoodWanted(uint32_t index);
+
+        WorldUpdateBuilder &m_builder;
         GamePacket &m_targetPacket;
+        FoodStore &m_food;
+        InterestSet* m_knownFood;
+        bool m_compact;
         uint32_t m_counter;
 };
 
@@ -118,7 +136,8 @@ class AllObjectCreateCellVisitor : public BaseCellVisitor
 class AllPlayerCreateCellVisitor : public BaseCellVisitor
 {
     public:
-        AllPlayerCreateCellVisitor(GamePacket &gp) : m_targetPacket(gp), m_counter(0) { };
+        AllPlayerCreateCellVisitor(WorldUpdateBuilder &builder) : m_builder(builder), m_targetPacket(builder.GetPlayerBlocks()),
+            m_compact(builder.IsCompact()), m_counter(0) { };
 
         void Visit(Cell* cell) override;
 
@@ -126,68 +145,88 @@ class AllPlayerCreateCellVisitor : public BaseCellVisitor
         uint32_t GetCounter();
 
     private:
+        WorldUpdateBuilder &m_builder;
         GamePacket &m_targetPacket;
+        bool m_compact;
         uint32_t m_counter;
 };
 
-/* Visits cell and broadcasts packet to every player in cell */
+/* Visits cell and broadcasts packet to every player in cell; clients using compact encoding get compact variant, if supplied */
 class BroadcastPacketCellVisitor : public BaseCellVisitor
 {
     public:
-        BroadcastPacketCellVisitor(GamePacket &gp) : m_targetPacket(gp) { };
+        BroadcastPacketCellVisitor(GamePacket &gp, GamePacket* compactGp = nullptr) : m_targetFrame(gp.GetWireFrame()),
+            m_compactFrame(compactGp ? compactGp->GetWireFrame() : WireFramePtr()) { };
 
         void Visit(Cell* cell) override;
 
     private:
-        GamePacket &m_targetPacket;
+        /* packet is serialized just once and shared by all recipients */
+        WireFramePtr m_targetFrame;
+        WireFramePtr m_compactFrame;
 };
 
-/* Visits cell and broadcasts packet to every player in cell */
-class ObjectFinderCellVisitor : public BaseCellVisitor
+/* Visits cell and sends food create packet to every player in cell, who does not know the food yet */
+class FoodCreateCellVisitor : public BaseCellVisitor
 {
     public:
-        ObjectFinderCellVisitor(uint32_t objectId, bool isPlayer) : m_isPlayer(isPlayer), m_objectId(objectId), m_object(nullptr) {};
+        FoodCreateCellVisitor(GamePacket &gp, uint32_t foodIndex, GamePacket* compactGp = nullptr) : m_targetFrame(gp.GetWireFrame()),
+            m_compactFrame(compactGp ? compactGp->GetWireFrame() : WireFramePtr()), m_foodIndex(foodIndex) { };
 
         void Visit(Cell* cell) override;
 
-        WorldObject* GetFoundObject() { return m_object; };
-
     private:
-        bool m_isPlayer;
-        uint32_t m_objectId;
-        WorldObject* m_object;
+        WireFramePtr m_targetFrame;
+        WireFramePtr m_compactFrame;
+        uint32_t m_foodIndex;
 };
 
-/* Visits cell and broadcasts packet to every player in cell depending on its parameter set (see BaseCellVisitor method SetParameter) */
-class MultiplexBroadcastPacketCellVisitor : public BaseCellVisitor
+/* Visits cells the player left (destruction mode of VisibilityChangeGridSearcher) and collects every food the player
+ * knows there into one SP_DESTROY_OBJECTS packet, sent by Finish; the food becomes unknown, so it's sent again, when
+ * the player comes back */
+class KnownFoodDestroyCellVisitor : public BaseCellVisitor
 {
     public:
-        MultiplexBroadcastPacketCellVisitor(GamePacket &pkt1, GamePacket &pkt2) : m_srcPacket1(pkt1), m_srcPacket2(pkt2) { };
+        KnownFoodDestroyCellVisitor(Player* player, FoodStore &food) : m_player(player), m_food(food), m_counter(0), m_idCount(0), m_lastId(0) { };
 
         void Visit(Cell* cell) override;
 
+        /* Sends the rest of collected food; nothing is sent, if there's none */
+        void Finish();
+
+        /* Retrieves count of food destroyed */
+        uint32_t GetCounter();
+
     private:
-        GamePacket &m_srcPacket1;
-        GamePacket &m_srcPacket2;
+        /* Sends collected food */
+        void Send();
+
+        Player* m_player;
+        FoodStore &m_food;
+        uint32_t m_counter;
+
+        /* IDs collected for next packet, each as difference from the previous one */
+        GamePacket m_ids;
+        /* count of IDs collected for next packet */
+        uint32_t m_idCount;
+        /* last ID collected */
+        uint32_t m_lastId;
 };
 
-/* Visits cell and broadcasts packet to every player in cell */
-class ManhattanClosestCellVisitor : public BaseCellVisitor
+/* Visits cell and broadcasts packet to every player in cell depending on its parameter set (see BaseCellVisitor method SetParameter);
+ * the first packet may have compact variant */
+class MultiplexBroadcastPacketCellVisitor : public BaseCellVisitor
 {
     public:
-        ManhattanClosestCellVisitor(Position const& src, uint32_t sourceSize, WorldObject* except) : m_sourcePos(src), m_exception(except),
-            m_sourceSize(sourceSize), m_closest(nullptr), m_closestDistance(10000.0f) { };
+        MultiplexBroadcastPacketCellVisitor(GamePacket &pkt1, GamePacket &pkt2, GamePacket* compactPkt1 = nullptr) : m_srcFrame1(pkt1.GetWireFrame()),
+            m_srcFrame2(pkt2.GetWireFrame()), m_compactFrame1(compactPkt1 ? compactPkt1->GetWireFrame() : WireFramePtr()) { };
 
         void Visit(Cell* cell) override;
 
-        WorldObject* GetFoundObject();
-
     private:
-        Position const& m_sourcePos;
-        WorldObject* m_exception;
-        uint32_t m_sourceSize;
-        WorldObject* m_closest;
-        float m_closestDistance;
+        WireFramePtr m_srcFrame1;
+        WireFramePtr m_srcFrame2;
+        WireFramePtr m_compactFrame1;
 };
 
 #endif
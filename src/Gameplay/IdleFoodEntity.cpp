@@ -1,18 +0,0 @@
-#include "General.h"
-#include "Entities.h"
-#include "WorldObject.h"
-
-IdleFoodEntity::IdleFoodEntity()
-{
-    SetTypeId(OBJECT_TYPE_IDLEFOOD);
-}
-
-IdleFoodEntity::~IdleFoodEntity()
-{
-    //
-}
-
-void IdleFoodEntity::OnEatenByPlayer(Player* plr)
-{
-    //
-}
@@ -0,0 +1,28 @@
+#include "General.h"
+#include "InterestSet.h"
+
+#include <algorithm>
+
+InterestSet::InterestSet()
+{
+    //
+}
+
+void InterestSet::Clear()
+{
+    // keep allocated storage, the set will most likely grow to the same size again
+    std::fill(m_bits.begin(), m_bits.end(), 0);
+}
+
+uint32_t InterestSet::GetKnownCount() const
+{
+    uint32_t count = 0;
+
+    for (std::vector<uint64_t>::const_iterator itr = m_bits.begin(); itr != m_bits.end(); ++itr)
+    {
+        for (uint64_t bits = *itr; bits != 0; bits &= bits - 1)
+            count++;
+    }
+
+    return count;
+}
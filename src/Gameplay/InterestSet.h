@@ -0,0 +1,45 @@
+#ifndef AGAR_INTERESTSET_H
+#define AGAR_INTERESTSET_H
+
+#include <vector>
+
+/* Set of room food known by client, one bit per food index. Food is known since the client received its creation,
+ * until it receives its destruction - either when the food is eaten, or when the player leaves its visibility range
+ * (only clients supporting batched destroy, others keep the food they left behind).
+ * The set grows on demand, so it does not need to know the food count in advance */
+class InterestSet
+{
+    public:
+        InterestSet();
+
+        /* Forgets everything, i.e. when the client builds its world from scratch */
+        void Clear();
+        /* Retrieves count of known food */
+        uint32_t GetKnownCount() const;
+
+        /* Does the client know given food? */
+        bool IsKnown(uint32_t index) const
+        {
+            return (index >> 6) < m_bits.size() && ((m_bits[index >> 6] >> (index & 63)) & 1) != 0;
+        };
+        /* Marks food as known */
+        void SetKnown(uint32_t index)
+        {
+            if ((index >> 6) >= m_bits.size())
+                m_bits.resize((index >> 6) + 1, 0);
+
+            m_bits[index >> 6] |= ((uint64_t)1) << (index & 63);
+        };
+        /* Marks food as unknown */
+        void SetUnknown(uint32_t index)
+        {
+            if ((index >> 6) < m_bits.size())
+                m_bits[index >> 6] &= ~(((uint64_t)1) << (index & 63));
+        };
+
+    private:
+        /* bitmask of known food, 64 per item */
+        std::vector<uint64_t> m_bits;
+};
+
+#endif
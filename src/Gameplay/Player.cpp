@@ -6,6 +6,8 @@
 #include "Room.h"
 #include "Opcodes.h"
 
+#include <algorithm>
+
 Player::Player() : WorldObject()
 {
     SetTypeId(OBJECT_TYPE_PLAYER);
@@ -67,6 +69,21 @@ void Player::BuildCreatePacketBlock(GamePacket& gp)
     gp.WriteFloat(m_moveAngle);
 }
 
+void Player::BuildCompactCreatePacketBlock(GamePacket& gp)
+{
+    // normalize angle to one turn, so it fits into 16 bits
+    float turns = m_moveAngle / FULL_TURN_ANGLE;
+    turns -= floor(turns);
+
+    gp.WriteVarUInt(m_id);
+    gp.WriteString(m_name.c_str());
+    gp.WriteVarUInt(m_playerSize);
+    Cell::WriteCompactPosition(gp, m_position.x, m_position.y);
+    gp.WriteVarUInt(m_color);
+    gp.WriteUInt8((m_isMoving ? 1 : 0) | (m_dead ? 2 : 0));
+    gp.WriteUInt16((uint16_t)((uint32_t)(turns * COMPACT_ANGLE_STEPS) & 0xFFFF));
+}
+
 void Player::SetMoving(bool state)
 {
     m_isMoving = state;
@@ -94,14 +111,23 @@ void Player::Update(uint32_t diff)
     if (!IsUpdateEnabled())
         return;
 
-    if (IsMoving() && !IsDead())
-    {
-        float dx = cos(GetMoveAngle())*diff*m_playerSpeed;
-        float dy = sin(GetMoveAngle())*diff*m_playerSpeed;
-
-        Position plpos(m_position.x + dx, m_position.y + dy);
+    Position plpos;
+    if (GetMoveDestination(diff, plpos))
         Relocate(plpos, true);
-    }
+}
+
+bool Player::GetMoveDestination(uint32_t diff, Position &dest)
+{
+    if (!IsMoving() || IsDead())
+        return false;
+
+    float dx = cos(GetMoveAngle())*diff*m_playerSpeed;
+    float dy = sin(GetMoveAngle())*diff*m_playerSpeed;
+
+    dest.x = m_position.x + dx;
+    dest.y = m_position.y + dy;
+
+    return true;
 }
 
 void Player::ModifySize(int32_t mod)
@@ -145,3 +171,23 @@ bool Player::IsUpdateEnabled()
 {
     return m_updateEnabled;
 }
+
+float Player::GetCollisionRadius()
+{
+    return PLAYER_SIZE_CALC_COEF*(float)std::max(m_playerSize, (uint32_t)MIN_PLAYER_CALC_SIZE);
+}
+
+void Player::SetLastCollisionPosition(Position const& pos)
+{
+    m_lastCollisionPos = pos;
+}
+
+Position const& Player::GetLastCollisionPosition()
+{
+    return m_lastCollisionPos;
+}
+
+InterestSet& Player::GetKnownFood()
+{
+    return m_knownFood;
+}
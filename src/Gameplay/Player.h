@@ -3,6 +3,7 @@
 
 #include "Network.h"
 #include "WorldObject.h"
+#include "InterestSet.h"
 
 /* Player starting size */
 #define DEFAULT_INITIAL_PLAYER_SIZE 10
@@ -25,6 +26,11 @@
 /* At this point, player stops gaining size */
 #define PLAYER_STOP_INCOME_SIZE 1200
 
+/* count of steps of full turn in compact encoding (16bit angle) */
+#define COMPACT_ANGLE_STEPS 65536.0f
+/* full turn in radians */
+#define FULL_TURN_ANGLE 6.28318531f
+
 class Session;
 
 /* Player class - object associated with one connected client 1:1 */
@@ -44,6 +50,8 @@ class Player : public WorldObject
 
         /* Overrides object create block building function for player class */
         void BuildCreatePacketBlock(GamePacket& gp) override;
+        /* Overrides compact object create block building function for player class */
+        void BuildCompactCreatePacketBlock(GamePacket& gp) override;
 
         /* Sets player name */
         void SetName(const char* name);
@@ -62,6 +70,8 @@ class Player : public WorldObject
 
         /* Update player record */
         void Update(uint32_t diff);
+        /* Computes position, where the player moves within given time; returns false if not moving */
+        bool GetMoveDestination(uint32_t diff, Position &dest);
 
         /* Modifies player size */
         void ModifySize(int32_t mod);
@@ -75,11 +85,21 @@ class Player : public WorldObject
         /* Is player dead? */
         bool IsDead();
 
+        /* Retrieves radius used for collisions */
+        float GetCollisionRadius();
+        /* Sets position of player at the time of last collision check */
+        void SetLastCollisionPosition(Position const& pos);
+        /* Retrieves position of player at the time of last collision check */
+        Position const& GetLastCollisionPosition();
+
         /* Sets enable update flag */
         void SetUpdateEnabled(bool state);
         /* Are updates enabled? */
         bool IsUpdateEnabled();
 
+        /* Retrieves set of food known by client */
+        InterestSet& GetKnownFood();
+
         /* mutex lock for player updates */
         std::mutex updateMutex;
 
@@ -106,6 +126,10 @@ class Player : public WorldObject
         bool m_dead;
         /* are updates enabled? */
         bool m_updateEnabled;
+        /* position at the time of last collision check */
+        Position m_lastCollisionPos;
+        /* food known by client */
+        InterestSet m_knownFood;
 };
 
 #endif
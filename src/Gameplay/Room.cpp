@@ -3,7 +3,7 @@
 #include "Room.h"
 #include "Player.h"
 #include "Opcodes.h"
-#include "Entities.h"
+#include "PacketSchemas.h"
 #include "GridSearchers.h"
 #include "Log.h"
 #include "StatusCodes.h"
@@ -11,9 +11,12 @@
 #include "Helpers.h"
 
 #include "Gameplay.h"
+#include "RoomScheduler.h"
+#include "NetworkWorker.h"
 
 #include <math.h>
 #include <random>
+#include <algorithm>
 
 /* Global position randomizer */
 std::uniform_real_distribution<float> positionRandomizer(0.0f, 1.0f);
@@ -26,16 +29,92 @@ void Cell::GetCoordPairFor(float x, float y, uint32_t &cellX, uint32_t &cellY)
     cellY = (uint32_t)floor(y / CELL_SIZE_Y);
 }
 
-bool RespawnTimeComparator::operator()(WorldObject* a, WorldObject* b)
+/* Quantizes offset within cell to 16 bits */
+static uint16_t quantizeCellOffset(float offset, float cellSize)
 {
-    return a->GetRespawnTime() > b->GetRespawnTime();
+    float q = offset / cellSize * COMPACT_OFFSET_STEPS + 0.5f;
+
+    if (q <= 0.0f)
+        return 0;
+    if (q >= COMPACT_OFFSET_STEPS)
+        return (uint16_t)COMPACT_OFFSET_STEPS;
+
+    return (uint16_t)q;
 }
 
-void runRoomUpdater(Room* room)
+void Cell::WriteCompactPosition(GamePacket& gp, float x, float y)
 {
-    room->Run();
+    uint32_t cellX, cellY;
+
+    GetCoordPairFor(x, y, cellX, cellY);
+
+    gp.WriteVarUInt(cellX);
+    gp.WriteVarUInt(cellY);
+    WriteCompactOffset(gp, x, y, cellX, cellY);
+}
+
+void Cell::WriteCompactOffset(GamePacket& gp, float x, float y, uint32_t cellX, uint32_t cellY)
+{
+    gp.WriteUInt16(quantizeCellOffset(x - cellX * CELL_SIZE_X, CELL_SIZE_X));
+    gp.WriteUInt16(quantizeCellOffset(y - cellY * CELL_SIZE_Y, CELL_SIZE_Y));
+}
+
+/* Appends item to cell list and lets it know its slot */
+template <class T>
+static void cellListAdd(std::vector<T*> &list, T* item)
+{
+    item->SetCellSlot((uint32_t)list.size());
+    list.push_back(item);
+}
 
-    delete room;
+/* Removes item from cell list by moving the last item to its slot */
+template <class T>
+static void cellListRemove(std::vector<T*> &list, T* item)
+{
+    uint32_t slot = item->GetCellSlot();
+
+    // the item is not in this cell at all
+    if (slot >= list.size() || list[slot] != item)
+        return;
+
+    list[slot] = list.back();
+    list[slot]->SetCellSlot(slot);
+    list.pop_back();
+}
+
+void Cell::AddObject(WorldObject* wobj)
+{
+    cellListAdd(objectList, wobj);
+}
+
+void Cell::RemoveObject(WorldObject* wobj)
+{
+    cellListRemove(objectList, wobj);
+}
+
+void Cell::AddPlayer(Player* plr)
+{
+    cellListAdd(playerList, plr);
+}
+
+void Cell::RemovePlayer(Player* plr)
+{
+    cellListRemove(playerList, plr);
+}
+
+RoomCommand::RoomCommand(RoomCommandType cmdType, Player* plr) : type(cmdType), playerId(plr->GetId()), player(plr), posX(0.0f), posY(0.0f), angle(0.0f), flag(false)
+{
+    //
+}
+
+bool PlayerMigrationComparator::operator()(PlayerMigration const& a, PlayerMigration const& b)
+{
+    return a.player->GetId() < b.player->GetId();
+}
+
+bool RespawnTimeComparator::operator()(WorldObject* a, WorldObject* b)
+{
+    return a->GetRespawnTime() > b->GetRespawnTime();
 }
 
 Room::Room(uint32_t id, uint32_t gameType, uint32_t capacity, const char* name, uint32_t size) : m_roomName(name)
@@ -44,16 +123,23 @@ Room::Room(uint32_t id, uint32_t gameType, uint32_t capacity, const char* name,
     m_gameType = gameType;
     m_capacity = capacity;
     m_isDefault = false;
+    m_isClosed = false;
+    m_playerCount = 0;
 
     m_lastObjectId = 0;
 
+    m_lastUpdateTime = getMSTime();
+    m_emptyStateTime = 0;
+    m_tickInterval = sRoomScheduler->GetTickInterval();
+
+    m_gridSizeX = 0;
+    m_gridSizeY = 0;
+
     float fsize = (float)size;
     SetMapSize(fsize, fsize);
 
     // this is default for now, dunno if it will be adjustable in future
     GenerateRandomContent();
-
-    m_updateThread = new std::thread(runRoomUpdater, this);
 }
 
 Room::~Room()
@@ -71,20 +157,16 @@ void Room::SetMapSize(float sizeX, float sizeY)
 
     // this is destructive action for now - do not use on fly, just before room initialization
 
-    if (m_cellMap.size() > 0)
-    {
-        for (i = 0; i < m_cellMap.size(); i++)
-            for (j = 0; j < m_cellMap[i].size(); j++)
-                delete m_cellMap[i][j];
-    }
+    m_gridSizeX = (uint32_t)floor(m_sizeX / CELL_SIZE_X) + 1;
+    m_gridSizeY = (uint32_t)floor(m_sizeY / CELL_SIZE_Y) + 1;
 
-    // init new grid (or cell map, if you like)
-    m_cellMap.resize((size_t)floor(m_sizeX / CELL_SIZE_X) + 1);
-    for (i = 0; i < m_cellMap.size(); i++)
+    // init new grid (or cell map, if you like); cells of one column are stored next to each other
+    m_cellMap.clear();
+    m_cellMap.reserve(m_gridSizeX * m_gridSizeY);
+    for (i = 0; i < m_gridSizeX; i++)
     {
-        m_cellMap[i].resize((size_t)floor(m_sizeY / CELL_SIZE_Y) + 1);
-        for (j = 0; j < m_cellMap[i].size(); j++)
-            m_cellMap[i][j] = new Cell(i, j);
+        for (j = 0; j < m_gridSizeY; j++)
+            m_cellMap.push_back(Cell(i, j));
     }
 }
 
@@ -118,93 +200,700 @@ bool Room::IsDefault()
     return m_isDefault;
 }
 
+void Room::QueueCommand(RoomCommand* cmd)
+{
+    m_commandQueue.Push(cmd);
+}
+
+bool Room::QueueMembershipCommand(RoomCommand* cmd)
+{
+    std::unique_lock<std::mutex> lck(membership_mtx);
+
+    // closed room won't process its queue anymore
+    if (m_isClosed)
+        return false;
+
+    m_commandQueue.Push(cmd);
+    return true;
+}
+
+bool Room::Close()
+{
+    std::unique_lock<std::mutex> lck(membership_mtx);
+    std::unique_lock<std::recursive_mutex> lock(cellMapLock);
+
+    // players may have asked to join just before closing
+    ProcessCommands();
+
+    if (!m_playerList.empty())
+        return false;
+
+    m_isClosed = true;
+    return true;
+}
+
+void Room::ProcessCommands()
+{
+    RoomCommand* cmd;
+    std::unordered_map<uint32_t, Player*>::iterator itr;
+
+    while ((cmd = m_commandQueue.Pop()) != nullptr)
+    {
+        // players entering or leaving room are not in player list, or may not stay there
+        if (cmd->type == ROOM_COMMAND_PLAYER_JOIN)
+        {
+            CommandPlayerJoin(cmd->player);
+            delete cmd;
+            continue;
+        }
+        if (cmd->type == ROOM_COMMAND_PLAYER_LEAVE)
+        {
+            // the command is passed back to network worker along with the player
+            CommandPlayerLeave(cmd);
+            continue;
+        }
+
+        // the player may have left room or disconnected since the command was queued
+        itr = m_playerIndex.find(cmd->playerId);
+        if (itr != m_playerIndex.end())
+            ExecuteCommand(cmd, itr->second);
+
+        delete cmd;
+    }
+}
+
+void Room::ExecuteCommand(RoomCommand* cmd, Player* plr)
+{
+    switch (cmd->type)
+    {
+        case ROOM_COMMAND_WORLD_REQUEST:
+            CommandWorldRequest(plr, cmd->flag);
+            break;
+        case ROOM_COMMAND_MOVE_START:
+            CommandMoveStart(plr, cmd->posX, cmd->posY, cmd->angle);
+            break;
+        case ROOM_COMMAND_MOVE_STOP:
+            CommandMoveStop(plr, cmd->posX, cmd->posY);
+            break;
+        case ROOM_COMMAND_MOVE_HEARTBEAT:
+            CommandMoveHeartbeat(plr, cmd->posX, cmd->posY);
+            break;
+        case ROOM_COMMAND_MOVE_DIRECTION:
+            CommandMoveDirection(plr, cmd->angle);
+            break;
+        case ROOM_COMMAND_PLAYER_EXIT:
+            CommandPlayerExit(plr);
+            break;
+        case ROOM_COMMAND_STATS:
+            CommandStats(plr);
+            break;
+        default:
+            sLog->Error("Unknown room command %u received from player %u", cmd->type, cmd->playerId);
+            break;
+    }
+}
+
+void Room::CommandWorldRequest(Player* plr, bool reinit)
+{
+    // if reinitializing, do not reset player state, just use current
+    if (!reinit)
+    {
+        PlaceNewPlayer(plr);
+        plr->SetDead(false);
+        plr->ResetAttributes();
+    }
+
+    GamePacket header;
+    bool compact = plr->GetSession()->HasClientFlag(CLIENT_FLAG_COMPACT_ENCODING);
+
+    // client builds its world from scratch
+    plr->GetKnownFood().Clear();
+
+    // write map dimensions
+    header.WriteFloat(GetMapSizeX());
+    header.WriteFloat(GetMapSizeY());
+
+    // compact positions are relative to cells, so the client has to know their size
+    if (compact)
+    {
+        header.WriteFloat(CELL_SIZE_X);
+        header.WriteFloat(CELL_SIZE_Y);
+    }
+
+    // build this player update, so the client will know, where we are and how do we look like
+    if (compact)
+        plr->BuildCompactCreatePacketBlock(header);
+    else
+        plr->BuildCreatePacketBlock(header);
+
+    // the world is streamed - the first packet is new world with header, the rest are world updates
+    WorldUpdateBuilder builder(plr, compact, &header);
+
+    // writes player count and player create block for each player in range
+    BuildPlayerCreateBlock(builder, plr);
+    // writes object count and object create block for each object in range
+    BuildObjectCreateBlock(builder, plr);
+
+    builder.Finish();
+
+    plr->SetUpdateEnabled(true);
+}
+
+void Room::CommandMoveStart(Player* plr, float x, float y, float angle)
+{
+    // TODO: checks for too fast movement, etc.
+
+    Position plpos(x, y);
+
+    plr->Relocate(plpos, true);
+    plr->SetMoveAngle(angle);
+    plr->SetMoving(true);
+
+    // broadcast packet about movement start
+    GamePacket movestart(SP_MOVE_START);
+    movestart.WriteUInt32(plr->GetId());
+    movestart.WriteFloat(angle);
+
+    BroadcastPacketCellVisitor visitor(movestart);
+    NearObjectVisibilityGridSearcher gs(this, &visitor, plr);
+
+    gs.Execute();
+}
+
+void Room::CommandMoveStop(Player* plr, float x, float y)
+{
+    Position plpos(x, y);
+
+    plr->Relocate(plpos, true);
+    plr->SetMoving(false);
+
+    // broadcast packet about movement stop
+    GamePacket movestop(SP_MOVE_STOP);
+    movestop.WriteUInt32(plr->GetId());
+    movestop.WriteFloat(x);
+    movestop.WriteFloat(y);
+
+    BroadcastPacketCellVisitor visitor(movestop);
+    NearObjectVisibilityGridSearcher gs(this, &visitor, plr);
+
+    gs.Execute();
+}
+
+void Room::CommandMoveHeartbeat(Player* plr, float x, float y)
+{
+    // TODO: checks for too fast movement, etc.
+
+    Position plpos(x, y);
+
+    plr->Relocate(plpos, true);
+}
+
+void Room::CommandMoveDirection(Player* plr, float angle)
+{
+    plr->SetMoveAngle(angle);
+
+    // broadcast packet about movement direction change
+    MoveDirectionPacket direction;
+    direction.playerId = plr->GetId();
+    direction.angle = angle;
+
+    GamePacket anglechange(MoveDirectionPacket::opcode);
+    direction.Encode(anglechange);
+
+    BroadcastPacketCellVisitor visitor(anglechange);
+    NearObjectVisibilityGridSearcher gs(this, &visitor, plr);
+
+    gs.Execute();
+}
+
+void Room::CommandPlayerExit(Player* plr)
+{
+    RemovePlayer(plr);
+    plr->GetSession()->SetConnectionState(CONNECTION_STATE_LOBBY);
+
+    // player exit packet was sent in RemovePlayer call, client exits room automatically
+}
+
+void Room::CommandStats(Player* plr)
+{
+    GamePacket stats(SP_STATS_RESPONSE);
+    BuildStatsBlock(stats);
+    sNetwork->SendPacket(plr->GetSession(), stats);
+}
+
+void Room::SendJoinResponse(Session* sess, uint8_t statusCode)
+{
+    JoinRoomResponsePacket response;
+    response.status = statusCode;
+    response.chatChannel = 0; // TODO: chat channels
+
+    GamePacket resp(JoinRoomResponsePacket::opcode);
+    response.Encode(resp);
+
+    sNetwork->SendPacket(sess, resp);
+}
+
+void Room::CommandPlayerJoin(Player* plr)
+{
+    // capacity checked by network worker may be used up by players, who asked sooner
+    if (!AddPlayer(plr))
+    {
+        plr->SetRoomId(0);
+        plr->GetSession()->SetConnectionState(CONNECTION_STATE_LOBBY);
+
+        SendJoinResponse(plr->GetSession(), STATUS_ROOMJOIN_FAILED_CAPACITY);
+        return;
+    }
+
+    SendJoinResponse(plr->GetSession(), STATUS_ROOMJOIN_OK);
+}
+
+void Room::CommandPlayerLeave(RoomCommand* cmd)
+{
+    Player* plr = cmd->player;
+
+    // join of player may have been refused
+    if (std::find(m_playerList.begin(), m_playerList.end(), plr) != m_playerList.end())
+        RemovePlayer(plr);
+
+    // nothing refers to the player anymore, so it could be destroyed along with its session
+    plr->GetSession()->GetWorker()->QueuePlayerRelease(cmd);
+}
+
 void Room::Update(uint32_t diff)
 {
-    // update all players
+    // packets sent during update are flushed together after the update ends
+    SendBatchGuard batch;
+    // and clients supporting snapshots get them in one packet
+    SnapshotGuard snapshot;
+
+    // players join and leave through command queue, so nobody else waits for the grid during update; lock
+    // it once for the whole update anyway, so nested grid searches just re-enter it
+    std::unique_lock<std::recursive_mutex> lock(cellMapLock, std::defer_lock);
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_LOCK_WAIT);
+        lock.lock();
+    }
+
+    // execute commands of players at first, so the update works with the most recent state
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_COMMANDS);
+        ProcessCommands();
+    }
+
+    // update all players; large rooms may use helper threads, if enabled
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_PLAYERS);
+
+        WorkStealingPool* pool = sRoomScheduler->GetStripePool();
+        if (pool && m_playerList.size() >= sRoomScheduler->GetParallelMinPlayers())
+            UpdatePlayersParallel(diff, pool);
+        else
+            UpdatePlayers(diff);
+    }
+
+    // eating is decided by server, not by clients
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_COLLISIONS);
+        DetectCollisions();
+    }
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_EATING);
+        ResolveEatEvents();
+    }
+
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_RESPAWN);
+
+        // check respawn queue
+        while (!m_respawnQueue.empty() && m_respawnQueue.top()->GetRespawnTime() <= time(nullptr))
+        {
+            WorldObject* toresp = m_respawnQueue.top();
+            m_respawnQueue.pop();
+
+            RespawnObject(toresp);
+        }
+
+        // check food respawn queue
+        while (!m_foodRespawnQueue.empty() && m_foodRespawnQueue.top().when <= time(nullptr))
+        {
+            uint32_t foodIndex = m_foodRespawnQueue.top().index;
+            m_foodRespawnQueue.pop();
+
+            RespawnFood(foodIndex);
+        }
+    }
+
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_SNAPSHOTS);
+        FinishSnapshots();
+    }
+
+    AccountPlayerTraffic(diff);
+}
+
+void Room::UpdatePlayers(uint32_t diff)
+{
     for (std::list<Player*>::iterator itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
         (*itr)->Update(diff);
+}
+
+void Room::UpdatePlayersParallel(uint32_t diff, WorkStealingPool* pool)
+{
+    size_t i, stripeCount, stripe;
+    uint32_t cellX, cellY;
+    Player* plr;
+
+    // use more stripes than threads, so the threads finishing early are able to steal the rest
+    stripeCount = std::min((size_t)(pool->GetThreadCount() + 1) * ROOM_STRIPES_PER_THREAD, (size_t)m_gridSizeX);
+
+    std::vector<PlayerStripe> stripes(stripeCount);
+    std::vector<MigrationList> migrations(stripeCount);
+    std::vector<PoolTaskFunction> tasks;
+
+    // sessions are updated here, as they are not safe to be touched from more threads; moving players
+    // are then sorted to stripes by grid column they stand in
+    for (std::list<Player*>::iterator itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
+    {
+        plr = *itr;
+
+        plr->GetSession()->Update(diff);
+
+        if (!plr->IsUpdateEnabled() || !plr->IsMoving() || plr->IsDead())
+            continue;
+
+        Position const& pos = plr->GetPosition();
+        Cell::GetCoordPairFor(pos.x, pos.y, cellX, cellY);
+
+        stripe = std::min((size_t)cellX * stripeCount / m_gridSizeX, stripeCount - 1);
+        stripes[stripe].push_back(plr);
+    }
 
-    // check respawn queue
-    while (!m_respawnQueue.empty() && m_respawnQueue.top()->GetRespawnTime() <= time(nullptr))
+    // 1) movement - every task touches just positions of its own players, grid remains unchanged
+    for (i = 0; i < stripeCount; i++)
     {
-        WorldObject* toresp = m_respawnQueue.top();
-        m_respawnQueue.pop();
+        if (!stripes[i].empty())
+            tasks.push_back(std::bind(&Room::MoveStripe, this, &stripes[i], &migrations[i], diff));
+    }
+
+    pool->RunBatch(tasks);
+
+    // 2) merge - cell migrations are applied in order of player IDs, so the result does not depend on scheduling
+    MigrationList merged;
+    for (i = 0; i < stripeCount; i++)
+        merged.insert(merged.end(), migrations[i].begin(), migrations[i].end());
+
+    std::sort(merged.begin(), merged.end(), PlayerMigrationComparator());
 
-        RespawnObject(toresp);
+    for (MigrationList::iterator itr = merged.begin(); itr != merged.end(); ++itr)
+        MigratePlayerCell(itr->player, itr->oldPos);
+
+    // 3) heartbeats - grid is read-only again, so the broadcast may be done in parallel
+    tasks.clear();
+    for (i = 0; i < stripeCount; i++)
+    {
+        if (!stripes[i].empty())
+            tasks.push_back(std::bind(&Room::HeartbeatStripe, this, &stripes[i]));
     }
+
+    pool->RunBatch(tasks);
 }
 
-void Room::Run()
+void Room::MoveStripe(PlayerStripe* stripe, MigrationList* migrations, uint32_t diff)
 {
-    uint32_t delay;
+    uint32_t cellX, cellY, cellXNew, cellYNew;
+    Position dest;
 
-    m_lastUpdateTime = getMSTime();
-    // sleep before first update
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (PlayerStripe::iterator itr = stripe->begin(); itr != stripe->end(); ++itr)
+    {
+        Position oldPos((*itr)->GetPosition());
 
-    m_emptyStateTime = 0;
+        if (!(*itr)->GetMoveDestination(diff, dest))
+            continue;
+
+        // just move, cell is changed later in merge phase; the room is not looked up, so stripes share no lock
+        (*itr)->MoveWithinMap(dest, m_sizeX, m_sizeY);
 
-    SetRunning(true);
+        Position const& pos = (*itr)->GetPosition();
+        Cell::GetCoordPairFor(oldPos.x, oldPos.y, cellX, cellY);
+        Cell::GetCoordPairFor(pos.x, pos.y, cellXNew, cellYNew);
 
-    while (IsRunning())
+        if (cellX != cellXNew || cellY != cellYNew)
+            migrations->push_back(PlayerMigration(*itr, oldPos));
+    }
+}
+
+void Room::HeartbeatStripe(PlayerStripe* stripe)
+{
+    // this thread has its own batch of packets to be flushed; snapshots are finished by room thread
+    SendBatchGuard batch;
+    SnapshotGuard snapshot;
+
+    for (PlayerStripe::iterator itr = stripe->begin(); itr != stripe->end(); ++itr)
+        SendMoveHeartbeat(*itr, false);
+}
+
+/* Computes distance of point from line segment */
+static float segmentPointDistance(Position const& a, Position const& b, Position const& p)
+{
+    float dx = b.x - a.x, dy = b.y - a.y;
+    float lenSq = dx*dx + dy*dy;
+    float t = 0.0f;
+
+    // project the point to segment, and clamp the projection to its ends
+    if (lenSq > 0.0f)
+        t = std::min(std::max(((p.x - a.x)*dx + (p.y - a.y)*dy) / lenSq, 0.0f), 1.0f);
+
+    return p.DistanceExact(Position(a.x + t*dx, a.y + t*dy));
+}
+
+void Room::DetectCollisions()
+{
+    std::list<Player*>::iterator itr;
+
+    // do not check the path of teleported players (respawn, position correction from client, ...)
+    for (itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
+    {
+        if ((*itr)->GetLastCollisionPosition().DistanceExact((*itr)->GetPosition()) > COLLISION_MAX_SWEEP)
+            (*itr)->SetLastCollisionPosition((*itr)->GetPosition());
+    }
+
+    // players are checked in order of joining, so the earlier one wins, when more of them touch the same food
+    for (itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
+    {
+        if (!(*itr)->IsUpdateEnabled() || (*itr)->IsDead())
+            continue;
+
+        CollectFoodCollisions(*itr);
+        CollectPlayerCollisions(*itr);
+    }
+
+    // next check continues, where this one ended
+    for (itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
+        (*itr)->SetLastCollisionPosition((*itr)->GetPosition());
+}
+
+void Room::GetCellRange(Position const& from, Position const& to, float radius, uint32_t &x1, uint32_t &x2, uint32_t &y1, uint32_t &y2)
+{
+    // broad phase - only cells touched by bounding box of the whole movement are checked
+    Cell::GetCoordPairFor(std::max(std::min(from.x, to.x) - radius, 0.0f), std::max(std::min(from.y, to.y) - radius, 0.0f), x1, y1);
+    Cell::GetCoordPairFor(std::max(from.x, to.x) + radius, std::max(from.y, to.y) + radius, x2, y2);
+
+    x2 = std::min(x2, m_gridSizeX - 1);
+    y2 = std::min(y2, m_gridSizeY - 1);
+}
+
+void Room::CollectFoodCollisions(Player* plr)
+{
+    uint32_t x1, x2, y1, y2, i;
+    Position const& from = plr->GetLastCollisionPosition();
+    Position const& to = plr->GetPosition();
+
+    float reach = plr->GetCollisionRadius() + PLAYER_SIZE_CALC_COEF*FOOD_COLLISION_SIZE;
+
+    GetCellRange(from, to, reach, x1, x2, y1, y2);
+
+    // food is generated column by column, so the food of cells in one column occupies continuous range of indexes,
+    // which is searched at once
+    for (i = x1; i <= x2; i++)
+    {
+        // narrow phase - the whole path since last check is tested, as the player moves further than its radius
+        // during one tick, and would otherwise jump over food
+        m_collidingFood.clear();
+        m_food.FindColliding(GetCell(i, y1)->foodBegin, GetCell(i, y2)->foodEnd, from, to, reach, m_collidingFood);
+
+        for (std::vector<uint32_t>::iterator itr = m_collidingFood.begin(); itr != m_collidingFood.end(); ++itr)
+            m_eatEvents.push_back(EatEvent(plr, *itr));
+    }
+}
+
+void Room::CollectPlayerCollisions(Player* plr)
+{
+    uint32_t x1, x2, y1, y2, i, j;
+    Cell* cell;
+    Player* target;
+    Position const& from = plr->GetLastCollisionPosition();
+    Position const& to = plr->GetPosition();
+
+    // only smaller players may be eaten, so the sum of radii can't exceed the double of this player radius; the target
+    // may have moved too, at most by the teleport distance
+    GetCellRange(from, to, 2 * plr->GetCollisionRadius() + COLLISION_MAX_SWEEP, x1, x2, y1, y2);
+
+    for (i = x1; i <= x2; i++)
     {
-        // end empty nondefault room after a while
-        if (!m_isDefault && m_emptyStateTime && getMSTimeDiff(m_emptyStateTime, getMSTime()) >= ROOM_EMPTY_SHUTDOWN * 1000)
+        for (j = y1; j <= y2; j++)
         {
-            SetRunning(false);
-            sGameplay->DestroyRoom(m_id);
-            break;
+            cell = GetCell(i, j);
+
+            for (std::vector<Player*>::iterator itr = cell->playerList.begin(); itr != cell->playerList.end(); ++itr)
+            {
+                target = *itr;
+
+                if (target == plr || target->IsDead() || !target->IsUpdateEnabled() || target->GetSize() >= plr->GetSize())
+                    continue;
+
+                // both players move, so test the movement of this player relative to the target
+                Position const& targetFrom = target->GetLastCollisionPosition();
+                Position const& targetTo = target->GetPosition();
+
+                if (segmentPointDistance(Position(from.x - targetFrom.x, from.y - targetFrom.y), Position(to.x - targetTo.x, to.y - targetTo.y),
+                    Position()) < plr->GetCollisionRadius() + target->GetCollisionRadius())
+                    m_eatEvents.push_back(EatEvent(plr, target));
+            }
         }
+    }
+}
+
+void Room::ResolveEatEvents()
+{
+    for (std::vector<EatEvent>::iterator itr = m_eatEvents.begin(); itr != m_eatEvents.end(); ++itr)
+    {
+        // the eater may have been eaten meanwhile
+        if (itr->eater->IsDead())
+            continue;
 
-        // when room is empty, set timestamp
-        if (!m_isDefault)
+        if (itr->victim)
         {
-            if (m_emptyStateTime == 0 && m_playerList.empty())
-                m_emptyStateTime = getMSTime();
+            // the victim may have been eaten by someone else, or may have grown meanwhile
+            if (itr->victim->IsDead() || itr->victim->GetSize() >= itr->eater->GetSize())
+                continue;
 
-            if (m_emptyStateTime != 0 && !m_playerList.empty())
-                m_emptyStateTime = 0;
+            EatObject(itr->eater, itr->victim);
         }
+        else
+        {
+            // food may have been eaten by someone else
+            if (!m_food.IsAlive(itr->foodIndex))
+                continue;
 
-        delay = getMSTimeDiff(m_lastUpdateTime, getMSTime());
+            EatFood(itr->eater, itr->foodIndex);
+        }
+    }
 
-        Update(delay);
+    m_eatEvents.clear();
+}
+
+bool Room::Tick()
+{
+    uint32_t delay;
+
+    // end empty nondefault room after a while; the room is released by everyone who holds it, so players
+    // may only be kept out of it
+    if (!m_isDefault && m_emptyStateTime && getMSTimeDiff(m_emptyStateTime, getMSTime()) >= ROOM_EMPTY_SHUTDOWN * 1000)
+    {
+        if (Close())
+        {
+            sGameplay->DestroyRoom(m_id);
+            return false;
+        }
+
+        // somebody joined at the last moment
+        m_emptyStateTime = 0;
+    }
+
+    // when room is empty, set timestamp
+    if (!m_isDefault)
+    {
+        if (m_emptyStateTime == 0 && m_playerList.empty())
+            m_emptyStateTime = getMSTime();
 
-        m_lastUpdateTime = getMSTime();
+        if (m_emptyStateTime != 0 && !m_playerList.empty())
+            m_emptyStateTime = 0;
+    }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    delay = getMSTimeDiff(m_lastUpdateTime, getMSTime());
+
+    {
+        RoomPhaseTimer timer(m_profiler, ROOM_PHASE_TOTAL);
+        Update(delay);
     }
+
+    m_profiler.EndTick();
+
+    m_lastUpdateTime = getMSTime();
+
+    return true;
+}
+
+uint32_t Room::GetTickInterval()
+{
+    return m_tickInterval;
+}
+
+void Room::SetTickInterval(uint32_t interval)
+{
+    m_tickInterval = interval;
+}
+
+void Room::GetTickStats(RoomTickStats& stats)
+{
+    std::unique_lock<std::mutex> lck(tickstats_mtx);
+
+    stats = m_tickStats;
+}
+
+void Room::RecordTick(uint32_t duration, uint32_t lag, bool overrun)
+{
+    std::unique_lock<std::mutex> lck(tickstats_mtx);
+
+    m_tickStats.tickCount++;
+    m_tickStats.lastTickTime = duration;
+    if (duration > m_tickStats.maxTickTime)
+        m_tickStats.maxTickTime = duration;
+    if (lag > m_tickStats.maxLag)
+        m_tickStats.maxLag = lag;
+    if (overrun)
+        m_tickStats.overrunCount++;
+}
+
+RoomProfiler& Room::GetProfiler()
+{
+    return m_profiler;
 }
 
 void Room::BroadcastPacket(GamePacket& pkt)
 {
+    WireFramePtr frame = pkt.GetWireFrame();
+
     for (std::list<Player*>::iterator itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
-        sNetwork->SendPacket((*itr)->GetSession(), pkt);
+        sNetwork->SendFrame((*itr)->GetSession(), frame);
 }
 
 void Cell::BroadcastPacket(GamePacket& pkt)
 {
-    for (std::list<Player*>::iterator itr = playerList.begin(); itr != playerList.end(); ++itr)
-        sNetwork->SendPacket((*itr)->GetSession(), pkt);
+    WireFramePtr frame = pkt.GetWireFrame();
+
+    for (std::vector<Player*>::iterator itr = playerList.begin(); itr != playerList.end(); ++itr)
+        sNetwork->SendFrame((*itr)->GetSession(), frame);
 }
 
-void Room::BroadcastPacketToNearCells(GamePacket& pkt, uint32_t centerCellX, uint32_t centerCellY)
+void Room::BroadcastPacketToNearCells(GamePacket& pkt, uint32_t centerCellX, uint32_t centerCellY, GamePacket* compactPkt)
 {
-    BroadcastPacketCellVisitor visitor(pkt);
+    BroadcastPacketCellVisitor visitor(pkt, compactPkt);
     NearVisibilityGridSearcher gs(this, &visitor, centerCellX, centerCellY);
 
     gs.Execute();
 }
 
-void Room::AddPlayer(Player* player)
+bool Room::AddPlayer(Player* player)
 {
-    if (m_playerList.size() >= m_capacity)
-        return;
+    std::unique_lock<std::recursive_mutex> lock(cellMapLock);
+
+    if (m_isClosed || m_playerList.size() >= m_capacity)
+        return false;
 
     m_playerList.push_back(player);
+    // player re-logged from another session replaces its former instance, which is about to leave
+    m_playerIndex[player->GetId()] = player;
+    m_playerCount = (uint32_t)m_playerList.size();
     player->SetRoomId(m_id);
 
+    // traffic from lobby does not belong to room
+    player->GetSession()->TakeQueuedBytesCount();
+
     BroadcastStats();
+
+    return true;
 }
 
 void Room::RemovePlayerFromGrid(Player* player)
@@ -214,25 +903,36 @@ void Room::RemovePlayerFromGrid(Player* player)
 
     Cell::GetCoordPairFor(pos.x, pos.y, cellX, cellY);
     // remove player from cellmap
-    if (cellX < m_cellMap.size() && cellY < m_cellMap[0].size())
-        m_cellMap[cellX][cellY]->playerList.remove(player);
+    Cell* cell = GetCell(cellX, cellY);
+    if (cell)
+        cell->RemovePlayer(player);
 }
 
 void Room::RemovePlayer(Player* player)
 {
+    std::unique_lock<std::recursive_mutex> lock(cellMapLock);
+
     RemovePlayerFromGrid(player);
 
     // remove player from room
     for (std::list<Player*>::iterator itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
     {
-        if ((*itr)->GetId() == player->GetId())
+        if (*itr == player)
         {
             player->SetRoomId(0);
             m_playerList.erase(itr);
+            // leave index to the newer instance of player, if there's any
+            std::unordered_map<uint32_t, Player*>::iterator idxItr = m_playerIndex.find(player->GetId());
+            if (idxItr != m_playerIndex.end() && idxItr->second == player)
+                m_playerIndex.erase(idxItr);
+            m_playerCount = (uint32_t)m_playerList.size();
             break;
         }
     }
 
+    // room won't finish snapshot of player anymore
+    sNetwork->FinishSnapshot(player->GetSession());
+
     // move player back to lobby
     player->GetSession()->SetConnectionState(CONNECTION_STATE_LOBBY);
 
@@ -252,19 +952,22 @@ void Room::PlaceNewPlayer(Player* player)
 
     Position npos(m_sizeX * positionRandomizer(positionRandomizerEngine), m_sizeY * positionRandomizer(positionRandomizerEngine));
     player->Relocate(npos, false);
+    player->SetLastCollisionPosition(npos);
 
     uint32_t cellX, cellY;
 
     Cell::GetCoordPairFor(npos.x, npos.y, cellX, cellY);
 
     // add to cell map
-    m_cellMap[cellX][cellY]->playerList.push_back(player);
+    GetCell(cellX, cellY)->AddPlayer(player);
 
     if (!m_playerList.empty())
     {
         GamePacket createPacket(SP_NEW_PLAYER);
         player->BuildCreatePacketBlock(createPacket);
-        BroadcastPacketToNearCells(createPacket, cellX, cellY);
+        GamePacket compactCreatePacket(SP_NEW_PLAYER);
+        player->BuildCompactCreatePacketBlock(compactCreatePacket);
+        BroadcastPacketToNearCells(createPacket, cellX, cellY, &compactCreatePacket);
     }
 }
 
@@ -278,20 +981,23 @@ void Room::AddWorldObject(WorldObject* wobj)
     Position const& pos = wobj->GetPosition();
 
     Cell::GetCoordPairFor(pos.x, pos.y, cellX, cellY);
-    if (cellX >= m_cellMap.size() || cellY >= m_cellMap[0].size())
+    Cell* cell = GetCell(cellX, cellY);
+    if (!cell)
         return;
 
     m_objectSet.insert(wobj);
 
     // add to grid
-    m_cellMap[cellX][cellY]->objectList.push_back(wobj);
+    cell->AddObject(wobj);
 
     // broadcast to cell and its neighbors, that we have a new object
     if (!m_playerList.empty())
     {
         GamePacket createPacket(SP_NEW_OBJECT);
         wobj->BuildCreatePacketBlock(createPacket);
-        BroadcastPacketToNearCells(createPacket, cellX, cellY);
+        GamePacket compactCreatePacket(SP_NEW_OBJECT);
+        wobj->BuildCompactCreatePacketBlock(compactCreatePacket);
+        BroadcastPacketToNearCells(createPacket, cellX, cellY, &compactCreatePacket);
     }
 }
 
@@ -312,10 +1018,11 @@ void Room::_RemoveWorldObject(WorldObject* wobj)
     Position const& pos = wobj->GetPosition();
 
     Cell::GetCoordPairFor(pos.x, pos.y, cellX, cellY);
-    if (cellX >= m_cellMap.size() || cellY >= m_cellMap[0].size())
+    Cell* cell = GetCell(cellX, cellY);
+    if (!cell)
         return;
 
-    m_cellMap[cellX][cellY]->objectList.remove(wobj);
+    cell->RemoveObject(wobj);
 
     GamePacket remPacket(SP_DESTROY_OBJECT);
     remPacket.WriteUInt32(wobj->GetId());
@@ -334,9 +1041,20 @@ void Room::RelocateWorldObject(WorldObject* wobj, Position &oldpos)
 }
 
 void Room::RelocatePlayer(Player* wobj, Position &oldpos)
+{
+    if (!MigratePlayerCell(wobj, oldpos))
+        return;
+
+    // if the player is moving, send move heartbeat
+    //if (wobj->IsMoving())
+    // actually it does not have to move at all, this will broadcast position change to player sorroundings
+    // regardless of move state
+    SendMoveHeartbeat(wobj);
+}
+
+bool Room::MigratePlayerCell(Player* wobj, Position &oldpos)
 {
     uint32_t cellX, cellY, cellXNew, cellYNew;
-    uint16_t sizePos;
     Position const& pos = wobj->GetPosition();
 
     // retrieve old and new cell coords
@@ -346,19 +1064,21 @@ void Room::RelocatePlayer(Player* wobj, Position &oldpos)
     // if relocation between cells is needed, proceed
     if (cellX != cellXNew || cellY != cellYNew)
     {
-        if (cellX >= m_cellMap.size() || cellY >= m_cellMap[0].size())
-            return;
-        if (cellXNew >= m_cellMap.size() || cellYNew >= m_cellMap[0].size())
-            return;
+        Cell* oldCell = GetCell(cellX, cellY);
+        Cell* newCell = GetCell(cellXNew, cellYNew);
+        if (!oldCell || !newCell)
+            return false;
 
-        m_cellMap[cellX][cellY]->playerList.remove(wobj);
-        m_cellMap[cellXNew][cellYNew]->playerList.push_back(wobj);
+        oldCell->RemovePlayer(wobj);
+        newCell->AddPlayer(wobj);
 
         // At first, let others know about moved player
 
-        // prepare creation packet
+        // prepare creation packet, in both encodings
         GamePacket createPacket(SP_NEW_PLAYER);
         wobj->BuildCreatePacketBlock(createPacket);
+        GamePacket compactCreatePacket(SP_NEW_PLAYER);
+        wobj->BuildCompactCreatePacketBlock(compactCreatePacket);
 
         // prepare destruction packet
         GamePacket deletePacket(SP_DESTROY_OBJECT);
@@ -367,113 +1087,108 @@ void Room::RelocatePlayer(Player* wobj, Position &oldpos)
         deletePacket.WriteUInt8(0); // "reason" - we don't use that for now, maybe in future to show i.e. some animation, etc.
 
         // create multiplexed broadcast packet visitor to send destroy packets to old area and create packets to new area
-        MultiplexBroadcastPacketCellVisitor mpbc(createPacket, deletePacket);
+        MultiplexBroadcastPacketCellVisitor mpbc(createPacket, deletePacket, &compactCreatePacket);
         // this grid searcher will also check for overlappings, so when "new" and "old" area overlaps, no packet is sent to that area
         VisibilityChangeGridSearcher vsearch(this, &mpbc, cellX, cellY, cellXNew, cellYNew);
 
         vsearch.Execute();
 
-        // Next, let player know about newly discovered sorroundings
+        // Next, let player forget food left out of sight, so its client does not have to keep it; all of it goes
+        // in one packet, clients not supporting that keep the food as they always did
 
-        GamePacket discoveryPacket(SP_UPDATE_WORLD);
+        if (wobj->GetSession()->HasClientFlag(CLIENT_FLAG_BATCHED_DESTROY))
+        {
+            KnownFoodDestroyCellVisitor fdvisitor(wobj, m_food);
+            VisibilityChangeGridSearcher fd_vsearch(this, &fdvisitor, cellX, cellY, cellXNew, cellYNew);
 
-        // store position, where we will write object count later
-        sizePos = discoveryPacket.GetWritePos();
-        // for now, write dummy value - zero
-        discoveryPacket.WriteUInt32(0);
+            fd_vsearch.Execute();
+            fdvisitor.Finish();
+        }
 
-        AllPlayerCreateCellVisitor plrvisitor(discoveryPacket);
-        CellDiscoveryGridSearcher plr_cdsearch(this, &plrvisitor, cellX, cellY, cellXNew, cellYNew);
+        // Then let player know about newly discovered sorroundings
 
-        plr_cdsearch.Execute();
+        WorldUpdateBuilder discovery(wobj, wobj->GetSession()->HasClientFlag(CLIENT_FLAG_COMPACT_ENCODING));
 
-        // overwrite zero value with valid count
-        discoveryPacket.WriteUInt32At(plrvisitor.GetCounter(), sizePos);
+        AllPlayerCreateCellVisitor plrvisitor(discovery);
+        CellDiscoveryGridSearcher plr_cdsearch(this, &plrvisitor, cellX, cellY, cellXNew, cellYNew);
 
-        // store position, where we will write object count later
-        sizePos = discoveryPacket.GetWritePos();
-        // for now, write dummy value - zero
-        discoveryPacket.WriteUInt32(0);
+        plr_cdsearch.Execute();
 
-        AllObjectCreateCellVisitor objvisitor(discoveryPacket);
+        // food the client already knows (i.e. created while the player stood nearby) is not sent again
+        AllObjectCreateCellVisitor objvisitor(discovery, m_food, &wobj->GetKnownFood());
         CellDiscoveryGridSearcher obj_cdsearch(this, &objvisitor, cellX, cellY, cellXNew, cellYNew);
 
         obj_cdsearch.Execute();
 
-        // overwrite zero value with valid count
-        discoveryPacket.WriteUInt32At(objvisitor.GetCounter(), sizePos);
-
-        sNetwork->SendPacket(wobj->GetSession(), discoveryPacket);
+        // nothing is sent, if there's nothing new around
+        discovery.Finish();
     }
 
-    // if the player is moving, send move heartbeat
-    //if (wobj->IsMoving())
-    // actually it does not have to move at all, this will broadcast position change to player sorroundings
-    // regardless of move state
-    {
-        GamePacket heartbeat(SP_MOVE_HEARTBEAT);
-        heartbeat.WriteUInt32(wobj->GetId());
-        heartbeat.WriteFloat(pos.x);
-        heartbeat.WriteFloat(pos.y);
+    return true;
+}
 
-        BroadcastPacketCellVisitor visitor(heartbeat);
-        NearObjectVisibilityGridSearcher gs(this, &visitor, wobj);
+void Room::SendMoveHeartbeat(Player* wobj, bool lockGrid)
+{
+    Position const& pos = wobj->GetPosition();
 
-        gs.Execute();
-    }
+    MoveHeartbeatPacket movement;
+    movement.playerId = wobj->GetId();
+    movement.posX = pos.x;
+    movement.posY = pos.y;
+
+    GamePacket heartbeat(MoveHeartbeatPacket::opcode);
+    movement.Encode(heartbeat);
+
+    GamePacket compactHeartbeat(SP_MOVE_HEARTBEAT);
+    compactHeartbeat.WriteVarUInt(wobj->GetId());
+    Cell::WriteCompactPosition(compactHeartbeat, pos.x, pos.y);
+
+    BroadcastPacketCellVisitor visitor(heartbeat, &compactHeartbeat);
+    NearObjectVisibilityGridSearcher gs(this, &visitor, wobj, lockGrid);
+
+    gs.Execute();
 }
 
 size_t Room::GetGridSizeX()
 {
-    return m_cellMap.size();
+    return m_gridSizeX;
 }
 
 size_t Room::GetGridSizeY()
 {
-    return m_cellMap.size() > 0 ? m_cellMap[0].size() : 0;
+    return m_gridSizeY;
 }
 
 Cell* Room::GetCell(uint32_t x, uint32_t y)
 {
-    if (x >= m_cellMap.size())
+    if (x >= m_gridSizeX)
         return nullptr;
 
-    if (y >= m_cellMap[x].size())
+    if (y >= m_gridSizeY)
         return nullptr;
 
-    return m_cellMap[x][y];
+    return &m_cellMap[x * m_gridSizeY + y];
 }
 
-void Room::BuildObjectCreateBlock(GamePacket& pkt, Player* plr)
+FoodStore& Room::GetFoodStore()
 {
-    // store position, where we will write object count later
-    uint16_t sizePos = pkt.GetWritePos();
-    // for now, write dummy value - zero
-    pkt.WriteUInt32(0);
+    return m_food;
+}
 
-    AllObjectCreateCellVisitor visitor(pkt);
+void Room::BuildObjectCreateBlock(WorldUpdateBuilder& builder, Player* plr)
+{
+    AllObjectCreateCellVisitor visitor(builder, m_food, &plr->GetKnownFood());
     NearObjectVisibilityGridSearcher gs(this, &visitor, plr);
 
     gs.Execute();
-
-    // overwrite zero value with valid count
-    pkt.WriteUInt32At(visitor.GetCounter(), sizePos);
 }
 
-void Room::BuildPlayerCreateBlock(GamePacket& pkt, Player* plr)
+void Room::BuildPlayerCreateBlock(WorldUpdateBuilder& builder, Player* plr)
 {
-    // store position, where we will write object count later
-    uint16_t sizePos = pkt.GetWritePos();
-    // for now, write dummy value - zero
-    pkt.WriteUInt32(0);
-
-    AllPlayerCreateCellVisitor visitor(pkt);
+    AllPlayerCreateCellVisitor visitor(builder);
     NearObjectVisibilityGridSearcher gs(this, &visitor, plr);
 
     gs.Execute();
-
-    // overwrite zero value with valid count
-    pkt.WriteUInt32At(visitor.GetCounter(), sizePos);
 }
 
 void Room::BuildStatsBlock(GamePacket& pkt)
@@ -510,7 +1225,7 @@ uint32_t Room::GetGameType()
 
 uint32_t Room::GetPlayerCount()
 {
-    return m_playerList.size();
+    return m_playerCount;
 }
 
 uint32_t Room::GetCapacity()
@@ -525,23 +1240,25 @@ void Room::ClearAllObjects()
         _RemoveWorldObject(*itr);
 
     m_objectSet.clear();
-}
 
-template <class T>
-T* Room::CreateRoomObject(float x, float y)
-{
-    if (!std::is_base_of<WorldObject, T>::value)
-        return nullptr;
-
-    T* obj = new T();
+    // let players know about disappearing food too
+    if (!m_playerList.empty())
+    {
+        for (uint32_t i = 0; i < m_food.GetCount(); i++)
+        {
+            if (m_food.IsAlive(i))
+                SendFoodDestroy(i);
+        }
+    }
 
-    obj->SetId(++m_lastObjectId);
-    obj->SetRoomId(GetId());
-    Position objpos(x, y);
-    obj->Relocate(objpos, false);
-    AddWorldObject(obj);
+    m_food.Clear();
+    m_foodRespawnQueue = std::priority_queue<FoodRespawn, std::vector<FoodRespawn>, FoodRespawnComparator>();
 
-    return obj;
+    for (CellMap::iterator itr = m_cellMap.begin(); itr != m_cellMap.end(); ++itr)
+    {
+        itr->foodBegin = 0;
+        itr->foodEnd = 0;
+    }
 }
 
 void Room::GenerateRandomContent()
@@ -552,7 +1269,11 @@ void Room::GenerateRandomContent()
 
     ClearAllObjects();
 
-    for (i = 0; i < m_cellMap.size(); i++)
+    // all food is allocated at once, and gets IDs in the same order it's stored
+    m_food.Reserve(m_gridSizeX * m_gridSizeY * FOOD_PER_CELL);
+    m_food.SetFirstId(m_lastObjectId + 1);
+
+    for (i = 0; i < m_gridSizeX; i++)
     {
         // calculate horizontal bounds
         lbound = (i*CELL_SIZE_X);
@@ -562,7 +1283,7 @@ void Room::GenerateRandomContent()
         if (rbound > m_sizeX)
             rbound = m_sizeX;
 
-        for (j = 0; j < m_cellMap[i].size(); j++)
+        for (j = 0; j < m_gridSizeY; j++)
         {
             // calculate vertical bounds
             ubound = (j*CELL_SIZE_Y);
@@ -572,19 +1293,26 @@ void Room::GenerateRandomContent()
             if (bbound > m_sizeY)
                 bbound = m_sizeY;
 
+            Cell* cell = GetCell(i, j);
+            cell->foodBegin = m_food.GetCount();
+
             // let's say we have 20 eatable food in one cell
-            for (k = 0; k < 20; k++)
-                CreateRoomObject<IdleFoodEntity>(lbound + positionRandomizer(positionRandomizerEngine)*(rbound - lbound), ubound + positionRandomizer(positionRandomizerEngine)*(bbound - ubound));
+            for (k = 0; k < FOOD_IDLE_PER_CELL; k++)
+                m_food.Add(lbound + positionRandomizer(positionRandomizerEngine)*(rbound - lbound), ubound + positionRandomizer(positionRandomizerEngine)*(bbound - ubound), OBJECT_TYPE_IDLEFOOD);
 
             // and 1 bonus
-            for (k = 0; k < 1; k++)
-                CreateRoomObject<BonusFoodEntity>(lbound + positionRandomizer(positionRandomizerEngine)*(rbound - lbound), ubound + positionRandomizer(positionRandomizerEngine)*(bbound - ubound));
+            for (k = 0; k < FOOD_BONUS_PER_CELL; k++)
+                m_food.Add(lbound + positionRandomizer(positionRandomizerEngine)*(rbound - lbound), ubound + positionRandomizer(positionRandomizerEngine)*(bbound - ubound), OBJECT_TYPE_BONUSFOOD);
 
             // and 1 trap
-            for (k = 0; k < 1; k++)
-                CreateRoomObject<TrapEntity>(lbound + positionRandomizer(positionRandomizerEngine)*(rbound - lbound), ubound + positionRandomizer(positionRandomizerEngine)*(bbound - ubound));
+            for (k = 0; k < FOOD_TRAP_PER_CELL; k++)
+                m_food.Add(lbound + positionRandomizer(positionRandomizerEngine)*(rbound - lbound), ubound + positionRandomizer(positionRandomizerEngine)*(bbound - ubound), OBJECT_TYPE_TRAP);
+
+            cell->foodEnd = m_food.GetCount();
         }
     }
+
+    m_lastObjectId += m_food.GetCount();
 }
 
 void Room::EatObject(Player* plr, WorldObject* obj)
@@ -603,15 +1331,7 @@ void Room::EatObject(Player* plr, WorldObject* obj)
         modSize = (uint32_t)(((Player*)obj)->GetSize() * 0.66f);
     }
 
-    // At some point, the player stops gaining size
-    if (plr->GetSize() >= PLAYER_STOP_INCOME_SIZE)
-        modSize = 0;
-    // from certain point, player will gain only half of bonus to size
-    else if (plr->GetSize() >= PLAYER_REDUCE_INCOME_SIZE)
-        modSize = modSize / 2;
-
-    gp.WriteInt32(modSize);
-    plr->ModifySize(modSize);
+    gp.WriteInt32(ApplySizeIncome(plr, modSize));
 
     BroadcastPacketCellVisitor visitor(gp);
     NearObjectVisibilityGridSearcher gs(this, &visitor, obj);
@@ -632,48 +1352,126 @@ void Room::EatObject(Player* plr, WorldObject* obj)
     }
 }
 
-void Room::QueueWorldObjectForRespawn(WorldObject* obj, uint32_t respawnDelay)
+void Room::EatFood(Player* plr, uint32_t foodIndex)
 {
-    obj->SetRespawnTime(time(nullptr) + respawnDelay);
+    uint32_t cellX, cellY;
 
-    m_respawnQueue.push(obj);
+    GamePacket gp(SP_OBJECT_EATEN, 3 * 4);
+    gp.WriteUInt32(m_food.GetId(foodIndex));
+    gp.WriteUInt32(plr->GetId());
+
+    int32_t modSize = 0;
+
+    if (m_food.GetType(foodIndex) == OBJECT_TYPE_IDLEFOOD)
+        modSize = +2; // dummy value for now
+
+    gp.WriteInt32(ApplySizeIncome(plr, modSize));
+
+    Cell::GetCoordPairFor(m_food.GetX(foodIndex), m_food.GetY(foodIndex), cellX, cellY);
+    BroadcastPacketToNearCells(gp, cellX, cellY);
+
+    sLog->Debug("Player %u ate object %u", plr->GetId(), m_food.GetId(foodIndex));
+
+    // food stays in store, it's just hidden until respawn
+    m_food.SetAlive(foodIndex, false);
+
+    SendFoodDestroy(foodIndex);
+
+    QueueFoodForRespawn(foodIndex);
 }
 
-void Room::RespawnObject(WorldObject* wobj)
+void Room::SendFoodDestroy(uint32_t foodIndex)
 {
-    wobj->SetRespawnTime(0);
-    AddWorldObject(wobj);
+    GamePacket remPacket(SP_DESTROY_OBJECT);
+    remPacket.WriteUInt32(m_food.GetId(foodIndex));
+    remPacket.WriteUInt8(PACKET_OBJECT_TYPE_WORLDOBJECT);
+    remPacket.WriteUInt8(0); // "reason" - we don't use this at the moment, maybe in future
+
+    WireFramePtr frame = remPacket.GetWireFrame();
+
+    // only players knowing the food are told; clients without batched destroy may know it from far away
+    for (std::list<Player*>::iterator itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
+    {
+        if (!(*itr)->GetKnownFood().IsKnown(foodIndex))
+            continue;
+
+        (*itr)->GetKnownFood().SetUnknown(foodIndex);
+        sNetwork->SendFrame((*itr)->GetSession(), frame);
+    }
 }
 
-WorldObject* Room::GetManhattanClosestObject(WorldObject* source)
+void Room::FinishSnapshots()
 {
-    uint32_t sourceSize = 2;
-    if (source->GetTypeId() == OBJECT_TYPE_PLAYER)
-        sourceSize = ((Player*)source)->GetSize();
+    for (std::list<Player*>::iterator itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
+        sNetwork->FinishSnapshot((*itr)->GetSession());
+}
 
-    ManhattanClosestCellVisitor visitor(source->GetPosition(), sourceSize, source);
-    NearObjectVisibilityGridSearcher gs(this, &visitor, source);
+void Room::AccountPlayerTraffic(uint32_t diff)
+{
+    uint64_t sentBytes = 0;
 
-    gs.Execute();
+    for (std::list<Player*>::iterator itr = m_playerList.begin(); itr != m_playerList.end(); ++itr)
+        sentBytes += (*itr)->GetSession()->TakeQueuedBytesCount();
+
+    std::unique_lock<std::mutex> lck(tickstats_mtx);
+
+    m_tickStats.sentBytes += sentBytes;
+    m_tickStats.playerTime += (uint64_t)m_playerList.size() * diff;
+}
+
+int32_t Room::ApplySizeIncome(Player* plr, int32_t modSize)
+{
+    // At some point, the player stops gaining size
+    if (plr->GetSize() >= PLAYER_STOP_INCOME_SIZE)
+        modSize = 0;
+    // from certain point, player will gain only half of bonus to size
+    else if (plr->GetSize() >= PLAYER_REDUCE_INCOME_SIZE)
+        modSize = modSize / 2;
+
+    plr->ModifySize(modSize);
 
-    return visitor.GetFoundObject();
+    return modSize;
 }
 
-void Room::SetRunning(bool state)
+void Room::QueueWorldObjectForRespawn(WorldObject* obj, uint32_t respawnDelay)
 {
-    std::unique_lock<std::mutex> lck(generic_mtx);
+    obj->SetRespawnTime(time(nullptr) + respawnDelay);
 
-    m_isRunning = state;
+    m_respawnQueue.push(obj);
 }
 
-bool Room::IsRunning()
+void Room::RespawnObject(WorldObject* wobj)
 {
-    std::unique_lock<std::mutex> lck(generic_mtx);
+    wobj->SetRespawnTime(0);
+    AddWorldObject(wobj);
+}
 
-    return m_isRunning;
+void Room::QueueFoodForRespawn(uint32_t foodIndex, uint32_t respawnDelay)
+{
+    m_foodRespawnQueue.push(FoodRespawn(time(nullptr) + respawnDelay, foodIndex));
 }
 
-void Room::WaitForShutdown()
+void Room::RespawnFood(uint32_t foodIndex)
 {
-    m_updateThread->join();
+    uint32_t cellX, cellY;
+
+    m_food.SetAlive(foodIndex, true);
+
+    // broadcast to cell and its neighbors, that we have a new object
+    if (!m_playerList.empty())
+    {
+        Cell::GetCoordPairFor(m_food.GetX(foodIndex), m_food.GetY(foodIndex), cellX, cellY);
+
+        GamePacket createPacket(SP_NEW_OBJECT);
+        m_food.BuildCreatePacketBlock(foodIndex, createPacket);
+        GamePacket compactCreatePacket(SP_NEW_OBJECT);
+        m_food.BuildCompactCreatePacketBlock(foodIndex, compactCreatePacket);
+
+        // players further away will get it, when they come closer
+        FoodCreateCellVisitor visitor(createPacket, foodIndex, &compactCreatePacket);
+        NearVisibilityGridSearcher gs(this, &visitor, cellX, cellY);
+
+        gs.Execute();
+    }
 }
+
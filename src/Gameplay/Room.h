@@ -2,17 +2,31 @@
 #define AGAR_ROOM_H
 
 #include "Network.h"
+#include "PacketBufferPool.h"
+#include "MPSCQueue.h"
+#include "WorkStealingPool.h"
+#include "WorldObject.h"
+#include "FoodStore.h"
+#include "WorldUpdateBuilder.h"
+#include "RoomProfiler.h"
 
 #include <set>
 #include <functional>
 #include <queue>
+#include <unordered_map>
 
 #define CELL_SIZE_X 10.0f
 #define CELL_SIZE_Y 10.0f
 
+/* count of steps of position within cell in compact encoding (16bit offset) */
+#define COMPACT_OFFSET_STEPS 65535.0f
+
 /* 2 cells to left and 2 to right will be visible */
 #define CELL_VISIBILITY_OFFSET 2
 
+/* longer movement between two collision checks is considered a teleport, and its path is not checked */
+#define COLLISION_MAX_SWEEP 10.0f
+
 /* default map width */
 #define MAP_DEFAULT_SIZE 500.0f
 
@@ -22,24 +36,140 @@
 /* number of seconds before room is shut down when empty */
 #define ROOM_EMPTY_SHUTDOWN 60
 
-class WorldObject;
-struct Position;
+/* count of grid stripes per thread in parallel room update */
+#define ROOM_STRIPES_PER_THREAD 2
 
 struct Cell
 {
-    Cell(uint32_t x, uint32_t y) : coordX(x), coordY(y) { };
+    Cell(uint32_t x, uint32_t y) : coordX(x), coordY(y), foodBegin(0), foodEnd(0) { };
 
     uint32_t coordX, coordY;
-    std::list<WorldObject*> objectList;
-    std::list<Player*> playerList;
+    /* range of indexes of food in this cell (food store of room) */
+    uint32_t foodBegin, foodEnd;
+    /* objects and players are packed in vectors; every object remembers its slot, so it is removed in constant time */
+    std::vector<WorldObject*> objectList;
+    std::vector<Player*> playerList;
 
     static void GetCoordPairFor(float x, float y, uint32_t &cellX, uint32_t &cellY);
 
+    /* Writes position in compact encoding - cell coordinates as varints, then offset within cell */
+    static void WriteCompactPosition(GamePacket& gp, float x, float y);
+    /* Writes position relative to given cell, quantized to 16 bits per coordinate */
+    static void WriteCompactOffset(GamePacket& gp, float x, float y, uint32_t cellX, uint32_t cellY);
+
+    /* Adds object to cell */
+    void AddObject(WorldObject* wobj);
+    /* Removes object from cell; order of remaining objects is not preserved */
+    void RemoveObject(WorldObject* wobj);
+    /* Adds player to cell */
+    void AddPlayer(Player* plr);
+    /* Removes player from cell; order of remaining players is not preserved */
+    void RemovePlayer(Player* plr);
+
     void BroadcastPacket(GamePacket& pkt);
 };
 
-typedef std::vector<Cell*> CellColumn;
-typedef std::vector<CellColumn> CellMap;
+/* types of commands sent to room thread */
+enum RoomCommandType
+{
+    ROOM_COMMAND_WORLD_REQUEST = 0,
+    ROOM_COMMAND_MOVE_START = 1,
+    ROOM_COMMAND_MOVE_STOP = 2,
+    ROOM_COMMAND_MOVE_HEARTBEAT = 3,
+    ROOM_COMMAND_MOVE_DIRECTION = 4,
+    ROOM_COMMAND_PLAYER_EXIT = 5,
+    ROOM_COMMAND_STATS = 6,
+    ROOM_COMMAND_PLAYER_JOIN = 7,
+    ROOM_COMMAND_PLAYER_LEAVE = 8,
+
+    ROOM_COMMAND_MAX
+};
+
+/* Command decoded from player packet by network worker, to be executed by room thread */
+struct RoomCommand : public MPSCQueueNode
+{
+    RoomCommand(RoomCommandType cmdType, uint32_t plrId) : type(cmdType), playerId(plrId), player(nullptr), posX(0.0f), posY(0.0f), angle(0.0f), flag(false) { };
+    RoomCommand(RoomCommandType cmdType, Player* plr);
+
+    /* command type */
+    RoomCommandType type;
+    /* player, who sent the command */
+    uint32_t playerId;
+    /* player entering or leaving room (join and leave commands); the player is not in room yet, or is
+     * already disconnected, so it could not be looked up by ID */
+    Player* player;
+
+    /* position (movement commands) */
+    float posX, posY;
+    /* movement angle */
+    float angle;
+    /* generic flag (i.e. reinitialization flag of world request) */
+    bool flag;
+
+    /* commands are decoded packets, so they are allocated from packet pool as well */
+    static void* operator new(size_t size) { return sPacketPool->Acquire(size); };
+    static void operator delete(void* ptr, size_t size) { sPacketPool->Release((uint8_t*)ptr, size); };
+};
+
+/* Statistics of room ticks, maintained by room scheduler; room keeps them under lock, readers get a copy */
+struct RoomTickStats
+{
+    RoomTickStats() : tickCount(0), overrunCount(0), lastTickTime(0), maxTickTime(0), maxLag(0), sentBytes(0), playerTime(0) { };
+
+    /* total count of ticks */
+    uint64_t tickCount;
+    /* count of ticks, that did not fit into their time slot */
+    uint64_t overrunCount;
+    /* duration of last tick in microseconds */
+    uint32_t lastTickTime;
+    /* longest tick duration in microseconds */
+    uint32_t maxTickTime;
+    /* maximum delay of tick start after its due time, in milliseconds */
+    uint32_t maxLag;
+    /* bytes sent to players of room */
+    uint64_t sentBytes;
+    /* sum of time spent in room by all players, in milliseconds */
+    uint64_t playerTime;
+
+    /* Retrieves average count of bytes sent to one player per second */
+    uint64_t GetBytesPerPlayerSecond() const { return playerTime ? (sentBytes * 1000) / playerTime : 0; };
+};
+
+/* Player, who moved to another cell during parallel update phase */
+struct PlayerMigration
+{
+    PlayerMigration(Player* plr, Position const& pos) : player(plr), oldPos(pos) { };
+
+    /* moved player */
+    Player* player;
+    /* position before movement */
+    Position oldPos;
+};
+
+struct PlayerMigrationComparator
+{
+    bool operator()(PlayerMigration const& a, PlayerMigration const& b);
+};
+
+/* Player touching food or smaller player, found by collision detection */
+struct EatEvent
+{
+    EatEvent(Player* plr, uint32_t food) : eater(plr), victim(nullptr), foodIndex(food) { };
+    EatEvent(Player* plr, Player* target) : eater(plr), victim(target), foodIndex(FOOD_INDEX_NONE) { };
+
+    /* player, who eats */
+    Player* eater;
+    /* eaten player, or nullptr if food is eaten */
+    Player* victim;
+    /* eaten food, or FOOD_INDEX_NONE if player is eaten */
+    uint32_t foodIndex;
+};
+
+typedef std::vector<Player*> PlayerStripe;
+typedef std::vector<PlayerMigration> MigrationList;
+
+/* all cells in one block, column by column (index = x * grid height + y) */
+typedef std::vector<Cell> CellMap;
 
 struct RespawnTimeComparator
 {
@@ -54,9 +184,9 @@ class Room
         Room(uint32_t id, uint32_t gameType, uint32_t capacity, const char* name = "Unnamed room", uint32_t size = (uint32_t)MAP_DEFAULT_SIZE);
         ~Room();
 
-        /* Adds player into room */
-        void AddPlayer(Player* player);
-        /* Removes player from room */
+        /* Adds player into room, unless it's full or closed; called by room thread */
+        bool AddPlayer(Player* player);
+        /* Removes player from room; called by room thread */
         void RemovePlayer(Player* player);
         /* Removes player from room */
         void RemovePlayerFromGrid(Player* player);
@@ -64,15 +194,15 @@ class Room
         void PlaceNewPlayer(Player* player);
         /* Broadcasts packet inside room */
         void BroadcastPacket(GamePacket& pkt);
-        /* Broadcasts packet to cell and its neighbors */
-        void BroadcastPacketToNearCells(GamePacket& pkt, uint32_t centerCellX, uint32_t centerCellY);
+        /* Broadcasts packet to cell and its neighbors; clients using compact encoding get compact variant, if supplied */
+        void BroadcastPacketToNearCells(GamePacket& pkt, uint32_t centerCellX, uint32_t centerCellY, GamePacket* compactPkt = nullptr);
         /* Builds stats packet and broadcasts it to all in room */
         void BroadcastStats();
 
         /* Builds objects update for player */
-        void BuildObjectCreateBlock(GamePacket& pkt, Player* plr);
+        void BuildObjectCreateBlock(WorldUpdateBuilder& builder, Player* plr);
         /* Builds players update for player */
-        void BuildPlayerCreateBlock(GamePacket& pkt, Player* plr);
+        void BuildPlayerCreateBlock(WorldUpdateBuilder& builder, Player* plr);
         /* Build statistics packet block */
         void BuildStatsBlock(GamePacket& pkt);
 
@@ -84,11 +214,19 @@ class Room
         void RelocateWorldObject(WorldObject* wobj, Position &oldpos);
         /* Relocates player between cells if necessary */
         void RelocatePlayer(Player* wobj, Position &oldpos);
+        /* Moves player between cells if necessary and lets players know about visibility changes; returns false if out of grid */
+        bool MigratePlayerCell(Player* wobj, Position &oldpos);
+        /* Broadcasts player position to its surroundings */
+        void SendMoveHeartbeat(Player* wobj, bool lockGrid = true);
 
-        /* Retrieves closest object using manhattan distance */
-        WorldObject* GetManhattanClosestObject(WorldObject* source);
         /* Player eats object */
         void EatObject(Player* plr, WorldObject* obj);
+        /* Player eats food */
+        void EatFood(Player* plr, uint32_t foodIndex);
+        /* Queues eaten food for respawn */
+        void QueueFoodForRespawn(uint32_t foodIndex, uint32_t respawnDelay = MAP_OBJECT_RESPAWN_TIME);
+        /* Respawns eaten food */
+        void RespawnFood(uint32_t foodIndex);
         /* Queues object for respawn */
         void QueueWorldObjectForRespawn(WorldObject* obj, uint32_t respawnDelay = MAP_OBJECT_RESPAWN_TIME);
         /* Respawns world object on its place */
@@ -114,6 +252,8 @@ class Room
         size_t GetGridSizeY();
         /* Retrieves one cell from grid */
         Cell* GetCell(uint32_t x, uint32_t y);
+        /* Retrieves static food of room; cells refer to it by index ranges */
+        FoodStore& GetFoodStore();
 
         /* Retrieves map width */
         float GetMapSizeX();
@@ -130,20 +270,35 @@ class Room
         /* Is room listed as "default" ? */
         bool IsDefault();
 
+        /* Passes command to room thread, the room takes ownership of it; may be called from any thread */
+        void QueueCommand(RoomCommand* cmd);
+        /* Passes player join or leave command to room thread; returns false and keeps the ownership
+         * with caller, if the room was closed, so the player cannot get stuck in destroyed room */
+        bool QueueMembershipCommand(RoomCommand* cmd);
+        /* Sends response to join request; the room sends it, once the player is really inside */
+        static void SendJoinResponse(Session* sess, uint8_t statusCode);
+
         /* Updates room contents */
         void Update(uint32_t diff);
 
-        /* Thread runner */
-        void Run();
-
-        /* Set running state */
-        void SetRunning(bool state);
+        /* Performs one scheduled tick; returns false, if the room was destroyed and should not be ticked anymore */
+        bool Tick();
 
-        /* waits for thread shutdown */
-        void WaitForShutdown();
+        /* Retrieves interval between ticks in milliseconds */
+        uint32_t GetTickInterval();
+        /* Sets interval between ticks in milliseconds */
+        void SetTickInterval(uint32_t interval);
+        /* Copies tick statistics; may be called from any thread */
+        void GetTickStats(RoomTickStats& stats);
+        /* Adds finished tick to statistics; called by room scheduler */
+        void RecordTick(uint32_t duration, uint32_t lag, bool overrun);
+        /* Retrieves profiler of tick phases */
+        RoomProfiler& GetProfiler();
 
         /* lock for cell map updates */
         std::recursive_mutex cellMapLock;
+        /* lock for closing the room against players joining or leaving it */
+        std::mutex membership_mtx;
 
     protected:
         /* For now protected, due to unsupported size variability; sets room dimensions */
@@ -152,15 +307,71 @@ class Room
         /* Internal method for cleaning up object from grid */
         void _RemoveWorldObject(WorldObject* wobj);
 
-        /* Template method for creating object for this room */
-        template <class T>
-        T* CreateRoomObject(float x, float y);
+        /* Applies size gained by eating to player; returns real size change */
+        int32_t ApplySizeIncome(Player* plr, int32_t modSize);
+        /* Sends food destroy packet to every player, who knows the food, and forgets it */
+        void SendFoodDestroy(uint32_t foodIndex);
+        /* Sends snapshots collected during update to all players */
+        void FinishSnapshots();
+        /* Adds traffic of room players to statistics */
+        void AccountPlayerTraffic(uint32_t diff);
+
+        /* Updates all players one by one */
+        void UpdatePlayers(uint32_t diff);
+        /* Updates all players using helper threads; grid is split to stripes, which are moved in parallel, cell
+         * migrations are then applied serially in order of player IDs, and heartbeats are broadcasted in parallel again */
+        void UpdatePlayersParallel(uint32_t diff, WorkStealingPool* pool);
+        /* Parallel phase: moves players of one stripe without touching grid, and collects those who changed cell */
+        void MoveStripe(PlayerStripe* stripe, MigrationList* migrations, uint32_t diff);
+        /* Parallel phase: broadcasts positions of players of one stripe; grid must not change meanwhile */
+        void HeartbeatStripe(PlayerStripe* stripe);
+
+        /* Finds all players touching food or smaller players, and lets them eat */
+        void DetectCollisions();
+        /* Finds food touched by player */
+        void CollectFoodCollisions(Player* plr);
+        /* Finds smaller players touched by player */
+        void CollectPlayerCollisions(Player* plr);
+        /* Retrieves range of cells covered by circle moving from one point to another, clamped to grid */
+        void GetCellRange(Position const& from, Position const& to, float radius, uint32_t &x1, uint32_t &x2, uint32_t &y1, uint32_t &y2);
+        /* Executes eat events in order they were found; events made obsolete by previous ones are skipped */
+        void ResolveEatEvents();
+
+        /* Executes all commands queued by network workers */
+        void ProcessCommands();
+        /* Closes room for players, if it's still empty after executing pending commands; returns true, if closed */
+        bool Close();
+        /* Executes one command on behalf of player */
+        void ExecuteCommand(RoomCommand* cmd, Player* plr);
+
+        /* Sends world contents to player, and places him to map, if not reinitializing */
+        void CommandWorldRequest(Player* plr, bool reinit);
+        /* Starts player movement */
+        void CommandMoveStart(Player* plr, float x, float y, float angle);
+        /* Stops player movement */
+        void CommandMoveStop(Player* plr, float x, float y);
+        /* Updates player position */
+        void CommandMoveHeartbeat(Player* plr, float x, float y);
+        /* Changes player movement direction */
+        void CommandMoveDirection(Player* plr, float angle);
+        /* Player leaves room */
+        void CommandPlayerExit(Player* plr);
+        /* Sends room statistics to player */
+        void CommandStats(Player* plr);
+        /* Adds player, who asked to join, if there's a free slot */
+        void CommandPlayerJoin(Player* plr);
+        /* Removes disconnected player and passes it back to its network worker to be destroyed */
+        void CommandPlayerLeave(RoomCommand* cmd);
 
     private:
         /* Basic parameters */
         uint32_t m_id, m_gameType, m_capacity;
         /* List of all players */
         std::list<Player*> m_playerList;
+        /* Players in list by their IDs, to look up command targets */
+        std::unordered_map<uint32_t, Player*> m_playerIndex;
+        /* count of players; read by network workers (room list, join requests) */
+        std::atomic<uint32_t> m_playerCount;
         /* List of all non-player objects */
         std::set<WorldObject*> m_objectSet;
 
@@ -168,6 +379,8 @@ class Room
         std::string m_roomName;
         /* Is room default? (allow empty state) */
         bool m_isDefault;
+        /* Was room closed? (no player may join or leave through command queue anymore) */
+        bool m_isClosed;
 
         /* Last assigned object ID */
         uint32_t m_lastObjectId;
@@ -175,14 +388,18 @@ class Room
         /* Respawn queue for respawning world objects */
         std::priority_queue<WorldObject*, std::vector<WorldObject*>, RespawnTimeComparator> m_respawnQueue;
 
+        /* Static food of map */
+        FoodStore m_food;
+        /* Respawn queue for eaten food */
+        std::priority_queue<FoodRespawn, std::vector<FoodRespawn>, FoodRespawnComparator> m_foodRespawnQueue;
+
         /* Map dimensions */
         float m_sizeX, m_sizeY;
 
         /* Map grid - we will do updates using simple grid and visibility detection */
         CellMap m_cellMap;
-
-        /* Is still running? */
-        bool IsRunning();
+        /* Grid dimensions */
+        uint32_t m_gridSizeX, m_gridSizeY;
 
         /* last update time */
         uint32_t m_lastUpdateTime;
@@ -190,14 +407,23 @@ class Room
         /* when room recognizes its empty state */
         uint32_t m_emptyStateTime;
 
-        /* is room running? */
-        bool m_isRunning;
+        /* interval between ticks in milliseconds */
+        uint32_t m_tickInterval;
+
+        /* tick statistics */
+        RoomTickStats m_tickStats;
+        /* lock for tick statistics */
+        std::mutex tickstats_mtx;
+        /* profiler of tick phases */
+        RoomProfiler m_profiler;
 
-        /* update thread instance */
-        std::thread* m_updateThread;
+        /* eat events found in current tick */
+        std::vector<EatEvent> m_eatEvents;
+        /* food found by collision search of one player; kept, so its storage is reused */
+        std::vector<uint32_t> m_collidingFood;
 
-        /* generic miutex */
-        std::mutex generic_mtx;
+        /* commands waiting to be executed by room thread */
+        MPSCQueue<RoomCommand> m_commandQueue;
 };
 
 #endif
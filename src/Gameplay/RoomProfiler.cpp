@@ -0,0 +1,75 @@
+#include "General.h"
+#include "RoomProfiler.h"
+
+#include <algorithm>
+
+/* names of phases, as shown on console */
+static const char* roomPhaseNames[ROOM_PHASE_MAX] = {
+    "lock wait",
+    "commands",
+    "players",
+    "collisions",
+    "eating",
+    "respawn",
+    "snapshots",
+    "total"
+};
+
+RoomProfiler::RoomProfiler() : m_nextSlot(0), m_tickCount(0)
+{
+    memset(m_current, 0, sizeof(m_current));
+    memset(m_history, 0, sizeof(m_history));
+}
+
+void RoomProfiler::AddPhaseTime(RoomTickPhase phase, uint32_t time)
+{
+    m_current[phase] += time;
+}
+
+void RoomProfiler::EndTick()
+{
+    std::unique_lock<std::mutex> lck(history_mtx);
+
+    memcpy(m_history[m_nextSlot], m_current, sizeof(m_current));
+    memset(m_current, 0, sizeof(m_current));
+
+    m_nextSlot = (m_nextSlot + 1) % ROOM_PROFILER_HISTORY;
+    if (m_tickCount < ROOM_PROFILER_HISTORY)
+        m_tickCount++;
+}
+
+uint32_t RoomProfiler::GetSummary(RoomPhaseSummary* summary)
+{
+    uint32_t samples[ROOM_PROFILER_HISTORY];
+    uint32_t count;
+
+    std::unique_lock<std::mutex> lck(history_mtx);
+
+    count = m_tickCount;
+
+    for (uint32_t phase = 0; phase < ROOM_PHASE_MAX; phase++)
+    {
+        if (count == 0)
+        {
+            summary[phase].p50 = summary[phase].p99 = summary[phase].max = 0;
+            continue;
+        }
+
+        // the ring is either full, or filled from its start
+        for (uint32_t i = 0; i < count; i++)
+            samples[i] = m_history[i][phase];
+
+        std::sort(samples, samples + count);
+
+        summary[phase].p50 = samples[(count - 1) / 2];
+        summary[phase].p99 = samples[(count - 1) * 99 / 100];
+        summary[phase].max = samples[count - 1];
+    }
+
+    return count;
+}
+
+const char* RoomProfiler::GetPhaseName(RoomTickPhase phase)
+{
+    return roomPhaseNames[phase];
+}
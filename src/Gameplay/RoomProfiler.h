@@ -0,0 +1,89 @@
+#ifndef AGAR_ROOMPROFILER_H
+#define AGAR_ROOMPROFILER_H
+
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+
+/* count of last ticks kept by profiler */
+#define ROOM_PROFILER_HISTORY 256
+
+/* Phases of room update */
+enum RoomTickPhase
+{
+    ROOM_PHASE_LOCK_WAIT = 0,       // waiting for cell map lock held by network workers
+    ROOM_PHASE_COMMANDS = 1,        // commands of players (packets passed from network)
+    ROOM_PHASE_PLAYERS = 2,         // session updates (pings), movement and heartbeat broadcasts
+    ROOM_PHASE_COLLISIONS = 3,      // eat detection
+    ROOM_PHASE_EATING = 4,          // eat resolution
+    ROOM_PHASE_RESPAWN = 5,         // respawn queues
+    ROOM_PHASE_SNAPSHOTS = 6,       // serialization of snapshots
+    ROOM_PHASE_TOTAL = 7,           // whole update
+
+    ROOM_PHASE_MAX
+};
+
+/* Summary of one phase over ticks kept */
+struct RoomPhaseSummary
+{
+    /* median duration in microseconds */
+    uint32_t p50;
+    /* 99th percentile of duration in microseconds */
+    uint32_t p99;
+    /* maximum duration in microseconds */
+    uint32_t max;
+};
+
+/* Profiler of room ticks; keeps phase durations of last ticks in ring buffer. Phases are measured by room thread,
+ * summaries may be retrieved from any thread */
+class RoomProfiler
+{
+    public:
+        RoomProfiler();
+
+        /* Adds time to phase of current tick */
+        void AddPhaseTime(RoomTickPhase phase, uint32_t time);
+        /* Stores current tick to history and starts a new one */
+        void EndTick();
+
+        /* Computes summary of every phase over ticks kept; returns count of ticks the summary was made of */
+        uint32_t GetSummary(RoomPhaseSummary* summary);
+
+        /* Retrieves name of phase */
+        static const char* GetPhaseName(RoomTickPhase phase);
+
+    private:
+        /* durations of phases of current tick, in microseconds */
+        uint32_t m_current[ROOM_PHASE_MAX];
+
+        /* durations of phases of last ticks */
+        uint32_t m_history[ROOM_PROFILER_HISTORY][ROOM_PHASE_MAX];
+        /* index of history slot to be written next */
+        uint32_t m_nextSlot;
+        /* count of ticks stored in history */
+        uint32_t m_tickCount;
+
+        /* lock for history */
+        std::mutex history_mtx;
+};
+
+/* Measures time spent in its scope and adds it to phase of room tick */
+class RoomPhaseTimer
+{
+    public:
+        RoomPhaseTimer(RoomProfiler &profiler, RoomTickPhase phase) : m_profiler(profiler), m_phase(phase), m_start(std::chrono::steady_clock::now()) { };
+        ~RoomPhaseTimer()
+        {
+            m_profiler.AddPhaseTime(m_phase, (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_start).count());
+        };
+
+    private:
+        /* profiler to store time to */
+        RoomProfiler &m_profiler;
+        /* measured phase */
+        RoomTickPhase m_phase;
+        /* when the scope was entered */
+        std::chrono::steady_clock::time_point m_start;
+};
+
+#endif
@@ -0,0 +1,204 @@
+#include "General.h"
+#include "RoomScheduler.h"
+#include "Room.h"
+#include "Config.h"
+#include "Log.h"
+
+#include <algorithm>
+
+bool ScheduledRoomComparator::operator()(ScheduledRoom const& a, ScheduledRoom const& b)
+{
+    return a.due > b.due;
+}
+
+RoomScheduler::RoomScheduler() : m_tickInterval(1000 / ROOM_DEFAULT_TICK_RATE), m_parallelMinPlayers(0), m_isRunning(false)
+{
+    //
+}
+
+RoomScheduler::~RoomScheduler()
+{
+    //
+}
+
+void runRoomSchedulerWorker()
+{
+    sRoomScheduler->RunWorker();
+}
+
+bool RoomScheduler::Startup()
+{
+    int threads, helpers, tickRate;
+
+    tickRate = sConfig->GetIntValue(CONF_ROOM_TICK_RATE);
+    if (tickRate < 1 || tickRate > ROOM_MAX_TICK_RATE)
+    {
+        sLog->Error("Invalid room tick rate %i specified, using %u", tickRate, ROOM_DEFAULT_TICK_RATE);
+        tickRate = ROOM_DEFAULT_TICK_RATE;
+    }
+
+    m_tickInterval = 1000 / tickRate;
+
+    // one worker per core by default
+    threads = sConfig->GetIntValue(CONF_ROOM_THREADS);
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    if (threads <= 0)
+        threads = 1;
+
+    sLog->Info("Starting %i room update thread(s), tick interval %u ms", threads, m_tickInterval);
+
+    // large rooms may split their update among helper threads; disabled by default
+    helpers = sConfig->GetIntValue(CONF_ROOM_PARALLEL_THREADS);
+    if (helpers > 0)
+    {
+        if (helpers > WORK_POOL_MAX_THREADS)
+        {
+            sLog->Error("Invalid room parallel thread count %i specified, using %i", helpers, WORK_POOL_MAX_THREADS);
+            helpers = WORK_POOL_MAX_THREADS;
+        }
+
+        m_parallelMinPlayers = (uint32_t)std::max(sConfig->GetIntValue(CONF_ROOM_PARALLEL_MIN_PLAYERS), 1);
+
+        sLog->Info("Starting %i parallel room update helper thread(s) for rooms with at least %u players", helpers, m_parallelMinPlayers);
+        m_stripePool.Startup(helpers);
+    }
+
+    m_isRunning = true;
+
+    for (int i = 0; i < threads; i++)
+        m_workers.push_back(new std::thread(runRoomSchedulerWorker));
+
+    return true;
+}
+
+void RoomScheduler::Shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lck(schedule_mtx);
+        m_isRunning = false;
+    }
+
+    m_scheduleCond.notify_all();
+
+    for (std::vector<std::thread*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
+    {
+        (*itr)->join();
+        delete *itr;
+    }
+
+    m_workers.clear();
+
+    // release rooms, so they are freed along with the rest of gameplay
+    while (!m_schedule.empty())
+        m_schedule.pop();
+
+    // no room is ticked anymore, so nobody uses helpers
+    if (m_stripePool.IsRunning())
+        m_stripePool.Shutdown();
+}
+
+void RoomScheduler::ScheduleRoom(RoomPtr const& room)
+{
+    ScheduledRoom sr;
+
+    sr.room = room;
+    sr.due = RoomClock::now() + std::chrono::milliseconds(room->GetTickInterval());
+
+    {
+        std::unique_lock<std::mutex> lck(schedule_mtx);
+        m_schedule.push(sr);
+    }
+
+    // the room may be due sooner than the one, that workers are waiting for
+    m_scheduleCond.notify_one();
+}
+
+uint32_t RoomScheduler::GetTickInterval()
+{
+    return m_tickInterval;
+}
+
+WorkStealingPool* RoomScheduler::GetStripePool()
+{
+    return m_stripePool.IsRunning() ? &m_stripePool : nullptr;
+}
+
+uint32_t RoomScheduler::GetParallelMinPlayers()
+{
+    return m_parallelMinPlayers;
+}
+
+void RoomScheduler::RunWorker()
+{
+    ScheduledRoom sr;
+    RoomClock::time_point due;
+
+    std::unique_lock<std::mutex> lck(schedule_mtx);
+
+    while (m_isRunning)
+    {
+        if (m_schedule.empty())
+        {
+            m_scheduleCond.wait(lck);
+            continue;
+        }
+
+        // sleep until the earliest room is due; the schedule may change (and reallocate) meanwhile, so
+        // the time has to be copied
+        due = m_schedule.top().due;
+        if (due > RoomClock::now())
+        {
+            m_scheduleCond.wait_until(lck, due);
+            continue;
+        }
+
+        // take the room out of schedule, so no other worker could tick it at the same time
+        sr = m_schedule.top();
+        m_schedule.pop();
+
+        lck.unlock();
+        bool keep = TickRoom(sr);
+        lck.lock();
+
+        if (keep)
+        {
+            m_schedule.push(std::move(sr));
+            // wake another worker up, it may be this room turn sooner than the one it waits for
+            m_scheduleCond.notify_one();
+        }
+    }
+}
+
+bool RoomScheduler::TickRoom(ScheduledRoom &sr)
+{
+    RoomClock::time_point start = RoomClock::now();
+
+    // the room destroyed itself (i.e. it was empty for too long); whoever still holds it frees it
+    if (!sr.room->Tick())
+    {
+        sr.room.reset();
+        return false;
+    }
+
+    RoomClock::time_point end = RoomClock::now();
+
+    uint32_t duration = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+    uint32_t lag = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(start - sr.due).count();
+    bool overrun = false;
+
+    // fixed time step - the next tick is planned relatively to the due time, not to the time the tick really started
+    sr.due += std::chrono::milliseconds(sr.room->GetTickInterval());
+
+    // the tick did not fit into its time slot; do not try to catch up with ticks missed, just start over
+    if (sr.due <= end)
+    {
+        overrun = true;
+        sr.due = end + std::chrono::milliseconds(sr.room->GetTickInterval());
+    }
+
+    // statistics are read by console thread, the room copies them under lock
+    sr.room->RecordTick(duration, lag, overrun);
+
+    return true;
+}
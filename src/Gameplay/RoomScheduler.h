@@ -0,0 +1,93 @@
+#ifndef AGAR_ROOMSCHEDULER_H
+#define AGAR_ROOMSCHEDULER_H
+
+#include "Singleton.h"
+#include "WorkStealingPool.h"
+#include "Gameplay.h"
+
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <condition_variable>
+
+/* default room tick rate (updates per second) */
+#define ROOM_DEFAULT_TICK_RATE 10
+/* maximum room tick rate, faster ticking would make no sense */
+#define ROOM_MAX_TICK_RATE 1000
+
+typedef std::chrono::steady_clock RoomClock;
+
+/* Room waiting for its next tick */
+struct ScheduledRoom
+{
+    /* time of next tick */
+    RoomClock::time_point due;
+    /* scheduled room; the schedule keeps it alive until it destroys itself */
+    RoomPtr room;
+};
+
+struct ScheduledRoomComparator
+{
+    bool operator()(ScheduledRoom const& a, ScheduledRoom const& b);
+};
+
+/* Runs updates of all rooms in fixed time steps using shared pool of worker threads; every room
+ * is ticked by at most one worker at a time */
+class RoomScheduler
+{
+    friend class Singleton<RoomScheduler>;
+    public:
+        ~RoomScheduler();
+
+        /* Starts worker threads */
+        bool Startup();
+        /* Stops all workers; rooms are not ticked anymore after this call */
+        void Shutdown();
+
+        /* Adds room to schedule; its first tick will occur after one tick interval */
+        void ScheduleRoom(RoomPtr const& room);
+
+        /* Retrieves configured tick interval in milliseconds */
+        uint32_t GetTickInterval();
+
+        /* Retrieves pool for parallel updates of large rooms, or nullptr if the parallel mode is disabled */
+        WorkStealingPool* GetStripePool();
+        /* Retrieves minimum player count of room to be updated in parallel */
+        uint32_t GetParallelMinPlayers();
+
+        /* Worker thread loop */
+        void RunWorker();
+
+    protected:
+        /* Hidden singleton constructor */
+        RoomScheduler();
+
+    private:
+        /* Ticks one room and plans its next tick; returns false if the room was destroyed and released */
+        bool TickRoom(ScheduledRoom &sr);
+
+        /* rooms ordered by time of their next tick */
+        std::priority_queue<ScheduledRoom, std::vector<ScheduledRoom>, ScheduledRoomComparator> m_schedule;
+        /* lock for schedule */
+        std::mutex schedule_mtx;
+        /* signals change of schedule to workers */
+        std::condition_variable m_scheduleCond;
+
+        /* worker threads */
+        std::vector<std::thread*> m_workers;
+
+        /* tick interval in milliseconds */
+        uint32_t m_tickInterval;
+
+        /* pool for parallel updates of large rooms */
+        WorkStealingPool m_stripePool;
+        /* minimum player count of room to be updated in parallel */
+        uint32_t m_parallelMinPlayers;
+
+        /* are workers still intended to run? */
+        bool m_isRunning;
+};
+
+#define sRoomScheduler Singleton<RoomScheduler>::getInstance()
+
+#endif
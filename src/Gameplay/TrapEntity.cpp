@@ -1,13 +0,0 @@
-#include "General.h"
-#include "Entities.h"
-#include "WorldObject.h"
-
-TrapEntity::TrapEntity()
-{
-    SetTypeId(OBJECT_TYPE_TRAP);
-}
-
-TrapEntity::~TrapEntity()
-{
-    //
-}
@@ -8,6 +8,9 @@
 WorldObject::WorldObject()
 {
     m_roomId = 0;
+    m_id = 0;
+    m_respawnTime = 0;
+    m_cellSlot = 0;
 }
 
 Position const& WorldObject::GetPosition()
@@ -60,6 +63,16 @@ time_t WorldObject::GetRespawnTime()
     return m_respawnTime;
 }
 
+void WorldObject::SetCellSlot(uint32_t slot)
+{
+    m_cellSlot = slot;
+}
+
+uint32_t WorldObject::GetCellSlot()
+{
+    return m_cellSlot;
+}
+
 void WorldObject::Relocate(Position &pos, bool update)
 {
     Position oldPos(m_position);
@@ -69,20 +82,10 @@ void WorldObject::Relocate(Position &pos, bool update)
 
     if (m_roomId)
     {
-        Room* myRoom = sGameplay->GetRoom(m_roomId);
+        RoomPtr myRoom = sGameplay->GetRoom(m_roomId);
         if (myRoom)
         {
-            // lower bounds
-            if (m_position.x < 0)
-                m_position.x = 0;
-            if (m_position.y < 0)
-                m_position.y = 0;
-
-            // higher bounds
-            if (m_position.x > myRoom->GetMapSizeX())
-                m_position.x = myRoom->GetMapSizeX();
-            if (m_position.y > myRoom->GetMapSizeY())
-                m_position.y = myRoom->GetMapSizeY();
+            MoveWithinMap(pos, myRoom->GetMapSizeX(), myRoom->GetMapSizeY());
 
             if (update)
             {
@@ -97,6 +100,24 @@ void WorldObject::Relocate(Position &pos, bool update)
     }
 }
 
+void WorldObject::MoveWithinMap(Position const& pos, float mapSizeX, float mapSizeY)
+{
+    m_position.x = pos.x;
+    m_position.y = pos.y;
+
+    // lower bounds
+    if (m_position.x < 0)
+        m_position.x = 0;
+    if (m_position.y < 0)
+        m_position.y = 0;
+
+    // higher bounds
+    if (m_position.x > mapSizeX)
+        m_position.x = mapSizeX;
+    if (m_position.y > mapSizeY)
+        m_position.y = mapSizeY;
+}
+
 void WorldObject::BuildCreatePacketBlock(GamePacket& gp)
 {
     gp.WriteUInt32(m_id);
@@ -106,3 +127,12 @@ void WorldObject::BuildCreatePacketBlock(GamePacket& gp)
 
     gp.WriteUInt32(0); // TODO: specific parameter for each type
 }
+
+void WorldObject::BuildCompactCreatePacketBlock(GamePacket& gp)
+{
+    gp.WriteVarUInt(m_id);
+    Cell::WriteCompactPosition(gp, m_position.x, m_position.y);
+    gp.WriteUInt8(m_typeId);
+
+    gp.WriteVarUInt(0); // TODO: specific parameter for each type
+}
@@ -2,6 +2,7 @@
 #define AGAR_WORLDOBJECT_H
 
 #include <math.h>
+#include <atomic>
 
 /* Object type identifier */
 enum ObjectTypeId
@@ -58,6 +59,9 @@ class WorldObject
 
         /* Relocates object */
         void Relocate(Position &pos, bool update = true);
+        /* Moves object to position limited by map of given size; neither room nor cells are touched, so the caller
+         * has to know the map size and take care of cell change */
+        void MoveWithinMap(Position const& pos, float mapSizeX, float mapSizeY);
 
         /* Sets room ID the player has joined */
         void SetRoomId(uint32_t roomId);
@@ -80,8 +84,15 @@ class WorldObject
         /* Retrieves respawn time */
         time_t GetRespawnTime();
 
+        /* Sets index of object within its cell */
+        void SetCellSlot(uint32_t slot);
+        /* Retrieves index of object within its cell */
+        uint32_t GetCellSlot();
+
         /* Builds create packet contents to be sent to players; this method assumes valid opcode has been set */
         virtual void BuildCreatePacketBlock(GamePacket& gp);
+        /* Builds create packet contents in compact encoding (varint ID, position relative to cell) */
+        virtual void BuildCompactCreatePacketBlock(GamePacket& gp);
 
         /* When eaten by player */
         virtual void OnEatenByPlayer(Player* plr) { };
@@ -96,8 +107,8 @@ class WorldObject
         /* Object type identifier */
         ObjectTypeId m_typeId;
 
-        /* Object room ID */
-        uint32_t m_roomId;
+        /* Object room ID; players get it assigned by network workers, when they ask to join room */
+        std::atomic<uint32_t> m_roomId;
 
         /* Player ID */
         uint32_t m_id;
@@ -105,6 +116,9 @@ class WorldObject
         /* Will respawn at .. */
         time_t m_respawnTime;
 
+        /* Index in object (or player) list of cell */
+        uint32_t m_cellSlot;
+
     private:
         //
 };
@@ -0,0 +1,70 @@
+#include "General.h"
+#include "WorldUpdateBuilder.h"
+#include "Player.h"
+#include "Opcodes.h"
+
+WorldUpdateBuilder::WorldUpdateBuilder(Player* recipient, bool compact, GamePacket* header) : m_recipient(recipient), m_compact(compact), m_header(header),
+    m_playerCount(0), m_objectCount(0), m_sentPackets(0)
+{
+    //
+}
+
+void WorldUpdateBuilder::AddPlayerBlock()
+{
+    m_playerCount++;
+    CheckSize();
+}
+
+void WorldUpdateBuilder::AddObjectBlock()
+{
+    m_objectCount++;
+    CheckSize();
+}
+
+void WorldUpdateBuilder::Finish()
+{
+    if (m_header || m_playerCount != 0 || m_objectCount != 0)
+        Send();
+}
+
+void WorldUpdateBuilder::CheckSize()
+{
+    // blocks are never split, so the packet may exceed the limit by one block
+    if (m_playerBlocks.GetWritePos() + m_objectBlocks.GetWritePos() >= WORLD_UPDATE_CHUNK_SIZE)
+        Send();
+}
+
+/* Writes count of create blocks followed by the blocks; compact encoding uses varint for the count */
+static void writeCreateBlocks(GamePacket& pkt, uint32_t count, GamePacket& blocks, bool compact)
+{
+    if (compact)
+        pkt.WriteVarUInt(count);
+    else
+        pkt.WriteUInt32(count);
+
+    if (blocks.GetWritePos() > 0)
+        pkt.WriteData(blocks.GetData(), blocks.GetWritePos());
+}
+
+void WorldUpdateBuilder::Send()
+{
+    GamePacket pkt(m_header ? SP_NEW_WORLD : SP_UPDATE_WORLD);
+
+    // only the first packet builds the world, the rest just adds to it
+    if (m_header)
+    {
+        pkt.WriteData(m_header->GetData(), m_header->GetWritePos());
+        m_header = nullptr;
+    }
+
+    writeCreateBlocks(pkt, m_playerCount, m_playerBlocks, m_compact);
+    writeCreateBlocks(pkt, m_objectCount, m_objectBlocks, m_compact);
+
+    sNetwork->SendPacket(m_recipient->GetSession(), pkt);
+    m_sentPackets++;
+
+    m_playerBlocks.Reset(0);
+    m_objectBlocks.Reset(0);
+    m_playerCount = 0;
+    m_objectCount = 0;
+}
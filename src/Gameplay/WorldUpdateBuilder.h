@@ -0,0 +1,61 @@
+#ifndef AGAR_WORLDUPDATEBUILDER_H
+#define AGAR_WORLDUPDATEBUILDER_H
+
+#include "GamePacket.h"
+
+/* contents size, after which the collected world update is sent and next one is started */
+#define WORLD_UPDATE_CHUNK_SIZE 4096
+
+class Player;
+
+/* Collects create blocks of players and objects for one client, and streams them in world update packets of
+ * limited size, so the world of any visibility range fits into packets. The first packet is SP_NEW_WORLD, when
+ * the world header is supplied; everything else is sent as SP_UPDATE_WORLD, which the client just adds to its world */
+class WorldUpdateBuilder
+{
+    public:
+        /* The header (map dimensions, recipient himself) is written at the beginning of first packet, if supplied */
+        WorldUpdateBuilder(Player* recipient, bool compact, GamePacket* header = nullptr);
+
+        /* Is compact encoding used? */
+        bool IsCompact() { return m_compact; };
+
+        /* Retrieves packet to write player create block into */
+        GamePacket& GetPlayerBlocks() { return m_playerBlocks; };
+        /* Retrieves packet to write object create block (or cell group in compact encoding) into */
+        GamePacket& GetObjectBlocks() { return m_objectBlocks; };
+
+        /* Counts player block just written; sends the update, if it's large enough */
+        void AddPlayerBlock();
+        /* Counts object block just written; sends the update, if it's large enough */
+        void AddObjectBlock();
+
+        /* Sends the rest of collected blocks; the world packet is always sent, plain update only when not empty */
+        void Finish();
+
+        /* Retrieves count of packets sent */
+        uint32_t GetSentPacketCount() { return m_sentPackets; };
+
+    private:
+        /* Sends collected blocks, if there are too many of them */
+        void CheckSize();
+        /* Sends collected blocks */
+        void Send();
+
+        Player* m_recipient;
+        bool m_compact;
+        /* world header, not sent yet */
+        GamePacket* m_header;
+
+        /* blocks collected for next packet */
+        GamePacket m_playerBlocks;
+        GamePacket m_objectBlocks;
+        /* count of blocks collected for next packet */
+        uint32_t m_playerCount;
+        uint32_t m_objectCount;
+
+        /* count of packets sent */
+        uint32_t m_sentPackets;
+};
+
+#endif
@@ -1,21 +1,121 @@
 #include "General.h"
 #include "GamePacket.h"
+#include "WireFrame.h"
+#include "PacketBufferPool.h"
 #include "Log.h"
 #include "Helpers.h"
 
-GamePacket::GamePacket() : m_opcode(0), m_size(0), m_readPos(0), m_writePos(0)
+GamePacket::GamePacket() : m_opcode(0), m_size(0), m_data(m_inlineData), m_capacity(GAMEPACKET_INLINE_SIZE), m_readPos(0), m_writePos(0)
 {
     //
 }
 
-GamePacket::GamePacket(uint16_t opcode, uint16_t size) : m_opcode(opcode), m_size(size), m_readPos(0), m_writePos(0)
+GamePacket::GamePacket(uint16_t opcode, uint16_t size) : m_opcode(opcode), m_size(size), m_data(m_inlineData), m_capacity(GAMEPACKET_INLINE_SIZE),
+    m_readPos(0), m_writePos(0)
 {
-    m_data.reserve(size);
+    // one byte more for trailing zero
+    if (size + 1 > GAMEPACKET_INLINE_SIZE)
+        _Reserve(size + 1);
+}
+
+GamePacket::GamePacket(GamePacket&& other) : m_data(m_inlineData), m_capacity(GAMEPACKET_INLINE_SIZE)
+{
+    _MoveFrom(other);
 }
 
 GamePacket::~GamePacket()
 {
-    m_data.clear();
+    _ReleaseStorage();
+}
+
+GamePacket& GamePacket::operator = (GamePacket&& other)
+{
+    if (this != &other)
+    {
+        _ReleaseStorage();
+        _MoveFrom(other);
+    }
+
+    return *this;
+}
+
+void GamePacket::_MoveFrom(GamePacket& other)
+{
+    m_opcode = other.m_opcode;
+    m_size = other.m_size;
+    m_readPos = other.m_readPos;
+    m_writePos = other.m_writePos;
+    m_wireFrame = std::move(other.m_wireFrame);
+
+    // pooled buffer just changes its owner, inline contents have to be copied
+    if (other.m_data != other.m_inlineData)
+    {
+        m_data = other.m_data;
+        m_capacity = other.m_capacity;
+    }
+    else
+        memcpy(m_inlineData, other.m_inlineData, GAMEPACKET_INLINE_SIZE);
+
+    other.m_data = other.m_inlineData;
+    other.m_capacity = GAMEPACKET_INLINE_SIZE;
+    other.m_opcode = 0;
+    other.m_size = 0;
+    other.m_readPos = 0;
+    other.m_writePos = 0;
+}
+
+void GamePacket::_Reserve(size_t size)
+{
+    uint8_t* storage;
+    size_t keep;
+
+    if (size <= m_capacity)
+        return;
+
+    // grow at least twice, so the packet built field by field is moved just a few times
+    if (size < 2 * m_capacity)
+        size = 2 * m_capacity;
+
+    storage = sPacketPool->Acquire(size);
+
+    // everything written so far, including preset size of contents
+    keep = (m_size > m_writePos + 1) ? m_size : m_writePos + 1;
+    if (keep > m_capacity)
+        keep = m_capacity;
+    memcpy(storage, m_data, keep);
+
+    _ReleaseStorage();
+
+    m_data = storage;
+    m_capacity = PacketBufferPool::GetCapacity(size);
+}
+
+void GamePacket::_ReleaseStorage()
+{
+    if (m_data != m_inlineData)
+        sPacketPool->Release(m_data, m_capacity);
+
+    m_data = m_inlineData;
+    m_capacity = GAMEPACKET_INLINE_SIZE;
+}
+
+void GamePacket::Reset(uint16_t opcode, uint16_t size)
+{
+    m_wireFrame.reset();
+
+    m_opcode = opcode;
+    m_size = size;
+    m_readPos = 0;
+    m_writePos = 0;
+
+    // contents are replaced, there's nothing to keep
+    if ((size_t)size + 1 > m_capacity)
+    {
+        _ReleaseStorage();
+        _Reserve(size + 1);
+    }
+
+    m_data[size] = 0;
 }
 
 void GamePacket::SetReadPos(uint16_t pos)
@@ -30,6 +130,11 @@ void GamePacket::SetReadPos(uint16_t pos)
     m_readPos = pos;
 }
 
+uint16_t GamePacket::GetRemainingSize()
+{
+    return m_size - m_readPos;
+}
+
 uint16_t GamePacket::GetWritePos()
 {
     return m_writePos;
@@ -39,7 +144,7 @@ std::string GamePacket::ReadString()
 {
     // we can detect only starting point being out of range at this time
     if (m_readPos >= m_size)
-        throw new PacketReadException(m_readPos, 1);
+        throw PacketReadException(m_readPos, 1);
 
     int i;
 
@@ -52,8 +157,8 @@ std::string GamePacket::ReadString()
 
     // if we reached end without finding zero, that means, the string is not properly ended
     // or we just tried to read something, that's not string; by all means, this is errorneous state
-    if (m_data[i] != '\0')
-        throw new PacketReadException(m_readPos, m_size - m_readPos + 1);
+    if (i == m_size)
+        throw PacketReadException(m_readPos, m_size - m_readPos + 1);
 
     int oldReadPos = m_readPos;
     // set read position one character further to skip the zero termination
@@ -67,7 +172,7 @@ void GamePacket::_Read(void* dst, size_t size)
 {
     // disallow reading more bytes than available
     if (m_readPos + size > m_size)
-        throw new PacketReadException(m_readPos, m_size);
+        throw PacketReadException(m_readPos, m_size);
 
     memcpy(dst, &m_data[m_readPos], size);
     m_readPos += size;
@@ -123,24 +228,77 @@ float GamePacket::ReadFloat()
     return *(float*)&toret;
 }
 
-void GamePacket::_Write(void* data, size_t size)
+uint32_t GamePacket::ReadVarUInt()
 {
-    m_data.resize(m_writePos + 1 + size);
-    memcpy(&m_data[m_writePos], data, size);
+    uint32_t toret = 0;
+    uint8_t byte;
+
+    for (uint32_t shift = 0; ; shift += 7)
+    {
+        // 32bit value never takes more than 5 bytes
+        if (shift > 28)
+            throw PacketReadException(m_readPos, 1);
+
+        _Read(&byte, 1);
+        toret |= ((uint32_t)(byte & 0x7F)) << shift;
+
+        if ((byte & 0x80) == 0)
+            break;
+    }
+
+    return toret;
+}
+
+int32_t GamePacket::ReadVarInt()
+{
+    uint32_t val = ReadVarUInt();
+    return (int32_t)((val >> 1) ^ (~(val & 1) + 1));
+}
+
+uint8_t* GamePacket::Extend(size_t size)
+{
+    uint8_t* dst;
+
+    m_wireFrame.reset();
+
+    // cursors and header are 16bit, larger contents would silently wrap around
+    if (m_writePos + size + 1 > GAMEPACKET_MAX_SIZE)
+        throw PacketWriteException(m_opcode, m_writePos, size);
+
+    // one byte more for trailing zero, which is counted in contents size
+    if (m_writePos + size + 1 > m_capacity)
+        _Reserve(m_writePos + size + 1);
+
+    dst = &m_data[m_writePos];
     m_writePos += size;
+    m_data[m_writePos] = 0;
 
     if (m_size < m_writePos + 1)
         m_size = m_writePos + 1;
+
+    return dst;
+}
+
+void GamePacket::_Write(const void* data, size_t size)
+{
+    memcpy(Extend(size), data, size);
 }
 
 void GamePacket::_WriteAt(void* data, size_t size, uint16_t position)
 {
+    m_wireFrame.reset();
+
     memcpy(&m_data[position], data, size);
 }
 
+void GamePacket::WriteData(const uint8_t* data, size_t size)
+{
+    _Write(data, size);
+}
+
 void GamePacket::WriteString(const char* str)
 {
-    _Write((void*)str, strlen(str) + 1);
+    _Write(str, strlen(str) + 1);
 }
 
 void GamePacket::WriteUInt32(uint32_t val)
@@ -183,6 +341,28 @@ void GamePacket::WriteFloat(float val)
     _Write(&cval, sizeof(float));
 }
 
+void GamePacket::WriteVarUInt(uint32_t val)
+{
+    uint8_t buf[5];
+    size_t len = 0;
+
+    // highest bit of every byte but the last one says, that another byte follows
+    while (val >= 0x80)
+    {
+        buf[len++] = (uint8_t)(val | 0x80);
+        val >>= 7;
+    }
+    buf[len++] = (uint8_t)val;
+
+    _Write(buf, len);
+}
+
+void GamePacket::WriteVarInt(int32_t val)
+{
+    // sign goes to the lowest bit: 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+    WriteVarUInt((((uint32_t)val) << 1) ^ (uint32_t)(val >> 31));
+}
+
 void GamePacket::WriteUInt32At(uint32_t val, uint16_t position)
 {
     val = htonl(val);
@@ -202,12 +382,17 @@ void GamePacket::WriteUInt8At(uint8_t val, uint16_t position)
 
 void GamePacket::SetData(uint8_t* data, uint16_t size)
 {
-    m_data = std::vector<uint8_t>(data, data + size);
+    m_wireFrame.reset();
+
+    // the trailing zero stops reading of string not terminated properly
+    _Reserve(size + 1);
+    memcpy(m_data, data, size);
+    m_data[size] = 0;
 }
 
 uint8_t* GamePacket::GetData()
 {
-    return m_data.data();
+    return m_data;
 }
 
 uint16_t GamePacket::GetOpcode()
@@ -217,6 +402,8 @@ uint16_t GamePacket::GetOpcode()
 
 void GamePacket::SetOpcode(uint16_t opcode)
 {
+    m_wireFrame.reset();
+
     m_opcode = opcode;
 }
 
@@ -224,3 +411,12 @@ uint16_t GamePacket::GetSize()
 {
     return m_size;
 }
+
+WireFramePtr GamePacket::GetWireFrame()
+{
+    // encode packet, if not already encoded, or modified since then
+    if (!m_wireFrame)
+        m_wireFrame = std::allocate_shared<WireFrame>(PacketPoolAllocator<WireFrame>(), *this);
+
+    return m_wireFrame;
+}
@@ -4,9 +4,15 @@
 #include <cstdint>
 #include <exception>
 #include <vector>
+#include <memory>
+#include <string>
 
 /* packet header size - 2B for opcode, 2B for size */
 #define GAMEPACKET_HEADER_SIZE 4
+/* size of contents stored within packet itself; larger contents are stored in buffer taken from packet pool */
+#define GAMEPACKET_INLINE_SIZE 64
+/* largest contents size the 2B size field of header is able to carry (including trailing zero) */
+#define GAMEPACKET_MAX_SIZE 0xFFFF
 
 /* Exception thrown when trying to read more than available remaining bytes */
 class PacketReadException : public std::exception
@@ -27,6 +33,35 @@ class PacketReadException : public std::exception
         int attemptSize;
 };
 
+/* Exception thrown when trying to write more than the packet is able to carry; larger data (i.e. world) have to be
+ * split to more packets by their builder */
+class PacketWriteException : public std::exception
+{
+    public:
+        /* Only constructor we use to store values we need */
+        PacketWriteException(uint16_t opcode, size_t pos, size_t attemptsize) : opcode(opcode), position(pos), attemptSize(attemptsize) { };
+
+        /* Retrieves opcode of packet being written */
+        uint16_t GetOpcode() { return opcode; };
+        /* Retrieves write cursor position before write attempt */
+        size_t GetPosition() { return position; };
+        /* Retrieves the size we attempted to write */
+        size_t GetAttemptSize() { return attemptSize; };
+
+    private:
+        /* opcode of packet being written */
+        uint16_t opcode;
+        /* write cursor position before write attempt */
+        size_t position;
+        /* size we attempted to write */
+        size_t attemptSize;
+};
+
+class WireFrame;
+
+/* Shared pointer to immutable serialized packet */
+typedef std::shared_ptr<const WireFrame> WireFramePtr;
+
 /* Class wrapping game packet header and contents */
 class GamePacket
 {
@@ -35,8 +70,16 @@ class GamePacket
         GamePacket();
         /* constructor for known packet headers */
         GamePacket(uint16_t opcode, uint16_t size = 0);
+        /* move constructor; pooled storage is taken over, inline contents are copied */
+        GamePacket(GamePacket&& other);
         ~GamePacket();
 
+        /* move assignment; pooled storage is taken over, inline contents are copied */
+        GamePacket& operator = (GamePacket&& other);
+
+        /* Reinitializes packet for new contents of given size, keeping its storage; contents may be then
+         * filled directly through GetData, typically when read from socket */
+        void Reset(uint16_t opcode, uint16_t size = 0);
         /* Sets opcode */
         void SetOpcode(uint16_t opcode);
         /* Sets data, typically when read from socket */
@@ -48,8 +91,13 @@ class GamePacket
         /* Retrieves packet contents size (excluding header!) */
         uint16_t GetSize();
 
+        /* Retrieves serialized packet; it's encoded only once and shared until the packet is modified */
+        WireFramePtr GetWireFrame();
+
         /* Sets read cursor position */
         void SetReadPos(uint16_t pos);
+        /* Retrieves count of bytes not read yet */
+        uint16_t GetRemainingSize();
         /* Retrieves location of write cursor */
         uint16_t GetWritePos();
 
@@ -69,6 +117,10 @@ class GamePacket
         int8_t ReadInt8();
         /* Reads 32bit floating point number on current location */
         float ReadFloat();
+        /* Reads variable length unsigned integer on current location */
+        uint32_t ReadVarUInt();
+        /* Reads variable length signed (zigzag encoded) integer on current location */
+        int32_t ReadVarInt();
 
         /* Writes zero-terminated string on current location */
         void WriteString(const char* str);
@@ -86,6 +138,16 @@ class GamePacket
         void WriteInt8(int8_t val);
         /* Writes 32bit floating point number on current location */
         void WriteFloat(float val);
+        /* Writes variable length unsigned integer on current location; 7 bits per byte, lowest bits first */
+        void WriteVarUInt(uint32_t val);
+        /* Writes variable length signed integer on current location; zigzag encoded, so small negative values are short too */
+        void WriteVarInt(int32_t val);
+        /* Writes raw data on current location */
+        void WriteData(const uint8_t* data, size_t size);
+        /* Makes room for given count of bytes on current location and moves the write cursor behind them;
+         * returns pointer to them, so they could be filled directly; throws PacketWriteException, if the contents
+         * would not fit 16bit size of header */
+        uint8_t* Extend(size_t size);
 
         /* Writes 32bit unsigned integer at specified position */
         void WriteUInt32At(uint32_t val, uint16_t position);
@@ -98,22 +160,41 @@ class GamePacket
         /* Internal method for reading general data regardless of their type */
         void _Read(void* dst, size_t size);
         /* Internal method for writing general data regardless of their type */
-        void _Write(void* data, size_t size);
+        void _Write(const void* data, size_t size);
         /* Internal method for writing general data regardless of their type on specified location */
         void _WriteAt(void* data, size_t size, uint16_t position);
+        /* Makes sure the storage is able to hold given count of bytes, keeps current contents */
+        void _Reserve(size_t size);
+        /* Returns pooled storage (if any) and switches back to inline storage */
+        void _ReleaseStorage();
+        /* Takes storage and state of other packet, leaving it empty */
+        void _MoveFrom(GamePacket& other);
 
         /* packet opcode */
         uint16_t m_opcode;
         /* contents size (excluding header) */
         uint16_t m_size;
 
-        /* packet contents (excluding header) */
-        std::vector<uint8_t> m_data;
+        /* packet contents (excluding header); points either to inline storage, or to pooled buffer */
+        uint8_t* m_data;
+        /* count of bytes the storage is able to hold */
+        size_t m_capacity;
+        /* inline storage for small packets */
+        uint8_t m_inlineData[GAMEPACKET_INLINE_SIZE];
 
         /* read cursor (points to first byte, that will be read by next Read* method) */
         uint16_t m_readPos;
         /* write cursor (points to first byte, that will be written by next Write* method) */
         uint16_t m_writePos;
+
+        /* serialized packet, if already encoded */
+        WireFramePtr m_wireFrame;
+
+    private:
+        /* disable copying */
+        GamePacket(GamePacket const&);
+        /* disable assignment */
+        GamePacket& operator = (GamePacket const&);
 };
 
 #endif
@@ -1,30 +1,30 @@
 #include "General.h"
 #include "GamePacket.h"
 #include "Network.h"
+#include "NetworkWorker.h"
+#include "SessionRegistry.h"
 #include "Log.h"
 #include "Config.h"
 #include "Session.h"
 #include "Player.h"
-#include "Helpers.h"
-#include "Gameplay.h"
-#include "Room.h"
+#include "Opcodes.h"
+#include "OpcodeStats.h"
 
-Network::Network() : m_networkThread(nullptr)
-{
-    m_recvBytesCount = 0;
-    m_sentBytesCount = 0;
-    m_recvPacketsCount = 0;
-    m_sentPacketsCount = 0;
-}
+/* nesting level of send batches on this thread */
+static thread_local uint32_t t_sendBatchLevel = 0;
+/* mask of workers, that have something scheduled for flush during send batch on this thread */
+static thread_local uint64_t t_sendBatchPending = 0;
+/* nesting level of snapshot collection on this thread */
+static thread_local uint32_t t_snapshotLevel = 0;
 
-Network::~Network()
+Network::Network() : m_isRunning(false)
 {
-    //
+    m_sessionRegistry = new SessionRegistry();
 }
 
-void runNetworkThread()
+Network::~Network()
 {
-    sNetwork->Run();
+    delete m_sessionRegistry;
 }
 
 bool Network::Startup()
@@ -59,20 +59,6 @@ bool Network::Startup()
     }
 #endif
 
-    // create socket as Internet TCP socket
-    if ((m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == -1)
-    {
-        sLog->Error("Failed to create socket");
-        return false;
-    }
-
-    int param = 1;
-    if (setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&param, sizeof(int)) == -1)
-    {
-        sLog->Error("Failed to use SO_REUSEADDR flag, bind may fail due to orphan connections to old socket");
-        // do not fail whole process, this is not mandatory
-    }
-
     // retrieve address
     std::string bindAddr = sConfig->GetStringValue(CONF_BIND_IP);
 
@@ -93,37 +79,43 @@ bool Network::Startup()
         return false;
     }
 
-    // bind to network interface/address
-    if (bind(m_socket, (sockaddr*)&m_sockAddr, sizeof(m_sockAddr)) == -1)
+    int threads = sConfig->GetIntValue(CONF_NETWORK_THREADS);
+    if (threads < 1 || threads > NETWORK_MAX_THREADS)
     {
-        sLog->Error("Failed to bind socket to %s:%u errno: %u", bindAddr.c_str(), m_port, LASTERROR());
-        return false;
+        sLog->Error("Invalid network thread count %i specified, using 1", threads);
+        threads = 1;
     }
 
-    // create listen queue to be checked
-    if (listen(m_socket, NETWORK_LISTEN_BACKLOG_SIZE) == -1)
+#if defined(_WIN32) || !defined(SO_REUSEPORT)
+    // without SO_REUSEPORT, there's no way to share the port among workers
+    if (threads > 1)
     {
-        sLog->Error("Couldn't create connection queue");
-        return false;
+        sLog->Error("Multiple network threads are not supported on this platform, using 1");
+        threads = 1;
     }
-
-    // switch socket to nonblocking mode
-#ifdef _WIN32
-    u_long arg = WINSOCK_NONBLOCKING_ARG;
-    if (ioctlsocket(m_socket, FIONBIO, &arg) == SOCKET_ERROR)
-#else
-    int oldFlag = fcntl(m_socket, F_GETFL, 0);
-    if (fcntl(m_socket, F_SETFL, oldFlag | O_NONBLOCK) == -1)
 #endif
+
+    // every worker has its own listening socket bound to the same address
+    for (int i = 0; i < threads; i++)
     {
-        sLog->Error("Failed to switch socket to non-blocking mode");
+        NetworkWorker* worker = new NetworkWorker((uint32_t)i);
+        m_workers.push_back(worker);
+
+        if (!worker->Startup(m_sockAddr, threads > 1))
+        {
+            sLog->Error("Failed to start network worker %i", i);
+            return false;
+        }
     }
 
     sLog->Info("Listening on %s:%u", bindAddr.c_str(), m_port);
 
-    sLog->Info("Starting network thread");
+    sLog->Info("Starting %i network thread(s)", threads);
+
+    SetRunningFlag(true);
 
-    m_networkThread = new std::thread(runNetworkThread);
+    for (std::vector<NetworkWorker*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
+        (*itr)->Start();
 
     sLog->Info("Networking started successfully!\n");
 
@@ -136,11 +128,10 @@ void Network::Shutdown()
 
     SetRunningFlag(false);
 
-    m_networkThread->join();
+    for (std::vector<NetworkWorker*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
+        (*itr)->Shutdown();
 
-    sLog->Info("Networking thread stopped, closing socket");
-
-    CloseSocket_gen(m_socket);
+    sLog->Info("Networking threads stopped, sockets closed");
 }
 
 void Network::SetRunningFlag(bool state)
@@ -157,347 +148,179 @@ bool Network::IsRunning()
     return m_isRunning;
 }
 
-void Network::Run()
+void Network::CloseSocket_gen(SOCK socket)
 {
-    SetRunningFlag(true);
-
-    // Main network update loop
-    while (IsRunning())
-    {
-        sNetwork->Update();
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
-    }
+#ifdef _WIN32
+    shutdown(socket, SD_BOTH);
+    closesocket(socket);
+#else
+    close(socket);
+#endif
 }
 
-void Network::Update()
+void Network::SendPacket(Player* plr, GamePacket &pkt)
 {
-    // look into connection queue and accept new connections if any
-    AcceptConnections();
-
-    // if there are some clients, perform read, detect disconnections, etc.
-    if (!m_clients.empty())
-        UpdateClients();
+    SendPacket(plr->GetSession(), pkt);
 }
 
-void Network::AcceptConnections()
+void Network::SendPacket(Session* sess, GamePacket &pkt)
 {
-    SOCK res;
-    int error;
-    Player* plr;
-    sockaddr_in accaddr;
-    socklen_t addrlen = sizeof(accaddr);
-    char tmpaddr[INET_ADDRSTRLEN];
-
-    // try to accept incoming connection
-    res = accept(m_socket, (sockaddr*)&accaddr, &addrlen);
-    error = LASTERROR();
-
-    // no valid connection
-    if (res == INVALID_SOCKET)
-    {
-        // nonblocking socket returns "would block" state in error variable when no connection is
-        // there to be accepted
-
-        if (error != SOCKETWOULDBLOCK)
-            sLog->Error("Socket error: %i", error);
-    }
-    else // this means we just accepted valid connection
-    {
-        INET_NTOP(AF_INET, &accaddr.sin_addr, tmpaddr, INET_ADDRSTRLEN);
+    SendFrame(sess, pkt.GetWireFrame());
+}
 
-        // create new player, set connection info to his session instance
-        plr = new Player();
-        plr->GetSession()->SetConnectionInfo(res, accaddr, tmpaddr);
+void Network::SendFrame(Session* sess, WireFramePtr const& frame, WireFramePtr const& compactFrame)
+{
+    sLog->Debug("NETWORK: Sending packet %u", frame->GetOpcode());
 
-#ifdef _WIN32
-        u_long arg = WINSOCK_NONBLOCKING_ARG;
-        if (ioctlsocket(res, FIONBIO, &arg) == SOCKET_ERROR)
-#else
-        int oldFlag = fcntl(m_socket, F_GETFL, 0);
-        if (fcntl(res, F_SETFL, oldFlag | O_NONBLOCK) == -1)
-#endif
-        {
-            sLog->Error("Failed to switch socket to non-blocking mode");
-        }
+    // clients using compact encoding get compact variant of packet, if there's any
+    bool compact = compactFrame && sess->HasClientFlag(CLIENT_FLAG_COMPACT_ENCODING);
 
-        sLog->Debug("Accepting connection from: %s", tmpaddr);
+    // packets merged into snapshot are counted with their own size as well
+    if (frame->GetOpcode() < OPCODE_MAX)
+        sOpcodeStats->RecordSent(frame->GetOpcode(), compact ? compactFrame->GetSize() : frame->GetSize());
 
-        // insert into client list
-        InsertClient(plr);
+    // clients supporting snapshots get everything sent to them during room update at once; players, who are not
+    // in room anymore, would not have their snapshots finished
+    if (t_snapshotLevel > 0 && sess->HasClientFlag(CLIENT_FLAG_WORLD_SNAPSHOT) && sess->GetPlayer()->GetRoomId() != 0)
+    {
+        // snapshot reads positions from plain heartbeats, and encodes them on its own
+        if (sess->AddToSnapshot((compact && frame->GetOpcode() != SP_MOVE_HEARTBEAT) ? compactFrame : frame))
+            ScheduleFlush(sess);
+        return;
     }
+
+    // packet is just queued, it will be sent from network thread
+    if (sess->QueueFrame(compact ? compactFrame : frame))
+        ScheduleFlush(sess);
 }
 
-void Network::CloseSocket_gen(SOCK socket)
+void Network::FinishSnapshot(Session* sess)
 {
-#ifdef _WIN32
-    shutdown(socket, SD_BOTH);
-    closesocket(socket);
-#else
-    close(socket);
-#endif
+    if (sess->FinishSnapshot())
+        ScheduleFlush(sess);
 }
 
-void Network::UpdateClients()
+void Network::ScheduleFlush(Session* sess)
 {
-    uint16_t header_buf[2];
-    int result;
-    int error;
-    Player* plr;
-    Session* sess;
-    uint8_t* recvdata;
-    GamePacket pkt;
-    time_t tmout;
-
-    // go through all clients
-    for (std::list<ClientRecord*>::iterator itr = m_clients.begin(); itr != m_clients.end(); )
-    {
-        plr = (*itr)->player;
-        sess = plr->GetSession();
-
-        // if the session is marked as expired, disconnect client
-        if (sess->IsMarkedAsExpired())
-        {
-            sLog->Debug("Client session (IP: %s) expired, disconnecting", sess->GetRemoteAddr());
-            CloseSocket_gen(sess->GetSocket());
-            itr = RemoveClient(itr);
-            continue;
-        }
-
-        // if session is marked for expiration, wait for it
-        // expired sessions are not valid anymore - they are just kept in list for possible retrieval
-        // by another session
-        if ((tmout = sess->GetSessionTimeoutValue()) != 0)
-        {
-            if (tmout < time(nullptr))
-                sess->Kick();
+    NetworkWorker* worker = sess->GetWorker();
 
-            ++itr;
-            continue;
-        }
-
-        // try to read from socket assigned to client
-        result = recv(sess->GetSocket(), (char*)&header_buf, GAMEPACKET_HEADER_SIZE, 0);
-        error = LASTERROR();
+    worker->AddPendingFlush(sess);
 
-        // some data available
-        if (result > 0)
-        {
-            header_buf[0] = ntohs(header_buf[0]);
-            header_buf[1] = ntohs(header_buf[1]);
-
-            m_recvBytesCount += GAMEPACKET_HEADER_SIZE;
-
-            // size read must be equal to header length
-            if (result == GAMEPACKET_HEADER_SIZE && header_buf[1] < MAX_GAME_PACKET_SIZE)
-            {
-                // packet contents may be empty as well
-                if (header_buf[1] > 0)
-                {
-                    // following memory is deallocated in GamePacket destructor, or in near error handler
-                    recvdata = new uint8_t[header_buf[1]];
-                    result = recv(sess->GetSocket(), (char*)recvdata, header_buf[1], 0);
-                    error = LASTERROR();
-
-                    // malformed packet - received less bytes than expected
-                    if (result != (int)header_buf[1])
-                    {
-                        delete[] recvdata;
-
-                        sLog->Error("Received malformed packet: opcode %u, size %u, real size %u; disconnecting client (IP: %s)", header_buf[0], header_buf[1], result, sess->GetRemoteAddr());
-                        //CloseSocket_gen(sess->GetSocket());
-                        itr = RemoveClient(itr);
-                        continue;
-                    }
-
-                    m_recvBytesCount += (int64_t)header_buf[1];
-                }
-
-                // build packet (this will cause previous packet destructor call and new packet constructor call)
-                pkt = GamePacket(header_buf[0], header_buf[1]);
-
-                m_recvPacketsCount++;
-
-                // pass the data, if any
-                if (header_buf[1] > 0)
-                    pkt.SetData(recvdata, header_buf[1]);
-
-                // and let the session handle the packet - cleanup is done in GamePacket destructor
-                sess->HandlePacket(pkt);
-            }
-            else
-            {
-                sLog->Error("Received malformed packet: no valid headers sent; disconnecting client (IP: %s)", sess->GetRemoteAddr());
-                CloseSocket_gen(sess->GetSocket());
-                itr = RemoveClient(itr);
-                continue;
-            }
-        }
-        // connection abort, this may be due to network error
-        else if (error == SOCKETCONNABORT)
-        {
-            // set timeout if necessary
-            if (!sess->GetSessionTimeoutValue())
-            {
-                sess->SetSessionTimeoutValue(SESSION_INACTIVITY_EXPIRE);
-                sLog->Error("Client (IP: %s) aborted connection, marking session as expired and waiting for timeout", sess->GetRemoteAddr());
-            }
-        }
-        // connection closed by remote endpoint (either controlled or errorneous scenario, but initiated by client)
-        else if (error == SOCKETCONNRESET)
-        {
-            if (plr->GetRoomId())
-            {
-                // set timeout if necessary
-                if (!sess->GetSessionTimeoutValue())
-                {
-                    sess->SetSessionTimeoutValue(SESSION_INACTIVITY_EXPIRE);
-                    sLog->Debug("Client (IP: %s) disconnected in room, marking session as expired and waiting for timeout", sess->GetRemoteAddr());
-                }
-
-                ++itr;
-            }
-            else
-            {
-                sLog->Debug("Client (IP: %s) disconnected", sess->GetRemoteAddr());
-                itr = RemoveClient(itr);
-            }
-
-            continue;
-        }
-        else
-        {
-            // just check, if the error is caused by nonblocking socket, that would block, or that there's
-            // no error at all (should not happen due to previous condition blocks, technically result == 0 means,
-            // that we have some error set)
-            if (error != SOCKETWOULDBLOCK && error != 0)
-            {
-                sLog->Error("Unhandled socket error: %u; disconnecting client (IP: %s)", error, sess->GetRemoteAddr());
-                CloseSocket_gen(sess->GetSocket());
-                itr = RemoveClient(itr);
-                continue;
-            }
-        }
+    // worker flushes all pending sessions at the end of each update
+    if (worker->IsWorkerThread())
+        return;
 
-        ++itr;
+    // wake worker up when the batch ends
+    if (t_sendBatchLevel > 0)
+    {
+        t_sendBatchPending |= ((uint64_t)1) << worker->GetIndex();
+        return;
     }
-}
-
-void Network::InsertClient(Player* plr)
-{
-    ClientRecord* cr = new ClientRecord;
 
-    cr->player = plr;
-    // defaulting connection state to "auth" since we need the player to log in first
-    plr->GetSession()->SetConnectionState(CONNECTION_STATE_AUTH);
-
-    m_clients.push_back(cr);
+    worker->WakeUp();
 }
 
-std::list<ClientRecord*>::iterator Network::RemoveClient(std::list<ClientRecord*>::iterator rec)
+void Network::WakeUpWorkers(uint64_t workerMask)
 {
-    // lookup client in rooms, to remove him from here
-    if ((*rec)->player->GetRoomId() > 0)
+    for (std::vector<NetworkWorker*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
     {
-        Room* rm = sGameplay->GetRoom((*rec)->player->GetRoomId());
-        rm->RemovePlayer((*rec)->player);
+        if (workerMask & (((uint64_t)1) << (*itr)->GetIndex()))
+            (*itr)->WakeUp();
     }
+}
 
-    delete (*rec)->player->GetSession();
-    delete (*rec)->player;
-
-    return m_clients.erase(rec);
+void Network::RegisterSession(Session* sess)
+{
+    std::unique_lock<std::recursive_mutex> lck(clientDirectoryLock);
+    m_sessionRegistry->Add(sess);
 }
 
-void Network::SendPacket(Player* plr, GamePacket &pkt)
+void Network::UnregisterSession(Session* sess)
 {
-    SendPacket(plr->GetSession()->GetSocket(), pkt);
+    std::unique_lock<std::recursive_mutex> lck(clientDirectoryLock);
+    m_sessionRegistry->Remove(sess);
 }
 
-void Network::SendPacket(Session* sess, GamePacket &pkt)
+void Network::UpdateSessionIndex(Session* sess)
 {
-    SendPacket(sess->GetSocket(), pkt);
+    std::unique_lock<std::recursive_mutex> lck(clientDirectoryLock);
+    m_sessionRegistry->Update(sess);
 }
 
-void Network::SendPacket(SOCK socket, GamePacket &pkt)
+Session* Network::FindSessionBySocket(SOCK socket)
 {
-    uint16_t op, sz;
-    uint8_t* tosend = new uint8_t[GAMEPACKET_HEADER_SIZE + pkt.GetSize()];
+    std::unique_lock<std::recursive_mutex> lck(clientDirectoryLock);
+    return m_sessionRegistry->FindBySocket(socket);
+}
 
-    sLog->Debug("NETWORK: Sending packet %u", pkt.GetOpcode());
+Session* Network::FindSessionByPlayerId(uint32_t playerId)
+{
+    std::unique_lock<std::recursive_mutex> lck(clientDirectoryLock);
+    return m_sessionRegistry->FindByPlayerId(playerId);
+}
 
-    op = htons(pkt.GetOpcode());
-    sz = htons(pkt.GetSize());
+Session* Network::FindSessionBySessionKey(const char* sessionKey, Session* except)
+{
+    std::unique_lock<std::recursive_mutex> lck(clientDirectoryLock);
+    return m_sessionRegistry->FindBySessionKey(sessionKey, except);
+}
 
-    // write opcode
-    memcpy(tosend, &op, 2);
-    // write contents size
-    memcpy(tosend + 2, &sz, 2);
-    // write contents
-    memcpy(tosend + 4, pkt.GetData(), pkt.GetSize());
+uint64_t Network::GetRecvBytesCount()
+{
+    uint64_t total = 0;
 
-    m_sentBytesCount += pkt.GetSize() + GAMEPACKET_HEADER_SIZE;
-    m_sentPacketsCount++;
+    for (std::vector<NetworkWorker*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
+        total += (*itr)->GetRecvBytesCount();
 
-    // send response
-    send(socket, (const char*)tosend, pkt.GetSize() + GAMEPACKET_HEADER_SIZE, MSG_NOSIGNAL);
+    return total;
 }
 
-Session* Network::FindSessionByPlayerId(uint32_t playerId)
+uint64_t Network::GetSentBytesCount()
 {
-    for (std::list<ClientRecord*>::iterator itr = m_clients.begin(); itr != m_clients.end(); ++itr)
-    {
-        if ((*itr)->player->GetId() == playerId)
-            return (*itr)->player->GetSession();
-    }
+    uint64_t total = 0;
+
+    for (std::vector<NetworkWorker*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
+        total += (*itr)->GetSentBytesCount();
 
-    return nullptr;
+    return total;
 }
 
-Session* Network::FindSessionBySessionKey(const char* sessionKey, Session* except)
+uint64_t Network::GetRecvPacketsCount()
 {
-    Session* sess;
+    uint64_t total = 0;
 
-    for (std::list<ClientRecord*>::iterator itr = m_clients.begin(); itr != m_clients.end(); ++itr)
-    {
-        sess = (*itr)->player->GetSession();
-        if (sess != except && strcmp(sess->GetSessionKey(), sessionKey) == 0)
-            return sess;
-    }
+    for (std::vector<NetworkWorker*>::iterator itr = m_workers.begin(); itr != m_workers.end(); ++itr)
+        total += (*itr)->GetRecvPacketsCount();
 
-    return nullptr;
+    return total;
 }
 
-void Network::OverridePlayerClient(Player* oldplayer, Player* newplayer)
+uint64_t Network::GetSentPacketsCount()
 {
-    for (std::list<ClientRecord*>::iterator itr = m_clients.begin(); itr != m_clients.end(); ++itr)
-    {
-        // this will switch client records between old and new player records
-
-        if ((*itr)->player == oldplayer)
-            (*itr)->player = newplayer;
-        else if ((*itr)->player == newplayer)
-            (*itr)->player = oldplayer;
-    }
+    return sOpcodeStats->GetSentPacketsCount();
 }
 
-uint64_t Network::GetRecvBytesCount()
+SendBatchGuard::SendBatchGuard()
 {
-    return m_recvBytesCount;
+    t_sendBatchLevel++;
 }
 
-uint64_t Network::GetSentBytesCount()
+SendBatchGuard::~SendBatchGuard()
 {
-    return m_sentBytesCount;
+    // wake workers up, if anything was queued for them during outermost batch
+    if (--t_sendBatchLevel == 0 && t_sendBatchPending)
+    {
+        sNetwork->WakeUpWorkers(t_sendBatchPending);
+        t_sendBatchPending = 0;
+    }
 }
 
-uint64_t Network::GetRecvPacketsCount()
+SnapshotGuard::SnapshotGuard()
 {
-    return m_recvPacketsCount;
+    t_snapshotLevel++;
 }
 
-uint64_t Network::GetSentPacketsCount()
+SnapshotGuard::~SnapshotGuard()
 {
-    return m_sentPacketsCount;
+    t_snapshotLevel--;
 }
-
@@ -5,6 +5,8 @@
 #include "GamePacket.h"
 
 #include <list>
+#include <vector>
+#include <atomic>
 
 /* Macro madness for main differences between Windows and Linux approach.
  * I personally need Windows-stuff because I use Windows for development.
@@ -31,6 +33,9 @@
  #include <string>
  #include <netdb.h>
  #include <fcntl.h>
+ #include <sys/epoll.h>
+ #include <sys/eventfd.h>
+ #include <sys/uio.h>
 
  #define SOCK int
  #define ADDRLEN socklen_t
@@ -66,6 +71,13 @@
 /* WinSock nonblocking flag; this value is not defined in any WinSock headers, but is described as constant */
 #define WINSOCK_NONBLOCKING_ARG 1
 
+/* maximum number of events retrieved from epoll in one wait call */
+#define NETWORK_MAX_EVENTS 256
+/* interval in milliseconds for checking session expiration and timeouts; also the longest time we block waiting for events */
+#define NETWORK_HOUSEKEEPING_INTERVAL 100
+/* maximum count of network worker threads (workers pending for wakeup are stored in 64bit mask) */
+#define NETWORK_MAX_THREADS 64
+
 /* enumeration of allowed connection states */
 enum ConnectionState
 {
@@ -78,14 +90,8 @@ enum ConnectionState
 
 class Player;
 class Session;
-
-/* Client record used when storing active player */
-struct ClientRecord
-{
-    Player* player;
-
-    // something more? bytes transferred? packets received/sent?
-};
+class NetworkWorker;
+class SessionRegistry;
 
 /* Networking singleton class */
 class Network
@@ -94,29 +100,43 @@ class Network
     public:
         ~Network();
 
-        /* Main method for running network updates */
-        void Run();
-
         /* Shuts whole networking down */
         void Shutdown();
 
         /* Starts up networking, prepares everything needed to be run */
         bool Startup();
-        /* Accepts new connections and processes messages/errors on currently estabilished ones */
-        void Update();
+
+        /* Is server still intended to run? */
+        bool IsRunning();
 
         /* Sends packet to specific player */
         void SendPacket(Player* plr, GamePacket &pkt);
         /* Sends packet to specific session */
         void SendPacket(Session* sess, GamePacket &pkt);
-
+        /* Sends already serialized packet to specific session; clients using compact encoding get compact variant, if supplied */
+        void SendFrame(Session* sess, WireFramePtr const& frame, WireFramePtr const& compactFrame = WireFramePtr());
+        /* Sends snapshot collected for session, if there's any */
+        void FinishSnapshot(Session* sess);
+
+        /* Wakes up all workers present in supplied mask (bit position = worker index) */
+        void WakeUpWorkers(uint64_t workerMask);
+
+        /* Adds session to lookup indexes */
+        void RegisterSession(Session* sess);
+        /* Removes session from lookup indexes */
+        void UnregisterSession(Session* sess);
+        /* Updates lookup indexes after change of player ID or session key of session */
+        void UpdateSessionIndex(Session* sess);
+
+        /* Finds session using its socket */
+        Session* FindSessionBySocket(SOCK socket);
         /* Finds session using player ID */
         Session* FindSessionByPlayerId(uint32_t playerId);
         /* Finds session using session key */
         Session* FindSessionBySessionKey(const char* sessionKey, Session* except = nullptr);
 
-        /* Overrides player in client map */
-        void OverridePlayerClient(Player* oldplayer, Player* newplayer);
+        /* Closes client socket using OS-dependent routines */
+        void CloseSocket_gen(SOCK socket);
 
         /* retrieves received bytes count */
         uint64_t GetRecvBytesCount();
@@ -128,58 +148,56 @@ class Network
         /* retrieves sent packets count */
         uint64_t GetSentPacketsCount();
 
+        /* lock for client lists of all workers; has to be held when looking up or destroying sessions, since
+         * the session may belong to another worker */
+        std::recursive_mutex clientDirectoryLock;
+
     protected:
         /* Hidden singleton constructor */
         Network();
 
     private:
-        /* Accept new connections if any */
-        void AcceptConnections();
-        /* Reads data from all sockets enlisted, detects connection problems, disconnections, etc. */
-        void UpdateClients();
-
         /* Sets running flag */
         void SetRunningFlag(bool state);
-        /* Is server still intended to run? */
-        bool IsRunning();
-
-        /* Sends game packet to specified socket */
-        void SendPacket(SOCK socket, GamePacket &pkt);
 
-        /* Closes client socket using OS-dependent routines */
-        void CloseSocket_gen(SOCK socket);
+        /* Schedules session send queue to be flushed by its worker */
+        void ScheduleFlush(Session* sess);
 
-        /* Inserts new client to internal list */
-        void InsertClient(Player* plr);
-        /* Removes existing client (using iterators, cause it's used inside list-iterating loop) */
-        std::list<ClientRecord*>::iterator RemoveClient(std::list<ClientRecord*>::iterator rec);
-
-        /* Server socket */
-        SOCK m_socket;
         /* Server socket info */
         sockaddr_in m_sockAddr;
         /* Currently used port */
         unsigned short m_port;
 
-        /* List of all connected clients */
-        std::list<ClientRecord*> m_clients;
-
-        /* instance of network thread */
-        std::thread* m_networkThread;
+        /* network I/O workers, each with its own listening socket and clients */
+        std::vector<NetworkWorker*> m_workers;
+        /* lookup indexes of sessions of all workers; guarded by client directory lock */
+        SessionRegistry* m_sessionRegistry;
 
         /* is server still intended to run? */
         bool m_isRunning;
 
         /* generic networking mutex */
         std::mutex generic_mtx;
+};
 
-        uint64_t m_recvBytesCount;
-        uint64_t m_sentBytesCount;
+#define sNetwork Singleton<Network>::getInstance()
 
-        uint64_t m_recvPacketsCount;
-        uint64_t m_sentPacketsCount;
+/* Guard for batching packets sent from current thread; network workers are woken up just once, when
+ * the outermost batch ends, so all packets of batch are flushed using as few syscalls as possible */
+class SendBatchGuard
+{
+    public:
+        SendBatchGuard();
+        ~SendBatchGuard();
 };
 
-#define sNetwork Singleton<Network>::getInstance()
+/* Guard for collecting packets sent from current thread into snapshots; packets for clients supporting
+ * snapshots are not sent immediately, but stored until the owner of guard finishes snapshots of its players */
+class SnapshotGuard
+{
+    public:
+        SnapshotGuard();
+        ~SnapshotGuard();
+};
 
 #endif
@@ -0,0 +1,670 @@
+#include "General.h"
+#include "GamePacket.h"
+#include "Network.h"
+#include "NetworkWorker.h"
+#include "Log.h"
+#include "Session.h"
+#include "Player.h"
+#include "Helpers.h"
+#include "Gameplay.h"
+#include "Room.h"
+#include "Storage.h"
+
+#include <algorithm>
+
+/* worker running on this thread, if any */
+static thread_local NetworkWorker* t_currentWorker = nullptr;
+
+NetworkWorker::NetworkWorker(uint32_t index) : m_index(index), m_socket(INVALID_SOCKET), m_thread(nullptr)
+{
+#ifndef _WIN32
+    m_epollFd = -1;
+    m_wakeupFd = -1;
+#endif
+    m_recvBytesCount = 0;
+    m_sentBytesCount = 0;
+    m_recvPacketsCount = 0;
+}
+
+NetworkWorker::~NetworkWorker()
+{
+#ifndef _WIN32
+    if (m_wakeupFd != -1)
+        close(m_wakeupFd);
+    if (m_epollFd != -1)
+        close(m_epollFd);
+#endif
+}
+
+void runNetworkWorker(NetworkWorker* worker)
+{
+    worker->Run();
+}
+
+bool NetworkWorker::Startup(sockaddr_in &bindAddr, bool reusePort)
+{
+    // create socket as Internet TCP socket
+    if ((m_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
+    {
+        sLog->Error("Failed to create socket");
+        return false;
+    }
+
+    int param = 1;
+    if (setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&param, sizeof(int)) == -1)
+    {
+        sLog->Error("Failed to use SO_REUSEADDR flag, bind may fail due to orphan connections to old socket");
+        // do not fail whole process, this is not mandatory
+    }
+
+#ifdef SO_REUSEPORT
+    // every worker binds its own socket to the same address, the kernel then distributes incoming connections among them
+    if (reusePort && setsockopt(m_socket, SOL_SOCKET, SO_REUSEPORT, (const char*)&param, sizeof(int)) == -1)
+    {
+        sLog->Error("Failed to use SO_REUSEPORT flag, errno: %u", LASTERROR());
+        return false;
+    }
+#endif
+
+    // bind to network interface/address
+    if (bind(m_socket, (sockaddr*)&bindAddr, sizeof(bindAddr)) == -1)
+    {
+        sLog->Error("Failed to bind socket to port %u errno: %u", ntohs(bindAddr.sin_port), LASTERROR());
+        return false;
+    }
+
+    // create listen queue to be checked
+    if (listen(m_socket, NETWORK_LISTEN_BACKLOG_SIZE) == -1)
+    {
+        sLog->Error("Couldn't create connection queue");
+        return false;
+    }
+
+    // switch socket to nonblocking mode
+#ifdef _WIN32
+    u_long arg = WINSOCK_NONBLOCKING_ARG;
+    if (ioctlsocket(m_socket, FIONBIO, &arg) == SOCKET_ERROR)
+#else
+    int oldFlag = fcntl(m_socket, F_GETFL, 0);
+    if (fcntl(m_socket, F_SETFL, oldFlag | O_NONBLOCK) == -1)
+#endif
+    {
+        sLog->Error("Failed to switch socket to non-blocking mode");
+    }
+
+#ifndef _WIN32
+    // create epoll instance, we will wait for socket events using it
+    if ((m_epollFd = epoll_create1(0)) == -1)
+    {
+        sLog->Error("Failed to create epoll instance, errno: %u", LASTERROR());
+        return false;
+    }
+
+    // register listening socket; null data pointer distinguishes it from client records
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_socket, &ev) == -1)
+    {
+        sLog->Error("Failed to register listening socket to epoll, errno: %u", LASTERROR());
+        return false;
+    }
+
+    // create event descriptor for waking worker thread up from other threads
+    if ((m_wakeupFd = eventfd(0, EFD_NONBLOCK)) == -1)
+    {
+        sLog->Error("Failed to create wakeup event descriptor, errno: %u", LASTERROR());
+        return false;
+    }
+
+    // its data pointer points to descriptor itself to be distinguished from other records
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &m_wakeupFd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeupFd, &ev) == -1)
+    {
+        sLog->Error("Failed to register wakeup event descriptor to epoll, errno: %u", LASTERROR());
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+void NetworkWorker::Start()
+{
+    m_thread = new std::thread(runNetworkWorker, this);
+}
+
+void NetworkWorker::Shutdown()
+{
+    WakeUp();
+
+    if (m_thread)
+    {
+        m_thread->join();
+        delete m_thread;
+        m_thread = nullptr;
+    }
+
+    if (m_socket != INVALID_SOCKET)
+        sNetwork->CloseSocket_gen(m_socket);
+
+    // event descriptors are kept until the worker is destroyed - rooms may still let players go, and wake the
+    // worker up; whatever is passed to stopped worker is just never processed
+}
+
+uint32_t NetworkWorker::GetIndex()
+{
+    return m_index;
+}
+
+bool NetworkWorker::IsWorkerThread()
+{
+    return t_currentWorker == this;
+}
+
+void NetworkWorker::Run()
+{
+    t_currentWorker = this;
+
+    m_lastHousekeepingTime = getMSTime();
+
+    // Main network update loop
+    while (sNetwork->IsRunning())
+        Update();
+}
+
+void NetworkWorker::Update()
+{
+#ifdef _WIN32
+    // no epoll on Windows - look into connection queue and accept new connections if any
+    AcceptConnections();
+
+    // if there are some clients, perform read, detect disconnections, etc.
+    if (!m_clients.empty())
+        UpdateClients();
+
+    // complete requests executed by storage thread
+    ProcessStorageCompletions();
+    // destroy players, that rooms let go
+    ProcessPlayerReleases();
+
+    // send everything queued
+    FlushPendingSessions();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#else
+    int i, count;
+    epoll_event events[NETWORK_MAX_EVENTS];
+    ClientRecord* rec;
+    uint64_t wakeups;
+
+    // block until there's something to do, but wake up in time for housekeeping
+    count = epoll_wait(m_epollFd, events, NETWORK_MAX_EVENTS, NETWORK_HOUSEKEEPING_INTERVAL);
+    if (count == -1 && LASTERROR() != EINTR)
+        sLog->Error("epoll_wait failed, errno: %u", LASTERROR());
+
+    for (i = 0; i < count; i++)
+    {
+        rec = (ClientRecord*)events[i].data.ptr;
+
+        // listening socket has connections to be accepted
+        if (!rec)
+        {
+            AcceptConnections();
+            continue;
+        }
+
+        // somebody woke us up to flush queued packets, that's done below
+        if (events[i].data.ptr == &m_wakeupFd)
+        {
+            // reset event counter
+            if (read(m_wakeupFd, &wakeups, sizeof(wakeups)) == -1 && LASTERROR() != SOCKETWOULDBLOCK)
+                sLog->Error("Failed to read wakeup event descriptor, errno: %u", LASTERROR());
+            continue;
+        }
+
+        // readable socket, remote hangup or error - all of them are resolved by reading from socket
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+        {
+            if (!ReadClient(rec))
+                continue;
+        }
+
+        // socket has space for data, that did not fit in last time
+        if (events[i].events & EPOLLOUT)
+            FlushSession(rec->session);
+    }
+
+    // complete requests executed by storage thread, responses are flushed right below
+    ProcessStorageCompletions();
+    // destroy players, that rooms let go
+    ProcessPlayerReleases();
+
+    // send everything queued during event processing and by other threads
+    FlushPendingSessions();
+
+    // check for expired sessions and timeouts once in a while
+    if (getMSTimeDiff(m_lastHousekeepingTime, getMSTime()) >= NETWORK_HOUSEKEEPING_INTERVAL)
+    {
+        CheckClientStates();
+        m_lastHousekeepingTime = getMSTime();
+    }
+#endif
+}
+
+void NetworkWorker::AcceptConnections()
+{
+    SOCK res;
+    int error;
+    Player* plr;
+    sockaddr_in accaddr;
+    socklen_t addrlen;
+    char tmpaddr[INET_ADDRSTRLEN];
+
+    // accept everything in queue, since we are notified only once about new connections
+    while (true)
+    {
+        // try to accept incoming connection
+        addrlen = sizeof(accaddr);
+        res = accept(m_socket, (sockaddr*)&accaddr, &addrlen);
+        error = LASTERROR();
+
+        // no valid connection
+        if (res == INVALID_SOCKET)
+        {
+            // nonblocking socket returns "would block" state in error variable when no connection is
+            // there to be accepted
+
+            if (error != SOCKETWOULDBLOCK)
+                sLog->Error("Socket error: %i", error);
+            break;
+        }
+
+        // this means we just accepted valid connection
+        INET_NTOP(AF_INET, &accaddr.sin_addr, tmpaddr, INET_ADDRSTRLEN);
+
+        // create new player, set connection info to his session instance
+        plr = new Player();
+        plr->GetSession()->SetConnectionInfo(res, accaddr, tmpaddr);
+
+#ifdef _WIN32
+        u_long arg = WINSOCK_NONBLOCKING_ARG;
+        if (ioctlsocket(res, FIONBIO, &arg) == SOCKET_ERROR)
+#else
+        int oldFlag = fcntl(m_socket, F_GETFL, 0);
+        if (fcntl(res, F_SETFL, oldFlag | O_NONBLOCK) == -1)
+#endif
+        {
+            sLog->Error("Failed to switch socket to non-blocking mode");
+        }
+
+        sLog->Debug("Accepting connection from: %s (worker %u)", tmpaddr, m_index);
+
+        // insert into client list
+        InsertClient(plr->GetSession());
+    }
+}
+
+void NetworkWorker::UpdateClients()
+{
+    ClientRecord* rec;
+
+    // disconnect expired and kick timed out clients at first
+    CheckClientStates();
+
+    // and read from every client remaining
+    for (std::list<ClientRecord*>::iterator itr = m_clients.begin(); itr != m_clients.end(); )
+    {
+        // move iterator before reading, the record may be removed
+        rec = *itr;
+        ++itr;
+
+        ReadClient(rec);
+    }
+}
+
+void NetworkWorker::CheckClientStates()
+{
+    ClientRecord* rec;
+    Session* sess;
+    time_t tmout;
+
+    // only this worker modifies its client list, so it does not need to lock client directory for iterating
+    for (std::list<ClientRecord*>::iterator itr = m_clients.begin(); itr != m_clients.end(); )
+    {
+        rec = *itr;
+        ++itr;
+
+        sess = rec->session;
+
+        // if the session is marked as expired, disconnect client
+        if (sess->IsMarkedAsExpired())
+        {
+            sLog->Debug("Client session (IP: %s) expired, disconnecting", sess->GetRemoteAddr());
+            RemoveClient(rec);
+            continue;
+        }
+
+        // if session is marked for expiration, wait for it
+        // expired sessions are not valid anymore - they are just kept in list for possible retrieval
+        // by another session
+        if ((tmout = sess->GetSessionTimeoutValue()) != 0 && tmout < time(nullptr))
+            sess->Kick();
+    }
+}
+
+bool NetworkWorker::ReadClient(ClientRecord* rec)
+{
+    int result;
+    int error;
+    Session* sess = rec->session;
+    uint8_t* writePtr;
+    size_t writeSize;
+
+    // read until there's nothing left in socket, we won't be notified about the same data again
+    while (true)
+    {
+        // expired sessions and sessions waiting for timeout are not read anymore; they
+        // will be resolved in next client states check
+        if (sess->IsMarkedAsExpired() || sess->GetSessionTimeoutValue() != 0)
+            return true;
+
+        // read as much as fits into receive buffer
+        writePtr = sess->GetRecvBuffer().GetWritePointer(writeSize);
+
+        // full buffer means there's no complete packet in it, and yet it's larger than allowed maximum
+        if (writeSize == 0)
+        {
+            sLog->Error("Receive buffer overflow; disconnecting client (IP: %s)", sess->GetRemoteAddr());
+            RemoveClient(rec);
+            return false;
+        }
+
+        // try to read from socket assigned to client
+        result = recv(sess->GetSocket(), (char*)writePtr, writeSize, 0);
+        error = LASTERROR();
+
+        // some data available
+        if (result > 0)
+        {
+            sess->GetRecvBuffer().CommitWrite(result);
+            m_recvBytesCount.fetch_add(result, std::memory_order_relaxed);
+
+            // handle every complete packet received so far, incomplete one stays in buffer
+            if (!ProcessReceivedPackets(rec))
+                return false;
+        }
+        // connection abort, this may be due to network error
+        else if (result < 0 && error == SOCKETCONNABORT)
+        {
+            // set timeout if necessary
+            if (!sess->GetSessionTimeoutValue())
+            {
+                sess->SetSessionTimeoutValue(SESSION_INACTIVITY_EXPIRE);
+                sLog->Error("Client (IP: %s) aborted connection, marking session as expired and waiting for timeout", sess->GetRemoteAddr());
+            }
+            return true;
+        }
+        // connection closed by remote endpoint (either controlled or errorneous scenario, but initiated by client)
+        else if (result == 0 || error == SOCKETCONNRESET)
+        {
+            if (sess->GetPlayer()->GetRoomId())
+            {
+                // set timeout if necessary
+                if (!sess->GetSessionTimeoutValue())
+                {
+                    sess->SetSessionTimeoutValue(SESSION_INACTIVITY_EXPIRE);
+                    sLog->Debug("Client (IP: %s) disconnected in room, marking session as expired and waiting for timeout", sess->GetRemoteAddr());
+                }
+
+                return true;
+            }
+
+            sLog->Debug("Client (IP: %s) disconnected", sess->GetRemoteAddr());
+            RemoveClient(rec);
+            return false;
+        }
+        // nonblocking socket, that would block - we read everything available
+        else if (error == SOCKETWOULDBLOCK)
+            return true;
+        else
+        {
+            sLog->Error("Unhandled socket error: %u; disconnecting client (IP: %s)", error, sess->GetRemoteAddr());
+            RemoveClient(rec);
+            return false;
+        }
+    }
+}
+
+bool NetworkWorker::ProcessReceivedPackets(ClientRecord* rec)
+{
+    uint16_t header_buf[2];
+    Session* sess = rec->session;
+    RingBuffer& recvbuf = sess->GetRecvBuffer();
+    GamePacket pkt;
+
+    while (true)
+    {
+        // previous packet may have caused session expiration, do not handle anything else
+        if (sess->IsMarkedAsExpired())
+            return true;
+
+        // header is not complete yet, wait for more data
+        if (!recvbuf.Peek(header_buf, GAMEPACKET_HEADER_SIZE))
+            return true;
+
+        header_buf[0] = ntohs(header_buf[0]);
+        header_buf[1] = ntohs(header_buf[1]);
+
+        if (header_buf[1] >= MAX_GAME_PACKET_SIZE)
+        {
+            sLog->Error("Received malformed packet: opcode %u, size %u exceeds limit; disconnecting client (IP: %s)", header_buf[0], header_buf[1], sess->GetRemoteAddr());
+            RemoveClient(rec);
+            return false;
+        }
+
+        // packet contents are not complete yet, keep partial packet for next read
+        if (recvbuf.GetReadableSize() < (size_t)(GAMEPACKET_HEADER_SIZE + header_buf[1]))
+            return true;
+
+        recvbuf.Skip(GAMEPACKET_HEADER_SIZE);
+
+        // reuse packet storage, and read contents right into it (packet contents may be empty as well)
+        pkt.Reset(header_buf[0], header_buf[1]);
+        if (header_buf[1] > 0)
+            recvbuf.Read(pkt.GetData(), header_buf[1]);
+
+        m_recvPacketsCount.fetch_add(1, std::memory_order_relaxed);
+
+        // and let the session handle the packet (or pass it to thread of room, where it belongs)
+        sess->HandlePacket(pkt);
+    }
+}
+
+void NetworkWorker::InsertClient(Session* sess)
+{
+    ClientRecord* cr = new ClientRecord;
+
+    cr->session = sess;
+    sess->SetWorker(this);
+    // defaulting connection state to "auth" since we need the player to log in first
+    sess->SetConnectionState(CONNECTION_STATE_AUTH);
+
+    {
+        std::unique_lock<std::recursive_mutex> lck(sNetwork->clientDirectoryLock);
+        cr->listPosition = m_clients.insert(m_clients.end(), cr);
+        sNetwork->RegisterSession(sess);
+    }
+
+    m_sessionIds[sess->GetId()] = cr;
+
+#ifndef _WIN32
+    // register for read, write and hangup events; edge triggered, so we are notified only about new data
+    // and about the socket becoming writable after filling its buffer
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = cr;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, sess->GetSocket(), &ev) == -1)
+        sLog->Error("Failed to register client socket to epoll, errno: %u", LASTERROR());
+#endif
+}
+
+void NetworkWorker::RemoveClient(ClientRecord* rec)
+{
+    Session* sess = rec->session;
+    Player* plr = sess->GetPlayer();
+
+    RoomPtr rm;
+
+    // other workers may be looking this session up right now
+    std::unique_lock<std::recursive_mutex> lck(sNetwork->clientDirectoryLock);
+
+    // player in room (or about to join it) is removed by room thread, which may be using it right now
+    if (plr->GetRoomId() > 0)
+        rm = sGameplay->GetRoom(plr->GetRoomId());
+
+    // send whatever is possible (i.e. kick packet) and make sure the session won't be flushed later
+    FlushSession(sess);
+    sess->Close();
+    {
+        std::unique_lock<std::mutex> flck(pendingflush_mtx);
+        m_pendingFlush.erase(std::remove(m_pendingFlush.begin(), m_pendingFlush.end(), sess), m_pendingFlush.end());
+    }
+
+    // closing the socket also removes it from epoll set
+    sNetwork->CloseSocket_gen(sess->GetSocket());
+
+    sNetwork->UnregisterSession(sess);
+    m_sessionIds.erase(sess->GetId());
+    m_clients.erase(rec->listPosition);
+    delete rec;
+
+    // the room passes the player back, once it does not refer to it anymore
+    if (rm)
+    {
+        RoomCommand* cmd = new RoomCommand(ROOM_COMMAND_PLAYER_LEAVE, plr);
+        if (rm->QueueMembershipCommand(cmd))
+            return;
+
+        // closed room is empty, so it does not know the player
+        delete cmd;
+    }
+
+    delete sess;
+    delete plr;
+}
+
+void NetworkWorker::AddPendingFlush(Session* sess)
+{
+    std::unique_lock<std::mutex> lck(pendingflush_mtx);
+    m_pendingFlush.push_back(sess);
+}
+
+void NetworkWorker::WakeUp()
+{
+#ifndef _WIN32
+    uint64_t one = 1;
+    if (write(m_wakeupFd, &one, sizeof(one)) == -1 && LASTERROR() != SOCKETWOULDBLOCK)
+        sLog->Error("Failed to wake network worker %u up, errno: %u", m_index, LASTERROR());
+#endif
+}
+
+void NetworkWorker::QueueStorageCompletion(StorageRequest* req)
+{
+    m_storageCompletions.Push(req);
+    WakeUp();
+}
+
+void NetworkWorker::ProcessStorageCompletions()
+{
+    StorageRequest* req;
+    Session* sess;
+    std::unordered_map<uint64_t, ClientRecord*>::iterator itr;
+
+    while ((req = m_storageCompletions.Pop()) != nullptr)
+    {
+        // the client may have disconnected while the request was executed
+        itr = m_sessionIds.find(req->GetSessionId());
+        if (itr != m_sessionIds.end())
+        {
+            sess = itr->second->session;
+            sess->SetStorageRequestPending(false);
+
+            // completion may look up or modify sessions owned by other workers, as the packet handler would
+            if (!sess->IsMarkedAsExpired())
+            {
+                std::unique_lock<std::recursive_mutex> lck(sNetwork->clientDirectoryLock);
+                req->Complete(sess);
+            }
+        }
+
+        delete req;
+    }
+}
+
+void NetworkWorker::QueuePlayerRelease(RoomCommand* cmd)
+{
+    m_playerReleases.Push(cmd);
+    WakeUp();
+}
+
+void NetworkWorker::ProcessPlayerReleases()
+{
+    RoomCommand* cmd;
+    Session* sess;
+
+    while ((cmd = m_playerReleases.Pop()) != nullptr)
+    {
+        sess = cmd->player->GetSession();
+
+        // room may have scheduled the session for flush, before it let the player go
+        {
+            std::unique_lock<std::mutex> lck(pendingflush_mtx);
+            m_pendingFlush.erase(std::remove(m_pendingFlush.begin(), m_pendingFlush.end(), sess), m_pendingFlush.end());
+        }
+
+        delete sess;
+        delete cmd->player;
+        delete cmd;
+    }
+}
+
+void NetworkWorker::FlushPendingSessions()
+{
+    // retrieve pending sessions, so other threads could schedule another flush meanwhile
+    {
+        std::unique_lock<std::mutex> lck(pendingflush_mtx);
+        m_flushing.swap(m_pendingFlush);
+    }
+
+    for (std::vector<Session*>::iterator itr = m_flushing.begin(); itr != m_flushing.end(); ++itr)
+        FlushSession(*itr);
+
+    m_flushing.clear();
+}
+
+void NetworkWorker::FlushSession(Session* sess)
+{
+    int result = sess->FlushSendQueue();
+
+    if (result > 0)
+        m_sentBytesCount.fetch_add(result, std::memory_order_relaxed);
+    else if (result < 0)
+        sLog->Debug("Could not send data to client (IP: %s), errno: %u", sess->GetRemoteAddr(), LASTERROR());
+}
+
+uint64_t NetworkWorker::GetRecvBytesCount()
+{
+    return m_recvBytesCount;
+}
+
+uint64_t NetworkWorker::GetSentBytesCount()
+{
+    return m_sentBytesCount;
+}
+
+uint64_t NetworkWorker::GetRecvPacketsCount()
+{
+    return m_recvPacketsCount;
+}
@@ -0,0 +1,137 @@
+#ifndef AGAR_NETWORKWORKER_H
+#define AGAR_NETWORKWORKER_H
+
+#include "Network.h"
+#include "MPSCQueue.h"
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+class Session;
+class StorageRequest;
+struct RoomCommand;
+
+/* Client record used when storing active session */
+struct ClientRecord
+{
+    Session* session;
+
+    /* position in client list, so the record could be removed in constant time */
+    std::list<ClientRecord*>::iterator listPosition;
+};
+
+/* One network I/O shard - owns its listening socket, event loop and all clients accepted through it */
+class NetworkWorker
+{
+    public:
+        /* Only constructor - index is unique among workers and lower than NETWORK_MAX_THREADS */
+        NetworkWorker(uint32_t index);
+        ~NetworkWorker();
+
+        /* Creates listening socket bound to supplied address and prepares event descriptors */
+        bool Startup(sockaddr_in &bindAddr, bool reusePort);
+        /* Starts worker thread */
+        void Start();
+        /* Waits for worker thread to end and closes listening socket; event descriptors are closed on destruction */
+        void Shutdown();
+
+        /* Main worker loop, runs until the network is shut down */
+        void Run();
+
+        /* Retrieves worker index */
+        uint32_t GetIndex();
+        /* Is the calling thread this worker thread? */
+        bool IsWorkerThread();
+
+        /* Schedules session send queue to be flushed by this worker */
+        void AddPendingFlush(Session* sess);
+        /* Wakes worker thread up, so it could flush queued packets */
+        void WakeUp();
+
+        /* Flushes send queues of all sessions scheduled for it; called by worker thread, or by tools running
+         * gameplay without worker thread */
+        void FlushPendingSessions();
+
+        /* Passes executed storage request to be completed by this worker; may be called from any thread */
+        void QueueStorageCompletion(StorageRequest* req);
+        /* Passes leave command of disconnected player back, after the room let the player go; the player and its
+         * session are then destroyed by this worker; may be called from any thread */
+        void QueuePlayerRelease(RoomCommand* cmd);
+
+        /* retrieves received bytes count */
+        uint64_t GetRecvBytesCount();
+        /* retrieves sent bytes count */
+        uint64_t GetSentBytesCount();
+        /* retrieves received packets count */
+        uint64_t GetRecvPacketsCount();
+
+    private:
+        /* Waits for network events, accepts new connections and processes messages/errors on currently estabilished ones */
+        void Update();
+        /* Accept new connections if any */
+        void AcceptConnections();
+        /* Reads data from all sockets enlisted, detects connection problems, disconnections, etc. */
+        void UpdateClients();
+        /* Reads all pending data of one client; returns false if the client was removed */
+        bool ReadClient(ClientRecord* rec);
+        /* Splits received data of client to complete packets and handles them; returns false if the client was removed */
+        bool ProcessReceivedPackets(ClientRecord* rec);
+        /* Disconnects expired sessions and kicks sessions, that timed out */
+        void CheckClientStates();
+
+        /* Writes queued data of one session to its socket */
+        void FlushSession(Session* sess);
+
+        /* Completes executed storage requests of sessions, that still exist */
+        void ProcessStorageCompletions();
+        /* Destroys disconnected players released by their rooms */
+        void ProcessPlayerReleases();
+
+        /* Inserts new client to internal list and registers its socket for events */
+        void InsertClient(Session* sess);
+        /* Removes existing client, closes its socket and destroys its player and session */
+        void RemoveClient(ClientRecord* rec);
+
+        /* worker index */
+        uint32_t m_index;
+
+        /* Listening socket of this worker */
+        SOCK m_socket;
+#ifndef _WIN32
+        /* epoll instance used for waiting on socket events */
+        int m_epollFd;
+        /* event descriptor used for waking worker thread up */
+        int m_wakeupFd;
+#endif
+
+        /* List of all clients accepted by this worker */
+        std::list<ClientRecord*> m_clients;
+        /* clients of this worker by session ID; used only by worker thread */
+        std::unordered_map<uint64_t, ClientRecord*> m_sessionIds;
+
+        /* last time the client states were checked */
+        uint32_t m_lastHousekeepingTime;
+
+        /* sessions with queued data waiting for flush */
+        std::vector<Session*> m_pendingFlush;
+        /* sessions being flushed; swapped with pending list, so neither of them has to allocate again */
+        std::vector<Session*> m_flushing;
+        /* lock for pending flush list */
+        std::mutex pendingflush_mtx;
+
+        /* executed storage requests waiting for completion */
+        MPSCQueue<StorageRequest> m_storageCompletions;
+        /* leave commands of disconnected players, that are not referenced by rooms anymore */
+        MPSCQueue<RoomCommand> m_playerReleases;
+
+        /* instance of worker thread */
+        std::thread* m_thread;
+
+        /* traffic counters; written just by worker thread, read by anyone */
+        std::atomic<uint64_t> m_recvBytesCount;
+        std::atomic<uint64_t> m_sentBytesCount;
+        std::atomic<uint64_t> m_recvPacketsCount;
+};
+
+#endif
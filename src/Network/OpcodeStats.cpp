@@ -0,0 +1,211 @@
+#include "General.h"
+#include "OpcodeStats.h"
+#include "Log.h"
+
+#include <algorithm>
+
+/* counters of current thread */
+static thread_local OpcodeThreadCounters* t_opcodeCounters = nullptr;
+
+/* Adds value to counter owned by current thread */
+static inline void addCounter(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/* Retrieves histogram bucket for given time */
+static inline uint32_t getTimeBucket(uint64_t time)
+{
+    uint32_t bucket = 0;
+
+    while (time > 0 && bucket < OPCODE_STATS_TIME_BUCKETS - 1)
+    {
+        time >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+OpcodeThreadCounters::OpcodeThreadCounters()
+{
+    for (uint32_t i = 0; i < OPCODE_MAX; i++)
+    {
+        recvCount[i] = 0;
+        recvBytes[i] = 0;
+        sentCount[i] = 0;
+        sentBytes[i] = 0;
+        handlerTime[i] = 0;
+
+        for (uint32_t j = 0; j < OPCODE_STATS_TIME_BUCKETS; j++)
+            timeHistogram[i][j] = 0;
+    }
+}
+
+uint64_t OpcodeStatsRecord::GetTimePercentile(double fraction) const
+{
+    uint64_t threshold = (uint64_t)(recvCount * fraction);
+    uint64_t count = 0;
+
+    for (uint32_t i = 0; i < OPCODE_STATS_TIME_BUCKETS; i++)
+    {
+        count += timeHistogram[i];
+        if (count > threshold)
+            return OpcodeStats::GetBucketUpperBound(i);
+    }
+
+    return 0;
+}
+
+OpcodeStats::OpcodeStats()
+{
+    //
+}
+
+OpcodeStats::~OpcodeStats()
+{
+    for (size_t i = 0; i < m_threadCounters.size(); i++)
+        delete m_threadCounters[i];
+}
+
+uint64_t OpcodeStats::GetBucketUpperBound(uint32_t bucket)
+{
+    return (((uint64_t)1) << bucket) - 1;
+}
+
+OpcodeThreadCounters* OpcodeStats::GetThreadCounters()
+{
+    if (!t_opcodeCounters)
+    {
+        t_opcodeCounters = new OpcodeThreadCounters();
+
+        std::unique_lock<std::mutex> lck(threads_mtx);
+        m_threadCounters.push_back(t_opcodeCounters);
+    }
+
+    return t_opcodeCounters;
+}
+
+void OpcodeStats::RecordReceived(uint16_t opcode, size_t bytes, uint64_t handlerTime)
+{
+    OpcodeThreadCounters* counters = GetThreadCounters();
+
+    addCounter(counters->recvCount[opcode], 1);
+    addCounter(counters->recvBytes[opcode], bytes);
+    addCounter(counters->handlerTime[opcode], handlerTime);
+    addCounter(counters->timeHistogram[opcode][getTimeBucket(handlerTime)], 1);
+}
+
+void OpcodeStats::RecordSent(uint16_t opcode, size_t bytes)
+{
+    OpcodeThreadCounters* counters = GetThreadCounters();
+
+    addCounter(counters->sentCount[opcode], 1);
+    addCounter(counters->sentBytes[opcode], bytes);
+}
+
+void OpcodeStats::Collect(std::vector<OpcodeStatsRecord> &records)
+{
+    records.assign(OPCODE_MAX, OpcodeStatsRecord());
+
+    std::unique_lock<std::mutex> lck(threads_mtx);
+
+    for (size_t t = 0; t < m_threadCounters.size(); t++)
+    {
+        OpcodeThreadCounters* counters = m_threadCounters[t];
+
+        for (uint32_t i = 0; i < OPCODE_MAX; i++)
+        {
+            OpcodeStatsRecord &rec = records[i];
+
+            rec.recvCount += counters->recvCount[i].load(std::memory_order_relaxed);
+            rec.recvBytes += counters->recvBytes[i].load(std::memory_order_relaxed);
+            rec.sentCount += counters->sentCount[i].load(std::memory_order_relaxed);
+            rec.sentBytes += counters->sentBytes[i].load(std::memory_order_relaxed);
+            rec.handlerTime += counters->handlerTime[i].load(std::memory_order_relaxed);
+
+            for (uint32_t j = 0; j < OPCODE_STATS_TIME_BUCKETS; j++)
+                rec.timeHistogram[j] += counters->timeHistogram[i][j].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t OpcodeStats::GetSentPacketsCount()
+{
+    uint64_t total = 0;
+
+    std::unique_lock<std::mutex> lck(threads_mtx);
+
+    for (size_t t = 0; t < m_threadCounters.size(); t++)
+    {
+        for (uint32_t i = 0; i < OPCODE_MAX; i++)
+            total += m_threadCounters[t]->sentCount[i].load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
+void OpcodeStats::Print()
+{
+    std::vector<OpcodeStatsRecord> records;
+    std::vector<uint32_t> order;
+
+    Collect(records);
+
+    for (uint32_t i = 0; i < OPCODE_MAX; i++)
+    {
+        if (records[i].recvCount > 0 || records[i].sentCount > 0)
+            order.push_back(i);
+    }
+
+    // the most expensive opcodes first; for sent-only opcodes, the bandwidth matters
+    std::sort(order.begin(), order.end(), [&records](uint32_t a, uint32_t b) {
+        if (records[a].handlerTime != records[b].handlerTime)
+            return records[a].handlerTime > records[b].handlerTime;
+        return records[a].sentBytes > records[b].sentBytes;
+    });
+
+    sLog->Info("opcode   recv count   recv bytes   sent count   sent bytes   handler us   p50 ns   p99 ns");
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        OpcodeStatsRecord &rec = records[order[i]];
+
+        sLog->Info("  0x%02X %12llu %12llu %12llu %12llu %12llu %8llu %8llu", order[i],
+            rec.recvCount, rec.recvBytes, rec.sentCount, rec.sentBytes, rec.handlerTime / 1000,
+            rec.GetTimePercentile(0.5), rec.GetTimePercentile(0.99));
+    }
+}
+
+bool OpcodeStats::Export(const char* filename)
+{
+    std::vector<OpcodeStatsRecord> records;
+    FILE* f;
+
+    f = fopen(filename, "w");
+    if (!f)
+        return false;
+
+    Collect(records);
+
+    fprintf(f, "opcode,recv_count,recv_bytes,sent_count,sent_bytes,handler_ns");
+    for (uint32_t j = 0; j < OPCODE_STATS_TIME_BUCKETS - 1; j++)
+        fprintf(f, ",le_%llu_ns", (unsigned long long)GetBucketUpperBound(j));
+    fprintf(f, ",longer");
+    fprintf(f, "\n");
+
+    for (uint32_t i = 0; i < OPCODE_MAX; i++)
+    {
+        OpcodeStatsRecord &rec = records[i];
+
+        fprintf(f, "%u,%llu,%llu,%llu,%llu,%llu", i, (unsigned long long)rec.recvCount, (unsigned long long)rec.recvBytes,
+            (unsigned long long)rec.sentCount, (unsigned long long)rec.sentBytes, (unsigned long long)rec.handlerTime);
+        for (uint32_t j = 0; j < OPCODE_STATS_TIME_BUCKETS; j++)
+            fprintf(f, ",%llu", (unsigned long long)rec.timeHistogram[j]);
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+
+    return true;
+}
@@ -0,0 +1,93 @@
+#ifndef AGAR_OPCODESTATS_H
+#define AGAR_OPCODESTATS_H
+
+#include "Singleton.h"
+#include "Opcodes.h"
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+/* count of handler time histogram buckets; bucket N holds times from 2^(N-1) to 2^N - 1 nanoseconds, the last one everything longer */
+#define OPCODE_STATS_TIME_BUCKETS 32
+
+/* Counters of one thread; written just by their owner, so no read-modify-write atomics are needed, but read by anyone */
+struct OpcodeThreadCounters
+{
+    OpcodeThreadCounters();
+
+    /* received packets of every opcode */
+    std::atomic<uint64_t> recvCount[OPCODE_MAX];
+    /* received bytes (including header) of every opcode */
+    std::atomic<uint64_t> recvBytes[OPCODE_MAX];
+    /* sent packets of every opcode */
+    std::atomic<uint64_t> sentCount[OPCODE_MAX];
+    /* sent bytes (including header) of every opcode */
+    std::atomic<uint64_t> sentBytes[OPCODE_MAX];
+    /* total time spent in handler of every opcode, in nanoseconds */
+    std::atomic<uint64_t> handlerTime[OPCODE_MAX];
+    /* handler time histogram of every opcode */
+    std::atomic<uint64_t> timeHistogram[OPCODE_MAX][OPCODE_STATS_TIME_BUCKETS];
+};
+
+/* Statistics of one opcode merged from all threads */
+struct OpcodeStatsRecord
+{
+    /* received packets */
+    uint64_t recvCount;
+    /* received bytes */
+    uint64_t recvBytes;
+    /* sent packets */
+    uint64_t sentCount;
+    /* sent bytes */
+    uint64_t sentBytes;
+    /* total handler time in nanoseconds */
+    uint64_t handlerTime;
+    /* handler time histogram */
+    uint64_t timeHistogram[OPCODE_STATS_TIME_BUCKETS];
+
+    /* Retrieves upper bound (in nanoseconds) of handler time of given fraction of handled packets, i.e. 0.99 for 99th percentile */
+    uint64_t GetTimePercentile(double fraction) const;
+};
+
+/* Per-opcode traffic and handler time statistics. Every thread records into its own counters, which are merged
+ * when read, so recording never contends with other threads */
+class OpcodeStats
+{
+    friend class Singleton<OpcodeStats>;
+    public:
+        /* Records packet received and handled by current thread */
+        void RecordReceived(uint16_t opcode, size_t bytes, uint64_t handlerTime);
+        /* Records packet sent from current thread */
+        void RecordSent(uint16_t opcode, size_t bytes);
+
+        /* Merges counters of all threads; the record index is opcode */
+        void Collect(std::vector<OpcodeStatsRecord> &records);
+        /* Retrieves total count of sent packets */
+        uint64_t GetSentPacketsCount();
+
+        /* Prints statistics of all opcodes seen so far */
+        void Print();
+        /* Writes statistics to CSV file; returns false on failure */
+        bool Export(const char* filename);
+
+        /* Retrieves upper bound of histogram bucket in nanoseconds */
+        static uint64_t GetBucketUpperBound(uint32_t bucket);
+
+    private:
+        OpcodeStats();
+        ~OpcodeStats();
+
+        /* Retrieves counters of current thread, registers them on first use */
+        OpcodeThreadCounters* GetThreadCounters();
+
+        /* lock for thread counters list */
+        std::mutex threads_mtx;
+        /* counters of all threads, that ever recorded anything; kept after the thread exits */
+        std::vector<OpcodeThreadCounters*> m_threadCounters;
+};
+
+#define sOpcodeStats Singleton<OpcodeStats>::getInstance()
+
+#endif
@@ -9,6 +9,8 @@
  * But, if you decide to not listen, and do whatever you want anyway, take look at
  * PacketHandlers.h, where handlers for packets are defined - opcodes are also key
  * in array, so the session handler could find the packet handler in O(1) time
+ *
+ * Layout of packet contents is declared in PacketSchemas.h
  */
 
 enum Opcodes
@@ -57,6 +59,8 @@ enum Opcodes
     CP_RESTORE_SESSION          = 0x29,
     SP_RESTORE_SESSION_RESPONSE = 0x2A,
     SP_KICK                     = 0x2B,
+    SP_WORLD_SNAPSHOT           = 0x2C,
+    SP_DESTROY_OBJECTS          = 0x2D,
 
     OPCODE_MAX
 };
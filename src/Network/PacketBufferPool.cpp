@@ -0,0 +1,159 @@
+#include "General.h"
+#include "PacketBufferPool.h"
+
+/* Free buffers cached by one thread */
+struct PacketPoolThreadCache
+{
+    PacketPoolThreadCache()
+    {
+        memset(count, 0, sizeof(count));
+    };
+
+    /* gives cached buffers back, when the thread exits */
+    ~PacketPoolThreadCache()
+    {
+        for (uint32_t i = 0; i < PACKET_POOL_CLASS_COUNT; i++)
+        {
+            if (count[i] > 0)
+                sPacketPool->PutToDepot(i, buffers[i], count[i]);
+        }
+    };
+
+    /* free buffers of every class */
+    uint8_t* buffers[PACKET_POOL_CLASS_COUNT][PACKET_POOL_THREAD_CACHE_SIZE];
+    /* count of free buffers of every class */
+    uint32_t count[PACKET_POOL_CLASS_COUNT];
+};
+
+/* cache of current thread */
+static thread_local PacketPoolThreadCache t_poolCache;
+
+PacketBufferPool::PacketBufferPool() : m_acquireCount(0), m_heapAllocationCount(0)
+{
+    //
+}
+
+void PacketBufferPool::Init()
+{
+    for (uint32_t i = 0; i < PACKET_POOL_CLASS_COUNT; i++)
+        m_depot[i].reserve(PACKET_POOL_DEPOT_LIMIT);
+}
+
+PacketBufferPool::~PacketBufferPool()
+{
+    for (uint32_t i = 0; i < PACKET_POOL_CLASS_COUNT; i++)
+    {
+        for (size_t j = 0; j < m_depot[i].size(); j++)
+            delete[] m_depot[i][j];
+    }
+}
+
+uint32_t PacketBufferPool::GetSizeClass(size_t size)
+{
+    uint32_t sizeClass = 0;
+    size_t classSize = PACKET_POOL_MIN_BUFFER_SIZE;
+
+    while (classSize < size && sizeClass < PACKET_POOL_CLASS_COUNT)
+    {
+        classSize <<= 1;
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
+
+size_t PacketBufferPool::GetCapacity(size_t size)
+{
+    uint32_t sizeClass = GetSizeClass(size);
+
+    // large buffers are allocated exactly
+    if (sizeClass == PACKET_POOL_CLASS_COUNT)
+        return size;
+
+    return ((size_t)PACKET_POOL_MIN_BUFFER_SIZE) << sizeClass;
+}
+
+uint8_t* PacketBufferPool::Acquire(size_t size)
+{
+    uint32_t sizeClass = GetSizeClass(size);
+    PacketPoolThreadCache& cache = t_poolCache;
+
+    m_acquireCount.fetch_add(1, std::memory_order_relaxed);
+
+    if (sizeClass < PACKET_POOL_CLASS_COUNT)
+    {
+        // refill cache by half, so the next few requests are served without locking too
+        if (cache.count[sizeClass] == 0)
+            cache.count[sizeClass] = TakeFromDepot(sizeClass, cache.buffers[sizeClass], PACKET_POOL_THREAD_CACHE_SIZE / 2);
+
+        if (cache.count[sizeClass] > 0)
+            return cache.buffers[sizeClass][--cache.count[sizeClass]];
+    }
+
+    m_heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+    return new uint8_t[GetCapacity(size)];
+}
+
+void PacketBufferPool::Release(uint8_t* buffer, size_t size)
+{
+    uint32_t sizeClass = GetSizeClass(size);
+    PacketPoolThreadCache& cache = t_poolCache;
+
+    if (sizeClass == PACKET_POOL_CLASS_COUNT)
+    {
+        delete[] buffer;
+        return;
+    }
+
+    // cache is full, the older half goes to depot for other threads
+    if (cache.count[sizeClass] == PACKET_POOL_THREAD_CACHE_SIZE)
+    {
+        PutToDepot(sizeClass, cache.buffers[sizeClass], PACKET_POOL_THREAD_CACHE_SIZE / 2);
+        memmove(cache.buffers[sizeClass], cache.buffers[sizeClass] + PACKET_POOL_THREAD_CACHE_SIZE / 2, (PACKET_POOL_THREAD_CACHE_SIZE / 2) * sizeof(uint8_t*));
+        cache.count[sizeClass] -= PACKET_POOL_THREAD_CACHE_SIZE / 2;
+    }
+
+    cache.buffers[sizeClass][cache.count[sizeClass]++] = buffer;
+}
+
+uint32_t PacketBufferPool::TakeFromDepot(uint32_t sizeClass, uint8_t** buffers, uint32_t count)
+{
+    std::unique_lock<std::mutex> lck(depot_mtx);
+
+    std::vector<uint8_t*> &depot = m_depot[sizeClass];
+    uint32_t taken = 0;
+
+    while (taken < count && !depot.empty())
+    {
+        buffers[taken++] = depot.back();
+        depot.pop_back();
+    }
+
+    return taken;
+}
+
+void PacketBufferPool::PutToDepot(uint32_t sizeClass, uint8_t** buffers, uint32_t count)
+{
+    std::unique_lock<std::mutex> lck(depot_mtx);
+
+    std::vector<uint8_t*> &depot = m_depot[sizeClass];
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (depot.size() < PACKET_POOL_DEPOT_LIMIT)
+            depot.push_back(buffers[i]);
+        else
+            delete[] buffers[i];
+    }
+}
+
+uint64_t PacketBufferPool::GetAcquireCount()
+{
+    return m_acquireCount;
+}
+
+uint64_t PacketBufferPool::GetHeapAllocationCount()
+{
+    return m_heapAllocationCount;
+}
@@ -0,0 +1,90 @@
+#ifndef AGAR_PACKETBUFFERPOOL_H
+#define AGAR_PACKETBUFFERPOOL_H
+
+#include "Singleton.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+/* size of buffers of the smallest class */
+#define PACKET_POOL_MIN_BUFFER_SIZE 128
+/* count of buffer size classes; every class has buffers twice as large as the previous one */
+#define PACKET_POOL_CLASS_COUNT 8
+/* maximum count of free buffers of one class cached by one thread */
+#define PACKET_POOL_THREAD_CACHE_SIZE 32
+/* maximum count of free buffers of one class kept in shared depot; the rest is returned to heap */
+#define PACKET_POOL_DEPOT_LIMIT 1024
+
+/* Pool of packet buffers (slabs) in size classes of powers of two. Every thread caches some free buffers, so
+ * most of requests is served without locking; buffers released by other thread (i.e. packets built in room
+ * thread and sent by network thread) get back through shared depot. Buffers larger than the largest class
+ * are taken from heap directly */
+class PacketBufferPool
+{
+    friend class Singleton<PacketBufferPool>;
+    public:
+        /* Preallocates depot, so it never grows; must be called before other threads start using the pool */
+        void Init();
+
+        /* Acquires buffer of at least given size */
+        uint8_t* Acquire(size_t size);
+        /* Returns buffer back to pool; size must be the same as when acquired, or the capacity of buffer */
+        void Release(uint8_t* buffer, size_t size);
+
+        /* Retrieves real capacity of buffer acquired for given size */
+        static size_t GetCapacity(size_t size);
+
+        /* Retrieves count of buffers acquired so far */
+        uint64_t GetAcquireCount();
+        /* Retrieves count of buffers, that had to be allocated from heap */
+        uint64_t GetHeapAllocationCount();
+
+        /* Takes free buffers of given class from depot; returns count of buffers taken */
+        uint32_t TakeFromDepot(uint32_t sizeClass, uint8_t** buffers, uint32_t count);
+        /* Puts free buffers of given class to depot */
+        void PutToDepot(uint32_t sizeClass, uint8_t** buffers, uint32_t count);
+
+    private:
+        PacketBufferPool();
+        ~PacketBufferPool();
+
+        /* Retrieves size class for given size, or PACKET_POOL_CLASS_COUNT, if it's too large for any class */
+        static uint32_t GetSizeClass(size_t size);
+
+        /* lock for depot */
+        std::mutex depot_mtx;
+        /* free buffers of every class not cached by any thread */
+        std::vector<uint8_t*> m_depot[PACKET_POOL_CLASS_COUNT];
+
+        /* count of buffers acquired */
+        std::atomic<uint64_t> m_acquireCount;
+        /* count of buffers allocated from heap */
+        std::atomic<uint64_t> m_heapAllocationCount;
+};
+
+#define sPacketPool Singleton<PacketBufferPool>::getInstance()
+
+/* Allocator taking memory from packet buffer pool, i.e. for shared frames allocated along with their control blocks */
+template <class T>
+class PacketPoolAllocator
+{
+    public:
+        typedef T value_type;
+
+        PacketPoolAllocator() { };
+        template <class U>
+        PacketPoolAllocator(PacketPoolAllocator<U> const&) { };
+
+        T* allocate(size_t n) { return (T*)sPacketPool->Acquire(n * sizeof(T)); };
+        void deallocate(T* ptr, size_t n) { sPacketPool->Release((uint8_t*)ptr, n * sizeof(T)); };
+};
+
+template <class T, class U>
+bool operator==(PacketPoolAllocator<T> const&, PacketPoolAllocator<U> const&) { return true; }
+template <class T, class U>
+bool operator!=(PacketPoolAllocator<T> const&, PacketPoolAllocator<U> const&) { return false; }
+
+#endif
@@ -10,39 +10,141 @@
 #include "sha1.h"
 #include "Version.h"
 #include "Helpers.h"
-#include "GridSearchers.h"
 #include "Log.h"
 
-void PacketHandlers::Handle_NULL(Session* sess, GamePacket& packet)
+bool PacketHandlers::Handle_NULL(Session* sess, GamePacket& packet)
 {
     // NULL handler - this means we throw away whole packet
+    return true;
 }
 
-void PacketHandlers::Handle_ServerSide(Session* sess, GamePacket& packet)
+bool PacketHandlers::Handle_ServerSide(Session* sess, GamePacket& packet)
 {
     // This should never happen - we should never receive server-to-client packet
+    return true;
 }
 
-void PacketHandlers::HandlePong(Session* sess, GamePacket& packet)
+void PacketHandlers::QueueRoomCommand(Session* sess, RoomCommand* cmd)
+{
+    RoomPtr plroom = sGameplay->GetRoom(sess->GetPlayer()->GetRoomId());
+
+    // the room may be already gone
+    if (!plroom)
+    {
+        sLog->Debug("Player %u is not in any room, dropping command %u", sess->GetPlayer()->GetId(), cmd->type);
+        delete cmd;
+        return;
+    }
+
+    // the room thread will execute the command and destroy it
+    plroom->QueueCommand(cmd);
+}
+
+bool PacketHandlers::QueueRoomJoin(Session* sess, Room* rm)
+{
+    Player* plr = sess->GetPlayer();
+
+    plr->SetUpdateEnabled(false);
+
+    // the player belongs to room from now on, so its commands (and leave on disconnection) follow the join
+    // through the same queue; room thread refuses the join, if the room gets full meanwhile
+    plr->SetRoomId(rm->GetId());
+    // move player to game stage
+    sess->SetConnectionState(CONNECTION_STATE_GAME);
+
+    // room thread adds the player and responds
+    RoomCommand* cmd = new RoomCommand(ROOM_COMMAND_PLAYER_JOIN, plr);
+    if (rm->QueueMembershipCommand(cmd))
+        return true;
+
+    // the room was closed meanwhile
+    delete cmd;
+    plr->SetRoomId(0);
+    sess->SetConnectionState(CONNECTION_STATE_LOBBY);
+
+    return false;
+}
+
+void PacketHandlers::HandlePong(Session* sess, PongPacket& packet)
 {
     sess->SignalLatencyMeasure();
 
-    GamePacket resp(SP_PING_PONG);
-    resp.WriteUInt32(sess->GetLatency());
+    PingPongPacket pingpong;
+    pingpong.latency = sess->GetLatency();
+
+    GamePacket resp(PingPongPacket::opcode);
+    pingpong.Encode(resp);
 
     sNetwork->SendPacket(sess, resp);
 }
 
-void PacketHandlers::HandleLoginRequest(Session* sess, GamePacket& packet)
+/* Computes SHA1 hash of password in hex string form, as it's stored in database */
+static std::string hashPassword(std::string const& password)
 {
-    std::string username, password, sessionKey;
-    uint32_t version, playerId;
+    unsigned char resbuf[64];
+    memset(resbuf, 0, sizeof(resbuf));
+    char hexbuf[64];
+    memset(hexbuf, 0, sizeof(hexbuf));
+
+    sha1::calc(password.c_str(), password.length(), resbuf);
+    sha1::toHexString(resbuf, hexbuf);
+
+    return std::string(hexbuf);
+}
+
+/* Login request; user record is retrieved by storage thread, the rest is resolved when the request completes */
+class LoginStorageRequest : public StorageRequest
+{
+    public:
+        LoginStorageRequest(Session* sess, LoginRequestPacket& packet) : StorageRequest(sess),
+            m_username(packet.username.ToString()), m_passwordHash(hashPassword(packet.password.ToString())),
+            m_version(packet.version), m_clientFlags(packet.clientFlags), m_found(false), m_userId(0) { };
+
+        void Execute()
+        {
+            StorageResult::UserRecord* user = sStorage->GetUserByUsername(m_username.c_str());
+            if (!user)
+                return;
+
+            m_found = true;
+            m_userId = user->id;
+            m_storedUsername = user->username;
+            m_storedPasswordHash = user->passwordHash;
+
+            delete user;
+        };
+
+        void Complete(Session* sess);
+
+    private:
+        /* requested user name */
+        std::string m_username;
+        /* hash of supplied password */
+        std::string m_passwordHash;
+        /* client version */
+        uint32_t m_version;
+        /* features supported by client */
+        uint32_t m_clientFlags;
+
+        /* was the user found? */
+        bool m_found;
+        /* ID of user found */
+        int32_t m_userId;
+        /* name of user found */
+        std::string m_storedUsername;
+        /* password hash of user found */
+        std::string m_storedPasswordHash;
+};
+
+void LoginStorageRequest::Complete(Session* sess)
+{
+    std::string sessionKey;
+    uint32_t playerId;
     uint8_t statusCode;
 
-    // read contents
-    username = packet.ReadString();
-    password = packet.ReadString();
-    version = packet.ReadUInt32();
+    // the session may have been restored by another request meanwhile
+    if (sess->GetConnectionState() != CONNECTION_STATE_AUTH)
+        return;
 
     // prepare response packet
     GamePacket resp(SP_LOGIN_RESPONSE, 1);
@@ -51,60 +153,48 @@ void PacketHandlers::HandleLoginRequest(Session* sess, GamePacket& packet)
 
     sessionKey = sess->CreateSessionKey();
 
-    // retrieve user record from database
-    StorageResult::UserRecord* user = sStorage->GetUserByUsername(username.c_str());
     // user does not exist
-    if (!user)
+    if (!m_found)
         statusCode = STATUS_LOGIN_INVALID_USER;
     // version does not match expected value
-    else if (version != GAME_VERSION)
+    else if (m_version != GAME_VERSION)
         statusCode = STATUS_LOGIN_VERSION_MISMATCH;
+    // passwords does not match the stored one
+    else if (m_passwordHash != m_storedPasswordHash)
+        statusCode = STATUS_LOGIN_WRONG_PASSWORD;
     else
     {
-        // prepare SHA1 hash of received password
-        unsigned char resbuf[64];
-        memset(resbuf, 0, sizeof(resbuf));
-        char hexbuf[64];
-        memset(hexbuf, 0, sizeof(hexbuf));
-
-        sha1::calc(password.c_str(), password.length(), resbuf);
-        sha1::toHexString(resbuf, hexbuf);
-
-        // passwords does not match the stored one
-        if (strcmp((const char*)hexbuf, user->passwordHash) != 0)
-            statusCode = STATUS_LOGIN_WRONG_PASSWORD;
-        else
+        // if there's another user logged in to that account, kick him
+        Session* existing = sNetwork->FindSessionByPlayerId(m_userId);
+        if (existing)
         {
-            // if there's another user logged in to that account, kick him
-            Session* existing = sNetwork->FindSessionByPlayerId(user->id);
-            if (existing)
+            RoomPtr plroom;
+            if (existing->GetPlayer()->GetRoomId())
+                plroom = sGameplay->GetRoom(existing->GetPlayer()->GetRoomId());
+
+            sLog->Info("Existing player: %u, timeout: %u, room: %u", m_userId, existing->GetSessionTimeoutValue(), plroom ? 1 : 0);
+
+            // Possible scenarios:
+            // player is playing, somebody tries to login --> kick player
+            // player is in lobby, somebody tries to login --> kick player
+            // player is offline in lobby (session in timeout), somebody tries to login --> kick player
+            // player is offline in game (session in timeout), somebody tries to login --> suggest session restore
+
+            // if existing player does not have timeout interval or is not in any room, kick
+            if (!existing->GetSessionTimeoutValue() || !plroom)
+                existing->Kick();
+            else // otherwise suggest client to restore session
             {
-                Room* plroom = nullptr;
-                if (existing->GetPlayer()->GetRoomId())
-                    plroom = sGameplay->GetRoom(existing->GetPlayer()->GetRoomId());
-
-                sLog->Info("Existing player: %u, timeout: %u, room: %u", user->id, existing->GetSessionTimeoutValue(), plroom ? 1 : 0);
-
-                // Possible scenarios:
-                // player is playing, somebody tries to login --> kick player
-                // player is in lobby, somebody tries to login --> kick player
-                // player is offline in lobby (session in timeout), somebody tries to login --> kick player
-                // player is offline in game (session in timeout), somebody tries to login --> suggest session restore
-
-                // if existing player does not have timeout interval or is not in any room, kick
-                if (!existing->GetSessionTimeoutValue() || !plroom)
-                    existing->Kick();
-                else // otherwise suggest client to restore session
-                {
-                    statusCode = STATUS_LOGIN_SESSION_RESTORE;
-                    sessionKey = existing->GetSessionKey();
-                }
+                statusCode = STATUS_LOGIN_SESSION_RESTORE;
+                sessionKey = existing->GetSessionKey();
             }
-
-            sess->GetPlayer()->SetId(user->id);
-            sess->GetPlayer()->SetName(user->username);
-            playerId = (uint32_t)user->id;
         }
+
+        sess->GetPlayer()->SetId(m_userId);
+        sess->GetPlayer()->SetName(m_storedUsername.c_str());
+        sess->SetClientFlags(m_clientFlags);
+        sNetwork->UpdateSessionIndex(sess);
+        playerId = (uint32_t)m_userId;
     }
 
     // send response
@@ -122,7 +212,6 @@ void PacketHandlers::HandleLoginRequest(Session* sess, GamePacket& packet)
     resp.WriteString(sessionKey.c_str());
 
     sNetwork->SendPacket(sess, resp);
-    delete user;
 
     // kick current session, the client will reset connection status, and start again
     // this is due to allow us to have generic flow
@@ -130,21 +219,117 @@ void PacketHandlers::HandleLoginRequest(Session* sess, GamePacket& packet)
         sess->Kick();
 }
 
-void PacketHandlers::HandleRegisterRequest(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleLoginRequest(Session* sess, LoginRequestPacket& packet)
+{
+    // the client has to wait for response of previous request
+    if (sess->IsStorageRequestPending())
+    {
+        sLog->Debug("Client (IP: %s) sent login request while waiting for storage, not handling", sess->GetRemoteAddr());
+        return;
+    }
+
+    // database lookup may block on disk, leave it to storage thread
+    sess->SetStorageRequestPending(true);
+    sStorage->QueueRequest(new LoginStorageRequest(sess, packet));
+}
+
+/* Sends response to registration request */
+static void sendRegisterResponse(Session* sess, uint8_t statusCode, uint32_t playerId)
+{
+    GamePacket resp(SP_REGISTER_RESPONSE, 1);
+
+    resp.WriteUInt8(statusCode);
+    if (statusCode == STATUS_REGISTER_OK)
+    {
+        resp.WriteUInt32(playerId);
+
+        // move connection state to "lobby" after registering
+        sess->SetConnectionState(CONNECTION_STATE_LOBBY);
+    }
+
+    // write session key in case of session restore
+    resp.WriteString(sess->CreateSessionKey());
+
+    sNetwork->SendPacket(sess, resp);
+}
+
+/* Registration request; name check and insertion are done by storage thread, so no other registration could get in between */
+class RegisterStorageRequest : public StorageRequest
+{
+    public:
+        RegisterStorageRequest(Session* sess, std::string const& username, std::string const& password) : StorageRequest(sess),
+            m_username(username), m_passwordHash(hashPassword(password)), m_statusCode(STATUS_REGISTER_OK), m_userId(0) { };
+
+        void Execute()
+        {
+            StorageResult::UserRecord* user = sStorage->GetUserByUsername(m_username.c_str());
+            if (user)
+            {
+                m_statusCode = STATUS_REGISTER_NAME_IS_TAKEN;
+                delete user;
+                return;
+            }
+
+            sStorage->StoreUser(m_username.c_str(), m_passwordHash.c_str());
+
+            user = sStorage->GetUserByUsername(m_username.c_str());
+            if (!user)
+            {
+                m_statusCode = STATUS_REGISTER_INVALID_NAME;
+                return;
+            }
+
+            m_userId = user->id;
+            delete user;
+        };
+
+        void Complete(Session* sess)
+        {
+            // the session may have been restored by another request meanwhile
+            if (sess->GetConnectionState() != CONNECTION_STATE_AUTH)
+                return;
+
+            if (m_statusCode == STATUS_REGISTER_OK)
+            {
+                sess->GetPlayer()->SetId(m_userId);
+                sess->GetPlayer()->SetName(m_username.c_str());
+                sNetwork->UpdateSessionIndex(sess);
+            }
+
+            sendRegisterResponse(sess, m_statusCode, (uint32_t)m_userId);
+        };
+
+    private:
+        /* requested user name */
+        std::string m_username;
+        /* hash of supplied password */
+        std::string m_passwordHash;
+
+        /* resulting status code */
+        uint8_t m_statusCode;
+        /* ID of registered user */
+        int32_t m_userId;
+};
+
+void PacketHandlers::HandleRegisterRequest(Session* sess, RegisterRequestPacket& packet)
 {
     std::string username, password;
-    uint32_t version, playerId;
+    uint32_t version;
     uint8_t statusCode;
 
+    // the client has to wait for response of previous request
+    if (sess->IsStorageRequestPending())
+    {
+        sLog->Debug("Client (IP: %s) sent register request while waiting for storage, not handling", sess->GetRemoteAddr());
+        return;
+    }
+
     // read contents
-    username = packet.ReadString();
-    password = packet.ReadString();
-    version = packet.ReadUInt32();
+    username = packet.username.ToString();
+    password = packet.password.ToString();
+    version = packet.version;
 
-    // prepare response packet
-    GamePacket resp(SP_REGISTER_RESPONSE, 1);
     statusCode = STATUS_REGISTER_OK;
-    playerId = 0;
 
     if (username.length() < 4)
         statusCode = STATUS_REGISTER_NAME_TOO_SHORT;
@@ -158,62 +343,25 @@ void PacketHandlers::HandleRegisterRequest(Session* sess, GamePacket& packet)
         statusCode = STATUS_REGISTER_INVALID_NAME;
     else if (version != GAME_VERSION)
         statusCode = STATUS_REGISTER_VERSION_MISMATCH;
-    else
-    {
-        StorageResult::UserRecord* user = sStorage->GetUserByUsername(username.c_str());
-        if (user)
-        {
-            statusCode = STATUS_REGISTER_NAME_IS_TAKEN;
-            delete user;
-        }
-        else
-        {
-            // prepare SHA1 hash of received password
-            unsigned char resbuf[64];
-            memset(resbuf, 0, sizeof(resbuf));
-            char hexbuf[64];
-            memset(hexbuf, 0, sizeof(hexbuf));
-
-            sha1::calc(password.c_str(), password.length(), resbuf);
-            sha1::toHexString(resbuf, hexbuf);
-
-            sStorage->StoreUser(username.c_str(), (const char*)hexbuf);
 
-            user = sStorage->GetUserByUsername(username.c_str());
-            if (!user)
-                statusCode = STATUS_REGISTER_INVALID_NAME;
-            else
-            {
-                sess->GetPlayer()->SetId(user->id);
-                sess->GetPlayer()->SetName(user->username);
-                playerId = (uint32_t)user->id;
-                delete user;
-            }
-        }
-    }
-
-    resp.WriteUInt8(statusCode);
-    if (statusCode == STATUS_REGISTER_OK)
+    // invalid requests are refused right away, without touching the database
+    if (statusCode != STATUS_REGISTER_OK)
     {
-        resp.WriteUInt32(playerId);
-
-        // move connection state to "lobby" after registering
-        sess->SetConnectionState(CONNECTION_STATE_LOBBY);
+        sendRegisterResponse(sess, statusCode, 0);
+        return;
     }
 
-    // write session key in case of session restore
-    resp.WriteString(sess->CreateSessionKey());
-
-    sNetwork->SendPacket(sess, resp);
+    sess->SetStorageRequestPending(true);
+    sStorage->QueueRequest(new RegisterStorageRequest(sess, username, password));
 }
 
-void PacketHandlers::HandleRestoreSession(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleRestoreSession(Session* sess, RestoreSessionRequestPacket& packet)
 {
     std::string sessionKey;
     uint32_t playerId;
 
-    sessionKey = packet.ReadString();
-    playerId = packet.ReadUInt32();
+    sessionKey = packet.sessionKey.ToString();
+    playerId = packet.playerId;
 
     sLog->Info("Attempting to restore session of player %u, sessionKey %s", playerId, sessionKey.c_str());
 
@@ -258,8 +406,7 @@ void PacketHandlers::HandleRestoreSession(Session* sess, GamePacket& packet)
         Player* dummypl = sess->GetPlayer();
         Session* oldsess = oldpl->GetSession();
 
-        // switch player records in update array (literally switch)
-        sNetwork->OverridePlayerClient(dummypl, oldpl);
+        // client records are bound to sessions (sockets), so they stay within their network workers
 
         // set this session to old player
         oldpl->OverrideSession(sess);
@@ -268,6 +415,8 @@ void PacketHandlers::HandleRestoreSession(Session* sess, GamePacket& packet)
 
         // new session should contain old player
         sess->OverridePlayer(oldpl, oldsess->GetSessionKey());
+        // restoring client does not log in again, so it supports the same features
+        sess->SetClientFlags(oldsess->GetClientFlags());
         // and old session should contain new player (dummy)
         oldsess->OverridePlayer(dummypl);
 
@@ -281,14 +430,14 @@ void PacketHandlers::HandleRestoreSession(Session* sess, GamePacket& packet)
     sNetwork->SendPacket(sess, resp);
 }
 
-void PacketHandlers::HandleRoomListRequest(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleRoomListRequest(Session* sess, RoomListRequestPacket& packet)
 {
     uint8_t gameType;
-    Room* tmp;
+    RoomPtr tmp;
 
-    gameType = packet.ReadInt8();
+    gameType = packet.gameType;
 
-    std::list<Room*> roomList;
+    std::list<RoomPtr> roomList;
 
     // fetch room list from gameplay singleton
     sGameplay->GetRoomList(roomList, gameType);
@@ -296,7 +445,7 @@ void PacketHandlers::HandleRoomListRequest(Session* sess, GamePacket& packet)
     // and build response
     GamePacket resp(SP_ROOM_LIST_RESPONSE, 4 + roomList.size() * (4 + 1 + 1 + 1));
     resp.WriteUInt32(roomList.size());
-    for (std::list<Room*>::iterator itr = roomList.begin(); itr != roomList.end(); ++itr)
+    for (std::list<RoomPtr>::iterator itr = roomList.begin(); itr != roomList.end(); ++itr)
     {
         tmp = *itr;
         resp.WriteUInt32(tmp->GetId());
@@ -308,17 +457,15 @@ void PacketHandlers::HandleRoomListRequest(Session* sess, GamePacket& packet)
     sNetwork->SendPacket(sess, resp);
 }
 
-void PacketHandlers::HandleJoinRoomRequest(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleJoinRoomRequest(Session* sess, JoinRoomRequestPacket& packet)
 {
     uint32_t roomId;
     /*uint8_t spectator;*/
 
-    roomId = packet.ReadUInt32();
-    /*spectator = */packet.ReadUInt8();
-
-    Room* rm = sGameplay->GetRoom(roomId);
+    roomId = packet.roomId;
+    /*spectator = packet.spectator;*/
 
-    GamePacket resp(SP_JOIN_ROOM_RESPONSE);
+    RoomPtr rm = sGameplay->GetRoom(roomId);
 
     uint8_t statusCode = STATUS_ROOMJOIN_OK;
 
@@ -331,33 +478,25 @@ void PacketHandlers::HandleJoinRoomRequest(Session* sess, GamePacket& packet)
     // TODO: spectators
     //else if (!rm->AllowSpectators() && spectator)
     //    statusCode = STATUS_ROOMJOIN_NO_SPECTATORS;
+    // room thread responds, once the player is inside
+    else if (QueueRoomJoin(sess, rm.get()))
+        return;
     else
-    {
-        sess->GetPlayer()->SetUpdateEnabled(false);
-
-        rm->AddPlayer(sess->GetPlayer());
-        // move player to game stage
-        sess->SetConnectionState(CONNECTION_STATE_GAME);
-    }
-
-    resp.WriteUInt8(statusCode);
-    resp.WriteUInt32(0); // TODO: chat channels
+        statusCode = STATUS_ROOMJOIN_FAILED_NO_SUCH_ROOM;
 
-    sNetwork->SendPacket(sess, resp);
+    Room::SendJoinResponse(sess, statusCode);
 }
 
-void PacketHandlers::HandleCreateRoom(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleCreateRoom(Session* sess, CreateRoomRequestPacket& packet)
 {
     uint32_t size, capacity;
     std::string name;
-    Room* rm = nullptr;
+    RoomPtr rm;
     uint8_t statusCode = STATUS_ROOMCREATE_OK;
 
-    name = packet.ReadString();
-    capacity = packet.ReadUInt32();
-    size = packet.ReadUInt32();
-
-    GamePacket resp(SP_JOIN_ROOM_RESPONSE);
+    name = packet.name.ToString();
+    capacity = packet.capacity;
+    size = packet.size;
 
     if (capacity > 50 || capacity < 2 || size > 500 || size < 20)
         statusCode = STATUS_ROOMCREATE_INVALID_PARAMETERS;
@@ -367,213 +506,120 @@ void PacketHandlers::HandleCreateRoom(Session* sess, GamePacket& packet)
 
         if (!rm)
             statusCode = STATUS_ROOMCREATE_SERVER_LIMIT;
+        // creator joins the room the same way as anybody else
+        else if (QueueRoomJoin(sess, rm.get()))
+            return;
+        // fresh room could not be closed so soon, but do not leave the player waiting anyway
         else
-        {
-            sess->GetPlayer()->SetUpdateEnabled(false);
-
-            rm->AddPlayer(sess->GetPlayer());
-            // move player to game stage
-            sess->SetConnectionState(CONNECTION_STATE_GAME);
-        }
+            statusCode = STATUS_ROOMCREATE_SERVER_LIMIT;
     }
 
-    resp.WriteUInt8(statusCode);
-    resp.WriteUInt32(0); // TODO: chat channels
-
-    sNetwork->SendPacket(sess, resp);
+    Room::SendJoinResponse(sess, statusCode);
 }
 
-void PacketHandlers::HandleWorldRequest(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleWorldRequest(Session* sess, WorldRequestPacket& packet)
 {
-    Room* plroom;
-
-    plroom = sGameplay->GetRoom(sess->GetPlayer()->GetRoomId());
-    if (!plroom)
-    {
-        sLog->Debug("Player %u is not in any room, kicking!", sess->GetPlayer()->GetId());
+    bool reinitGame = (packet.reinit == 1);
 
-        // TODO: kick player
-        return;
-    }
-
-    bool reinitGame = (packet.ReadUInt8() == 1);
-
-    // if reinitializing, do not reset player state, just use current
-    if (!reinitGame)
-    {
-        plroom->PlaceNewPlayer(sess->GetPlayer());
-        sess->GetPlayer()->SetDead(false);
-        sess->GetPlayer()->ResetAttributes();
-    }
-
-    GamePacket resp(SP_NEW_WORLD);
-
-    // write map dimensions
-    resp.WriteFloat(plroom->GetMapSizeX());
-    resp.WriteFloat(plroom->GetMapSizeY());
-
-    // build this player update, so the client will know, where we are and how do we look like
-    sess->GetPlayer()->BuildCreatePacketBlock(resp);
-
-    // writes 4B player count and player create block for each player in range
-    plroom->BuildPlayerCreateBlock(resp, sess->GetPlayer());
-    // writes 4B object count and object create block for each object in range
-    plroom->BuildObjectCreateBlock(resp, sess->GetPlayer());
-
-    sNetwork->SendPacket(sess, resp);
+    RoomCommand* cmd = new RoomCommand(ROOM_COMMAND_WORLD_REQUEST, sess->GetPlayer()->GetId());
+    cmd->flag = reinitGame;
 
-    sess->GetPlayer()->SetUpdateEnabled(true);
+    QueueRoomCommand(sess, cmd);
 }
 
-void PacketHandlers::HandleMoveStart(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleMoveStart(Session* sess, MoveStartRequestPacket& packet)
 {
-    // TODO: checks for too fast movement, etc.
+    RoomCommand* cmd = new RoomCommand(ROOM_COMMAND_MOVE_START, sess->GetPlayer()->GetId());
+    cmd->posX = packet.posX;
+    cmd->posY = packet.posY;
+    cmd->angle = packet.angle;
 
-    Player* plr = sess->GetPlayer();
-    Room* plroom = sGameplay->GetRoom(plr->GetRoomId());
-    float posX, posY, angle;
-
-    posX = packet.ReadFloat();
-    posY = packet.ReadFloat();
-    angle = packet.ReadFloat();
-
-    Position plpos(posX, posY);
-
-    plr->Relocate(plpos, true);
-    plr->SetMoveAngle(angle);
-    plr->SetMoving(true);
-
-    // broadcast packet about movement start
-    GamePacket movestart(SP_MOVE_START);
-    movestart.WriteUInt32(plr->GetId());
-    movestart.WriteFloat(angle);
-
-    BroadcastPacketCellVisitor visitor(movestart);
-    NearObjectVisibilityGridSearcher gs(plroom, &visitor, plr);
-
-    gs.Execute();
+    QueueRoomCommand(sess, cmd);
 }
 
-void PacketHandlers::HandleMoveStop(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleMoveStop(Session* sess, MoveStopRequestPacket& packet)
 {
-    Player* plr = sess->GetPlayer();
-    Room* plroom = sGameplay->GetRoom(plr->GetRoomId());
-    float posX, posY;
-
-    posX = packet.ReadFloat();
-    posY = packet.ReadFloat();
-    packet.ReadFloat(); // angle, we don't use it (yet?)
-
-    Position plpos(posX, posY);
-
-    plr->Relocate(plpos, true);
-    plr->SetMoving(false);
-
-    // broadcast packet about movement stop
-    GamePacket movestop(SP_MOVE_STOP);
-    movestop.WriteUInt32(plr->GetId());
-    movestop.WriteFloat(posX);
-    movestop.WriteFloat(posY);
-
-    BroadcastPacketCellVisitor visitor(movestop);
-    NearObjectVisibilityGridSearcher gs(plroom, &visitor, plr);
+    // angle is not used (yet?)
+    RoomCommand* cmd = new RoomCommand(ROOM_COMMAND_MOVE_STOP, sess->GetPlayer()->GetId());
+    cmd->posX = packet.posX;
+    cmd->posY = packet.posY;
 
-    gs.Execute();
+    QueueRoomCommand(sess, cmd);
 }
 
-void PacketHandlers::HandleMoveHeartbeat(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleMoveHeartbeat(Session* sess, MoveHeartbeatRequestPacket& packet)
 {
-    // TODO: checks for too fast movement, etc.
+    RoomCommand* cmd = new RoomCommand(ROOM_COMMAND_MOVE_HEARTBEAT, sess->GetPlayer()->GetId());
+    cmd->posX = packet.posX;
+    cmd->posY = packet.posY;
 
-    Player* plr = sess->GetPlayer();
-    float posX, posY;
-
-    posX = packet.ReadFloat();
-    posY = packet.ReadFloat();
-
-    Position plpos(posX, posY);
-
-    plr->Relocate(plpos, true);
+    QueueRoomCommand(sess, cmd);
 }
 
-void PacketHandlers::HandleMoveDirection(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleMoveDirection(Session* sess, MoveDirectionRequestPacket& packet)
 {
-    Player* plr = sess->GetPlayer();
-    Room* plroom = sGameplay->GetRoom(plr->GetRoomId());
-    float angle;
-
-    angle = packet.ReadFloat();
+    RoomCommand* cmd = new RoomCommand(ROOM_COMMAND_MOVE_DIRECTION, sess->GetPlayer()->GetId());
+    cmd->angle = packet.angle;
 
-    plr->SetMoveAngle(angle);
-
-    // broadcast packet about movement stop
-    GamePacket anglechange(SP_MOVE_DIRECTION);
-    anglechange.WriteUInt32(plr->GetId());
-    anglechange.WriteFloat(angle);
-
-    BroadcastPacketCellVisitor visitor(anglechange);
-    NearObjectVisibilityGridSearcher gs(plroom, &visitor, plr);
-
-    gs.Execute();
+    QueueRoomCommand(sess, cmd);
 }
 
-void PacketHandlers::HandleEatRequest(Session* sess, GamePacket& packet)
+void PacketHandlers::HandlePlayerExit(Session* sess, PlayerExitRequestPacket& packet)
 {
-    Player* plr = sess->GetPlayer();
-    Room* plroom = sGameplay->GetRoom(plr->GetRoomId());
-
-    uint8_t objType = packet.ReadUInt8();
-    uint32_t objId = packet.ReadUInt32();
-
-    bool isPlayer = (objType == PACKET_OBJECT_TYPE_PLAYER);
-
-    ObjectFinderCellVisitor visitor(objId, isPlayer);
-    NearObjectVisibilityGridSearcher gs(plroom, &visitor, plr);
-
-    gs.Execute();
-
-    WorldObject* obj = visitor.GetFoundObject();
-
-    // TODO: maybe some nice "is this possible?" check
-
-    if (obj)
-    {
-        if (isPlayer && ((Player*)obj)->GetSize() > plr->GetSize())
-            plroom->EatObject((Player*)(obj), plr);
-        else
-            plroom->EatObject(plr, obj);
-    }
+    QueueRoomCommand(sess, new RoomCommand(ROOM_COMMAND_PLAYER_EXIT, sess->GetPlayer()->GetId()));
 }
 
-void PacketHandlers::HandlePlayerExit(Session* sess, GamePacket& packet)
+void PacketHandlers::HandleStatsRequest(Session* sess, StatsRequestPacket& packet)
 {
-    Player* plr = sess->GetPlayer();
-    Room* plroom = sGameplay->GetRoom(plr->GetRoomId());
-
-    if (!plroom)
-    {
-        sLog->Error("Received player exit request when not in room!");
-        return;
-    }
-
-    plroom->RemovePlayer(plr);
-    plr->GetSession()->SetConnectionState(CONNECTION_STATE_LOBBY);
-
-    // player exit packet was sent in RemovePlayer call, client exits room automatically
+    QueueRoomCommand(sess, new RoomCommand(ROOM_COMMAND_STATS, sess->GetPlayer()->GetId()));
 }
 
-void PacketHandlers::HandleStatsRequest(Session* sess, GamePacket& packet)
-{
-    Player* plr = sess->GetPlayer();
-    Room* plroom = sGameplay->GetRoom(plr->GetRoomId());
-
-    if (!plroom)
-    {
-        sLog->Error("Received statistics request when not in room!");
-        return;
-    }
-
-    GamePacket stats(SP_STATS_RESPONSE);
-    plroom->BuildStatsBlock(stats);
-    sNetwork->SendPacket(sess, stats);
-}
+/* table of packet handlers; the opcode is also an index here */
+PacketHandlerStructure PacketHandlerTable[] = {
+    { &PacketHandlers::Handle_NULL,                                   STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // OPCODE_NONE
+    { DECODED(LoginRequestPacket, HandleLoginRequest),                STATE_RESTRICTION_AUTH,     PACKET_PROCESS_INPLACE },       // CP_LOGIN
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_LOGIN_RESPONSE
+    { DECODED(RegisterRequestPacket, HandleRegisterRequest),          STATE_RESTRICTION_AUTH,     PACKET_PROCESS_INPLACE },       // CP_REGISTER
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_REGISTER_RESPONSE
+    { DECODED(RoomListRequestPacket, HandleRoomListRequest),          STATE_RESTRICTION_LOBBY,    PACKET_PROCESS_INPLACE },       // CP_ROOM_LIST
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_ROOM_LIST_RESPONSE
+    { DECODED(JoinRoomRequestPacket, HandleJoinRoomRequest),          STATE_RESTRICTION_LOBBY,    PACKET_PROCESS_INPLACE },       // CP_JOIN_ROOM
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_JOIN_ROOM_RESPONSE
+    { DECODED(CreateRoomRequestPacket, HandleCreateRoom),             STATE_RESTRICTION_LOBBY,    PACKET_PROCESS_INPLACE },       // CP_CREATE_ROOM
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_CREATE_ROOM_RESPONSE
+    { DECODED(WorldRequestPacket, HandleWorldRequest),                STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_WORLD_REQUEST
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_NEW_PLAYER
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_NEW_WORLD
+    { DECODED(MoveDirectionRequestPacket, HandleMoveDirection),       STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_MOVE_DIRECTION
+    { DECODED(MoveStartRequestPacket, HandleMoveStart),               STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_MOVE_START
+    { DECODED(MoveStopRequestPacket, HandleMoveStop),                 STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_MOVE_STOP
+    { DECODED(MoveHeartbeatRequestPacket, HandleMoveHeartbeat),       STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_MOVE_HEARTBEAT
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_MOVE_DIRECTION
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_MOVE_START
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_MOVE_STOP
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_MOVE_HEARTBEAT
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_OBJECT_EATEN
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_PLAYER_EATEN
+    { &PacketHandlers::Handle_NULL,                                   STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_USE_BONUS
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_USE_BONUS_FAILED
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_USE_BONUS
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_CANCEL_BONUS
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_NEW_OBJECT
+    { DECODED(PlayerExitRequestPacket, HandlePlayerExit),             STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_PLAYER_EXIT
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_PLAYER_EXIT
+    { DECODED(StatsRequestPacket, HandleStatsRequest),                STATE_RESTRICTION_GAME,     PACKET_PROCESS_ROOM },          // CP_STATS
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_STATS_RESPONSE
+    { &PacketHandlers::Handle_NULL,                                   STATE_RESTRICTION_VERIFIED, PACKET_PROCESS_INPLACE },       // CP_CHAT_MSG
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_CHAT_MSG
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_DESTROY_OBJECT
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_UPDATE_WORLD
+    { &PacketHandlers::Handle_NULL,                                   STATE_RESTRICTION_GAME,     PACKET_PROCESS_INPLACE },       // CP_EAT_REQUEST
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_PING
+    { DECODED(PongPacket, HandlePong),                                STATE_RESTRICTION_ANY,      PACKET_PROCESS_INPLACE },       // CP_PONG
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_PING_PONG
+    { DECODED(RestoreSessionRequestPacket, HandleRestoreSession),     STATE_RESTRICTION_ANY,      PACKET_PROCESS_DIRECTORY },     // CP_RESTORE_SESSION
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_RESTORE_SESSION_RESPONSE
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_KICK
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_WORLD_SNAPSHOT
+    { &PacketHandlers::Handle_ServerSide,                             STATE_RESTRICTION_NEVER,    PACKET_PROCESS_INPLACE },       // SP_DESTROY_OBJECTS
+};
@@ -3,11 +3,19 @@
 
 #include "Session.h"
 #include "GamePacket.h"
+#include "PacketSchemas.h"
+
+struct RoomCommand;
+class Room;
 
 /* packet handler function arguments */
 #define PACKET_HANDLER_ARGS Session* sess, GamePacket &packet
-/* packez handler definition */
-#define PACKET_HANDLER(x) void x(PACKET_HANDLER_ARGS)
+/* packez handler definition; returns false, if the packet contents are malformed */
+#define PACKET_HANDLER(x) bool x(PACKET_HANDLER_ARGS)
+/* handler of packet decoded by its schema */
+#define TYPED_PACKET_HANDLER(x, schema) void x(Session* sess, schema &packet)
+/* packet table entry for handler of packet decoded by given schema */
+#define DECODED(schema, x) &PacketHandlers::DecodePacket<schema, &PacketHandlers::x>
 
 enum StateRestrictionMask
 {
@@ -19,14 +27,25 @@ enum StateRestrictionMask
     STATE_RESTRICTION_VERIFIED      = 1 << CONNECTION_STATE_LOBBY | 1 << CONNECTION_STATE_GAME,
 };
 
+/* where and how should the packet be handled */
+enum PacketProcessing
+{
+    PACKET_PROCESS_INPLACE          = 0,    // handled directly by network worker, which received it
+    PACKET_PROCESS_DIRECTORY        = 1,    // handled by network worker, with client directory locked (touches sessions of other workers)
+    PACKET_PROCESS_ROOM             = 2,    // decoded by network worker and passed as command to thread of room, the player is in
+};
+
 /* structure of packet handler record */
 struct PacketHandlerStructure
 {
     /* handler function */
-    void (*handler)(PACKET_HANDLER_ARGS);
+    bool (*handler)(PACKET_HANDLER_ARGS);
 
     /* state restriction */
     StateRestrictionMask stateRestriction;
+
+    /* processing type */
+    PacketProcessing processing;
 };
 
 /* we wrap all packet handlers into namespace */
@@ -34,69 +53,41 @@ namespace PacketHandlers
 {
     PACKET_HANDLER(Handle_NULL);
     PACKET_HANDLER(Handle_ServerSide);
-    PACKET_HANDLER(HandleLoginRequest);
-    PACKET_HANDLER(HandleRegisterRequest);
-    PACKET_HANDLER(HandleRoomListRequest);
-    PACKET_HANDLER(HandleJoinRoomRequest);
-    PACKET_HANDLER(HandleWorldRequest);
-    PACKET_HANDLER(HandleMoveStart);
-    PACKET_HANDLER(HandleMoveStop);
-    PACKET_HANDLER(HandleMoveHeartbeat);
-    PACKET_HANDLER(HandleMoveDirection);
-    PACKET_HANDLER(HandleEatRequest);
-    PACKET_HANDLER(HandleRestoreSession);
-    PACKET_HANDLER(HandlePong);
-    PACKET_HANDLER(HandleCreateRoom);
-    PACKET_HANDLER(HandlePlayerExit);
-    PACKET_HANDLER(HandleStatsRequest);
+    TYPED_PACKET_HANDLER(HandleLoginRequest, LoginRequestPacket);
+    TYPED_PACKET_HANDLER(HandleRegisterRequest, RegisterRequestPacket);
+    TYPED_PACKET_HANDLER(HandleRoomListRequest, RoomListRequestPacket);
+    TYPED_PACKET_HANDLER(HandleJoinRoomRequest, JoinRoomRequestPacket);
+    TYPED_PACKET_HANDLER(HandleWorldRequest, WorldRequestPacket);
+    TYPED_PACKET_HANDLER(HandleMoveStart, MoveStartRequestPacket);
+    TYPED_PACKET_HANDLER(HandleMoveStop, MoveStopRequestPacket);
+    TYPED_PACKET_HANDLER(HandleMoveHeartbeat, MoveHeartbeatRequestPacket);
+    TYPED_PACKET_HANDLER(HandleMoveDirection, MoveDirectionRequestPacket);
+    TYPED_PACKET_HANDLER(HandleRestoreSession, RestoreSessionRequestPacket);
+    TYPED_PACKET_HANDLER(HandlePong, PongPacket);
+    TYPED_PACKET_HANDLER(HandleCreateRoom, CreateRoomRequestPacket);
+    TYPED_PACKET_HANDLER(HandlePlayerExit, PlayerExitRequestPacket);
+    TYPED_PACKET_HANDLER(HandleStatsRequest, StatsRequestPacket);
+
+    /* Decodes packet contents by schema and passes them to typed handler */
+    template <class Schema, void (*Handler)(Session*, Schema&)>
+    PACKET_HANDLER(DecodePacket)
+    {
+        Schema contents;
+
+        if (!contents.Decode(packet.GetData(), packet.GetSize()))
+            return false;
+
+        Handler(sess, contents);
+        return true;
+    }
+
+    /* Passes decoded command to room of session player */
+    void QueueRoomCommand(Session* sess, RoomCommand* cmd);
+    /* Assigns session player to room and asks room thread to add it; returns false, if the room was closed */
+    bool QueueRoomJoin(Session* sess, Room* rm);
 };
 
 /* table of packet handlers; the opcode is also an index here */
-static PacketHandlerStructure PacketHandlerTable[] = {
-    { &PacketHandlers::Handle_NULL,             STATE_RESTRICTION_NEVER },      // OPCODE_NONE
-    { &PacketHandlers::HandleLoginRequest,      STATE_RESTRICTION_AUTH },       // CP_LOGIN
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_LOGIN_RESPONSE
-    { &PacketHandlers::HandleRegisterRequest,   STATE_RESTRICTION_AUTH },       // CP_REGISTER
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_REGISTER_RESPONSE
-    { &PacketHandlers::HandleRoomListRequest,   STATE_RESTRICTION_LOBBY },      // CP_ROOM_LIST
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_ROOM_LIST_RESPONSE
-    { &PacketHandlers::HandleJoinRoomRequest,   STATE_RESTRICTION_LOBBY },      // CP_JOIN_ROOM
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_JOIN_ROOM_RESPONSE
-    { &PacketHandlers::HandleCreateRoom,        STATE_RESTRICTION_LOBBY },      // CP_CREATE_ROOM
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_CREATE_ROOM_RESPONSE
-    { &PacketHandlers::HandleWorldRequest,      STATE_RESTRICTION_GAME },       // CP_WORLD_REQUEST
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_NEW_PLAYER
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_NEW_WORLD
-    { &PacketHandlers::HandleMoveDirection,     STATE_RESTRICTION_GAME },       // CP_MOVE_DIRECTION
-    { &PacketHandlers::HandleMoveStart,         STATE_RESTRICTION_GAME },       // CP_MOVE_START
-    { &PacketHandlers::HandleMoveStop,          STATE_RESTRICTION_GAME },       // CP_MOVE_STOP
-    { &PacketHandlers::HandleMoveHeartbeat,     STATE_RESTRICTION_GAME },       // CP_MOVE_HEARTBEAT
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_MOVE_DIRECTION
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_MOVE_START
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_MOVE_STOP
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_MOVE_HEARTBEAT
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_OBJECT_EATEN
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_PLAYER_EATEN
-    { &PacketHandlers::Handle_NULL,             STATE_RESTRICTION_GAME },       // CP_USE_BONUS
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_USE_BONUS_FAILED
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_USE_BONUS
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_CANCEL_BONUS
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_NEW_OBJECT
-    { &PacketHandlers::HandlePlayerExit,        STATE_RESTRICTION_GAME },       // CP_PLAYER_EXIT
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_PLAYER_EXIT
-    { &PacketHandlers::HandleStatsRequest,      STATE_RESTRICTION_GAME },       // CP_STATS
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_STATS_RESPONSE
-    { &PacketHandlers::Handle_NULL,             STATE_RESTRICTION_VERIFIED },   // CP_CHAT_MSG
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_CHAT_MSG
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_DESTROY_OBJECT
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_UPDATE_WORLD
-    { &PacketHandlers::HandleEatRequest,        STATE_RESTRICTION_GAME },       // CP_EAT_REQUEST
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_PING
-    { &PacketHandlers::HandlePong,              STATE_RESTRICTION_ANY },        // CP_PONG
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_PING_PONG
-    { &PacketHandlers::HandleRestoreSession,    STATE_RESTRICTION_ANY },        // CP_RESTORE_SESSION
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_RESTORE_SESSION_RESPONSE
-    { &PacketHandlers::Handle_ServerSide,       STATE_RESTRICTION_NEVER },      // SP_KICK
-};
+extern PacketHandlerStructure PacketHandlerTable[];
 
 #endif
@@ -0,0 +1,244 @@
+#ifndef AGAR_PACKETSCHEMAS_H
+#define AGAR_PACKETSCHEMAS_H
+
+#include "GamePacket.h"
+#include "Opcodes.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/*
+ * Every packet with fixed layout declares its fields here just once, as a list of (codec, name) pairs. The
+ * PACKET_SCHEMA macro then generates structure with these fields, decoder and encoder. Decoder checks the
+ * packet length only once at the beginning (strings and optional fields are accounted for within the same
+ * budget), so the fields themselves are read without any further branching and without exceptions.
+ *
+ * When changing layout of packet, do not forget the client has its own copy of it.
+ */
+
+/* Reference to zero-terminated string within packet contents; valid only as long as the packet exists */
+struct PacketString
+{
+    PacketString() : str(""), length(0) { };
+    PacketString(const char* s) : str(s), length(strlen(s)) { };
+
+    /* Copies the string out of packet */
+    std::string ToString() const { return std::string(str, length); };
+
+    /* string contents */
+    const char* str;
+    /* string length excluding zero termination */
+    size_t length;
+};
+
+/* Codec of 8bit unsigned integer */
+struct SchemaUInt8
+{
+    typedef uint8_t type;
+    static const size_t minSize = 1;
+
+    static bool Decode(const uint8_t* &src, size_t& /*slack*/, type &val)
+    {
+        val = src[0];
+        src += 1;
+        return true;
+    }
+    static size_t GetSize(type const& /*val*/) { return 1; }
+    static void Encode(uint8_t* &dst, type const& val)
+    {
+        dst[0] = val;
+        dst += 1;
+    }
+};
+
+/* Codec of 32bit unsigned integer in network byte order */
+struct SchemaUInt32
+{
+    typedef uint32_t type;
+    static const size_t minSize = 4;
+
+    static bool Decode(const uint8_t* &src, size_t& /*slack*/, type &val)
+    {
+        val = ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+        src += 4;
+        return true;
+    }
+    static size_t GetSize(type const& /*val*/) { return 4; }
+    static void Encode(uint8_t* &dst, type const& val)
+    {
+        dst[0] = (uint8_t)(val >> 24);
+        dst[1] = (uint8_t)(val >> 16);
+        dst[2] = (uint8_t)(val >> 8);
+        dst[3] = (uint8_t)val;
+        dst += 4;
+    }
+};
+
+/* Codec of 32bit floating point number, sent the same way as 32bit integer */
+struct SchemaFloat
+{
+    typedef float type;
+    static const size_t minSize = 4;
+
+    static bool Decode(const uint8_t* &src, size_t &slack, type &val)
+    {
+        uint32_t raw;
+        SchemaUInt32::Decode(src, slack, raw);
+        memcpy(&val, &raw, sizeof(float));
+        return true;
+    }
+    static size_t GetSize(type const& /*val*/) { return 4; }
+    static void Encode(uint8_t* &dst, type const& val)
+    {
+        uint32_t raw;
+        memcpy(&raw, &val, sizeof(float));
+        SchemaUInt32::Encode(dst, raw);
+    }
+};
+
+/* Codec of zero-terminated string; only the terminating zero is counted in minimal size */
+struct SchemaString
+{
+    typedef PacketString type;
+    static const size_t minSize = 1;
+
+    static bool Decode(const uint8_t* &src, size_t &slack, type &val)
+    {
+        // the zero has to be within the bytes not claimed by other fields
+        const uint8_t* end = (const uint8_t*)memchr(src, '\0', slack + 1);
+        if (!end)
+            return false;
+
+        val.str = (const char*)src;
+        val.length = end - src;
+        slack -= val.length;
+        src = end + 1;
+        return true;
+    }
+    static size_t GetSize(type const& val) { return val.length + 1; }
+    static void Encode(uint8_t* &dst, type const& val)
+    {
+        memcpy(dst, val.str, val.length);
+        dst[val.length] = '\0';
+        dst += val.length + 1;
+    }
+};
+
+/* Codec of trailing 32bit unsigned integer, which older clients do not send; zero, when missing */
+struct SchemaOptionalUInt32
+{
+    typedef uint32_t type;
+    static const size_t minSize = 0;
+
+    static bool Decode(const uint8_t* &src, size_t &slack, type &val)
+    {
+        val = 0;
+        if (slack < SchemaUInt32::minSize)
+            return true;
+
+        slack -= SchemaUInt32::minSize;
+        return SchemaUInt32::Decode(src, slack, val);
+    }
+    static size_t GetSize(type const& /*val*/) { return SchemaUInt32::minSize; }
+    static void Encode(uint8_t* &dst, type const& val)
+    {
+        SchemaUInt32::Encode(dst, val);
+    }
+};
+
+/* field list expansions used by PACKET_SCHEMA */
+#define SCHEMA_FIELD_DECLARE(codec, name) codec::type name;
+#define SCHEMA_FIELD_MIN_SIZE(codec, name) + codec::minSize
+#define SCHEMA_FIELD_SIZE(codec, name) + codec::GetSize(name)
+#define SCHEMA_FIELD_DECODE(codec, name) if (!codec::Decode(wireData, wireSlack, name)) return false;
+#define SCHEMA_FIELD_ENCODE(codec, name) codec::Encode(wireDst, name);
+
+/* Defines packet structure with given opcode and field list */
+#define PACKET_SCHEMA(structName, opc, FIELDS) \
+    struct structName \
+    { \
+        static const uint16_t opcode = opc; \
+        static const size_t minWireSize = 0 FIELDS(SCHEMA_FIELD_MIN_SIZE); \
+        \
+        FIELDS(SCHEMA_FIELD_DECLARE) \
+        \
+        /* Decodes packet contents; returns false, if they do not match the schema */ \
+        bool Decode(const uint8_t* wireData, size_t wireSize) \
+        { \
+            if (wireSize < minWireSize) \
+                return false; \
+            size_t wireSlack = wireSize - minWireSize; \
+            FIELDS(SCHEMA_FIELD_DECODE) \
+            (void)wireData; (void)wireSlack; \
+            return true; \
+        } \
+        /* Retrieves size of encoded contents */ \
+        size_t GetWireSize() const { return 0 FIELDS(SCHEMA_FIELD_SIZE); } \
+        /* Appends encoded fields to packet */ \
+        void Encode(GamePacket &gp) const \
+        { \
+            uint8_t* wireDst = gp.Extend(GetWireSize()); \
+            FIELDS(SCHEMA_FIELD_ENCODE) \
+            (void)wireDst; \
+        } \
+    };
+
+#define NO_FIELDS(F)
+
+/* client packets */
+
+#define CP_LOGIN_FIELDS(F) F(SchemaString, username) F(SchemaString, password) F(SchemaUInt32, version) F(SchemaOptionalUInt32, clientFlags)
+PACKET_SCHEMA(LoginRequestPacket, CP_LOGIN, CP_LOGIN_FIELDS)
+
+#define CP_REGISTER_FIELDS(F) F(SchemaString, username) F(SchemaString, password) F(SchemaUInt32, version)
+PACKET_SCHEMA(RegisterRequestPacket, CP_REGISTER, CP_REGISTER_FIELDS)
+
+#define CP_ROOM_LIST_FIELDS(F) F(SchemaUInt8, gameType)
+PACKET_SCHEMA(RoomListRequestPacket, CP_ROOM_LIST, CP_ROOM_LIST_FIELDS)
+
+#define CP_JOIN_ROOM_FIELDS(F) F(SchemaUInt32, roomId) F(SchemaUInt8, spectator)
+PACKET_SCHEMA(JoinRoomRequestPacket, CP_JOIN_ROOM, CP_JOIN_ROOM_FIELDS)
+
+#define CP_CREATE_ROOM_FIELDS(F) F(SchemaString, name) F(SchemaUInt32, capacity) F(SchemaUInt32, size)
+PACKET_SCHEMA(CreateRoomRequestPacket, CP_CREATE_ROOM, CP_CREATE_ROOM_FIELDS)
+
+#define CP_WORLD_REQUEST_FIELDS(F) F(SchemaUInt8, reinit)
+PACKET_SCHEMA(WorldRequestPacket, CP_WORLD_REQUEST, CP_WORLD_REQUEST_FIELDS)
+
+#define CP_MOVE_DIRECTION_FIELDS(F) F(SchemaFloat, angle)
+PACKET_SCHEMA(MoveDirectionRequestPacket, CP_MOVE_DIRECTION, CP_MOVE_DIRECTION_FIELDS)
+
+#define CP_MOVE_START_FIELDS(F) F(SchemaFloat, posX) F(SchemaFloat, posY) F(SchemaFloat, angle)
+PACKET_SCHEMA(MoveStartRequestPacket, CP_MOVE_START, CP_MOVE_START_FIELDS)
+
+#define CP_MOVE_STOP_FIELDS(F) F(SchemaFloat, posX) F(SchemaFloat, posY) F(SchemaFloat, angle)
+PACKET_SCHEMA(MoveStopRequestPacket, CP_MOVE_STOP, CP_MOVE_STOP_FIELDS)
+
+#define CP_MOVE_HEARTBEAT_FIELDS(F) F(SchemaFloat, posX) F(SchemaFloat, posY)
+PACKET_SCHEMA(MoveHeartbeatRequestPacket, CP_MOVE_HEARTBEAT, CP_MOVE_HEARTBEAT_FIELDS)
+
+PACKET_SCHEMA(PlayerExitRequestPacket, CP_PLAYER_EXIT, NO_FIELDS)
+
+PACKET_SCHEMA(StatsRequestPacket, CP_STATS, NO_FIELDS)
+
+PACKET_SCHEMA(PongPacket, CP_PONG, NO_FIELDS)
+
+#define CP_RESTORE_SESSION_FIELDS(F) F(SchemaString, sessionKey) F(SchemaUInt32, playerId)
+PACKET_SCHEMA(RestoreSessionRequestPacket, CP_RESTORE_SESSION, CP_RESTORE_SESSION_FIELDS)
+
+/* server packets */
+
+#define SP_JOIN_ROOM_RESPONSE_FIELDS(F) F(SchemaUInt8, status) F(SchemaUInt32, chatChannel)
+PACKET_SCHEMA(JoinRoomResponsePacket, SP_JOIN_ROOM_RESPONSE, SP_JOIN_ROOM_RESPONSE_FIELDS)
+
+#define SP_MOVE_DIRECTION_FIELDS(F) F(SchemaUInt32, playerId) F(SchemaFloat, angle)
+PACKET_SCHEMA(MoveDirectionPacket, SP_MOVE_DIRECTION, SP_MOVE_DIRECTION_FIELDS)
+
+#define SP_MOVE_HEARTBEAT_FIELDS(F) F(SchemaUInt32, playerId) F(SchemaFloat, posX) F(SchemaFloat, posY)
+PACKET_SCHEMA(MoveHeartbeatPacket, SP_MOVE_HEARTBEAT, SP_MOVE_HEARTBEAT_FIELDS)
+
+#define SP_PING_PONG_FIELDS(F) F(SchemaUInt32, latency)
+PACKET_SCHEMA(PingPongPacket, SP_PING_PONG, SP_PING_PONG_FIELDS)
+
+#endif
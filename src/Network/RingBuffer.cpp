@@ -0,0 +1,83 @@
+#include "General.h"
+#include "RingBuffer.h"
+
+RingBuffer::RingBuffer(size_t capacity) : m_capacity(capacity), m_readPos(0), m_writePos(0)
+{
+    m_buffer = new uint8_t[capacity];
+}
+
+RingBuffer::~RingBuffer()
+{
+    delete[] m_buffer;
+}
+
+size_t RingBuffer::GetReadableSize()
+{
+    return m_writePos - m_readPos;
+}
+
+size_t RingBuffer::GetWritableSize()
+{
+    return m_capacity - GetReadableSize();
+}
+
+uint8_t* RingBuffer::GetWritePointer(size_t &contiguousSize)
+{
+    size_t offset = m_writePos & (m_capacity - 1);
+
+    // free space ends either at buffer end, or at read cursor, whatever comes first
+    contiguousSize = m_capacity - offset;
+    if (contiguousSize > GetWritableSize())
+        contiguousSize = GetWritableSize();
+
+    return m_buffer + offset;
+}
+
+void RingBuffer::CommitWrite(size_t size)
+{
+    m_writePos += size;
+}
+
+bool RingBuffer::Peek(void* dst, size_t size)
+{
+    size_t offset, firstPart;
+
+    if (size > GetReadableSize())
+        return false;
+
+    offset = m_readPos & (m_capacity - 1);
+
+    // the data may be wrapped around buffer end, so copy it in two parts
+    firstPart = m_capacity - offset;
+    if (firstPart > size)
+        firstPart = size;
+
+    memcpy(dst, m_buffer + offset, firstPart);
+    if (firstPart < size)
+        memcpy((uint8_t*)dst + firstPart, m_buffer, size - firstPart);
+
+    return true;
+}
+
+bool RingBuffer::Read(void* dst, size_t size)
+{
+    if (!Peek(dst, size))
+        return false;
+
+    m_readPos += size;
+    return true;
+}
+
+void RingBuffer::Skip(size_t size)
+{
+    if (size > GetReadableSize())
+        size = GetReadableSize();
+
+    m_readPos += size;
+}
+
+void RingBuffer::Clear()
+{
+    m_readPos = 0;
+    m_writePos = 0;
+}
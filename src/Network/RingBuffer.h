@@ -0,0 +1,51 @@
+#ifndef AGAR_RINGBUFFER_H
+#define AGAR_RINGBUFFER_H
+
+#include <cstdint>
+#include <cstddef>
+
+/* Fixed size circular byte buffer; capacity has to be power of two */
+class RingBuffer
+{
+    public:
+        /* Only constructor - allocates buffer of specified capacity */
+        RingBuffer(size_t capacity);
+        ~RingBuffer();
+
+        /* Retrieves count of bytes stored and not yet read */
+        size_t GetReadableSize();
+        /* Retrieves count of bytes, that could be written before the buffer gets full */
+        size_t GetWritableSize();
+
+        /* Retrieves pointer to contiguous free space and its size, to be filled directly i.e. by recv */
+        uint8_t* GetWritePointer(size_t &contiguousSize);
+        /* Marks specified amount of bytes as written after filling space retrieved by GetWritePointer */
+        void CommitWrite(size_t size);
+
+        /* Copies specified amount of bytes to destination without consuming them; returns false if not enough data is stored */
+        bool Peek(void* dst, size_t size);
+        /* Copies specified amount of bytes to destination and consumes them; returns false if not enough data is stored */
+        bool Read(void* dst, size_t size);
+        /* Consumes specified amount of bytes without reading them */
+        void Skip(size_t size);
+
+        /* Throws away all stored data */
+        void Clear();
+
+    private:
+        /* disable copying */
+        RingBuffer(RingBuffer const&);
+        /* disable assignment */
+        RingBuffer& operator = (RingBuffer const&);
+
+        /* buffer memory */
+        uint8_t* m_buffer;
+        /* buffer capacity */
+        size_t m_capacity;
+        /* read cursor; grows monotonically, masked by capacity when accessing buffer */
+        size_t m_readPos;
+        /* write cursor; grows monotonically, masked by capacity when accessing buffer */
+        size_t m_writePos;
+};
+
+#endif
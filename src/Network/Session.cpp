@@ -1,24 +1,41 @@
 #include "General.h"
 #include "Player.h"
+#include "Room.h"
 #include "Network.h"
 #include "Session.h"
 #include "Opcodes.h"
 #include "PacketHandlers.h"
+#include "OpcodeStats.h"
 #include "Log.h"
 #include "StatusCodes.h"
 #include "Helpers.h"
 #include "sha1.h"
 #include <string>
+#include <atomic>
+#include <algorithm>
 
-Session::Session(Player* plr) : m_player(plr)
+/* ID of next session created */
+static std::atomic<uint64_t> nextSessionId(1);
+
+Session::Session(Player* plr) : m_player(plr), m_worker(nullptr), m_recvBuffer(SESSION_RECV_BUFFER_SIZE)
 {
+    m_id = nextSessionId.fetch_add(1, std::memory_order_relaxed);
     m_violationCounter = 0;
     m_remoteAddr = "UNKNOWN";
     m_latency = 0;
     m_lastPingSendTime = 0;
     m_isExpired = false;
+    m_storageRequestPending = false;
     m_sessionTimeout = 0;
     m_pingWaitingResponse = false;
+    m_sendQueueHead = 0;
+    m_sendQueueOffset = 0;
+    m_sendQueueSize = 0;
+    m_queuedBytesCount = 0;
+    m_flushScheduled = false;
+    m_isClosed = false;
+    m_clientFlags = 0;
+    m_snapshotPacketCount = 0;
 }
 
 Session::~Session()
@@ -64,28 +81,68 @@ void Session::HandlePacket(GamePacket &packet)
 
     sLog->Debug("NETWORK: Received packet %u", packet.GetOpcode());
 
-    // packet handlers might throw exception about trying to reach out of packet data range
-    try
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    DispatchPacket(packet);
+
+    // time includes waiting for locks the handler needs, it's a part of the packet cost as well
+    sOpcodeStats->RecordReceived(packet.GetOpcode(), GAMEPACKET_HEADER_SIZE + packet.GetSize(),
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+void Session::DispatchPacket(GamePacket &packet)
+{
+    ConnectionState cstate = m_connectionState;
+
+    // verify the state of client connection
+    if ((PacketHandlerTable[packet.GetOpcode()].stateRestriction & (1 << cstate)) == 0)
+    {
+        sLog->Error("Client (IP: %s) sent invalid packet (opcode %u) for state %u, not handling", GetRemoteAddr(), packet.GetOpcode(), cstate);
+        IncreaseViolationCounter();
+        return;
+    }
+
+    switch (PacketHandlerTable[packet.GetOpcode()].processing)
     {
-        // verify the state of client connection
-        if ((PacketHandlerTable[packet.GetOpcode()].stateRestriction & (1 << m_connectionState)) == 0)
+        case PACKET_PROCESS_ROOM:
+            // gameplay packets are meaningful only within room
+            if (!m_player->GetRoomId())
+            {
+                sLog->Debug("Player %u is not in any room, not handling opcode %u", m_player->GetId(), packet.GetOpcode());
+                return;
+            }
+            break;
+        case PACKET_PROCESS_DIRECTORY:
         {
-            sLog->Error("Client (IP: %s) sent invalid packet (opcode %u) for state %u, not handling", GetRemoteAddr(), packet.GetOpcode(), m_connectionState);
-            IncreaseViolationCounter();
+            // handler may look up or modify sessions owned by other network workers
+            std::unique_lock<std::recursive_mutex> lck(sNetwork->clientDirectoryLock);
+            ExecutePacketHandler(packet);
             return;
         }
+        default:
+            break;
+    }
 
-        // look handler up in handler table and call it
-        PacketHandlerTable[packet.GetOpcode()].handler(this, packet);
+    ExecutePacketHandler(packet);
+}
 
-        // after successfull handling of packet, decrease violations count
-        DecreaseViolationCounter();
-    }
-    catch (PacketReadException &ex)
+void Session::ExecutePacketHandler(GamePacket &packet)
+{
+    // look handler up in handler table and call it; contents not matching the packet schema are refused by handler
+    if (!PacketHandlerTable[packet.GetOpcode()].handler(this, packet))
     {
-        sLog->Error("Read error during executing handler for opcode %u - attempt to read %u bytes at offset %u (real size %u bytes) (client IP: %s)", packet.GetOpcode(), ex.GetAttemptSize(), ex.GetPosition(), packet.GetSize(), GetRemoteAddr());
+        sLog->Error("Malformed contents of packet with opcode %u (size %u bytes) (client IP: %s)", packet.GetOpcode(), packet.GetSize(), GetRemoteAddr());
         IncreaseViolationCounter();
+        return;
     }
+
+    // after successfull handling of packet, decrease violations count
+    DecreaseViolationCounter();
+}
+
+uint64_t Session::GetId()
+{
+    return m_id;
 }
 
 Player* Session::GetPlayer()
@@ -102,6 +159,9 @@ void Session::OverridePlayer(Player* pl, const char* sessionKey)
     // override session key if necessary
     if (sessionKey)
         m_sessionKey = sessionKey;
+
+    // the session is now found using ID of new player
+    sNetwork->UpdateSessionIndex(this);
 }
 
 void Session::SetConnectionInfo(SOCK socket, sockaddr_in &addr, char* remoteAddr)
@@ -138,6 +198,325 @@ const char* Session::GetRemoteAddr()
     return m_remoteAddr.c_str();
 }
 
+RingBuffer& Session::GetRecvBuffer()
+{
+    return m_recvBuffer;
+}
+
+void Session::SetWorker(NetworkWorker* worker)
+{
+    m_worker = worker;
+}
+
+NetworkWorker* Session::GetWorker()
+{
+    return m_worker;
+}
+
+bool Session::QueueFrame(WireFramePtr const& frame)
+{
+    std::unique_lock<std::mutex> lck(sendqueue_mtx);
+
+    return _QueueFrame(frame);
+}
+
+bool Session::_QueueFrame(WireFramePtr const& frame)
+{
+    if (m_isClosed)
+        return false;
+
+    // do not let the queue grow forever, when the client does not read fast enough
+    if (m_sendQueueSize + frame->GetSize() > SESSION_SEND_QUEUE_HIGH_WATERMARK)
+    {
+        if (!m_isExpired)
+        {
+            sLog->Error("Client (IP: %s) exceeded send queue limit (%u bytes waiting), disconnecting", GetRemoteAddr(), m_sendQueueSize);
+            m_isExpired = true;
+        }
+        return false;
+    }
+
+    // just store reference, the frame may be shared with other recipients
+    m_sendQueue.push_back(frame);
+    m_sendQueueSize += frame->GetSize();
+    m_queuedBytesCount += frame->GetSize();
+
+    // already scheduled, the packet will be sent along with others
+    if (m_flushScheduled)
+        return false;
+
+    m_flushScheduled = true;
+    return true;
+}
+
+bool Session::AddToSnapshot(WireFramePtr const& frame)
+{
+    bool flush = false;
+    uint32_t playerId;
+    const uint8_t* data = frame->GetData() + GAMEPACKET_HEADER_SIZE;
+
+    std::unique_lock<std::mutex> lck(sendqueue_mtx);
+
+    if (m_isClosed)
+        return false;
+
+    // large packets (i.e. new world) are not worth aggregating; the snapshot collected so far goes first to keep the order
+    if (frame->GetSize() > SNAPSHOT_MAX_SIZE)
+    {
+        flush = _FinishSnapshot();
+        return _QueueFrame(frame) || flush;
+    }
+
+    // snapshot is full, start next one
+    if (m_snapshotPackets.size() + m_snapshotPositions.size() + frame->GetSize() > SNAPSHOT_MAX_SIZE)
+        flush = _FinishSnapshot();
+
+    // only the last known position of every player is sent, the rest of heartbeat is useless for client
+    if (frame->GetOpcode() == SP_MOVE_HEARTBEAT)
+    {
+        memcpy(&playerId, data, 4);
+
+        std::vector<uint32_t>::iterator itr = std::find(m_snapshotPositionIds.begin(), m_snapshotPositionIds.end(), playerId);
+        if (itr == m_snapshotPositionIds.end())
+        {
+            m_snapshotPositionIds.push_back(playerId);
+            m_snapshotPositions.insert(m_snapshotPositions.end(), data, data + SNAPSHOT_POSITION_SIZE);
+        }
+        else
+            memcpy(&m_snapshotPositions[(itr - m_snapshotPositionIds.begin()) * SNAPSHOT_POSITION_SIZE], data, SNAPSHOT_POSITION_SIZE);
+
+        return flush;
+    }
+
+    // everything else is stored as it is, including header
+    m_snapshotPackets.insert(m_snapshotPackets.end(), frame->GetData(), frame->GetData() + frame->GetSize());
+    m_snapshotPacketCount++;
+
+    return flush;
+}
+
+bool Session::FinishSnapshot()
+{
+    std::unique_lock<std::mutex> lck(sendqueue_mtx);
+
+    return _FinishSnapshot();
+}
+
+bool Session::_FinishSnapshot()
+{
+    if (m_snapshotPacketCount == 0 && m_snapshotPositions.empty())
+        return false;
+
+    bool compact = HasClientFlag(CLIENT_FLAG_COMPACT_ENCODING);
+
+    // size of compact contents is not known in advance
+    GamePacket snapshot(SP_WORLD_SNAPSHOT, compact ? 0 : 2 + m_snapshotPackets.size() + 2 + m_snapshotPositions.size());
+
+    // packets in order they were sent, then positions, which are valid after all packets are applied
+    if (compact)
+        _WriteCompactSnapshot(snapshot);
+    else
+    {
+        snapshot.WriteUInt16(m_snapshotPacketCount);
+        if (!m_snapshotPackets.empty())
+            snapshot.WriteData(m_snapshotPackets.data(), m_snapshotPackets.size());
+
+        snapshot.WriteUInt16((uint16_t)(m_snapshotPositions.size() / SNAPSHOT_POSITION_SIZE));
+        if (!m_snapshotPositions.empty())
+            snapshot.WriteData(m_snapshotPositions.data(), m_snapshotPositions.size());
+    }
+
+    m_snapshotPackets.clear();
+    m_snapshotPacketCount = 0;
+    m_snapshotPositions.clear();
+    m_snapshotPositionIds.clear();
+
+    return _QueueFrame(snapshot.GetWireFrame());
+}
+
+/* Reads big endian 16bit value from serialized data */
+static inline uint16_t readSerializedUInt16(const uint8_t* data)
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+/* Reads big endian 32bit value from serialized data */
+static inline uint32_t readSerializedUInt32(const uint8_t* data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+void Session::_WriteCompactSnapshot(GamePacket& snapshot)
+{
+    size_t offset, size;
+    uint32_t bits;
+    float x, y;
+
+    // packets are stored with plain headers, so just the headers are rewritten
+    snapshot.WriteVarUInt(m_snapshotPacketCount);
+    for (offset = 0; offset < m_snapshotPackets.size(); offset += GAMEPACKET_HEADER_SIZE + size)
+    {
+        size = readSerializedUInt16(&m_snapshotPackets[offset + 2]);
+
+        snapshot.WriteVarUInt(readSerializedUInt16(&m_snapshotPackets[offset]));
+        snapshot.WriteVarUInt((uint32_t)size);
+        if (size > 0)
+            snapshot.WriteData(&m_snapshotPackets[offset + GAMEPACKET_HEADER_SIZE], size);
+    }
+
+    // positions are stored the way plain heartbeat carries them
+    snapshot.WriteVarUInt((uint32_t)(m_snapshotPositions.size() / SNAPSHOT_POSITION_SIZE));
+    for (offset = 0; offset < m_snapshotPositions.size(); offset += SNAPSHOT_POSITION_SIZE)
+    {
+        bits = readSerializedUInt32(&m_snapshotPositions[offset + 4]);
+        memcpy(&x, &bits, sizeof(float));
+        bits = readSerializedUInt32(&m_snapshotPositions[offset + 8]);
+        memcpy(&y, &bits, sizeof(float));
+
+        snapshot.WriteVarUInt(readSerializedUInt32(&m_snapshotPositions[offset]));
+        Cell::WriteCompactPosition(snapshot, x, y);
+    }
+}
+
+void Session::SetClientFlags(uint32_t flags)
+{
+    m_clientFlags = flags;
+}
+
+uint32_t Session::GetClientFlags()
+{
+    return m_clientFlags;
+}
+
+bool Session::HasClientFlag(uint32_t flag)
+{
+    return (m_clientFlags & flag) != 0;
+}
+
+uint64_t Session::TakeQueuedBytesCount()
+{
+    std::unique_lock<std::mutex> lck(sendqueue_mtx);
+
+    uint64_t count = m_queuedBytesCount;
+    m_queuedBytesCount = 0;
+
+    return count;
+}
+
+void Session::Close()
+{
+    std::unique_lock<std::mutex> lck(sendqueue_mtx);
+
+    m_isClosed = true;
+
+    _ClearSendQueue();
+
+    m_snapshotPackets.clear();
+    m_snapshotPacketCount = 0;
+    m_snapshotPositions.clear();
+    m_snapshotPositionIds.clear();
+}
+
+int Session::FlushSendQueue()
+{
+    int result, total;
+    size_t remaining;
+
+    std::unique_lock<std::mutex> lck(sendqueue_mtx);
+
+    m_flushScheduled = false;
+    total = 0;
+
+    // the socket descriptor may belong to someone else already
+    if (m_isClosed)
+        return 0;
+
+    while (m_sendQueueHead < m_sendQueue.size())
+    {
+#ifdef _WIN32
+        WireFramePtr &frame = m_sendQueue[m_sendQueueHead];
+        result = send(m_socket, (const char*)frame->GetData() + m_sendQueueOffset, (int)(frame->GetSize() - m_sendQueueOffset), 0);
+#else
+        iovec iov[SESSION_SEND_MAX_BATCH];
+        msghdr msg;
+        int count = 0;
+
+        // gather as many queued packets as possible to be written at once
+        for (std::vector<WireFramePtr>::iterator itr = m_sendQueue.begin() + m_sendQueueHead; itr != m_sendQueue.end() && count < SESSION_SEND_MAX_BATCH; ++itr, ++count)
+        {
+            iov[count].iov_base = (void*)((*itr)->GetData() + (count == 0 ? m_sendQueueOffset : 0));
+            iov[count].iov_len = (*itr)->GetSize() - (count == 0 ? m_sendQueueOffset : 0);
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        result = sendmsg(m_socket, &msg, MSG_NOSIGNAL);
+#endif
+
+        if (result < 0)
+        {
+            // socket buffer is full, the rest will be sent when the socket becomes writable again
+            if (LASTERROR() == SOCKETWOULDBLOCK)
+                break;
+
+            // the connection is broken, there's no point in keeping the data; disconnection is
+            // detected when reading from socket
+            _ClearSendQueue();
+            return -1;
+        }
+
+        total += result;
+        m_sendQueueSize -= result;
+
+        // throw away everything, that was sent completely
+        remaining = (size_t)result;
+        while (remaining > 0)
+        {
+            size_t frameRest = m_sendQueue[m_sendQueueHead]->GetSize() - m_sendQueueOffset;
+            if (remaining < frameRest)
+            {
+                m_sendQueueOffset += remaining;
+                break;
+            }
+
+            remaining -= frameRest;
+            _PopSendQueue();
+        }
+    }
+
+    return total;
+}
+
+void Session::_PopSendQueue()
+{
+    m_sendQueue[m_sendQueueHead].reset();
+    m_sendQueueHead++;
+    m_sendQueueOffset = 0;
+
+    // everything was sent, start from the beginning again
+    if (m_sendQueueHead == m_sendQueue.size())
+    {
+        m_sendQueue.clear();
+        m_sendQueueHead = 0;
+    }
+    // the client does not keep up, do not let sent packets pile up in front of the queue
+    else if (m_sendQueueHead >= SESSION_SEND_MAX_BATCH && m_sendQueueHead * 2 >= m_sendQueue.size())
+    {
+        m_sendQueue.erase(m_sendQueue.begin(), m_sendQueue.begin() + m_sendQueueHead);
+        m_sendQueueHead = 0;
+    }
+}
+
+void Session::_ClearSendQueue()
+{
+    m_sendQueue.clear();
+    m_sendQueueHead = 0;
+    m_sendQueueOffset = 0;
+    m_sendQueueSize = 0;
+}
+
 time_t Session::GetSessionTimeoutValue()
 {
     return m_sessionTimeout;
@@ -170,6 +549,16 @@ void Session::ClearViolationCounter()
     m_violationCounter = 0;
 }
 
+void Session::SetStorageRequestPending(bool pending)
+{
+    m_storageRequestPending = pending;
+}
+
+bool Session::IsStorageRequestPending()
+{
+    return m_storageRequestPending;
+}
+
 bool Session::IsMarkedAsExpired()
 {
     return m_isExpired;
@@ -201,6 +590,7 @@ const char* Session::CreateSessionKey()
 
     // store 24char limited session key
     m_sessionKey = std::string(hexbuf).substr(0, 24);
+    sNetwork->UpdateSessionIndex(this);
 
     return m_sessionKey.c_str();
 }
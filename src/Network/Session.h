@@ -3,6 +3,12 @@
 
 #include "GamePacket.h"
 #include "Network.h"
+#include "RingBuffer.h"
+#include "WireFrame.h"
+
+#include <vector>
+
+class NetworkWorker;
 
 /* Maximum violations before disconnection */
 #define MAX_SESSION_VIOLATIONS 3
@@ -10,6 +16,23 @@
 #define PING_TIMER 5000
 /* Limit response time to X milliseconds */
 #define PING_RESPONSE_TIME_LIMIT 5000
+/* Size of receive buffer for each session; must be power of two and hold at least one packet of maximum size */
+#define SESSION_RECV_BUFFER_SIZE 8192
+/* Maximum amount of bytes waiting in send queue; clients not able to receive data this fast are disconnected */
+#define SESSION_SEND_QUEUE_HIGH_WATERMARK (256 * 1024)
+/* Maximum count of queued packets written using one syscall */
+#define SESSION_SEND_MAX_BATCH 64
+/* Maximum size of snapshot contents; larger packets are sent on their own */
+#define SNAPSHOT_MAX_SIZE 8192
+/* Size of one player position in snapshot - ID, X and Y */
+#define SNAPSHOT_POSITION_SIZE 12
+
+/* Client supports SP_WORLD_SNAPSHOT */
+#define CLIENT_FLAG_WORLD_SNAPSHOT 0x00000001
+/* Client supports compact encoding - varint IDs and counts, positions quantized relatively to cells */
+#define CLIENT_FLAG_COMPACT_ENCODING 0x00000002
+/* Client supports SP_DESTROY_OBJECTS; food left out of sight is then forgotten, the client does not have to keep it */
+#define CLIENT_FLAG_BATCHED_DESTROY 0x00000004
 
 /* Class holding information about session */
 class Session
@@ -22,8 +45,15 @@ class Session
         /* Update session if needed */
         void Update(uint32_t diff);
 
-        /* Handles packet within session */
+        /* Validates packet and handles it, or passes it to room the player is in; the handling is recorded in opcode statistics */
         void HandlePacket(GamePacket &packet);
+        /* Verifies state restriction of packet with valid opcode and calls its handler */
+        void DispatchPacket(GamePacket &packet);
+        /* Calls handler of already validated packet */
+        void ExecutePacketHandler(GamePacket &packet);
+
+        /* Retrieves unique session ID; IDs are never reused, so they could safely identify sessions, that may be gone */
+        uint64_t GetId();
 
         /* Retrieves Player pointer */
         Player* GetPlayer();
@@ -38,12 +68,44 @@ class Session
         sockaddr_in const& GetSockAddr();
         /* Retrieves remote address */
         const char* GetRemoteAddr();
+        /* Retrieves buffer of received data, that were not yet processed */
+        RingBuffer& GetRecvBuffer();
+        /* Sets network worker, which owns the session socket */
+        void SetWorker(NetworkWorker* worker);
+        /* Retrieves network worker, which owns the session socket */
+        NetworkWorker* GetWorker();
+
+        /* Appends serialized packet to send queue; returns true, if the session should be scheduled for flush */
+        bool QueueFrame(WireFramePtr const& frame);
+        /* Writes as much of queued data as the socket accepts; returns count of bytes written, or -1 on socket error */
+        int FlushSendQueue();
+        /* Retrieves count of bytes queued since last call, and resets it */
+        uint64_t TakeQueuedBytesCount();
+        /* Throws away everything queued; nothing is queued nor written to socket from now on */
+        void Close();
+
+        /* Adds serialized packet to snapshot of current tick; returns true, if the session should be scheduled for flush */
+        bool AddToSnapshot(WireFramePtr const& frame);
+        /* Queues snapshot of current tick, if there's anything in it; returns true, if the session should be scheduled for flush */
+        bool FinishSnapshot();
+
+        /* Sets features supported by client (CLIENT_FLAG_*) */
+        void SetClientFlags(uint32_t flags);
+        /* Retrieves features supported by client */
+        uint32_t GetClientFlags();
+        /* Does client support given feature? */
+        bool HasClientFlag(uint32_t flag);
 
         /* Sets connection state of associated client */
         void SetConnectionState(ConnectionState cstate);
         /* Retrueves connection state of associated client */
         ConnectionState GetConnectionState();
 
+        /* Sets flag of storage request issued by session and not completed yet */
+        void SetStorageRequestPending(bool pending);
+        /* Is there a storage request issued by session and not completed yet? */
+        bool IsStorageRequestPending();
+
         /* Is session marked as expired? (should we disconnect client?) */
         bool IsMarkedAsExpired();
         /* Kick player and end session */
@@ -65,6 +127,17 @@ class Session
         void SetSessionTimeoutValue(time_t tm);
 
     protected:
+        /* Internal method for appending to send queue, the caller must hold send queue lock */
+        bool _QueueFrame(WireFramePtr const& frame);
+        /* Internal method for queueing snapshot, the caller must hold send queue lock */
+        bool _FinishSnapshot();
+        /* Writes snapshot contents in compact encoding - varint headers and counts, compact positions */
+        void _WriteCompactSnapshot(GamePacket& snapshot);
+        /* Throws away the first packet of send queue, the caller must hold send queue lock */
+        void _PopSendQueue();
+        /* Throws away all packets of send queue, the caller must hold send queue lock */
+        void _ClearSendQueue();
+
         /* increases violation counter */
         void IncreaseViolationCounter();
         /* decreases violation counter */
@@ -73,6 +146,8 @@ class Session
         void ClearViolationCounter();
 
     private:
+        /* unique session ID */
+        uint64_t m_id;
         /* Player pointer */
         Player* m_player;
         /* Socket descriptor */
@@ -80,13 +155,47 @@ class Session
         /* Socket info */
         sockaddr_in m_sockAddr;
         /* Client connection state */
-        ConnectionState m_connectionState;
+        std::atomic<ConnectionState> m_connectionState;
         /* network violation counter */
         uint32_t m_violationCounter;
-        /* is session expired? */
-        bool m_isExpired;
+        /* is session expired? set also by room threads (i.e. when send queue overflows) */
+        std::atomic<bool> m_isExpired;
+        /* is there a storage request not completed yet? */
+        bool m_storageRequestPending;
         /* remote address */
         std::string m_remoteAddr;
+        /* network worker owning the socket */
+        NetworkWorker* m_worker;
+        /* received data, that do not form complete packet yet */
+        RingBuffer m_recvBuffer;
+        /* serialized packets waiting to be sent, starting at m_sendQueueHead; the vector keeps its capacity, so queueing
+         * does not allocate once the session has sent a few packets */
+        std::vector<WireFramePtr> m_sendQueue;
+        /* index of the first packet in send queue, that was not sent completely */
+        size_t m_sendQueueHead;
+        /* how many bytes of first packet in send queue were already sent */
+        size_t m_sendQueueOffset;
+        /* total count of bytes waiting in send queue */
+        size_t m_sendQueueSize;
+        /* count of bytes queued since last TakeQueuedBytesCount call */
+        uint64_t m_queuedBytesCount;
+        /* is session scheduled for send queue flush? */
+        bool m_flushScheduled;
+        /* is the socket closed? (the session may still be referenced by room, which did not let its player go yet) */
+        bool m_isClosed;
+        /* lock for send queue and snapshot */
+        std::mutex sendqueue_mtx;
+        /* features supported by client */
+        uint32_t m_clientFlags;
+        /* packets of snapshot, serialized with headers */
+        std::vector<uint8_t> m_snapshotPackets;
+        /* count of packets in snapshot */
+        uint16_t m_snapshotPacketCount;
+        /* player positions of snapshot (ID, X, Y), already serialized */
+        std::vector<uint8_t> m_snapshotPositions;
+        /* player IDs of snapshot positions, in the same order; just a few players are visible, so the position of
+         * player is looked up by walking them, which allocates nothing unlike hash map nodes */
+        std::vector<uint32_t> m_snapshotPositionIds;
         /* network latency */
         uint32_t m_latency;
         /* last ping send time */
@@ -96,8 +205,8 @@ class Session
         /* session key (for restoring session) */
         std::string m_sessionKey;
 
-        /* time, when session times out */
-        time_t m_sessionTimeout;
+        /* time, when session times out; set also by room threads (ping timeout) */
+        std::atomic<time_t> m_sessionTimeout;
 };
 
 #endif
@@ -0,0 +1,131 @@
+#include "General.h"
+#include "SessionRegistry.h"
+#include "Session.h"
+#include "Player.h"
+
+#include <algorithm>
+
+/* Removes session from list of sessions sharing one key; erases the key, when no session is left */
+template <class K>
+static void removeFromIndex(std::unordered_map<K, std::vector<Session*>> &index, K const& key, Session* sess)
+{
+    typename std::unordered_map<K, std::vector<Session*>>::iterator itr = index.find(key);
+    if (itr == index.end())
+        return;
+
+    std::vector<Session*> &sessions = itr->second;
+    sessions.erase(std::remove(sessions.begin(), sessions.end(), sess), sessions.end());
+
+    if (sessions.empty())
+        index.erase(itr);
+}
+
+SessionRegistry::SessionRegistry()
+{
+    //
+}
+
+SessionRegistry::~SessionRegistry()
+{
+    //
+}
+
+void SessionRegistry::Add(Session* sess)
+{
+    IndexedValues &values = m_sessions[sess];
+
+    values.socket = sess->GetSocket();
+    m_bySocket[values.socket] = sess;
+
+    AddIdentity(sess, values);
+}
+
+void SessionRegistry::Remove(Session* sess)
+{
+    std::unordered_map<Session*, IndexedValues>::iterator itr = m_sessions.find(sess);
+    if (itr == m_sessions.end())
+        return;
+
+    RemoveIdentity(sess, itr->second);
+
+    // the socket may already belong to another session
+    std::unordered_map<SOCK, Session*>::iterator sitr = m_bySocket.find(itr->second.socket);
+    if (sitr != m_bySocket.end() && sitr->second == sess)
+        m_bySocket.erase(sitr);
+
+    m_sessions.erase(itr);
+}
+
+void SessionRegistry::Update(Session* sess)
+{
+    std::unordered_map<Session*, IndexedValues>::iterator itr = m_sessions.find(sess);
+    if (itr == m_sessions.end())
+        return;
+
+    // nothing changed
+    if (itr->second.playerId == sess->GetPlayer()->GetId() && itr->second.sessionKey == sess->GetSessionKey())
+        return;
+
+    RemoveIdentity(sess, itr->second);
+    AddIdentity(sess, itr->second);
+}
+
+void SessionRegistry::RemoveIdentity(Session* sess, IndexedValues &values)
+{
+    if (values.playerId != 0)
+        removeFromIndex(m_byPlayerId, values.playerId, sess);
+    if (!values.sessionKey.empty())
+        removeFromIndex(m_bySessionKey, values.sessionKey, sess);
+}
+
+void SessionRegistry::AddIdentity(Session* sess, IndexedValues &values)
+{
+    values.playerId = sess->GetPlayer()->GetId();
+    values.sessionKey = sess->GetSessionKey();
+
+    if (values.playerId != 0)
+        m_byPlayerId[values.playerId].push_back(sess);
+    if (!values.sessionKey.empty())
+        m_bySessionKey[values.sessionKey].push_back(sess);
+}
+
+Session* SessionRegistry::PickSession(std::vector<Session*> const& candidates, Session* except)
+{
+    Session* expired = nullptr;
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        if (candidates[i] == except)
+            continue;
+
+        // expired session is about to be destroyed, prefer the live one
+        if (!candidates[i]->IsMarkedAsExpired())
+            return candidates[i];
+
+        if (!expired)
+            expired = candidates[i];
+    }
+
+    return expired;
+}
+
+Session* SessionRegistry::FindBySocket(SOCK socket)
+{
+    std::unordered_map<SOCK, Session*>::iterator itr = m_bySocket.find(socket);
+
+    return (itr != m_bySocket.end()) ? itr->second : nullptr;
+}
+
+Session* SessionRegistry::FindByPlayerId(uint32_t playerId)
+{
+    std::unordered_map<uint32_t, std::vector<Session*>>::iterator itr = m_byPlayerId.find(playerId);
+
+    return (itr != m_byPlayerId.end()) ? PickSession(itr->second, nullptr) : nullptr;
+}
+
+Session* SessionRegistry::FindBySessionKey(const char* sessionKey, Session* except)
+{
+    std::unordered_map<std::string, std::vector<Session*>>::iterator itr = m_bySessionKey.find(sessionKey);
+
+    return (itr != m_bySessionKey.end()) ? PickSession(itr->second, except) : nullptr;
+}
@@ -0,0 +1,67 @@
+#ifndef AGAR_SESSIONREGISTRY_H
+#define AGAR_SESSIONREGISTRY_H
+
+#include "Network.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class Session;
+
+/* Hash indexes of sessions of all network workers by socket, by player ID and by session key. Player ID and session
+ * key of session may be shared for a while (i.e. the old session of restored player is not destroyed yet), so these
+ * indexes keep all sessions, and lookups prefer sessions not marked as expired. The client directory lock has to be
+ * held when using the registry */
+class SessionRegistry
+{
+    public:
+        SessionRegistry();
+        ~SessionRegistry();
+
+        /* Adds session to all indexes */
+        void Add(Session* sess);
+        /* Removes session from all indexes */
+        void Remove(Session* sess);
+        /* Reindexes session after change of its player ID or session key */
+        void Update(Session* sess);
+
+        /* Finds session using its socket */
+        Session* FindBySocket(SOCK socket);
+        /* Finds session using player ID */
+        Session* FindByPlayerId(uint32_t playerId);
+        /* Finds session using session key */
+        Session* FindBySessionKey(const char* sessionKey, Session* except = nullptr);
+
+    private:
+        /* values the session is indexed by */
+        struct IndexedValues
+        {
+            SOCK socket;
+            uint32_t playerId;
+            std::string sessionKey;
+        };
+
+        /* disable copying */
+        SessionRegistry(SessionRegistry const&);
+        /* disable assignment */
+        SessionRegistry& operator = (SessionRegistry const&);
+
+        /* Removes session from player ID and session key indexes */
+        void RemoveIdentity(Session* sess, IndexedValues &values);
+        /* Adds session to player ID and session key indexes */
+        void AddIdentity(Session* sess, IndexedValues &values);
+        /* Picks the best candidate among sessions sharing the same key */
+        static Session* PickSession(std::vector<Session*> const& candidates, Session* except);
+
+        /* values all registered sessions are indexed by */
+        std::unordered_map<Session*, IndexedValues> m_sessions;
+        /* sessions by socket */
+        std::unordered_map<SOCK, Session*> m_bySocket;
+        /* sessions by player ID; sessions without player ID are not indexed */
+        std::unordered_map<uint32_t, std::vector<Session*>> m_byPlayerId;
+        /* sessions by session key; sessions without key are not indexed */
+        std::unordered_map<std::string, std::vector<Session*>> m_bySessionKey;
+};
+
+#endif
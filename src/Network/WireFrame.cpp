@@ -0,0 +1,41 @@
+#include "General.h"
+#include "WireFrame.h"
+#include "PacketBufferPool.h"
+
+WireFrame::WireFrame(GamePacket &pkt) : m_opcode(pkt.GetOpcode()), m_size(GAMEPACKET_HEADER_SIZE + pkt.GetSize())
+{
+    uint16_t op, sz;
+
+    m_data = sPacketPool->Acquire(m_size);
+
+    op = htons(pkt.GetOpcode());
+    sz = htons(pkt.GetSize());
+
+    // write opcode
+    memcpy(&m_data[0], &op, 2);
+    // write contents size
+    memcpy(&m_data[2], &sz, 2);
+    // write contents
+    if (pkt.GetSize() > 0)
+        memcpy(&m_data[GAMEPACKET_HEADER_SIZE], pkt.GetData(), pkt.GetSize());
+}
+
+WireFrame::~WireFrame()
+{
+    sPacketPool->Release(m_data, m_size);
+}
+
+const uint8_t* WireFrame::GetData() const
+{
+    return m_data;
+}
+
+size_t WireFrame::GetSize() const
+{
+    return m_size;
+}
+
+uint16_t WireFrame::GetOpcode() const
+{
+    return m_opcode;
+}
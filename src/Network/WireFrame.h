@@ -0,0 +1,37 @@
+#ifndef AGAR_WIREFRAME_H
+#define AGAR_WIREFRAME_H
+
+#include "GamePacket.h"
+
+/* Immutable serialized packet (header and contents), ready to be written to socket; the frame is
+ * shared by send queues of all recipients, so broadcasted packet is encoded just once. Frames are usually
+ * released by other thread than the one, which built them, so their data are held in pooled buffer */
+class WireFrame
+{
+    public:
+        /* Encodes packet into frame */
+        WireFrame(GamePacket &pkt);
+        ~WireFrame();
+
+        /* Retrieves serialized data, including header */
+        const uint8_t* GetData() const;
+        /* Retrieves size of serialized data, including header */
+        size_t GetSize() const;
+        /* Retrieves opcode of encoded packet */
+        uint16_t GetOpcode() const;
+
+    private:
+        /* disable copying */
+        WireFrame(WireFrame const&);
+        /* disable assignment */
+        WireFrame& operator = (WireFrame const&);
+
+        /* opcode of encoded packet */
+        uint16_t m_opcode;
+        /* serialized data */
+        uint8_t* m_data;
+        /* size of serialized data */
+        size_t m_size;
+};
+
+#endif
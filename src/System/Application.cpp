@@ -2,9 +2,13 @@
 #include "Application.h"
 #include "Config.h"
 #include "Network.h"
+#include "PacketBufferPool.h"
+#include "OpcodeStats.h"
 #include "Storage.h"
 #include "Log.h"
 #include "Gameplay.h"
+#include "Room.h"
+#include "RoomScheduler.h"
 #include "Helpers.h"
 
 #include <signal.h>
@@ -22,6 +26,8 @@ Application::~Application()
 
 void sigIntHandler(int s)
 {
+    // storage goes first, so the requests already queued are completed by network workers still running
+    sStorage->Shutdown();
     sNetwork->Shutdown();
     sGameplay->Shutdown();
 
@@ -54,9 +60,14 @@ bool Application::Init(int argc, char** argv)
     if (!sStorage->Init())
         return false;
 
+    sPacketPool->Init();
+
     if (!sNetwork->Startup())
         return false;
 
+    if (!sRoomScheduler->Startup())
+        return false;
+
     sGameplay->Init();
 
     sLog->Info("Initialization sequence complete!\n");
@@ -70,6 +81,49 @@ void Application::PrintStats()
     sLog->Info("Server sent packets: %llu", sNetwork->GetSentPacketsCount());
     sLog->Info("Server received bytes: %llu B", sNetwork->GetRecvBytesCount());
     sLog->Info("Server sent bytes: %llu B", sNetwork->GetSentBytesCount());
+    sLog->Info("Packet buffers acquired: %llu, allocated from heap: %llu", sPacketPool->GetAcquireCount(), sPacketPool->GetHeapAllocationCount());
+}
+
+void Application::PrintRoomStats()
+{
+    std::list<RoomPtr> roomList;
+    RoomTickStats stats;
+
+    sGameplay->GetRoomList(roomList);
+
+    for (std::list<RoomPtr>::iterator itr = roomList.begin(); itr != roomList.end(); ++itr)
+    {
+        // rooms keep ticking on scheduler workers meanwhile, so the statistics are copied under lock
+        (*itr)->GetTickStats(stats);
+
+        sLog->Info("Room %u (%s): %u players, %llu ticks, %llu overruns, last tick %u us, max tick %u us, max lag %u ms, %llu B/s per player",
+            (*itr)->GetId(), (*itr)->GetRoomName(), (*itr)->GetPlayerCount(), stats.tickCount, stats.overrunCount,
+            stats.lastTickTime, stats.maxTickTime, stats.maxLag, stats.GetBytesPerPlayerSecond());
+    }
+}
+
+void Application::PrintRoomProfile(uint32_t roomId)
+{
+    RoomPhaseSummary summary[ROOM_PHASE_MAX];
+    uint32_t ticks;
+
+    RoomPtr room = sGameplay->GetRoom(roomId);
+    if (!room)
+    {
+        sLog->Error("Room %u does not exist", roomId);
+        return;
+    }
+
+    ticks = room->GetProfiler().GetSummary(summary);
+
+    sLog->Info("Room %u (%s), last %u ticks:", room->GetId(), room->GetRoomName(), ticks);
+    sLog->Info("phase         p50 us     p99 us     max us");
+
+    for (uint32_t i = 0; i < ROOM_PHASE_MAX; i++)
+    {
+        sLog->Info("%-10s %9u  %9u  %9u", RoomProfiler::GetPhaseName((RoomTickPhase)i),
+            summary[i].p50, summary[i].p99, summary[i].max);
+    }
 }
 
 void Application::PrintAvailableCommands()
@@ -77,6 +131,10 @@ void Application::PrintAvailableCommands()
     sLog->Info("help    - displays this message");
     sLog->Info("exit    - exits whole server");
     sLog->Info("stats   - print statistics");
+    sLog->Info("rooms   - print room update statistics");
+    sLog->Info("opcodes - print traffic and handler time statistics of opcodes");
+    sLog->Info("opcodes export <file> - write opcode statistics to CSV file");
+    sLog->Info("profile <room id> - print tick phase durations of room");
 }
 
 int Application::Run()
@@ -95,6 +153,8 @@ int Application::Run()
         // shut server down
         else if (input == "exit")
         {
+            // see sigIntHandler for the order
+            sStorage->Shutdown();
             sNetwork->Shutdown();
             sGameplay->Shutdown();
 
@@ -106,6 +166,25 @@ int Application::Run()
         {
             PrintStats();
         }
+        else if (input == "rooms")
+        {
+            PrintRoomStats();
+        }
+        else if (input == "opcodes")
+        {
+            sOpcodeStats->Print();
+        }
+        else if (input.compare(0, 15, "opcodes export ") == 0 && input.length() > 15)
+        {
+            if (sOpcodeStats->Export(input.c_str() + 15))
+                sLog->Info("Opcode statistics written to %s", input.c_str() + 15);
+            else
+                sLog->Error("Could not write opcode statistics to %s", input.c_str() + 15);
+        }
+        else if (input.compare(0, 8, "profile ") == 0 && input.length() > 8)
+        {
+            PrintRoomProfile((uint32_t)strtoul(input.c_str() + 8, nullptr, 10));
+        }
         else
         {
             std::cout << "Unknown command, type 'help' for list of available commands" << std::endl;
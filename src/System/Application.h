@@ -17,6 +17,10 @@ class Application
 
         /* Prints server statistics */
         void PrintStats();
+        /* Prints update statistics of all rooms */
+        void PrintRoomStats();
+        /* Prints tick phase durations of given room */
+        void PrintRoomProfile(uint32_t roomId);
 
         /* Prints available commands */
         void PrintAvailableCommands();
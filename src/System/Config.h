@@ -15,6 +15,12 @@ enum RecognizedConfigOption
     CONF_PORT = 1,
     CONF_DEBUG_LOG = 2,
     CONF_LOG_FILE = 3,
+    CONF_NETWORK_THREADS = 4,
+    CONF_ROOM_THREADS = 5,
+    CONF_ROOM_TICK_RATE = 6,
+    CONF_ROOM_PARALLEL_THREADS = 7,
+    CONF_ROOM_PARALLEL_MIN_PLAYERS = 8,
+    CONF_USER_DIRECTORY_SIZE = 9,
 
     CONF_MAX
 };
@@ -51,7 +57,13 @@ static ConfigOption configOptions[] = {
     { "BIND_IP",    CONF_TYPE_STRING,       "0.0.0.0" } /* CONF_BIND_IP */,
     { "PORT",       CONF_TYPE_INT,          8969      } /* CONF_PORT */,
     { "DEBUG_LOG",  CONF_TYPE_INT,          0         } /* CONF_DEBUG_LOG */,
-    { "LOG_FILE",   CONF_TYPE_STRING,       "server.log" } /* CONF_LOG_FILE */
+    { "LOG_FILE",   CONF_TYPE_STRING,       "server.log" } /* CONF_LOG_FILE */,
+    { "NETWORK_THREADS", CONF_TYPE_INT,     1         } /* CONF_NETWORK_THREADS */,
+    { "ROOM_THREADS", CONF_TYPE_INT,        0         } /* CONF_ROOM_THREADS */,
+    { "ROOM_TICK_RATE", CONF_TYPE_INT,      10        } /* CONF_ROOM_TICK_RATE */,
+    { "ROOM_PARALLEL_THREADS", CONF_TYPE_INT, 0       } /* CONF_ROOM_PARALLEL_THREADS */,
+    { "ROOM_PARALLEL_MIN_PLAYERS", CONF_TYPE_INT, 32  } /* CONF_ROOM_PARALLEL_MIN_PLAYERS */,
+    { "USER_DIRECTORY_SIZE", CONF_TYPE_INT, 100000    } /* CONF_USER_DIRECTORY_SIZE */
 };
 
 class Config
@@ -67,6 +79,11 @@ class Config
         /* Gets numeric value from config */
         int GetIntValue(RecognizedConfigOption opt);
 
+        /* Sets string value; used when loading, or by tools running gameplay without config file */
+        void SetStringValue(RecognizedConfigOption opt, std::string val);
+        /* Sets numeric value; used when loading, or by tools running gameplay without config file */
+        void SetIntValue(RecognizedConfigOption opt, int val);
+
     protected:
         /* Hidden singleton constructor */
         Config();
@@ -74,11 +91,6 @@ class Config
         /* Parse one line of config file */
         void ParseConfigOption(char* line);
 
-        /* Sets string value internally */
-        void SetStringValue(RecognizedConfigOption opt, std::string val);
-        /* Sets numeric value internally */
-        void SetIntValue(RecognizedConfigOption opt, int val);
-
     private:
         /* All config options loaded from file/set from defaults */
         std::map<RecognizedConfigOption, ValueUnion> m_configOptions;
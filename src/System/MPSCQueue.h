@@ -0,0 +1,100 @@
+#ifndef AGAR_MPSCQUEUE_H
+#define AGAR_MPSCQUEUE_H
+
+#include <atomic>
+
+/* Base of all items stored in MPSC queue - the queue is intrusive, so it does not allocate anything */
+struct MPSCQueueNode
+{
+    MPSCQueueNode() : next(nullptr) { };
+
+    /* next item in queue */
+    std::atomic<MPSCQueueNode*> next;
+};
+
+/* Lock-free unbounded multi-producer single-consumer queue (Vyukov's algorithm); any thread may push,
+ * but only one thread is allowed to pop. Items are stored by pointer and have to derive from MPSCQueueNode */
+template <class T>
+class MPSCQueue
+{
+    public:
+        MPSCQueue() : m_head(&m_stub), m_tail(&m_stub) { };
+
+        /* Destroys all items left in queue */
+        ~MPSCQueue()
+        {
+            T* item;
+            while ((item = Pop()) != nullptr)
+                delete item;
+        };
+
+        /* Appends item to queue; wait-free, may be called from any thread */
+        void Push(T* item)
+        {
+            _Push(item);
+        };
+
+        /* Retrieves oldest item, or nullptr if the queue is empty (or the item is not completely pushed yet);
+         * must be called only from consumer thread */
+        T* Pop()
+        {
+            MPSCQueueNode* tail = m_tail;
+            MPSCQueueNode* next = tail->next.load(std::memory_order_acquire);
+
+            // skip stub node
+            if (tail == &m_stub)
+            {
+                if (!next)
+                    return nullptr;
+
+                m_tail = next;
+                tail = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+
+            if (next)
+            {
+                m_tail = next;
+                return static_cast<T*>(tail);
+            }
+
+            // producer exchanged head, but did not link the item yet; it will be retrieved next time
+            if (tail != m_head.load(std::memory_order_acquire))
+                return nullptr;
+
+            // last item in queue - put stub behind it, so the item could be detached
+            _Push(&m_stub);
+
+            next = tail->next.load(std::memory_order_acquire);
+            if (next)
+            {
+                m_tail = next;
+                return static_cast<T*>(tail);
+            }
+
+            return nullptr;
+        };
+
+    private:
+        /* disable copying */
+        MPSCQueue(MPSCQueue const&);
+        /* disable assignment */
+        MPSCQueue& operator = (MPSCQueue const&);
+
+        /* Links node to queue head */
+        void _Push(MPSCQueueNode* node)
+        {
+            node->next.store(nullptr, std::memory_order_relaxed);
+            MPSCQueueNode* prev = m_head.exchange(node, std::memory_order_acq_rel);
+            prev->next.store(node, std::memory_order_release);
+        };
+
+        /* most recently pushed node; producers swap it */
+        std::atomic<MPSCQueueNode*> m_head;
+        /* oldest node; touched only by consumer */
+        MPSCQueueNode* m_tail;
+        /* stub node, so the queue is never really empty */
+        MPSCQueueNode m_stub;
+};
+
+#endif
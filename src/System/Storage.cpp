@@ -1,17 +1,49 @@
 #include "General.h"
 #include "Storage.h"
+#include "UserDirectory.h"
+#include "Config.h"
 #include "Log.h"
+#include "Session.h"
+#include "NetworkWorker.h"
 
 #include <map>
 
+StorageRequest::StorageRequest(Session* sess) : m_sessionId(sess->GetId()), m_worker(sess->GetWorker())
+{
+    //
+}
+
+StorageRequest::~StorageRequest()
+{
+    //
+}
+
+uint64_t StorageRequest::GetSessionId()
+{
+    return m_sessionId;
+}
+
+NetworkWorker* StorageRequest::GetWorker()
+{
+    return m_worker;
+}
+
 Storage::Storage()
 {
     m_mainDB = nullptr;
+    m_userDirectory = new UserDirectory();
+    m_thread = nullptr;
+    m_isRunning = false;
 }
 
 Storage::~Storage()
 {
-    //
+    delete m_userDirectory;
+}
+
+void runStorageWorker()
+{
+    sStorage->RunWorker();
 }
 
 bool Storage::Init()
@@ -22,11 +54,75 @@ bool Storage::Init()
     // check main database for structure changes
     CheckDBStructure();
 
+    // users not found in directory are looked up by name
+    m_mainDB->Execute("CREATE INDEX IF NOT EXISTS users_username ON users (username)");
+
+    WarmUpUserDirectory();
+
+    // from now on, the database is accessed only from storage thread, so no disk I/O blocks network workers
+    m_isRunning = true;
+    m_thread = new std::thread(runStorageWorker);
+
     sLog->Info("Storage loaded successfully!\n");
 
     return true;
 }
 
+void Storage::Shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lck(request_mtx);
+        m_isRunning = false;
+    }
+
+    m_requestCond.notify_all();
+
+    if (m_thread)
+    {
+        m_thread->join();
+        delete m_thread;
+        m_thread = nullptr;
+    }
+}
+
+void Storage::QueueRequest(StorageRequest* req)
+{
+    {
+        std::unique_lock<std::mutex> lck(request_mtx);
+        m_requestQueue.push_back(req);
+    }
+
+    m_requestCond.notify_one();
+}
+
+void Storage::RunWorker()
+{
+    StorageRequest* req;
+
+    std::unique_lock<std::mutex> lck(request_mtx);
+
+    // requests queued before shutdown are still executed, so no registration is lost
+    while (m_isRunning || !m_requestQueue.empty())
+    {
+        if (m_requestQueue.empty())
+        {
+            m_requestCond.wait(lck);
+            continue;
+        }
+
+        req = m_requestQueue.front();
+        m_requestQueue.pop_front();
+
+        lck.unlock();
+
+        req->Execute();
+        // network worker completes the request on behalf of session
+        req->GetWorker()->QueueStorageCompletion(req);
+
+        lck.lock();
+    }
+}
+
 void Storage::CreateTable(int index)
 {
     int i;
@@ -47,32 +143,31 @@ void Storage::CreateTable(int index)
     query += ")";
 
     // execute!
-    m_mainDB->Query(query.c_str());
+    m_mainDB->Execute(query.c_str());
 }
 
-void Storage::CheckTableColumns(int index, SQLiteQueryResult* structure)
+void Storage::CheckTableColumns(int index, SQLiteCursor &structure)
 {
     int i;
     std::string tmp, cols;
     std::map<std::string, std::string> colSetToDel, colSetToAdd;
     DatabaseStructure::DBKnownTable &tblrec = DatabaseStructure::KnownTables[index];
-    SQLiteResultRow* rrow;
 
     // add all expected columns with types to colSetToAdd map
     for (i = 0; tblrec.structure[i].name != nullptr; i++)
         colSetToAdd[tblrec.structure[i].name] = tblrec.structure[i].type;
 
-    // go through all actual columns
-    while ((rrow = structure->Fetch()) != nullptr)
+    // go through all actual columns; the cursor already stands on the first one
+    do
     {
-        tmp = rrow->GetString(1);
+        tmp = structure.GetString(1);
         // if it does not exist in expected columns set, delete it;
         // otherwise erase it from "columns to be added" set, since it's already present
         if (colSetToAdd.find(tmp) == colSetToAdd.end())
-            colSetToDel[tmp] = rrow->GetString(2);
+            colSetToDel[tmp] = structure.GetString(2);
         else
             colSetToAdd.erase(tmp);
-    }
+    } while (structure.Next());
 
     // at first, check for columns to be added and add them
     if (!colSetToAdd.empty())
@@ -84,7 +179,7 @@ void Storage::CheckTableColumns(int index, SQLiteQueryResult* structure)
 
             tmp = "ALTER TABLE " + std::string(tblrec.name) + " ADD COLUMN " + (*itr).first + " " + (*itr).second;
 
-            m_mainDB->Query(tmp.c_str());
+            m_mainDB->Execute(tmp.c_str());
         }
     }
 
@@ -98,7 +193,7 @@ void Storage::CheckTableColumns(int index, SQLiteQueryResult* structure)
 
         // rename table with old structure (just add __old suffix)
         tmp = "ALTER TABLE " + std::string(tblrec.name) + " RENAME TO " + std::string(tblrec.name) + "__old";
-        m_mainDB->Query(tmp.c_str());
+        m_mainDB->Execute(tmp.c_str());
 
         // recreate original table
         CreateTable(index);
@@ -114,97 +209,173 @@ void Storage::CheckTableColumns(int index, SQLiteQueryResult* structure)
 
         // copy trimmed records from old table to new
         tmp = "INSERT INTO " + std::string(tblrec.name) + " (" + cols + ") SELECT " + cols + " FROM " + std::string(tblrec.name) + "__old";
-        m_mainDB->Query(tmp.c_str());
+        m_mainDB->Execute(tmp.c_str());
 
         // and finally drop the old table
         tmp = "DROP TABLE " + std::string(tblrec.name) + "__old";
-        m_mainDB->Query(tmp.c_str());
+        m_mainDB->Execute(tmp.c_str());
     }
 }
 
 void Storage::CheckDBStructure()
 {
-    SQLiteQueryResult* res;
     int i;
+    std::string query;
 
     // go through all known tables in DB
     for (i = 0; i < (int)(sizeof(DatabaseStructure::KnownTables) / sizeof(DatabaseStructure::DBKnownTable)); i++)
     {
-        // retrieve structure
-        res = GetTableStructure(DatabaseStructure::KnownTables[i].name);
+        // retrieve structure; table name cannot be bound as parameter
+        query = "PRAGMA table_info(" + std::string(DatabaseStructure::KnownTables[i].name) + ")";
+        SQLiteCursor structure(m_mainDB, query.c_str());
+
         // if it does not exist, create it; otherwise check for structure consistency
-        if (!res || res->GetRowCount() == 0)
+        if (!structure.IsValid() || !structure.Next())
         {
             sLog->Info("Creating table %s", DatabaseStructure::KnownTables[i].name);
             CreateTable(i);
         }
         else
-            CheckTableColumns(i, res);
-
-        res->Finalize()->Destroy();
+            CheckTableColumns(i, structure);
     }
 }
 
-SQLiteQueryResult* Storage::GetTableStructure(const char* table)
+void Storage::WarmUpUserDirectory()
 {
-    return m_mainDB->Query("PRAGMA table_info(%s)", table);
+    int capacity;
+    StorageResult::UserRecord* user;
+
+    capacity = sConfig->GetIntValue(CONF_USER_DIRECTORY_SIZE);
+    if (capacity <= 0)
+    {
+        sLog->Info("User directory disabled");
+        return;
+    }
+
+    m_userDirectory->SetCapacity((size_t)capacity);
+
+    SQLiteCursor cursor(m_mainDB->Prepare("SELECT id, username, password FROM users"));
+    if (!cursor.IsValid())
+        return;
+
+    while (cursor.Next())
+    {
+        // there are more users than the directory could hold, the rest will be loaded when needed
+        if (m_userDirectory->GetSize() == (size_t)capacity)
+        {
+            sLog->Info("User directory holds %u users, the rest is loaded on demand", (uint32_t)capacity);
+            return;
+        }
+
+        user = StorageResult::UserRecord::Build(cursor);
+        m_userDirectory->Insert(*user);
+        delete user;
+    }
+
+    // directory holds everyone, lookups of users, that do not exist, won't touch database
+    m_userDirectory->SetComplete(true);
+    sLog->Info("User directory holds all %u users", (uint32_t)m_userDirectory->GetSize());
 }
 
-StorageResult::UserRecord* StorageResult::UserRecord::Build(SQLiteResultRow* rrow)
+StorageResult::UserRecord* StorageResult::UserRecord::Build(SQLiteCursor &cursor)
 {
     StorageResult::UserRecord* nr = new StorageResult::UserRecord;
+    SQLiteColumnView view;
+
+    nr->id = cursor.GetInt(0);
 
-    nr->id = rrow->GetInt(0);
-    nr->username = rrow->GetString(1);
-    nr->passwordHash = rrow->GetString(2);
+    view = cursor.GetView(1);
+    nr->username.assign(view.data, view.length);
+    view = cursor.GetView(2);
+    nr->passwordHash.assign(view.data, view.length);
 
     return nr;
 }
 
 StorageResult::UserRecord* Storage::GetUserById(int32_t id)
 {
-    SQLiteQueryResult* res = m_mainDB->Query("SELECT id, username, password FROM users WHERE id = %i", id);
-    if (!res)
-        return nullptr;
+    StorageResult::UserRecord const* cached;
+    StorageResult::UserRecord* user;
 
-    if (res->GetRowCount() == 0)
+    if (m_userDirectory->IsEnabled())
     {
-        res->Finalize()->Destroy();
-        return nullptr;
+        if ((cached = m_userDirectory->FindById(id)) != nullptr)
+            return new StorageResult::UserRecord(*cached);
+        // complete directory knows, the user does not exist
+        if (m_userDirectory->IsComplete())
+            return nullptr;
     }
 
-    SQLiteResultRow* rrow = res->Fetch();
+    SQLiteCursor cursor(m_mainDB->Prepare("SELECT id, username, password FROM users WHERE id = ?"));
+    if (!cursor.IsValid())
+        return nullptr;
+
+    cursor.BindInt(1, id);
 
     // we assume there is only one user with this ID (guaranteed, because id is primary key)
-    if (rrow)
-        return StorageResult::UserRecord::Build(rrow);
+    if (!cursor.Next())
+        return nullptr;
+
+    user = StorageResult::UserRecord::Build(cursor);
+    m_userDirectory->Insert(*user);
 
-    return nullptr;
+    return user;
 }
 
 StorageResult::UserRecord* Storage::GetUserByUsername(const char* username)
 {
-    SQLiteQueryResult* res = m_mainDB->Query("SELECT id, username, password FROM users WHERE username = '%s'", username);
-    if (!res)
-        return nullptr;
+    StorageResult::UserRecord const* cached;
+    StorageResult::UserRecord* user;
 
-    if (res->GetRowCount() == 0)
+    if (m_userDirectory->IsEnabled())
     {
-        res->Finalize()->Destroy();
-        return nullptr;
+        if ((cached = m_userDirectory->FindByUsername(username)) != nullptr)
+            return new StorageResult::UserRecord(*cached);
+        // complete directory knows, the user does not exist
+        if (m_userDirectory->IsComplete())
+            return nullptr;
     }
 
-    SQLiteResultRow* rrow = res->Fetch();
+    // the statement is compiled just once, and the name is bound as parameter, so it does not need any escaping
+    SQLiteCursor cursor(m_mainDB->Prepare("SELECT id, username, password FROM users WHERE username = ?"));
+    if (!cursor.IsValid())
+        return nullptr;
 
-    // we assume there is only one user with this ID (guaranteed, because id is primary key)
-    if (rrow)
-        return StorageResult::UserRecord::Build(rrow);
+    cursor.BindString(1, username);
 
-    return nullptr;
+    // there may be just one user with this name, since registration checks it
+    if (!cursor.Next())
+        return nullptr;
+
+    user = StorageResult::UserRecord::Build(cursor);
+    m_userDirectory->Insert(*user);
+
+    return user;
 }
 
 void Storage::StoreUser(const char* username, const char* passhash)
 {
-    if (!m_mainDB->Execute("INSERT INTO users (username, password) VALUES ('%s', '%s')", username, passhash))
+    SQLiteCursor cursor(m_mainDB->Prepare("INSERT INTO users (username, password) VALUES (?, ?)"));
+    if (!cursor.IsValid())
+    {
+        sLog->Error("STORAGE: Could not prepare insertion of user with name '%s'", username);
+        return;
+    }
+
+    cursor.BindString(1, username);
+    cursor.BindString(2, passhash);
+
+    if (!cursor.Execute())
+    {
         sLog->Error("STORAGE: Could not insert user with name '%s' to database", username);
+        return;
+    }
+
+    // write through, so the new user is known to directory as well
+    StorageResult::UserRecord user;
+    user.id = (int32_t)m_mainDB->GetLastInsertRowId();
+    user.username = username;
+    user.passwordHash = passhash;
+
+    m_userDirectory->Insert(user);
 }
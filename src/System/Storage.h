@@ -2,9 +2,19 @@
 #define AGAR_STORAGE_H
 
 #include "Singleton.h"
+#include "MPSCQueue.h"
 #include "sqlite3.h"
 #include "sqlite3_wrapper.h"
 
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class Session;
+class NetworkWorker;
+class UserDirectory;
+
 /* Namespace for database structures, known tables, and everything needed for database structure consistency */
 namespace DatabaseStructure
 {
@@ -45,15 +55,41 @@ namespace StorageResult
         /* assigned id */
         int32_t id;
         /* user name */
-        const char* username;
+        std::string username;
         /* SHA1 password hash stored */
-        const char* passwordHash;
+        std::string passwordHash;
 
-        /* Static factory method for building record from fetched row */
-        static UserRecord* Build(SQLiteResultRow* rrow);
+        /* Static factory method for building record from current row of cursor */
+        static UserRecord* Build(SQLiteCursor &cursor);
     };
 };
 
+/* Request executed asynchronously by storage thread; its completion is then passed back to network worker owning the session,
+ * which issued the request. Completion is dropped, if the session is gone meanwhile */
+class StorageRequest : public MPSCQueueNode
+{
+    public:
+        /* Only constructor - request is bound to session, that issued it */
+        StorageRequest(Session* sess);
+        virtual ~StorageRequest();
+
+        /* Executes request; called from storage thread, must not touch the session */
+        virtual void Execute() = 0;
+        /* Completes request; called from thread of network worker owning the session, with client directory locked */
+        virtual void Complete(Session* sess) = 0;
+
+        /* Retrieves ID of session, that issued the request */
+        uint64_t GetSessionId();
+        /* Retrieves network worker owning the session */
+        NetworkWorker* GetWorker();
+
+    private:
+        /* ID of session, that issued the request */
+        uint64_t m_sessionId;
+        /* network worker owning the session */
+        NetworkWorker* m_worker;
+};
+
 /* Storage class used for accessing data in SQLite and runtime storage */
 class Storage
 {
@@ -61,8 +97,17 @@ class Storage
     public:
         ~Storage();
 
-        /* Initializes database, check for valid structure and makes sure storage layer is ready */
+        /* Initializes database, check for valid structure, makes sure storage layer is ready and starts storage thread */
         bool Init();
+        /* Executes requests left in queue and stops storage thread */
+        void Shutdown();
+
+        /* Queues request to be executed by storage thread */
+        void QueueRequest(StorageRequest* req);
+        /* Storage thread loop */
+        void RunWorker();
+
+        /* Database getters and setters below block on disk I/O; after initialization, they should be called only by storage thread */
 
         StorageResult::UserRecord* GetUserById(int32_t id);
         StorageResult::UserRecord* GetUserByUsername(const char* username);
@@ -74,16 +119,29 @@ class Storage
 
         /* Checks database for structure changes, creates missing tables, modifies existing if necessary */
         void CheckDBStructure();
-        /* Checks column presence in existing table */
-        void CheckTableColumns(int index, SQLiteQueryResult* structure);
+        /* Checks column presence in existing table; the cursor of table structure stands on its first row */
+        void CheckTableColumns(int index, SQLiteCursor &structure);
         /* Creates a new table based on stored known structure */
         void CreateTable(int index);
-        /* Retrieves SQLite table structure in standard SQLiteQueryResult */
-        SQLiteQueryResult* GetTableStructure(const char* table);
+        /* Loads users to directory, as many as it could hold */
+        void WarmUpUserDirectory();
 
     private:
         /* Main database */
         SQLiteDB* m_mainDB;
+        /* users cached in memory; database is written through */
+        UserDirectory* m_userDirectory;
+
+        /* requests waiting for storage thread */
+        std::deque<StorageRequest*> m_requestQueue;
+        /* lock for request queue */
+        std::mutex request_mtx;
+        /* signals new request to storage thread */
+        std::condition_variable m_requestCond;
+        /* storage thread instance */
+        std::thread* m_thread;
+        /* is storage thread still intended to run? */
+        bool m_isRunning;
 };
 
 #define sStorage Singleton<Storage>::getInstance()
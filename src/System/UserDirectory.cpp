@@ -0,0 +1,101 @@
+#include "General.h"
+#include "UserDirectory.h"
+
+UserDirectory::UserDirectory() : m_capacity(0), m_complete(false)
+{
+    //
+}
+
+UserDirectory::~UserDirectory()
+{
+    //
+}
+
+void UserDirectory::SetCapacity(size_t capacity)
+{
+    m_capacity = capacity;
+
+    while (m_records.size() > m_capacity)
+        EvictOldest();
+}
+
+bool UserDirectory::IsEnabled()
+{
+    return m_capacity > 0;
+}
+
+size_t UserDirectory::GetSize()
+{
+    return m_records.size();
+}
+
+void UserDirectory::SetComplete(bool complete)
+{
+    m_complete = complete;
+}
+
+bool UserDirectory::IsComplete()
+{
+    return m_complete;
+}
+
+void UserDirectory::Insert(StorageResult::UserRecord const& record)
+{
+    if (m_capacity == 0)
+        return;
+
+    std::unordered_map<std::string, RecordList::iterator>::iterator itr = m_byName.find(record.username);
+    if (itr != m_byName.end())
+    {
+        *(itr->second) = record;
+        Touch(itr->second);
+        return;
+    }
+
+    if (m_records.size() >= m_capacity)
+        EvictOldest();
+
+    m_records.push_front(record);
+    m_byName[record.username] = m_records.begin();
+    m_byId[record.id] = m_records.begin();
+}
+
+StorageResult::UserRecord const* UserDirectory::FindByUsername(const char* username)
+{
+    std::unordered_map<std::string, RecordList::iterator>::iterator itr = m_byName.find(username);
+    if (itr == m_byName.end())
+        return nullptr;
+
+    Touch(itr->second);
+
+    return &(*itr->second);
+}
+
+StorageResult::UserRecord const* UserDirectory::FindById(int32_t id)
+{
+    std::unordered_map<int32_t, RecordList::iterator>::iterator itr = m_byId.find(id);
+    if (itr == m_byId.end())
+        return nullptr;
+
+    Touch(itr->second);
+
+    return &(*itr->second);
+}
+
+void UserDirectory::Touch(RecordList::iterator itr)
+{
+    // splicing keeps iterators valid, so the indexes do not need to be updated
+    m_records.splice(m_records.begin(), m_records, itr);
+}
+
+void UserDirectory::EvictOldest()
+{
+    StorageResult::UserRecord &oldest = m_records.back();
+
+    m_byName.erase(oldest.username);
+    m_byId.erase(oldest.id);
+    m_records.pop_back();
+
+    // the evicted user still exists in database, so the directory does not know about everyone anymore
+    m_complete = false;
+}
@@ -0,0 +1,64 @@
+#ifndef AGAR_USERDIRECTORY_H
+#define AGAR_USERDIRECTORY_H
+
+#include "Storage.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+/* In-memory directory of user records indexed by name and ID; when full, the least recently used record is evicted.
+ * Once it holds all stored users (it was warmed up with whole table, and nothing was evicted since then), it also
+ * answers lookups of users, that do not exist, so the database is not touched at all. Used just by storage thread */
+class UserDirectory
+{
+    public:
+        UserDirectory();
+        ~UserDirectory();
+
+        /* Sets maximum count of records kept; zero disables the directory */
+        void SetCapacity(size_t capacity);
+        /* Is the directory enabled? */
+        bool IsEnabled();
+        /* Retrieves count of records kept */
+        size_t GetSize();
+
+        /* Marks directory as holding all stored users */
+        void SetComplete(bool complete);
+        /* Does directory hold all stored users? */
+        bool IsComplete();
+
+        /* Stores record (or refreshes existing one) as the most recently used */
+        void Insert(StorageResult::UserRecord const& record);
+        /* Finds record by user name; returns nullptr, if it's not present */
+        StorageResult::UserRecord const* FindByUsername(const char* username);
+        /* Finds record by user ID; returns nullptr, if it's not present */
+        StorageResult::UserRecord const* FindById(int32_t id);
+
+    private:
+        typedef std::list<StorageResult::UserRecord> RecordList;
+
+        /* disable copying */
+        UserDirectory(UserDirectory const&);
+        /* disable assignment */
+        UserDirectory& operator = (UserDirectory const&);
+
+        /* Marks record as the most recently used */
+        void Touch(RecordList::iterator itr);
+        /* Removes the least recently used record */
+        void EvictOldest();
+
+        /* records ordered from the most recently used */
+        RecordList m_records;
+        /* records by user name */
+        std::unordered_map<std::string, RecordList::iterator> m_byName;
+        /* records by user ID */
+        std::unordered_map<int32_t, RecordList::iterator> m_byId;
+
+        /* maximum count of records kept */
+        size_t m_capacity;
+        /* does directory hold all stored users? */
+        bool m_complete;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "General.h"
+#include "WorkStealingPool.h"
+
+WorkStealingPool::WorkStealingPool() : m_queuedTasks(0), m_nextQueue(0), m_isRunning(false)
+{
+    //
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    Shutdown();
+}
+
+bool WorkStealingPool::Startup(int threads)
+{
+    if (threads <= 0 || threads > WORK_POOL_MAX_THREADS)
+        return false;
+
+    m_isRunning = true;
+
+    for (int i = 0; i < threads; i++)
+        m_queues.push_back(new WorkerTaskQueue());
+
+    for (int i = 0; i < threads; i++)
+        m_threads.push_back(new std::thread(&WorkStealingPool::RunWorker, this, (uint32_t)i));
+
+    return true;
+}
+
+void WorkStealingPool::Shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lck(idle_mtx);
+        m_isRunning = false;
+    }
+
+    m_idleCond.notify_all();
+
+    for (std::vector<std::thread*>::iterator itr = m_threads.begin(); itr != m_threads.end(); ++itr)
+    {
+        (*itr)->join();
+        delete *itr;
+    }
+    m_threads.clear();
+
+    for (std::vector<WorkerTaskQueue*>::iterator itr = m_queues.begin(); itr != m_queues.end(); ++itr)
+        delete *itr;
+    m_queues.clear();
+}
+
+bool WorkStealingPool::IsRunning()
+{
+    return m_isRunning;
+}
+
+uint32_t WorkStealingPool::GetThreadCount()
+{
+    return (uint32_t)m_threads.size();
+}
+
+void WorkStealingPool::RunBatch(std::vector<PoolTaskFunction> &tasks)
+{
+    if (tasks.empty())
+        return;
+
+    // no threads to help us, just do it here
+    if (m_queues.empty())
+    {
+        for (size_t i = 0; i < tasks.size(); i++)
+            tasks[i]();
+        return;
+    }
+
+    TaskBatch batch((uint32_t)tasks.size());
+    PoolTask task;
+    // the calling thread has no queue of its own, it helps starting with the queue its last task went to
+    uint32_t queueIndex = 0;
+
+    task.batch = &batch;
+
+    // spread tasks evenly over all queues; anything left imbalanced is solved by stealing
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        queueIndex = (m_nextQueue++) % m_queues.size();
+        task.func = tasks[i];
+
+        std::unique_lock<std::mutex> lck(m_queues[queueIndex]->queue_mtx);
+        m_queues[queueIndex]->tasks.push_back(task);
+        m_queuedTasks++;
+    }
+
+    {
+        std::unique_lock<std::mutex> lck(idle_mtx);
+        m_idleCond.notify_all();
+    }
+
+    // help with execution (of any batch) instead of just waiting
+    while (batch.remaining > 0)
+    {
+        if (PopTask(queueIndex, task))
+        {
+            ExecuteTask(task);
+            continue;
+        }
+
+        // everything is taken, just wait for the rest of our tasks to finish
+        std::unique_lock<std::mutex> lck(batch.done_mtx);
+        while (batch.remaining > 0)
+            batch.doneCond.wait(lck);
+    }
+
+    // last task may still hold the lock after decrementing counter; wait for it before the batch vanishes
+    std::unique_lock<std::mutex> lck(batch.done_mtx);
+}
+
+void WorkStealingPool::RunWorker(uint32_t index)
+{
+    PoolTask task;
+
+    while (true)
+    {
+        if (PopTask(index, task))
+        {
+            ExecuteTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lck(idle_mtx);
+
+        // tasks may have been queued meanwhile; the counter is changed before idle threads are notified
+        while (m_isRunning && m_queuedTasks == 0)
+            m_idleCond.wait(lck);
+
+        if (!m_isRunning)
+            break;
+    }
+}
+
+bool WorkStealingPool::PopTask(uint32_t preferred, PoolTask &task)
+{
+    size_t i, queueIndex;
+
+    // there's nothing to take
+    if (m_queuedTasks == 0)
+        return false;
+
+    // own queue at first (newest task, its data are most likely still in cache), then the others (oldest task)
+    for (i = 0; i < m_queues.size(); i++)
+    {
+        queueIndex = (preferred + i) % m_queues.size();
+        WorkerTaskQueue* queue = m_queues[queueIndex];
+
+        std::unique_lock<std::mutex> lck(queue->queue_mtx);
+        if (queue->tasks.empty())
+            continue;
+
+        if (i == 0)
+        {
+            task = queue->tasks.back();
+            queue->tasks.pop_back();
+        }
+        else
+        {
+            task = queue->tasks.front();
+            queue->tasks.pop_front();
+        }
+
+        m_queuedTasks--;
+        return true;
+    }
+
+    return false;
+}
+
+void WorkStealingPool::ExecuteTask(PoolTask &task)
+{
+    TaskBatch* batch = task.batch;
+
+    task.func();
+    task.func = nullptr;
+
+    // the batch lives on submitter stack - it must not be touched after the submitter is able to see zero
+    std::unique_lock<std::mutex> lck(batch->done_mtx);
+    if (--batch->remaining == 0)
+        batch->doneCond.notify_all();
+}
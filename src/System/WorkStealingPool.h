@@ -0,0 +1,100 @@
+#ifndef AGAR_WORKSTEALINGPOOL_H
+#define AGAR_WORKSTEALINGPOOL_H
+
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+/* maximum number of pool threads */
+#define WORK_POOL_MAX_THREADS 64
+
+typedef std::function<void()> PoolTaskFunction;
+
+/* Group of tasks submitted at once; submitter waits for all of them */
+struct TaskBatch
+{
+    TaskBatch(uint32_t count) : remaining(count) { };
+
+    /* count of tasks not finished yet */
+    std::atomic<uint32_t> remaining;
+    /* lock for completion signalling */
+    std::mutex done_mtx;
+    /* signals completion of the last task */
+    std::condition_variable doneCond;
+};
+
+/* One task waiting in queue */
+struct PoolTask
+{
+    /* task body */
+    PoolTaskFunction func;
+    /* batch the task belongs to */
+    TaskBatch* batch;
+};
+
+/* Task queue of one pool thread */
+struct WorkerTaskQueue
+{
+    /* tasks; owner takes them from back, thieves from front */
+    std::deque<PoolTask> tasks;
+    /* lock for task deque */
+    std::mutex queue_mtx;
+};
+
+/* Pool of threads executing short tasks in batches; every thread owns a task queue and steals tasks
+ * from other queues, when its own gets empty. The submitting thread helps with execution of its batch */
+class WorkStealingPool
+{
+    public:
+        WorkStealingPool();
+        ~WorkStealingPool();
+
+        /* Starts pool threads */
+        bool Startup(int threads);
+        /* Stops pool threads; no batch may be running at this point */
+        void Shutdown();
+
+        /* Is the pool running? */
+        bool IsRunning();
+        /* Retrieves count of pool threads */
+        uint32_t GetThreadCount();
+
+        /* Executes all tasks and returns after all of them finished; may be called from more threads at once */
+        void RunBatch(std::vector<PoolTaskFunction> &tasks);
+
+        /* Pool thread loop */
+        void RunWorker(uint32_t index);
+
+    private:
+        /* disable copying */
+        WorkStealingPool(WorkStealingPool const&);
+        /* disable assignment */
+        WorkStealingPool& operator = (WorkStealingPool const&);
+
+        /* Takes task from preferred queue, or steals one from any other queue */
+        bool PopTask(uint32_t preferred, PoolTask &task);
+        /* Executes task and signals its batch completion, if it was the last one */
+        void ExecuteTask(PoolTask &task);
+
+        /* task queues, one for each pool thread */
+        std::vector<WorkerTaskQueue*> m_queues;
+        /* pool threads */
+        std::vector<std::thread*> m_threads;
+
+        /* count of tasks waiting in all queues */
+        std::atomic<uint32_t> m_queuedTasks;
+        /* queue to put next submitted task into */
+        std::atomic<uint32_t> m_nextQueue;
+
+        /* lock for idle waiting */
+        std::mutex idle_mtx;
+        /* wakes idle threads up, when new tasks arrive */
+        std::condition_variable m_idleCond;
+
+        /* are threads still intended to run? */
+        bool m_isRunning;
+};
+
+#endif